@@ -107,6 +107,28 @@ enum {
     FDB_SEQTREE_USE = 1
 };
 
+/**
+ * Buffer cache priority of a ForestDB file, which is used when a file is
+ * chosen to evict its cached blocks.
+ */
+typedef uint8_t fdb_cache_priority_t;
+enum {
+    /**
+     * Blocks of the file are evicted before those of the files with higher
+     * priorities.
+     */
+    FDB_CACHE_PRIORITY_LOW = 0,
+    /**
+     * Default priority.
+     */
+    FDB_CACHE_PRIORITY_NORMAL = 1,
+    /**
+     * Blocks of the file are evicted only if no file with lower priorities
+     * has evictable blocks.
+     */
+    FDB_CACHE_PRIORITY_HIGH = 2
+};
+
 /**
  * Durability options for ForestDB.
  */
@@ -293,6 +315,32 @@ typedef struct {
     uint8_t bytes[32];
 } fdb_encryption_key;
 
+/**
+ * The callback function used by the secondary index of a KV store to extract
+ * the secondary key of a document (see fdb_register_secondary_index()).
+ * Note that the callback is invoked by writers and while documents are
+ * flushed from the WAL, with the file lock held, so it should not call any
+ * ForestDB API.
+ *
+ * @param doc Pointer to the document whose key, metadata, and body are
+ *        populated.
+ * @param skey_buf Pointer to the buffer where the secondary key is written.
+ * @param skey_buf_size Size of the buffer, which is FDB_MAX_KEYLEN.
+ * @param ctx Client context
+ * @return Length of the secondary key, or zero if the document should not be
+ *         indexed.
+ */
+typedef size_t (*fdb_secondary_key_fn)(fdb_doc *doc,
+                                       void *skey_buf,
+                                       size_t skey_buf_size,
+                                       void *ctx);
+
+/**
+ * Opaque reference to ForestDB secondary index iterator structure definition,
+ * which is exposed in public APIs.
+ */
+typedef struct FdbSecondaryIterator fdb_secondary_iterator;
+
 /**
  * Using off_t turned out to be a real challenge. On "unix-like" systems
  * its size is set by a combination of #defines like: _LARGE_FILE,
@@ -501,6 +549,9 @@ typedef struct {
      * Duration that prefetching of DB file will be performed when the file
      * is opened, in the unit of second. If the duration is set to zero,
      * prefetching is disabled. This is a local config to each ForestDB file.
+     * When prefetching is enabled, the list of hot blocks in the buffer cache
+     * is also persisted into a sidecar file ('<filename>.warmup') on a clean
+     * close, and those blocks are prefetched first on the next open.
      */
     uint64_t prefetch_duration;
     /**
@@ -593,6 +644,105 @@ typedef struct {
      * Flush limit in bytes for non-block aligned buffer cache
      */
     size_t bcache_flush_limit;
+    /**
+     * Size in bytes of the second-tier buffer cache that keeps compressed
+     * copies of clean blocks evicted from the buffer cache. A miss in the
+     * buffer cache is served from this tier, if possible, before reading the
+     * block from disk. It is budgeted separately from buffercache_size and
+     * set to zero (disabled) by default. Blocks are compressed with snappy
+     * if ForestDB is built with document compression support, and with a
+     * simple run-length coding otherwise. This is a global config that is
+     * used across all ForestDB files.
+     */
+    uint64_t compressed_buffercache_size;
+    /**
+     * Amount of the buffer cache memory in bytes reserved for this file.
+     * The file's cached blocks are not evicted in favor of the other files
+     * while the file uses less than this amount, unless all the files are
+     * within their reservations. It is set to zero by default.
+     * This is a local config to each ForestDB file.
+     */
+    uint64_t buffercache_min_reservation;
+    /**
+     * Maximum amount of the buffer cache memory in bytes that this file can
+     * use. Once the file reaches this limit, caching a new block of the file
+     * evicts one of its own cached blocks. It is set to zero (no limit) by
+     * default. This is a local config to each ForestDB file.
+     */
+    uint64_t buffercache_max_limit;
+    /**
+     * Eviction priority of this file's cached blocks. Files with lower
+     * priorities are chosen as eviction victims first. It is set to
+     * FDB_CACHE_PRIORITY_NORMAL by default.
+     * This is a local config to each ForestDB file.
+     */
+    fdb_cache_priority_t buffercache_priority;
+    /**
+     * Total amount of memory in bytes shared by the buffer cache (or bnode
+     * cache), the compressed second-tier cache, and the WAL indexes of all
+     * the open files. At each commit, the buffer cache gives up memory to
+     * the WAL indexes to stay within the budget, down to 1/8 of the budget,
+     * and takes it back (up to buffercache_size) as the WAL indexes are
+     * flushed. Once the cache can't shrink further, a commit flushes the WAL
+     * regardless of wal_threshold. It is set to zero (no budget) by default.
+     * This is a global config that is used across all ForestDB files.
+     */
+    uint64_t memory_budget;
+    /**
+     * Back the buffer cache memory with 2MB huge pages (transparent huge
+     * pages on Linux), which reduces TLB misses when reading cached blocks.
+     * When the cache is shrunk, the memory of a huge page is returned to the
+     * OS once all its blocks are taken out of the cache. The index node cache
+     * of the B+tree V2 format is not affected, as it allocates each node
+     * separately. It is disabled by default, and has no effect on platforms
+     * without huge page support. This is a global config that is used
+     * across all ForestDB files.
+     */
+    bool buffercache_huge_pages;
+    /**
+     * Number of bits per key of the Bloom filters that are kept for each KV
+     * store, so that fdb_get() and fdb_get_metaonly() on absent keys can
+     * return without traversing the main index. The filters are persisted
+     * in the file along with the KV store header, and rebuilt by compaction.
+     * 10 bits per key give about 1 % false positives. Each commit only
+     * writes the parts of the filters that have changed. It is set to zero
+     * (no filters) by default, and requires multi KV instance mode.
+     * This is a local config to each ForestDB file, and is decided by the
+     * first handle that opens the file.
+     */
+    uint32_t bloom_filter_bits_per_key;
+    /**
+     * Document bodies larger than this size (in bytes) are written into a
+     * separate append-only blob file next to the ForestDB file, and only a
+     * reference to the body is kept in the file. Compaction then moves the
+     * references instead of the bodies. Only the files created with a non-zero
+     * threshold use blob files, as they are written in a format that older
+     * versions of ForestDB cannot open. System documents and files that are
+     * encrypted never use blob files. It requires the multi KV instance mode,
+     * and is set to zero (disabled) by default. This is a local config to each
+     * ForestDB file, and is decided by the first handle that opens the file.
+     */
+    uint32_t blob_threshold;
+    /**
+     * Stale data ratio (%) of a blob file at which compaction moves the live
+     * bodies in the blob file into the new file's blob file, so that the old
+     * blob file can be removed along with the old ForestDB file. It is set to
+     * 50 % by default, and zero disables the relocation. This is a local
+     * config to each ForestDB file.
+     */
+    uint8_t blob_gc_threshold;
+    /**
+     * Height limit of the B+trees that index the keys of a KV store with a
+     * custom comparison function. When such a B+tree grows taller than the
+     * limit, ForestDB checks if splitting it by the leading bytes of the keys
+     * into smaller B+trees would shorten lookups, and if so, splits it. The
+     * split B+trees are indexed by the byte-wise order of the leading bytes,
+     * and the custom comparison function is then only given the rest of each
+     * key, so this can be enabled only if every custom comparison function
+     * orders keys byte-wise. It is set to 255 (disabled) by default.
+     * This is a local config to each ForestDB handle.
+     */
+    uint8_t leaf_height_limit;
 
 } fdb_config;
 
@@ -645,7 +795,13 @@ enum {
     /**
      * Return Keys and Metadata only for fdb_changes_since API.
      */
-    FDB_ITR_NO_VALUES = 0x10
+    FDB_ITR_NO_VALUES = 0x10,
+    /**
+     * The iterator is used for a one-shot scan whose blocks are unlikely to
+     * be read again. Blocks read by the iterator are admitted at the cold
+     * end of the buffer cache so that they don't evict the working set.
+     */
+    FDB_ITR_ONE_SHOT_SCAN = 0x20
 };
 
 /**
@@ -878,6 +1034,45 @@ typedef struct {
     uint32_t lat_avg;
 } fdb_latency_stat;
 
+/**
+ * Memory usage of ForestDB components, in bytes.
+ */
+typedef struct {
+    /**
+     * Memory used by the cached blocks in the buffer cache.
+     */
+    uint64_t block_cache;
+    /**
+     * Current capacity of the buffer cache.
+     */
+    uint64_t block_cache_capacity;
+    /**
+     * Memory used by the compressed second-tier buffer cache.
+     */
+    uint64_t compressed_cache;
+    /**
+     * Memory used by the cached B+tree nodes in the bnode cache.
+     */
+    uint64_t bnode_cache;
+    /**
+     * Memory used by the WAL indexes of all the open files.
+     */
+    uint64_t wal;
+    /**
+     * Memory used by the secondary indexes of all the open files.
+     */
+    uint64_t secondary_index;
+    /**
+     * Sum of all the above except block_cache_capacity, with the buffer
+     * cache counted by its capacity as its memory is preallocated.
+     */
+    uint64_t total;
+    /**
+     * Global memory budget (fdb_config.memory_budget). Zero if not set.
+     */
+    uint64_t budget;
+} fdb_memory_usage;
+
 /**
  * List of ForestDB KV store names
  */
@@ -605,6 +605,103 @@ fdb_status fdb_iterator_seek_to_max(fdb_iterator *iterator);
 LIBFDB_API
 fdb_status fdb_iterator_close(fdb_iterator *iterator);
 
+/**
+ * Register the secondary index of a KV store. The secondary key of each
+ * document is given by the extractor callback, and the index is maintained
+ * by ForestDB whenever documents are flushed from the WAL into the main
+ * index, so that the application does not need to read the old version of
+ * a document to update its own index.
+ *
+ * The index is built by scanning the KV store when it is registered for the
+ * first time. Indexes are kept in memory only, so they should be registered
+ * again whenever the file is opened, before the KV store is updated
+ * concurrently. If an index is already registered for the KV store, only its
+ * extractor and context are replaced. The index is accounted in the memory
+ * budget (see fdb_memory_usage.secondary_index).
+ *
+ * After the KV store is rolled back, the index is rebuilt by the next
+ * fdb_secondary_iterator_init() call on a non-snapshot handle. The index is
+ * dropped when the KV store is removed.
+ *
+ * Note that the index reflects the documents that have been flushed from the
+ * WAL; fdb_commit() with FDB_COMMIT_MANUAL_WAL_FLUSH can be used to make
+ * recent updates visible through the index.
+ *
+ * @param handle Pointer to ForestDB KV store handle.
+ * @param extractor Callback function that extracts a secondary key.
+ * @param ctx Client context (passed to the callback).
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_register_secondary_index(fdb_kvs_handle *handle,
+                                        fdb_secondary_key_fn extractor,
+                                        void *ctx);
+
+/**
+ * Create an iterator to traverse the documents of a KV store in the order of
+ * their secondary keys. The secondary index should be registered by
+ * fdb_register_secondary_index() in advance.
+ *
+ * If the handle is a snapshot, a private index is built from the documents
+ * of the snapshot (including the ones not flushed from the WAL), so that the
+ * iteration is isolated from later updates. This costs a scan of the KV
+ * store for each iterator.
+ *
+ * @param handle Pointer to ForestDB KV store handle.
+ * @param iterator Pointer to the place where the iterator is created
+ *        as a result of this API call.
+ * @param min_skey Pointer to the smallest secondary key. Passing NULL means
+ *        that it wants to start with the smallest secondary key.
+ * @param min_skeylen Length of the smallest secondary key.
+ * @param max_skey Pointer to the largest secondary key. Passing NULL means
+ *        that it wants to end iteration with the largest secondary key.
+ * @param max_skeylen Length of the largest secondary key.
+ * @return FDB_RESULT_SUCCESS on success, FDB_RESULT_INVALID_ARGS if no
+ *         secondary index is registered for the KV store.
+ */
+LIBFDB_API
+fdb_status fdb_secondary_iterator_init(fdb_kvs_handle *handle,
+                                       fdb_secondary_iterator **iterator,
+                                       const void *min_skey,
+                                       size_t min_skeylen,
+                                       const void *max_skey,
+                                       size_t max_skeylen);
+
+/**
+ * Move the secondary index iterator forward by one entry.
+ *
+ * @param iterator Pointer to the iterator.
+ * @return FDB_RESULT_SUCCESS on success, FDB_RESULT_ITERATOR_FAIL if there is
+ *         no more entry.
+ */
+LIBFDB_API
+fdb_status fdb_secondary_iterator_next(fdb_secondary_iterator *iterator);
+
+/**
+ * Get the document of the current secondary index entry, which is read from
+ * the KV store by its primary key. The document is allocated in the same way
+ * as fdb_iterator_get(); if a pre-allocated document is passed, its key
+ * buffer should be large enough to hold any primary key.
+ *
+ * @param iterator Pointer to the iterator.
+ * @param doc Pointer to FDB_DOC instance to be populated by the iterator.
+ * @return FDB_RESULT_SUCCESS on success, FDB_RESULT_ITERATOR_FAIL if the
+ *         iterator has no current entry, FDB_RESULT_KEY_NOT_FOUND if the
+ *         document has been deleted since the entry was made.
+ */
+LIBFDB_API
+fdb_status fdb_secondary_iterator_get(fdb_secondary_iterator *iterator,
+                                      fdb_doc **doc);
+
+/**
+ * Close the secondary index iterator and free its associated resources.
+ *
+ * @param iterator Pointer to the iterator.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_secondary_iterator_close(fdb_secondary_iterator *iterator);
+
 /**
  * Iterate through the changes since sequence number `since` with a provided
  * callback function.
@@ -776,6 +873,32 @@ fdb_status fdb_rekey(fdb_file_handle *fhandle,
 LIBFDB_API
 size_t fdb_get_buffer_cache_used();
 
+/**
+ * Resize the buffer cache shared by all ForestDB files at runtime, without
+ * closing any file. When the cache shrinks, cached blocks are evicted
+ * incrementally, so concurrent readers and writers aren't blocked for the
+ * whole resize. Files opened afterwards use the new size.
+ * Note that this API can't enable the buffer cache if it was disabled
+ * (i.e., buffercache_size was 0) when ForestDB was initialized.
+ *
+ * @param cache_size New buffer cache size in bytes. It should be at least
+ *        one block.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_set_cache_size(uint64_t cache_size);
+
+/**
+ * Return the current memory usage of the buffer cache, the compressed
+ * second-tier cache, the bnode cache, and the WAL indexes of all the open
+ * files, along with the global memory budget.
+ *
+ * @param usage Pointer to the memory usage structure to be filled.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_memory_usage(fdb_memory_usage *usage);
+
 /**
  * Return the overall disk space actively used by a ForestDB file.
  * Note that this doesn't include the disk space used by stale btree nodes
@@ -72,6 +72,9 @@
 // full compaction internval in secs when the circular block reusing is enabled
 #define FDB_COMPACTOR_SLEEP_DURATION (28800)
 #define FDB_DEFAULT_COMPACTION_THRESHOLD (30)
+#define FDB_DEFAULT_BLOB_GC_THRESHOLD (50)
+// leaf B+trees of custom compare KV stores are never extended
+#define FDB_DEFAULT_LEAF_HEIGHT_LIMIT (0xff)
 
 #define FDB_BGFLUSHER_SLEEP_DURATION (2)
 #define FDB_BGFLUSHER_DIRTY_THRESHOLD (1024) //if more than this 4MB dirty
@@ -85,6 +88,8 @@
 #define BCACHE_EVICT_UNIT (1)
 #define BCACHE_MEMORY_THRESHOLD (0.8) // 80% of physical RAM
 #define __BCACHE_SECOND_CHANCE
+// Number of lock-free lookup slots per block cache shard (power of 2)
+#define BCACHE_LOOKUP_SLOTS (1024)
 
 #define FILEMGR_PREFETCH_UNIT (4194304) // 4MB
 #define FILEMGR_RESIDENT_THRESHOLD (0.9) // 90 % of file is in buffer cache
@@ -129,6 +134,22 @@
 
 // Asynchronous I/O queue depth
 #define ASYNC_IO_QUEUE_DEPTH (64)
+// Max number of sibling leaf nodes read ahead by a B+tree V2 iterator
+#define BTREEV2_PREFETCH_DEPTH (16)
+// Number of sibling leaf nodes first read ahead by a B+tree V2 iterator,
+// doubled on every further read-ahead up to BTREEV2_PREFETCH_DEPTH
+#define BTREEV2_PREFETCH_MIN_DEPTH (2)
+// Max number of delta records that a B+tree V2 node can be made up of
+#define BTREEV2_DELTA_MAX_CHAIN (16)
+// Max total size of the delta records that a B+tree V2 node is made up of,
+// relative to the entire node
+#define BTREEV2_DELTA_MAX_RATIO (25) // 25 %
+// Number of keys that the first segment of a per-KV store Bloom filter holds
+#define BLOOM_FILTER_INIT_CAPACITY (1024)
+#define MAX_BLOOM_FILTER_BITS_PER_KEY (64)
+// Max distance (in leaf nodes) between the leaf predicted by the sequence
+// number model of a KV store and the leaf that actually covers the seqnum
+#define SEQ_MODEL_MAX_ERROR (1)
 
 // Number of daemon compactor threads
 #define DEFAULT_NUM_COMPACTOR_THREADS (4)
@@ -0,0 +1,675 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <algorithm>
+#if defined(WIN32) || defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "blobstore.h"
+#include "filemgr.h"
+#include "checksum.h"
+#include "fdb_internal.h"
+
+#include "memleak.h"
+
+thread_local FileMgr *BlobMoveScope::srcFile = nullptr;
+thread_local FileMgr *BlobMoveScope::dstFile = nullptr;
+
+// offset, length, crc, and the length of the file name
+#define BLOB_REF_FIXED_SIZE (sizeof(uint64_t) + sizeof(uint32_t) * 2 + \
+                             sizeof(uint16_t))
+
+size_t BlobRef::encodedSize() const
+{
+    return BLOB_REF_FIXED_SIZE + fileName.size();
+}
+
+void BlobRef::encode(void *buf) const
+{
+    uint8_t *ptr = (uint8_t *)buf;
+    uint64_t _offset = _endian_encode(offset);
+    uint32_t _length = _endian_encode(length);
+    uint32_t _crc = _endian_encode(crc);
+    uint16_t _namelen = _endian_encode((uint16_t)fileName.size());
+
+    memcpy(ptr, &_offset, sizeof(_offset));
+    ptr += sizeof(_offset);
+    memcpy(ptr, &_length, sizeof(_length));
+    ptr += sizeof(_length);
+    memcpy(ptr, &_crc, sizeof(_crc));
+    ptr += sizeof(_crc);
+    memcpy(ptr, &_namelen, sizeof(_namelen));
+    ptr += sizeof(_namelen);
+    memcpy(ptr, fileName.data(), fileName.size());
+}
+
+bool BlobRef::decode(const void *buf, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)buf;
+    uint16_t namelen;
+
+    if (!buf || len < BLOB_REF_FIXED_SIZE) {
+        return false;
+    }
+    memcpy(&offset, ptr, sizeof(offset));
+    ptr += sizeof(offset);
+    memcpy(&length, ptr, sizeof(length));
+    ptr += sizeof(length);
+    memcpy(&crc, ptr, sizeof(crc));
+    ptr += sizeof(crc);
+    memcpy(&namelen, ptr, sizeof(namelen));
+    ptr += sizeof(namelen);
+
+    offset = _endian_decode(offset);
+    length = _endian_decode(length);
+    crc = _endian_decode(crc);
+    namelen = _endian_decode(namelen);
+    if (namelen == 0 || len != BLOB_REF_FIXED_SIZE + namelen) {
+        return false;
+    }
+    fileName.assign((const char *)ptr, namelen);
+    return true;
+}
+
+// the longest suffix of a blob file name: '.[file number].blob'
+#define BLOB_FILE_NAME_MAX_SUFFIX (1 + 20 + sizeof(BLOB_FILE_SUFFIX) - 1)
+
+BlobStore::BlobStore(const char *filename, struct filemgr_ops *_ops,
+                     uint32_t _threshold, uint8_t gc_threshold) :
+    ops(_ops), threshold(_threshold), gcThreshold(gc_threshold),
+    activePos(0), dirty(false), fileNum(1), statsDirty(false),
+    statsOffset(BLK_NOT_FOUND)
+{
+    std::string path(filename);
+    size_t pos = path.find_last_of("/\\");
+    if (pos == std::string::npos) {
+        baseName = path;
+    } else {
+        dirName = path.substr(0, pos + 1);
+        baseName = path.substr(pos + 1);
+    }
+}
+
+bool BlobStore::isBlobBody(uint32_t bodylen) const
+{
+    return threshold && bodylen > threshold &&
+           bodylen > BlobRef().encodedSize() + baseName.size() +
+                     BLOB_FILE_NAME_MAX_SUFFIX;
+}
+
+BlobStore::~BlobStore()
+{
+    for (auto &entry : handles) {
+        FileMgr::fileClose(ops, entry.second);
+    }
+}
+
+fdb_status BlobStore::openFile(const std::string &name, bool create,
+                               fdb_fileops_handle *handle_out,
+                               ErrLogCallback *log_callback)
+{
+    auto entry = handles.find(name);
+    if (entry != handles.end()) {
+        *handle_out = entry->second;
+        return FDB_RESULT_SUCCESS;
+    }
+
+    std::string path = dirName + name;
+    fdb_fileops_handle handle;
+    fdb_status fs = FileMgr::fileOpen(path.c_str(), ops, &handle, O_RDONLY,
+                                      0666);
+    if (fs != FDB_RESULT_SUCCESS) {
+        if (create || fs != FDB_RESULT_NO_SUCH_FILE) {
+            fdb_log(log_callback, fs,
+                    "Error in opening a blob file '%s'", path.c_str());
+        }
+        return fs;
+    }
+    handles.insert(std::make_pair(name, handle));
+    *handle_out = handle;
+    return FDB_RESULT_SUCCESS;
+}
+
+fdb_status BlobStore::openActiveFile(fdb_fileops_handle *handle_out,
+                                     ErrLogCallback *log_callback)
+{
+    auto entry = handles.find(activeFile);
+    if (entry != handles.end()) {
+        *handle_out = entry->second;
+        return FDB_RESULT_SUCCESS;
+    }
+
+    // Every store appends to a blob file of its own, whose name has never
+    // been used by the files that might still refer to blob files (e.g.,
+    // the file compacted into this store's file under the same name).
+    while (true) {
+        std::string name = baseName + "." + std::to_string(fileNum++) +
+                           BLOB_FILE_SUFFIX;
+        std::string path = dirName + name;
+        fdb_fileops_handle handle;
+        fdb_status fs = FileMgr::fileOpen(path.c_str(), ops, &handle,
+                                          O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fs == FDB_RESULT_EEXIST) {
+            continue;
+        }
+        if (fs != FDB_RESULT_SUCCESS) {
+            fdb_log(log_callback, fs,
+                    "Error in creating a blob file '%s'", path.c_str());
+            return fs;
+        }
+        activeFile = name;
+        activePos = 0;
+        handles.insert(std::make_pair(name, handle));
+        stats.insert(std::make_pair(name, FileStat()));
+        statsDirty = true;
+        *handle_out = handle;
+        return FDB_RESULT_SUCCESS;
+    }
+}
+
+void BlobStore::closeFile(const std::string &name)
+{
+    auto entry = handles.find(name);
+    if (entry != handles.end()) {
+        FileMgr::fileClose(ops, entry->second);
+        handles.erase(entry);
+    }
+}
+
+BlobStore::FileStat &BlobStore::getStat(const std::string &name)
+{
+    auto entry = stats.find(name);
+    if (entry != stats.end()) {
+        return entry->second;
+    }
+
+    FileStat stat;
+    fdb_fileops_handle handle;
+    if (openFile(name, false, &handle, NULL) == FDB_RESULT_SUCCESS) {
+        std::string path = dirName + name;
+        cs_off_t size = ops->file_size(handle, path.c_str());
+        // bodies written before the store knew of the file are live
+        stat.size = stat.live = size > 0 ? size : 0;
+    }
+    return stats.insert(std::make_pair(name, stat)).first->second;
+}
+
+fdb_status BlobStore::appendLocked(const void *body, uint32_t len,
+                                   BlobRef &ref_out,
+                                   ErrLogCallback *log_callback)
+{
+    fdb_fileops_handle handle;
+    fdb_status fs = openActiveFile(&handle, log_callback);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+    FileStat &stat = stats[activeFile];
+
+    fdb_ssize_t rv = ops->pwrite(handle, (void *)body, len, activePos);
+    if (rv != (fdb_ssize_t)len) {
+        fs = rv < 0 ? (fdb_status)rv : FDB_RESULT_WRITE_FAIL;
+        fdb_log(log_callback, fs,
+                "Error in writing a body of %u bytes at offset %" _F64
+                " into a blob file '%s%s'", len, activePos,
+                dirName.c_str(), activeFile.c_str());
+        return fs;
+    }
+
+    ref_out.fileName = activeFile;
+    ref_out.offset = activePos;
+    ref_out.length = len;
+    ref_out.crc = get_checksum(reinterpret_cast<const uint8_t*>(body), len,
+                               CRC32);
+    activePos += len;
+    stat.size = activePos;
+    stat.live += len;
+    dirty = true;
+    statsDirty = true;
+    return FDB_RESULT_SUCCESS;
+}
+
+fdb_status BlobStore::append(const void *body, uint32_t len,
+                             BlobRef &ref_out, ErrLogCallback *log_callback)
+{
+    LockHolder lh(lock);
+    return appendLocked(body, len, ref_out, log_callback);
+}
+
+fdb_status BlobStore::readBody(fdb_fileops_handle handle, const BlobRef &ref,
+                               void *buf, ErrLogCallback *log_callback)
+{
+    fdb_ssize_t rv = ops->pread(handle, buf, ref.length, ref.offset);
+    if (rv != (fdb_ssize_t)ref.length) {
+        fdb_status fs = rv < 0 ? (fdb_status)rv : FDB_RESULT_READ_FAIL;
+        fdb_log(log_callback, fs,
+                "Error in reading a body of %u bytes at offset %" _F64
+                " from a blob file '%s%s'", ref.length, ref.offset,
+                dirName.c_str(), ref.fileName.c_str());
+        return fs;
+    }
+    uint32_t crc = get_checksum(reinterpret_cast<const uint8_t*>(buf),
+                                ref.length, CRC32);
+    if (crc != ref.crc) {
+        fdb_log(log_callback, FDB_RESULT_CHECKSUM_ERROR,
+                "Body checksum mismatch error in a blob file '%s%s' "
+                "crc %x != %x offset %" _F64, dirName.c_str(),
+                ref.fileName.c_str(), crc, ref.crc, ref.offset);
+        return FDB_RESULT_CHECKSUM_ERROR;
+    }
+    return FDB_RESULT_SUCCESS;
+}
+
+fdb_status BlobStore::read(const BlobRef &ref, void *buf,
+                           ErrLogCallback *log_callback)
+{
+    fdb_fileops_handle handle;
+    fdb_status fs;
+    {
+        LockHolder lh(lock);
+        fs = openFile(ref.fileName, true, &handle, log_callback);
+    }
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+    // open handles are only closed once no file refers to the blob file,
+    // so the body can be read without holding the lock
+    return readBody(handle, ref, buf, log_callback);
+}
+
+fdb_status BlobStore::sync(ErrLogCallback *log_callback)
+{
+    LockHolder lh(lock);
+    if (!dirty) {
+        return FDB_RESULT_SUCCESS;
+    }
+    auto entry = handles.find(activeFile);
+    if (entry == handles.end()) {
+        return FDB_RESULT_SUCCESS;
+    }
+    int rv = ops->fsync(entry->second);
+    if (rv != FDB_RESULT_SUCCESS) {
+        fdb_log(log_callback, (fdb_status)rv,
+                "Error in fsync on a blob file '%s%s'",
+                dirName.c_str(), activeFile.c_str());
+        return (fdb_status)rv;
+    }
+    dirty = false;
+    return FDB_RESULT_SUCCESS;
+}
+
+void BlobStore::markStale(const BlobRef &ref)
+{
+    LockHolder lh(lock);
+    FileStat &stat = getStat(ref.fileName);
+    stat.live -= std::min((uint64_t)ref.length, stat.live);
+    statsDirty = true;
+}
+
+void BlobStore::prepareRelocation(BlobStore *src)
+{
+    std::unordered_set<std::string> files;
+    uint64_t src_file_num;
+    {
+        LockHolder lh(src->lock);
+        src_file_num = src->fileNum;
+        for (auto &entry : src->stats) {
+            const FileStat &stat = entry.second;
+            if (gcThreshold && stat.size &&
+                (stat.size - stat.live) * 100 >= stat.size * gcThreshold) {
+                files.insert(entry.first);
+            }
+        }
+    }
+
+    LockHolder lh(lock);
+    fileNum = std::max(fileNum, src_file_num);
+    relocating.swap(files);
+}
+
+fdb_status BlobStore::moveRef(BlobRef &ref, ErrLogCallback *log_callback)
+{
+    LockHolder lh(lock);
+    if (!relocating.count(ref.fileName)) {
+        bool known = stats.count(ref.fileName);
+        FileStat &stat = getStat(ref.fileName);
+        if (!known) {
+            // count the live bytes of the file from the moved references
+            stat.live = 0;
+        }
+        stat.live += ref.length;
+        statsDirty = true;
+        return FDB_RESULT_SUCCESS;
+    }
+
+    // copy the body into the active blob file, and leave the stale copy
+    // behind in the relocated file, which is removed with the old file
+    void *buf = malloc(ref.length);
+    BlobRef new_ref;
+    fdb_fileops_handle handle;
+    fdb_status fs = openFile(ref.fileName, true, &handle, log_callback);
+    if (fs == FDB_RESULT_SUCCESS) {
+        fs = readBody(handle, ref, buf, log_callback);
+    }
+    if (fs == FDB_RESULT_SUCCESS) {
+        fs = appendLocked(buf, ref.length, new_ref, log_callback);
+    }
+    free(buf);
+    if (fs == FDB_RESULT_SUCCESS) {
+        ref = new_ref;
+    }
+    return fs;
+}
+
+void BlobStore::inheritFiles(BlobStore *src)
+{
+    std::map<std::string, FileStat> files;
+    uint64_t src_file_num;
+    {
+        LockHolder lh(src->lock);
+        files = src->stats;
+        src_file_num = src->fileNum;
+    }
+
+    LockHolder lh(lock);
+    for (auto &entry : files) {
+        stats.insert(entry);
+    }
+    fileNum = std::max(fileNum, src_file_num);
+    statsDirty = true;
+}
+
+void BlobStore::setObsoleteFiles(BlobStore *dst)
+{
+    std::unordered_set<std::string> files;
+    {
+        LockHolder lh(lock);
+        for (auto &entry : stats) {
+            files.insert(entry.first);
+        }
+    }
+    if (dst) {
+        LockHolder lh(dst->lock);
+        for (auto it = files.begin(); it != files.end(); ) {
+            if (dst->stats.count(*it)) {
+                it = files.erase(it);
+            } else {
+                // the new file might have read it for relocation
+                dst->closeFile(*it);
+                ++it;
+            }
+        }
+        dst->relocating.clear();
+    }
+
+    LockHolder lh(lock);
+    obsolete.swap(files);
+}
+
+void BlobStore::setActiveFileObsolete()
+{
+    LockHolder lh(lock);
+    if (!activeFile.empty()) {
+        // only the active file was created by this store; the other blob
+        // files are still referred to by the file compacted into it
+        obsolete.insert(activeFile);
+    }
+}
+
+void BlobStore::takeObsoleteFiles(BlobStore *src)
+{
+    std::unordered_set<std::string> files;
+    {
+        LockHolder lh(src->lock);
+        for (auto &name : src->obsolete) {
+            src->closeFile(name);
+        }
+        files.swap(src->obsolete);
+    }
+
+    LockHolder lh(lock);
+    obsolete.insert(files.begin(), files.end());
+}
+
+void BlobStore::unlinkObsoleteFiles(ErrLogCallback *log_callback)
+{
+    LockHolder lh(lock);
+    for (auto it = obsolete.begin(); it != obsolete.end(); ) {
+        fdb_fileops_handle handle;
+        fdb_status fs = openFile(*it, false, &handle, log_callback);
+        if (fs == FDB_RESULT_NO_SUCH_FILE) {
+            it = obsolete.erase(it);
+            continue;
+        }
+        if (fs == FDB_RESULT_SUCCESS) {
+            std::string path = dirName + *it;
+            remove(path.c_str());
+        }
+        // removeObsoleteFiles() closes the handle (or retries the removal)
+        ++it;
+    }
+}
+
+void BlobStore::removeObsoleteFiles()
+{
+    LockHolder lh(lock);
+    for (auto &name : obsolete) {
+        closeFile(name);
+        std::string path = dirName + name;
+        remove(path.c_str());
+        stats.erase(name);
+    }
+    if (!obsolete.empty()) {
+        statsDirty = true;
+    }
+    obsolete.clear();
+}
+
+void BlobStore::exportStats(void **data, size_t *len)
+{
+    /* << raw data structure >>
+     * [next file number]:  8 bytes
+     * [# blob files]:      8 bytes
+     * ---
+     * [name length]:       2 bytes
+     * [file name]:         x bytes
+     * [file size]:         8 bytes
+     * [live body bytes]:   8 bytes
+     * ...
+     */
+    LockHolder lh(lock);
+    size_t size = sizeof(uint64_t) * 2;
+    for (auto &entry : stats) {
+        size += sizeof(uint16_t) + entry.first.size() + sizeof(uint64_t) * 2;
+    }
+
+    uint8_t *ptr = (uint8_t *)malloc(size);
+    *data = ptr;
+    *len = size;
+
+    uint64_t _file_num = _endian_encode(fileNum);
+    memcpy(ptr, &_file_num, sizeof(_file_num));
+    ptr += sizeof(_file_num);
+    uint64_t _n_files = _endian_encode((uint64_t)stats.size());
+    memcpy(ptr, &_n_files, sizeof(_n_files));
+    ptr += sizeof(_n_files);
+
+    for (auto &entry : stats) {
+        uint16_t _namelen = _endian_encode((uint16_t)entry.first.size());
+        memcpy(ptr, &_namelen, sizeof(_namelen));
+        ptr += sizeof(_namelen);
+        memcpy(ptr, entry.first.data(), entry.first.size());
+        ptr += entry.first.size();
+        uint64_t _size = _endian_encode(entry.second.size);
+        memcpy(ptr, &_size, sizeof(_size));
+        ptr += sizeof(_size);
+        uint64_t _live = _endian_encode(entry.second.live);
+        memcpy(ptr, &_live, sizeof(_live));
+        ptr += sizeof(_live);
+    }
+}
+
+bool BlobStore::importStats(const void *data, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+    const uint8_t *end = ptr + len;
+    uint64_t _file_num, _n_files;
+    std::map<std::string, FileStat> files;
+
+    if (!data || len < sizeof(uint64_t) * 2) {
+        return false;
+    }
+    memcpy(&_file_num, ptr, sizeof(_file_num));
+    ptr += sizeof(_file_num);
+    memcpy(&_n_files, ptr, sizeof(_n_files));
+    ptr += sizeof(_n_files);
+
+    uint64_t n_files = _endian_decode(_n_files);
+    for (uint64_t i = 0; i < n_files; ++i) {
+        uint16_t _namelen;
+        FileStat stat;
+        if (ptr + sizeof(_namelen) > end) {
+            return false;
+        }
+        memcpy(&_namelen, ptr, sizeof(_namelen));
+        ptr += sizeof(_namelen);
+        uint16_t namelen = _endian_decode(_namelen);
+        if (ptr + namelen + sizeof(uint64_t) * 2 > end) {
+            return false;
+        }
+        std::string name((const char *)ptr, namelen);
+        ptr += namelen;
+        memcpy(&stat.size, ptr, sizeof(stat.size));
+        ptr += sizeof(stat.size);
+        memcpy(&stat.live, ptr, sizeof(stat.live));
+        ptr += sizeof(stat.live);
+        stat.size = _endian_decode(stat.size);
+        stat.live = _endian_decode(stat.live);
+        files.insert(std::make_pair(name, stat));
+    }
+
+    LockHolder lh(lock);
+    // the stats of the files that this store has already seen are newer
+    for (auto &entry : files) {
+        stats.insert(entry);
+    }
+    fileNum = std::max(fileNum, (uint64_t)_endian_decode(_file_num));
+    return true;
+}
+
+void BlobStore::setStatsPersisted(uint64_t doc_offset)
+{
+    LockHolder lh(lock);
+    statsOffset = doc_offset;
+    statsDirty = false;
+}
+
+bool BlobStore::isStatsDirty()
+{
+    LockHolder lh(lock);
+    return statsDirty;
+}
+
+uint64_t BlobStore::getStatsOffset()
+{
+    LockHolder lh(lock);
+    return statsOffset;
+}
+
+// check if 'name' is '[base name].[file number].blob'; the blob files of
+// '[base name].[n]' (e.g., the next file of the auto compaction) have two
+// numbers, and are not matched.
+static bool _is_blob_file_name(const char *name, const std::string &base_name)
+{
+    size_t len = strlen(name);
+    size_t suffix_len = strlen(BLOB_FILE_SUFFIX);
+    if (len <= base_name.size() + 1 + suffix_len ||
+        strncmp(name, base_name.c_str(), base_name.size()) ||
+        name[base_name.size()] != '.' ||
+        strcmp(name + len - suffix_len, BLOB_FILE_SUFFIX)) {
+        return false;
+    }
+    for (size_t i = base_name.size() + 1; i < len - suffix_len; ++i) {
+        if (name[i] < '0' || name[i] > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BlobStore::removeBlobFiles(const char *filename)
+{
+    std::string path(filename);
+    std::string dir_name, base_name;
+    size_t pos = path.find_last_of("/\\");
+    if (pos == std::string::npos) {
+        dir_name = ".";
+        base_name = path;
+    } else {
+        dir_name = path.substr(0, pos);
+        base_name = path.substr(pos + 1);
+    }
+
+    // the blob files do not exist if no body has exceeded the threshold
+#if !defined(WIN32) && !defined(_WIN32)
+    DIR *dir_info = opendir(dir_name.c_str());
+    if (dir_info == NULL) {
+        return;
+    }
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir_info))) {
+        if (_is_blob_file_name(dir_entry->d_name, base_name)) {
+            std::string blob_path = dir_name + "/" + dir_entry->d_name;
+            remove(blob_path.c_str());
+        }
+    }
+    closedir(dir_info);
+#else
+    WIN32_FIND_DATA filedata;
+    std::string query = path + ".*" + BLOB_FILE_SUFFIX;
+    HANDLE hfind = FindFirstFile(query.c_str(), &filedata);
+    while (hfind != INVALID_HANDLE_VALUE) {
+        if (_is_blob_file_name(filedata.cFileName, base_name)) {
+            std::string blob_path = dir_name + "\\" + filedata.cFileName;
+            remove(blob_path.c_str());
+        }
+        if (!FindNextFile(hfind, &filedata)) {
+            FindClose(hfind);
+            hfind = INVALID_HANDLE_VALUE;
+        }
+    }
+#endif
+}
+
+BlobMoveScope::BlobMoveScope(FileMgr *src, FileMgr *dst) :
+    prevSrc(srcFile), prevDst(dstFile)
+{
+    srcFile = src;
+    dstFile = dst;
+}
+
+BlobMoveScope::~BlobMoveScope()
+{
+    srcFile = prevSrc;
+    dstFile = prevDst;
+}
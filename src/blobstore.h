@@ -0,0 +1,285 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "libforestdb/fdb_errors.h"
+#include "libforestdb/fdb_types.h"
+#include "common.h"
+#include "internal_types.h"
+
+class FileMgr;
+
+#define BLOB_FILE_SUFFIX ".blob"
+
+/**
+ * Reference to a document body that is kept in a blob file. The reference
+ * is written into the ForestDB file in place of the body, and the document
+ * is flagged with DOCIO_BLOB.
+ */
+struct BlobRef {
+    BlobRef() : offset(0), length(0), crc(0) { }
+
+    size_t encodedSize() const;
+
+    void encode(void *buf) const;
+
+    /**
+     * Decode a reference from 'buf' of 'len' bytes.
+     *
+     * @return False if 'buf' does not hold a valid reference.
+     */
+    bool decode(const void *buf, size_t len);
+
+    // Name of the blob file, relative to the directory of the ForestDB file
+    std::string fileName;
+    // Offset of the body in the blob file
+    uint64_t offset;
+    // Length of the body
+    uint32_t length;
+    // CRC32 of the body
+    uint32_t crc;
+};
+
+/**
+ * Blob files that hold the large document bodies of a ForestDB file.
+ *
+ * Bodies larger than the blob threshold are appended to a blob file created
+ * by the store, '[filename].[file number].blob' (with the original file name
+ * for the file being compacted in-place), and only their references are
+ * written into the ForestDB file. The file number is never reused for the
+ * same file name, so that a blob file is never shared by two stores (e.g.,
+ * in-place compaction reuses the file names). Compaction moves the
+ * references into the new file as they are (see BlobMoveScope), so that the
+ * bodies are not copied, and the new file keeps referring to the blob files
+ * of its ancestors.
+ *
+ * The store tracks the size and the live body bytes of each blob file it
+ * knows of; a body becomes stale when the WAL flush replaces or removes its
+ * document. When a file is compacted, the live bodies in the blob files
+ * whose stale ratio reaches the blob GC threshold are relocated into the new
+ * file's blob file, and blob files that the new file no longer refers to are
+ * removed along with the old file. The stats are persisted along with the
+ * KV header (see exportStats()); blob files that the store has not seen yet
+ * are considered fully live.
+ */
+class BlobStore {
+public:
+    BlobStore(const char *filename, struct filemgr_ops *ops,
+              uint32_t threshold, uint8_t gc_threshold);
+
+    ~BlobStore();
+
+    /**
+     * Check if a body of the given length should be kept in a blob file.
+     */
+    bool isBlobBody(uint32_t bodylen) const;
+
+    /**
+     * Append a body to the active blob file.
+     *
+     * @param ref_out Reference to the appended body.
+     */
+    fdb_status append(const void *body, uint32_t len, BlobRef &ref_out,
+                      ErrLogCallback *log_callback);
+
+    /**
+     * Read the body that 'ref' refers to into 'buf', and verify its CRC.
+     */
+    fdb_status read(const BlobRef &ref, void *buf,
+                    ErrLogCallback *log_callback);
+
+    /**
+     * Flush the appended bodies to disk, so that the references written into
+     * the ForestDB file are durable once its header is committed.
+     */
+    fdb_status sync(ErrLogCallback *log_callback);
+
+    /**
+     * Mark the body that 'ref' refers to as stale.
+     */
+    void markStale(const BlobRef &ref);
+
+    /**
+     * Decide the blob files whose live bodies should be relocated while the
+     * file of 'src' is compacted into the file of this store.
+     */
+    void prepareRelocation(BlobStore *src);
+
+    /**
+     * Take over a reference moved from the old file by compaction. If its
+     * blob file is being relocated, the body is copied into the active blob
+     * file and 'ref' is updated.
+     */
+    fdb_status moveRef(BlobRef &ref, ErrLogCallback *log_callback);
+
+    /**
+     * Take over all blob files of 'src', whose documents are cloned into
+     * the file of this store without being read.
+     */
+    void inheritFiles(BlobStore *src);
+
+    /**
+     * Once the file of this store has been compacted into the file of 'dst',
+     * mark the blob files that 'dst' does not refer to as obsolete. They are
+     * removed by removeObsoleteFiles() when the old file is removed. 'dst' is
+     * NULL if the new file does not refer to any blob file.
+     */
+    void setObsoleteFiles(BlobStore *dst);
+
+    /**
+     * Mark the blob file created by this store as obsolete, once the
+     * compaction into the file of this store has failed.
+     */
+    void setActiveFileObsolete();
+
+    /**
+     * Take over the obsolete blob files of 'src', whose file is removed while
+     * the file of this store (i.e., an older file) is still open and might
+     * refer to them.
+     */
+    void takeObsoleteFiles(BlobStore *src);
+
+    /**
+     * Unlink the obsolete blob files while keeping them open, so that the
+     * handles still reading the old file can read their bodies (POSIX only).
+     * They are closed by removeObsoleteFiles().
+     */
+    void unlinkObsoleteFiles(ErrLogCallback *log_callback);
+
+    void removeObsoleteFiles();
+
+    /**
+     * Export the stats of all blob files into a newly allocated buffer.
+     */
+    void exportStats(void **data, size_t *len);
+
+    /**
+     * Import the stats exported by exportStats(), except for the blob files
+     * that the store already knows of. Return false if the data is
+     * malformed.
+     */
+    bool importStats(const void *data, size_t len);
+
+    /**
+     * Record that the stats have been written into the document at
+     * 'doc_offset'.
+     */
+    void setStatsPersisted(uint64_t doc_offset);
+
+    /**
+     * Return true if the stats have changed since they were last persisted.
+     */
+    bool isStatsDirty();
+
+    /**
+     * Return the offset of the last stats document, or BLK_NOT_FOUND.
+     */
+    uint64_t getStatsOffset();
+
+    /**
+     * Remove the blob files created for the given ForestDB file, i.e.,
+     * '[filename].[file number].blob'.
+     */
+    static void removeBlobFiles(const char *filename);
+
+private:
+    struct FileStat {
+        FileStat() : size(0), live(0) { }
+        uint64_t size;
+        uint64_t live;
+    };
+
+    fdb_status openFile(const std::string &name, bool create,
+                        fdb_fileops_handle *handle_out,
+                        ErrLogCallback *log_callback);
+
+    fdb_status openActiveFile(fdb_fileops_handle *handle_out,
+                              ErrLogCallback *log_callback);
+
+    void closeFile(const std::string &name);
+
+    FileStat &getStat(const std::string &name);
+
+    fdb_status appendLocked(const void *body, uint32_t len, BlobRef &ref_out,
+                            ErrLogCallback *log_callback);
+
+    fdb_status readBody(fdb_fileops_handle handle, const BlobRef &ref,
+                        void *buf, ErrLogCallback *log_callback);
+
+    // Directory of the ForestDB file, including the trailing separator
+    std::string dirName;
+    // Name of the ForestDB file, without the directory
+    std::string baseName;
+    struct filemgr_ops *ops;
+    uint32_t threshold;
+    uint8_t gcThreshold;
+
+    // Protects all the members below
+    std::mutex lock;
+    std::unordered_map<std::string, fdb_fileops_handle> handles;
+    // Name of the blob file that new bodies are appended to, or empty if
+    // the store has not created one yet
+    std::string activeFile;
+    uint64_t activePos;
+    bool dirty;
+    // Number to try first for the name of the next blob file
+    uint64_t fileNum;
+    std::map<std::string, FileStat> stats;
+    bool statsDirty;
+    // Offset of the last stats document, or BLK_NOT_FOUND
+    uint64_t statsOffset;
+    // Blob files whose live bodies are relocated by the ongoing compaction
+    std::unordered_set<std::string> relocating;
+    std::unordered_set<std::string> obsolete;
+};
+
+/**
+ * Scope in which the calling thread moves documents from one file to
+ * another (i.e., compaction). Within the scope, documents read from 'src'
+ * return the references to their blob bodies in place of the bodies, and
+ * the references are appended to 'dst' through BlobStore::moveRef(), so that
+ * the bodies are not copied.
+ */
+class BlobMoveScope {
+public:
+    BlobMoveScope(FileMgr *src, FileMgr *dst);
+
+    ~BlobMoveScope();
+
+    static bool isSource(FileMgr *file) {
+        return file && srcFile == file;
+    }
+
+    static bool isTarget(FileMgr *file) {
+        return file && dstFile == file;
+    }
+
+private:
+    FileMgr *prevSrc;
+    FileMgr *prevDst;
+    // Files that the current thread is moving documents between, if any.
+    static thread_local FileMgr *srcFile;
+    static thread_local FileMgr *dstFile;
+};
@@ -21,7 +21,9 @@
 
 #if !defined(WIN32) && !defined(_WIN32)
 #include <sys/time.h>
+#include <sys/mman.h>
 #endif
+#include <algorithm>
 #include <map>
 
 #include "hash_functions.h"
@@ -34,6 +36,9 @@
 #include "atomic.h"
 #include "fdb_internal.h"
 #include "time_utils.h"
+#ifdef _DOC_COMP
+#include "snappy-c.h"
+#endif
 #include "memleak.h"
 
 #ifdef __DEBUG
@@ -54,19 +59,21 @@ const uint32_t BlockCacheManager::defaultBlockSize = FDB_BLOCKSIZE; // 4KB
 
 class BlockCacheItem {
 public:
-    BlockCacheItem() : bid(BLK_NOT_FOUND), addr(NULL), flag(0), score(0) {
+    BlockCacheItem() : bid(BLK_NOT_FOUND), addr(NULL), flag(0), score(0),
+                       version(0), referenced(0), owner(NULL) {
         list_elem.prev = list_elem.next = NULL;
     }
 
     BlockCacheItem(bid_t _bid, void *_addr, uint8_t _flag, uint8_t _score) :
-        bid(_bid), addr(_addr), flag(_flag), score(_score) {
+        bid(_bid), addr(_addr), flag(_flag), score(_score),
+        version(0), referenced(0), owner(NULL) {
         list_elem.prev = list_elem.next = NULL;
     }
 
     ~BlockCacheItem() { }
 
     bid_t getBid(void) const {
-        return bid;
+        return bid.load(std::memory_order_relaxed);
     }
 
     void *getBlockAddr(void) const {
@@ -81,8 +88,12 @@ public:
         return score;
     }
 
+    BlockCacheShard *getOwner(void) const {
+        return owner.load(std::memory_order_relaxed);
+    }
+
     void setBid(bid_t _bid) {
-        bid = _bid;
+        bid.store(_bid, std::memory_order_relaxed);
     }
 
     void setFlag(uint8_t _flag) {
@@ -93,27 +104,96 @@ public:
         score = _score;
     }
 
+    void setOwner(BlockCacheShard *_owner) {
+        owner.store(_owner, std::memory_order_relaxed);
+    }
+
+    /**
+     * Mark the beginning of a modification to this item's identity or block
+     * content. Must be called with the owning shard's lock held, and be
+     * paired with endWrite().
+     */
+    void beginWrite() {
+        version.store(version.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endWrite() {
+        version.store(version.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+    }
+
+    /**
+     * Start an optimistic read. Returns the version to be validated later;
+     * an odd version means that a writer is currently modifying this item.
+     */
+    uint64_t beginRead() const {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Check if nothing has been modified since beginRead() returned
+     * a given version.
+     */
+    bool validateRead(uint64_t ver) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_relaxed) == ver;
+    }
+
+    /**
+     * Record an access by an optimistic reader. The flag is only stored when
+     * it is not already set, so that repeated hits on a hot block don't keep
+     * writing to the item's cache line.
+     */
+    void markReferenced() {
+        if (!referenced.load(std::memory_order_relaxed)) {
+            referenced.store(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Clear the access flag and return its previous value.
+     */
+    bool clearReferenced() {
+        if (referenced.load(std::memory_order_relaxed)) {
+            referenced.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
     // list elem for {free, clean} lists
     struct list_elem list_elem;
 
 private:
     // block ID
-    bid_t bid;
+    std::atomic<bid_t> bid;
     // block address
     void *addr;
     // Flag indicating if a given block is dirty or immutable or free to use
     std::atomic<uint8_t> flag;
     // cache block score
     uint8_t score;
+    // Sequence counter for optimistic readers; odd while a writer is active
+    std::atomic<uint64_t> version;
+    // Set by optimistic readers instead of moving the item to the LRU head
+    std::atomic<uint8_t> referenced;
+    // Shard that currently owns this item (NULL if it is in the free list)
+    std::atomic<BlockCacheShard *> owner;
 };
 
 typedef std::unordered_map<bid_t, BlockCacheItem *> block_map_t;
 
 class BlockCacheShard {
 public:
-    BlockCacheShard() {
+    BlockCacheShard(size_t num_shards) : stride(num_shards) {
         spin_init(&lock);
         list_init(&cleanBlocks);
+        lookupSlots = new std::atomic<BlockCacheItem *>[BCACHE_LOOKUP_SLOTS];
+        for (size_t i = 0; i < BCACHE_LOOKUP_SLOTS; ++i) {
+            lookupSlots[i].store(NULL, std::memory_order_relaxed);
+        }
     }
 
     ~BlockCacheShard() {
@@ -122,6 +202,7 @@ public:
         for (auto &block_entry : allBlocks) {
             delete block_entry.second;
         }
+        delete[] lookupSlots;
     }
 
     bool empty() {
@@ -130,10 +211,49 @@ public:
             dirtyIndexBlocks.empty();
     }
 
+    /**
+     * Return the item that was most recently published for a given block ID,
+     * without grabbing the shard lock. The returned item may have been
+     * recycled in the meantime, so that the caller should validate it
+     * through the item's version.
+     */
+    BlockCacheItem *lookup(bid_t bid) const {
+        return lookupSlots[getSlot(bid)].load(std::memory_order_acquire);
+    }
+
+    /**
+     * Make a given item visible to lock-free lookups.
+     * Caller should grab the shard lock before calling this function.
+     */
+    void publish(BlockCacheItem *item) {
+        lookupSlots[getSlot(item->getBid())].store(item,
+                                                   std::memory_order_release);
+    }
+
+    /**
+     * Detach a given item from this shard so that lock-free readers that
+     * still hold a reference to it fail their validation.
+     * Caller should grab the shard lock before calling this function.
+     */
+    void unpublish(BlockCacheItem *item) {
+        size_t slot = getSlot(item->getBid());
+        if (lookupSlots[slot].load(std::memory_order_relaxed) == item) {
+            lookupSlots[slot].store(NULL, std::memory_order_relaxed);
+        }
+        item->beginWrite();
+        item->setOwner(NULL);
+        item->endWrite();
+    }
+
 private:
     friend class BlockCacheManager;
     friend class FileBlockCache;
 
+    size_t getSlot(bid_t bid) const {
+        // Block IDs in this shard are congruent modulo the number of shards.
+        return (bid / stride) & (BCACHE_LOOKUP_SLOTS - 1);
+    }
+
     spin_t lock;
     // LRU List of clean blocks
     struct list cleanBlocks;
@@ -143,20 +263,452 @@ private:
     std::map<bid_t, BlockCacheItem *> dirtyIndexBlocks;
     // Hashtable of all the blocks belonging to this shard
     block_map_t allBlocks;
+    // Direct-mapped table of recently published items for lock-free lookups
+    std::atomic<BlockCacheItem *> *lookupSlots;
+    // Number of shards in the file block cache
+    size_t stride;
+};
+
+/**
+ * Second-tier cache that keeps compressed copies of clean blocks evicted from
+ * the block cache. Blocks are compressed with snappy if document compression
+ * is built in, and with a simple run-length coding otherwise. All methods are
+ * thread-safe, and never grab a block cache shard lock, so that they can be
+ * invoked while holding one.
+ */
+class CompressedBlockTier {
+public:
+    CompressedBlockTier(uint64_t capacity, uint32_t blocksize);
+
+    ~CompressedBlockTier();
+
+    /**
+     * Reserve the insertion of a given block that is being evicted. This
+     * should be invoked while holding the block cache shard lock, so that it
+     * is ordered with the writes that invalidate the block.
+     *
+     * @return Token to be passed to insert().
+     */
+    uint64_t reserve(FileBlockCache *fcache, bid_t bid);
+
+    /**
+     * Compress a given clean block and insert it into the tier, evicting the
+     * least recently inserted blocks if the tier is full. The block is
+     * compressed without holding any lock, and discarded if it has been
+     * invalidated since reserve() returned a given token.
+     */
+    void insert(FileBlockCache *fcache, bid_t bid, const void *block,
+                uint64_t token);
+
+    /**
+     * Remove a given block from the tier and decompress it into a buffer.
+     *
+     * @return True if a given block is found and decompressed successfully.
+     */
+    bool fetch(FileBlockCache *fcache, bid_t bid, void *buf);
+
+    /**
+     * Discard a given block from the tier if it exists.
+     */
+    void invalidate(FileBlockCache *fcache, bid_t bid);
+
+    /**
+     * Discard all the blocks belonging to a given file block cache.
+     */
+    void removeFile(FileBlockCache *fcache);
+
+    uint64_t getMemoryUsage() const {
+        return usedBytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getNumItems() const {
+        return numItems.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Entry {
+        // list elem for the shard's LRU list (must be the first member)
+        struct list_elem le;
+        FileBlockCache *fcache;
+        bid_t bid;
+        size_t len;
+        char *data;
+    };
+
+    typedef std::unordered_map<bid_t, Entry *> entry_map_t;
+
+    struct Shard {
+        spin_t lock;
+        // Compressed blocks grouped by their file block cache
+        std::unordered_map<FileBlockCache *, entry_map_t> files;
+        // LRU list of compressed blocks (head: most recent)
+        struct list lru;
+        uint64_t usedBytes;
+    };
+
+    Shard &getShard(bid_t bid) {
+        return shards[bid % numShards];
+    }
+
+    std::atomic<uint64_t> &getTokenSlot(FileBlockCache *fcache, bid_t bid) {
+        uint64_t h = bid ^ (reinterpret_cast<uintptr_t>(fcache) >> 4);
+        return tokenSlots[(h * 0x9e3779b97f4a7c15ULL) >> 52];
+    }
+
+    /**
+     * Compress a given block into a newly allocated buffer.
+     *
+     * @return Compressed length, or 0 if the block doesn't compress well.
+     */
+    size_t compressBlock(const void *block, char **comp_buf);
+
+    /**
+     * Decompress a given compressed block into a block-sized buffer.
+     */
+    bool uncompressBlock(const char *comp_buf, size_t comp_len, void *buf);
+
+    size_t getEntrySize(const Entry *entry) const {
+        return sizeof(Entry) + entry->len;
+    }
+
+    // Caller should grab the shard lock.
+    void detachEntry(Shard &shard, Entry *entry);
+
+    void freeEntry(Entry *entry) {
+        free(entry->data);
+        delete entry;
+    }
+
+    Shard *shards;
+    size_t numShards;
+    uint64_t shardCapacity;
+    uint32_t blockSize;
+    std::atomic<uint64_t> usedBytes;
+    std::atomic<uint64_t> numItems;
+    // Token of the pending insertion of each block (hashed into 4096 slots),
+    // or zero if it has been invalidated. Blocks sharing a slot may discard
+    // each other's insertion, which only costs a compressed copy.
+    std::atomic<uint64_t> *tokenSlots;
+    std::atomic<uint64_t> nextToken;
 };
 
+CompressedBlockTier::CompressedBlockTier(uint64_t capacity, uint32_t blocksize)
+    : numShards(DEFAULT_NUM_BCACHE_PARTITIONS), blockSize(blocksize),
+      usedBytes(0), numItems(0), nextToken(0)
+{
+    shardCapacity = capacity / numShards;
+    shards = new Shard[numShards];
+    for (size_t i = 0; i < numShards; ++i) {
+        spin_init(&shards[i].lock);
+        list_init(&shards[i].lru);
+        shards[i].usedBytes = 0;
+    }
+    tokenSlots = new std::atomic<uint64_t>[4096];
+    for (size_t i = 0; i < 4096; ++i) {
+        tokenSlots[i].store(0);
+    }
+}
+
+CompressedBlockTier::~CompressedBlockTier() {
+    for (size_t i = 0; i < numShards; ++i) {
+        struct list_elem *elem = list_begin(&shards[i].lru);
+        while (elem) {
+            Entry *entry = reinterpret_cast<Entry *>(elem);
+            elem = list_remove(&shards[i].lru, elem);
+            freeEntry(entry);
+        }
+        spin_destroy(&shards[i].lock);
+    }
+    delete[] shards;
+    delete[] tokenSlots;
+}
+
+void CompressedBlockTier::detachEntry(Shard &shard, Entry *entry) {
+    auto file_entry = shard.files.find(entry->fcache);
+    if (file_entry != shard.files.end()) {
+        file_entry->second.erase(entry->bid);
+        if (file_entry->second.empty()) {
+            shard.files.erase(file_entry);
+        }
+    }
+    list_remove(&shard.lru, &entry->le);
+    shard.usedBytes -= getEntrySize(entry);
+    usedBytes.fetch_sub(getEntrySize(entry), std::memory_order_relaxed);
+    numItems.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t CompressedBlockTier::compressBlock(const void *block, char **comp_buf) {
+    // Not worth keeping a block that doesn't compress to 7/8 of its size.
+    size_t max_len = blockSize - (blockSize / 8);
+#ifdef _DOC_COMP
+    size_t comp_len = snappy_max_compressed_length(blockSize);
+    *comp_buf = (char *)malloc(comp_len);
+    if (!*comp_buf) {
+        return 0;
+    }
+    if (snappy_compress((const char *)block, blockSize,
+                        *comp_buf, &comp_len) != SNAPPY_OK ||
+        comp_len >= max_len) {
+        free(*comp_buf);
+        return 0;
+    }
+#else
+    // PackBits-style run-length coding: a control byte below 0x80 is
+    // followed by (control + 1) literal bytes, and any other control byte
+    // by a single byte repeated (control - 0x80 + 3) times.
+    const uint8_t *src = (const uint8_t *)block;
+    *comp_buf = (char *)malloc(max_len);
+    if (!*comp_buf) {
+        return 0;
+    }
+    uint8_t *dst = (uint8_t *)*comp_buf;
+    size_t comp_len = 0;
+    size_t i = 0;
+    while (i < blockSize) {
+        size_t run = 1;
+        while (i + run < blockSize && run < 130 && src[i + run] == src[i]) {
+            ++run;
+        }
+        if (run >= 3) {
+            if (comp_len + 2 >= max_len) {
+                free(*comp_buf);
+                return 0;
+            }
+            dst[comp_len++] = 0x80 | (uint8_t)(run - 3);
+            dst[comp_len++] = src[i];
+            i += run;
+            continue;
+        }
+        size_t start = i;
+        size_t len = 0;
+        while (i < blockSize && len < 128) {
+            if (i + 2 < blockSize &&
+                src[i] == src[i + 1] && src[i] == src[i + 2]) {
+                break;
+            }
+            ++i;
+            ++len;
+        }
+        if (comp_len + 1 + len >= max_len) {
+            free(*comp_buf);
+            return 0;
+        }
+        dst[comp_len++] = (uint8_t)(len - 1);
+        memcpy(dst + comp_len, src + start, len);
+        comp_len += len;
+    }
+#endif
+    return comp_len;
+}
+
+bool CompressedBlockTier::uncompressBlock(const char *comp_buf,
+                                          size_t comp_len, void *buf) {
+#ifdef _DOC_COMP
+    size_t uncomp_len = blockSize;
+    return snappy_uncompress(comp_buf, comp_len,
+                             (char *)buf, &uncomp_len) == SNAPPY_OK &&
+           uncomp_len == blockSize;
+#else
+    const uint8_t *src = (const uint8_t *)comp_buf;
+    uint8_t *dst = (uint8_t *)buf;
+    size_t i = 0, uncomp_len = 0;
+    while (i < comp_len) {
+        uint8_t control = src[i++];
+        if (control < 0x80) {
+            size_t len = control + 1;
+            if (i + len > comp_len || uncomp_len + len > blockSize) {
+                return false;
+            }
+            memcpy(dst + uncomp_len, src + i, len);
+            i += len;
+            uncomp_len += len;
+        } else {
+            size_t run = control - 0x80 + 3;
+            if (i >= comp_len || uncomp_len + run > blockSize) {
+                return false;
+            }
+            memset(dst + uncomp_len, src[i++], run);
+            uncomp_len += run;
+        }
+    }
+    return uncomp_len == blockSize;
+#endif
+}
+
+uint64_t CompressedBlockTier::reserve(FileBlockCache *fcache, bid_t bid) {
+    uint64_t token = nextToken.fetch_add(1) + 1;
+    getTokenSlot(fcache, bid).store(token);
+    return token;
+}
+
+void CompressedBlockTier::insert(FileBlockCache *fcache, bid_t bid,
+                                 const void *block, uint64_t token) {
+    char *comp_buf = NULL;
+    size_t comp_len = compressBlock(block, &comp_buf);
+    if (!comp_len) {
+        return;
+    }
+
+    Entry *entry = new Entry();
+    entry->le.prev = entry->le.next = NULL;
+    entry->fcache = fcache;
+    entry->bid = bid;
+    entry->len = comp_len;
+    entry->data = (char *)realloc(comp_buf, comp_len);
+    if (!entry->data) {
+        entry->data = comp_buf;
+    }
+
+    struct list victims;
+    list_init(&victims);
+
+    Shard &shard = getShard(bid);
+    spin_lock(&shard.lock);
+    // Publish the entry only if the block has not been invalidated since
+    // its eviction. invalidate() clears the token before grabbing the shard
+    // lock, so it either fails this exchange or removes the entry after it.
+    if (!getTokenSlot(fcache, bid).compare_exchange_strong(token, 0)) {
+        spin_unlock(&shard.lock);
+        freeEntry(entry);
+        return;
+    }
+    entry_map_t &blocks = shard.files[fcache];
+    auto block_entry = blocks.find(bid);
+    if (block_entry != blocks.end()) {
+        // Replace the existing entry. detachEntry() is not used here, as it
+        // may erase 'blocks' from the file map.
+        Entry *old_entry = block_entry->second;
+        blocks.erase(block_entry);
+        list_remove(&shard.lru, &old_entry->le);
+        shard.usedBytes -= getEntrySize(old_entry);
+        usedBytes.fetch_sub(getEntrySize(old_entry), std::memory_order_relaxed);
+        numItems.fetch_sub(1, std::memory_order_relaxed);
+        list_push_back(&victims, &old_entry->le);
+    }
+    blocks.insert(std::make_pair(bid, entry));
+    list_push_front(&shard.lru, &entry->le);
+    shard.usedBytes += getEntrySize(entry);
+    usedBytes.fetch_add(getEntrySize(entry), std::memory_order_relaxed);
+    numItems.fetch_add(1, std::memory_order_relaxed);
+
+    while (shard.usedBytes > shardCapacity) {
+        struct list_elem *elem = list_end(&shard.lru);
+        Entry *victim = reinterpret_cast<Entry *>(elem);
+        detachEntry(shard, victim);
+        list_push_back(&victims, &victim->le);
+    }
+    spin_unlock(&shard.lock);
+
+    // Free the evicted entries outside the lock.
+    struct list_elem *elem = list_begin(&victims);
+    while (elem) {
+        Entry *victim = reinterpret_cast<Entry *>(elem);
+        elem = list_remove(&victims, elem);
+        freeEntry(victim);
+    }
+}
+
+bool CompressedBlockTier::fetch(FileBlockCache *fcache, bid_t bid, void *buf) {
+    Shard &shard = getShard(bid);
+    Entry *entry = NULL;
+
+    spin_lock(&shard.lock);
+    auto file_entry = shard.files.find(fcache);
+    if (file_entry != shard.files.end()) {
+        auto block_entry = file_entry->second.find(bid);
+        if (block_entry != file_entry->second.end()) {
+            entry = block_entry->second;
+            detachEntry(shard, entry);
+        }
+    }
+    spin_unlock(&shard.lock);
+
+    if (!entry) {
+        return false;
+    }
+
+    bool ret = uncompressBlock(entry->data, entry->len, buf);
+    freeEntry(entry);
+    return ret;
+}
+
+void CompressedBlockTier::invalidate(FileBlockCache *fcache, bid_t bid) {
+    Shard &shard = getShard(bid);
+    Entry *entry = NULL;
+
+    // Fail the pending insertion of the block, if any.
+    getTokenSlot(fcache, bid).store(0);
+
+    spin_lock(&shard.lock);
+    auto file_entry = shard.files.find(fcache);
+    if (file_entry != shard.files.end()) {
+        auto block_entry = file_entry->second.find(bid);
+        if (block_entry != file_entry->second.end()) {
+            entry = block_entry->second;
+            detachEntry(shard, entry);
+        }
+    }
+    spin_unlock(&shard.lock);
+
+    if (entry) {
+        freeEntry(entry);
+    }
+}
+
+void CompressedBlockTier::removeFile(FileBlockCache *fcache) {
+    // Fail all the pending insertions, as they may belong to the file.
+    for (size_t i = 0; i < 4096; ++i) {
+        tokenSlots[i].store(0);
+    }
+    for (size_t i = 0; i < numShards; ++i) {
+        Shard &shard = shards[i];
+        std::vector<Entry *> entries;
+
+        spin_lock(&shard.lock);
+        auto file_entry = shard.files.find(fcache);
+        if (file_entry != shard.files.end()) {
+            for (auto &block_entry : file_entry->second) {
+                Entry *entry = block_entry.second;
+                list_remove(&shard.lru, &entry->le);
+                shard.usedBytes -= getEntrySize(entry);
+                usedBytes.fetch_sub(getEntrySize(entry),
+                                    std::memory_order_relaxed);
+                numItems.fetch_sub(1, std::memory_order_relaxed);
+                entries.push_back(entry);
+            }
+            shard.files.erase(file_entry);
+        }
+        spin_unlock(&shard.lock);
+
+        for (auto &entry : entries) {
+            freeEntry(entry);
+        }
+    }
+}
+
 FileBlockCache::FileBlockCache()
     : curFile(NULL), refCount(0), numVictims(0), numItems(0), numImmutables(0),
-      accessTimestamp(0), numShards(DEFAULT_NUM_BCACHE_PARTITIONS) { }
+      accessTimestamp(0), numShards(DEFAULT_NUM_BCACHE_PARTITIONS),
+      minReservedItems(0), maxItems(0), priority(FDB_CACHE_PRIORITY_NORMAL) { }
 
 FileBlockCache::FileBlockCache(std::string fname, FileMgr *file,
                                size_t num_shards)
     : fileName(fname), curFile(file), refCount(0), numVictims(0), numItems(0),
       numImmutables(0), accessTimestamp(0), numShards(num_shards)
 {
+    FileMgrConfig *config = file->getConfig();
+    uint64_t blocksize = file->getBlockSize();
+    minReservedItems = config->getCacheMinReservation() / blocksize;
+    maxItems = config->getCacheMaxLimit() / blocksize;
+    if (config->getCacheMaxLimit() && !maxItems) {
+        // The limit smaller than a block still allows one block.
+        maxItems = 1;
+    }
+    priority = config->getCachePriority();
+
     // Create a block cache shard instance.
     for (size_t i = 0; i < numShards; ++i) {
-        BlockCacheShard *shard = new BlockCacheShard();
+        BlockCacheShard *shard = new BlockCacheShard(numShards);
         shards.push_back(shard);
     }
 }
@@ -203,6 +755,22 @@ void FileBlockCache::setAccessTimestamp(uint64_t timestamp) {
     accessTimestamp.store(timestamp, std::memory_order_relaxed);
 }
 
+fdb_cache_priority_t FileBlockCache::getPriority(void) const {
+    return priority;
+}
+
+bool FileBlockCache::isWithinReservation(void) const {
+    return numItems.load() <= minReservedItems;
+}
+
+bool FileBlockCache::isOverCacheLimit(void) const {
+    return maxItems && numItems.load() >= maxItems;
+}
+
+bool FileBlockCache::isPrioritized(void) const {
+    return priority != FDB_CACHE_PRIORITY_NORMAL || minReservedItems;
+}
+
 bool FileBlockCache::empty() {
     bool empty = true;
     size_t i = 0;
@@ -233,20 +801,40 @@ void FileBlockCache::releaseAllShardLocks() {
 
 static const size_t MAX_VICTIM_SELECTIONS = 5;
 static const size_t MIN_TIMESTAMP_GAP = 15000; // 15 seconds
+// Alignment of the memory chunks backing the cache blocks (page size)
+static const size_t BCACHE_CHUNK_ALIGN = 4096;
+// Alignment of the chunks backed by huge pages, and the huge page size
+static const size_t BCACHE_HUGE_PAGE_SIZE = 2097152;
 
 #define BCACHE_DIRTY (0x1)
 #define BCACHE_IMMUTABLE (0x2)
 #define BCACHE_FREE (0x4)
 
+// Victim candidates of the same eviction class
+struct bcache_victim_class {
+    bcache_victim_class()
+        : min_timestamp(static_cast<uint64_t>(-1)), max_timestamp(0),
+          max_items(0), victim_by_time(-1), victim_by_items(-1) { }
+
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    uint64_t max_items;
+    int victim_by_time;
+    int victim_by_items;
+};
+
+// Files within their reservations are put into the classes following all
+// the priority classes.
+static const size_t BCACHE_NUM_PRIORITIES = FDB_CACHE_PRIORITY_HIGH + 1;
+static const size_t BCACHE_NUM_VICTIM_CLASSES = BCACHE_NUM_PRIORITIES * 2;
+
 FileBlockCache *BlockCacheManager::chooseEvictionVictim() {
     FileBlockCache *ret = NULL;
-    uint64_t max_items = 0;
-    uint64_t min_timestamp = static_cast<uint64_t>(-1);
-    uint64_t max_timestamp = 0;
     uint64_t victim_timestamp;
     uint64_t victim_num_items;
-    int victim_idx, victim_by_time, victim_by_items;
+    int victim_idx;
     size_t num_attempts;
+    bcache_victim_class classes[BCACHE_NUM_VICTIM_CLASSES];
 
     if (reader_lock(&fileListLock) == 0) {
         // Pick the victim that has the oldest access timestamp
@@ -254,6 +842,11 @@ FileBlockCache *BlockCacheManager::chooseEvictionVictim() {
         // the oldest and newest timestamps is greater than the threshold.
         // Otherwise, pick the victim that has the largest number of
         // cached items among the files.
+        // The selected files are grouped by their priorities and
+        // reservations, and the victim is picked from the first group
+        // that has any file. If any file has a non-default priority or
+        // reservation, all the files are examined instead of random ones
+        // so that they are honored.
         num_attempts = fileList.size() / 10 + 1;
         if (num_attempts > MAX_VICTIM_SELECTIONS) {
             num_attempts = MAX_VICTIM_SELECTIONS;
@@ -262,37 +855,46 @@ FileBlockCache *BlockCacheManager::chooseEvictionVictim() {
                 ++num_attempts;
             }
         }
-
-        victim_by_time = victim_by_items = -1;
+        bool scan_all = numPrioritizedFiles > 0;
+        if (scan_all) {
+            num_attempts = fileList.size();
+        }
 
         for (size_t i = 0; i < num_attempts && !fileList.empty(); ++i) {
-            victim_idx = rand() % fileList.size();
+            victim_idx = scan_all ? i : rand() % fileList.size();
             victim_timestamp = fileList[victim_idx]->getAccessTimestamp();
             victim_num_items = fileList[victim_idx]->numItems;
 
             if (victim_num_items) {
-                if (victim_timestamp < min_timestamp) {
-                    min_timestamp = victim_timestamp;
-                    victim_by_time = victim_idx;
+                size_t class_idx = fileList[victim_idx]->getPriority();
+                if (fileList[victim_idx]->isWithinReservation()) {
+                    class_idx += BCACHE_NUM_PRIORITIES;
                 }
-                if (victim_timestamp > max_timestamp) {
-                    max_timestamp = victim_timestamp;
+                bcache_victim_class &vclass = classes[class_idx];
+
+                if (victim_timestamp < vclass.min_timestamp) {
+                    vclass.min_timestamp = victim_timestamp;
+                    vclass.victim_by_time = victim_idx;
                 }
-                if (victim_num_items > max_items) {
-                    max_items = victim_num_items;
-                    victim_by_items = victim_idx;
+                if (victim_timestamp > vclass.max_timestamp) {
+                    vclass.max_timestamp = victim_timestamp;
+                }
+                if (victim_num_items > vclass.max_items) {
+                    vclass.max_items = victim_num_items;
+                    vclass.victim_by_items = victim_idx;
                 }
             }
         }
 
-
-        if (max_timestamp - min_timestamp > MIN_TIMESTAMP_GAP) {
-            if (victim_by_time != -1) {
-                ret = fileList[victim_by_time];
+        for (size_t i = 0; i < BCACHE_NUM_VICTIM_CLASSES && !ret; ++i) {
+            bcache_victim_class &vclass = classes[i];
+            if (vclass.victim_by_items == -1) {
+                continue;
             }
-        } else {
-            if (victim_by_items != -1) {
-                ret = fileList[victim_by_items];
+            if (vclass.max_timestamp - vclass.min_timestamp > MIN_TIMESTAMP_GAP) {
+                ret = fileList[vclass.victim_by_time];
+            } else {
+                ret = fileList[vclass.victim_by_items];
             }
         }
 
@@ -353,6 +955,9 @@ bool BlockCacheManager::freeFileBlockCache(FileBlockCache *fcache,
         return false;
     }
 
+    if (compressedTier) {
+        compressedTier->removeFile(fcache);
+    }
     // free a file block cache
     delete fcache;
     return true;
@@ -650,16 +1255,24 @@ fdb_status BlockCacheManager::flushDirtyBlocks(FileBlockCache *fcache,
     return status;
 }
 
-void BlockCacheManager::performEviction() {
+void BlockCacheManager::performEviction(FileBlockCache *victim) {
     size_t n_evict;
     struct list_elem *elem = NULL;
     BlockCacheItem *item = NULL;
-    FileBlockCache *victim = NULL;
 
     // We don't need to grab the global buffer cache lock here because
     // the file's buffer cache instance (FileBlockCache) can be freed only if
     // there are no database handles opened for that file.
 
+    if (victim) {
+        // The caller holds the file, so that it can't be freed.
+        victim->refCount++;
+        if (victim->numItems.load() == 0) {
+            victim->refCount--;
+            return;
+        }
+    }
+
     while (victim == NULL) {
         // select a victim file
         victim = chooseEvictionVictim();
@@ -709,6 +1322,13 @@ void BlockCacheManager::performEviction() {
 
             elem = list_pop_back(&bshard->cleanBlocks);
             item = reinterpret_cast<BlockCacheItem *>(elem);
+            if (item->clearReferenced()) {
+                // The item was hit by an optimistic reader, which doesn't
+                // move it to the head of the clean list. Do it now.
+                list_push_front(&bshard->cleanBlocks, &item->list_elem);
+                spin_unlock(&bshard->lock);
+                continue;
+            }
 #ifdef __BCACHE_SECOND_CHANCE
             // repeat until zero-score item is found
             if (item->getScore() == 0) {
@@ -737,12 +1357,27 @@ void BlockCacheManager::performEviction() {
         victim->numItems--;
         // remove from the shard block list
         bshard->allBlocks.erase(item->getBid());
-        // add to the free block list
-        addToFreeBlockList(item);
+        bshard->unpublish(item);
+        uint64_t token = 0;
+        if (compressedTier) {
+            // Reserve the insertion while holding the shard lock, so that
+            // a write of the same block afterwards cancels it.
+            token = compressedTier->reserve(victim, item->getBid());
+        }
         n_evict++;
 
         spin_unlock(&bshard->lock);
 
+        if (compressedTier) {
+            // Keep a compressed copy in the second tier. The item is no
+            // longer reachable through the cache and not yet free, so it
+            // can be compressed without the shard lock.
+            compressedTier->insert(victim, item->getBid(),
+                                   item->getBlockAddr(), token);
+        }
+        // add to the free block list
+        addToFreeBlockList(item);
+
         if (victim->numItems.load() == 0) {
             break;
         }
@@ -776,6 +1411,9 @@ FileBlockCache* BlockCacheManager::createFileBlockCache(FileMgr *file) {
 
     if (writer_lock(&fileListLock) == 0) {
         fileList.push_back(fcache);
+        if (fcache->isPrioritized()) {
+            numPrioritizedFiles++;
+        }
         writer_unlock(&fileListLock);
     } else {
         fprintf(stderr, "Error in BlockCacheManager::createFileBlockCache(): "
@@ -794,6 +1432,9 @@ bool BlockCacheManager::prepareDeallocationForFileBlockCache(FileBlockCache *fca
         for (auto entry = fileList.begin(); entry != fileList.end(); ++entry) {
             if (*entry == fcache) {
                 fileList.erase(entry);
+                if (fcache->isPrioritized()) {
+                    numPrioritizedFiles--;
+                }
                 found = true;
                 break;
             }
@@ -836,6 +1477,40 @@ void BlockCacheManager::setScore(BlockCacheItem &item) {
 #endif
 }
 
+bool BlockCacheManager::readOptimistic(BlockCacheShard *shard,
+                                       bid_t bid,
+                                       void *buf,
+                                       bool promote) {
+    BlockCacheItem *item = shard->lookup(bid);
+    if (!item) {
+        return false;
+    }
+
+    uint64_t ver = item->beginRead();
+    if (ver & 0x1) {
+        // A writer is modifying this item.
+        return false;
+    }
+    // Only clean blocks are served here. Dirty blocks can be modified
+    // (e.g., CRC update on flush) without bumping the item's version.
+    if (item->getOwner() != shard || item->getBid() != bid ||
+        item->getFlag() != 0x0) {
+        return false;
+    }
+
+    memcpy(buf, item->getBlockAddr(), blockSize);
+
+    if (!item->validateRead(ver)) {
+        // The item was modified or recycled while being copied.
+        return false;
+    }
+
+    if (promote) {
+        item->markReferenced();
+    }
+    return true;
+}
+
 int BlockCacheManager::read(FileMgr *file,
                             bid_t bid,
                             void *buf) {
@@ -848,18 +1523,32 @@ int BlockCacheManager::read(FileMgr *file,
 
     if (fcache) {
         // file exists
-        fcache->setAccessTimestamp(gethrtime() / 1000000); // access timestamp in ms
+        // access timestamp in ms; skip the store if it is unchanged so that
+        // concurrent readers don't keep invalidating the same cache line.
+        uint64_t now = gethrtime() / 1000000;
+        if (fcache->getAccessTimestamp() != now) {
+            fcache->setAccessTimestamp(now);
+        }
 
         size_t shard_num = bid % fcache->getNumShards();
-        spin_lock(&fcache->shards[shard_num]->lock);
+        BlockCacheShard *shard = fcache->shards[shard_num];
+        // One-shot scans don't refresh the recency of the blocks they hit.
+        bool promote = !ScanReadScope::isActive(file);
+
+        // Try the lock-free lookup first.
+        if (readOptimistic(shard, bid, buf, promote)) {
+            return blockSize;
+        }
+
+        spin_lock(&shard->lock);
 
         // search shard hash table
-        auto block_entry = fcache->shards[shard_num]->allBlocks.find(bid);
-        if (block_entry != fcache->shards[shard_num]->allBlocks.end()) {
+        auto block_entry = shard->allBlocks.find(bid);
+        if (block_entry != shard->allBlocks.end()) {
             // cache hit
             BlockCacheItem *item = block_entry->second;
             if (item->getFlag() & BCACHE_FREE) {
-                spin_unlock(&fcache->shards[shard_num]->lock);
+                spin_unlock(&shard->lock);
                 DBG("Warning: failed to read the buffer cache entry for a file '%s' "
                     "because the entry belongs to the free list!\n",
                     file->getFileName());
@@ -871,19 +1560,32 @@ int BlockCacheManager::read(FileMgr *file,
             if (!(item->getFlag() & BCACHE_DIRTY)) {
                 // TODO: Scanning the list would cause some overhead. We need to devise
                 // the better data structure to provide a fast lookup for the clean list.
-                list_remove(&fcache->shards[shard_num]->cleanBlocks, &item->list_elem);
-                list_push_front(&fcache->shards[shard_num]->cleanBlocks, &item->list_elem);
+                if (promote) {
+                    list_remove(&shard->cleanBlocks, &item->list_elem);
+                    list_push_front(&shard->cleanBlocks, &item->list_elem);
+                }
+                // Let subsequent hits on this block skip the shard lock.
+                shard->publish(item);
             }
 
             memcpy(buf, item->getBlockAddr(), blockSize);
-            setScore(*item);
+            if (promote) {
+                setScore(*item);
+            }
 
-            spin_unlock(&fcache->shards[shard_num]->lock);
+            spin_unlock(&shard->lock);
 
             return blockSize;
         } else {
             // cache miss
-            spin_unlock(&fcache->shards[shard_num]->lock);
+            spin_unlock(&shard->lock);
+        }
+
+        if (compressedTier && compressedTier->fetch(fcache, bid, buf)) {
+            // Found in the compressed tier. Promote it back to the block
+            // cache, as the caller would do for a block read from disk.
+            write(file, bid, buf, BCACHE_REQ_CLEAN, false);
+            return blockSize;
         }
     }
 
@@ -909,6 +1611,10 @@ bool BlockCacheManager::invalidateBlock(FileMgr *file,
         size_t shard_num = bid % fcache->getNumShards();
         spin_lock(&fcache->shards[shard_num]->lock);
 
+        if (compressedTier) {
+            compressedTier->invalidate(fcache, bid);
+        }
+
         // search BHASH
         auto block_entry = fcache->shards[shard_num]->allBlocks.find(bid);
         if (block_entry != fcache->shards[shard_num]->allBlocks.end()) {
@@ -928,6 +1634,7 @@ bool BlockCacheManager::invalidateBlock(FileMgr *file,
                 // only for clean blocks
                 // remove from the shard block list
                 fcache->shards[shard_num]->allBlocks.erase(bid);
+                fcache->shards[shard_num]->unpublish(item);
                 // remove from the shard clean list
                 list_remove(&fcache->shards[shard_num]->cleanBlocks, &item->list_elem);
                 spin_unlock(&fcache->shards[shard_num]->lock);
@@ -976,10 +1683,22 @@ int BlockCacheManager::write(FileMgr *file,
     size_t shard_num = bid % fcache->getNumShards();
     spin_lock(&fcache->shards[shard_num]->lock);
 
+    if (compressedTier) {
+        // The block cache now holds the latest copy of this block.
+        compressedTier->invalidate(fcache, bid);
+    }
+
     // search shard hash table
     auto block_entry = fcache->shards[shard_num]->allBlocks.find(bid);
     if (block_entry == fcache->shards[shard_num]->allBlocks.end()) {
         // cache miss
+        if (fcache->isOverCacheLimit()) {
+            // The file has used up its buffer cache limit. Evict one of its
+            // own blocks instead of growing further.
+            spin_unlock(&fcache->shards[shard_num]->lock);
+            performEviction(fcache);
+            spin_lock(&fcache->shards[shard_num]->lock);
+        }
         // get a block from the free list
         while ((item = getFreeBlock()) == NULL) {
             // no free block .. perform eviction
@@ -1007,8 +1726,15 @@ int BlockCacheManager::write(FileMgr *file,
 
     fdb_assert(item, item, NULL);
 
+    item->beginWrite();
+
+    // A block newly admitted by a one-shot scan goes to the cold end of the
+    // clean list, so that it is the first one to be evicted.
+    bool cold_admission = false;
     if (item->getFlag() & BCACHE_FREE) {
         fcache->numItems++;
+        item->setOwner(fcache->shards[shard_num]);
+        cold_admission = ScanReadScope::isActive(file);
     }
 
     // remove from the list if the block is in clean list
@@ -1043,13 +1769,26 @@ int BlockCacheManager::write(FileMgr *file,
         // CLEAN request
         // insert into clean list only when it was originally clean
         if (!(item->getFlag() & BCACHE_DIRTY)) {
-            list_push_front(&fcache->shards[shard_num]->cleanBlocks, &item->list_elem);
+            if (cold_admission) {
+                list_push_back(&fcache->shards[shard_num]->cleanBlocks,
+                               &item->list_elem);
+            } else {
+                list_push_front(&fcache->shards[shard_num]->cleanBlocks,
+                                &item->list_elem);
+            }
             item->setFlag(item->getFlag() & ~(BCACHE_DIRTY));
         }
     }
 
     memcpy(item->getBlockAddr(), buf, blockSize);
-    setScore(*item);
+    if (!cold_admission) {
+        setScore(*item);
+    }
+
+    item->endWrite();
+    if (dirty == BCACHE_REQ_CLEAN) {
+        fcache->shards[shard_num]->publish(item);
+    }
 
     spin_unlock(&fcache->shards[shard_num]->lock);
 
@@ -1095,12 +1834,15 @@ int BlockCacheManager::writePartial(FileMgr *file,
     }
 
     if (item->getFlag() & BCACHE_FREE) {
+        spin_unlock(&fcache->shards[shard_num]->lock);
         DBG("Warning: failed to write on the buffer cache entry for a file '%s' "
             "because the entry belongs to the free list!\n",
             file->getFileName());
         return 0;
     }
 
+    item->beginWrite();
+
     // check whether this is dirty block
     // to avoid re-inserting the existing item into the dirty block list
     if (!(item->getFlag() & BCACHE_DIRTY)) {
@@ -1136,6 +1878,8 @@ int BlockCacheManager::writePartial(FileMgr *file,
     memcpy((uint8_t *)(item->getBlockAddr()) + offset, buf, len);
     setScore(*item);
 
+    item->endWrite();
+
     spin_unlock(&fcache->shards[shard_num]->lock);
 
     return len;
@@ -1195,12 +1939,49 @@ void BlockCacheManager::removeCleanBlocks(FileMgr *file) {
                 elem = list_remove(&fcache->shards[i]->cleanBlocks, elem);
                 // remove from the all block list
                 fcache->shards[i]->allBlocks.erase(item->getBid());
+                fcache->shards[i]->unpublish(item);
                 fcache->numItems--;
                 // insert into the free block list
                 addToFreeBlockList(item);
             }
             spin_unlock(&fcache->shards[i]->lock);
         }
+
+        if (compressedTier) {
+            compressedTier->removeFile(fcache);
+        }
+    }
+}
+
+void BlockCacheManager::getHotBlocks(FileMgr *file, std::vector<bid_t> &bids) {
+    FileBlockCache *fcache = file->getBCache();
+    if (!fcache) {
+        return;
+    }
+
+    // Collect each shard's clean blocks from the most recently used one.
+    std::vector<std::vector<bid_t> > shard_bids(fcache->getNumShards());
+    size_t max_len = 0;
+    for (size_t i = 0; i < fcache->getNumShards(); ++i) {
+        spin_lock(&fcache->shards[i]->lock);
+        struct list_elem *elem = list_begin(&fcache->shards[i]->cleanBlocks);
+        while (elem) {
+            BlockCacheItem *item = reinterpret_cast<BlockCacheItem *>(elem);
+            shard_bids[i].push_back(item->getBid());
+            elem = list_next(elem);
+        }
+        spin_unlock(&fcache->shards[i]->lock);
+        max_len = std::max(max_len, shard_bids[i].size());
+    }
+
+    // Interleave the per-shard lists so that the hottest blocks of all the
+    // shards come first.
+    for (size_t pos = 0; pos < max_len; ++pos) {
+        for (auto &entry : shard_bids) {
+            if (pos < entry.size()) {
+                bids.push_back(entry[pos]);
+            }
+        }
     }
 }
 
@@ -1259,18 +2040,26 @@ fdb_status BlockCacheManager::flush(FileMgr *file) {
     return status;
 }
 
-BlockCacheManager::BlockCacheManager(uint64_t nblock, uint32_t blocksize) {
-    BlockCacheItem *item;
-    uint8_t *block_ptr;
-
+BlockCacheManager::BlockCacheManager(uint64_t nblock, uint32_t blocksize,
+                                     uint64_t compressed_size,
+                                     bool huge_pages) {
     blockSize = blocksize;
+    hugePages = huge_pages;
+    numReleasedHugePages = 0;
     flushUnit = BCACHE_FLUSH_UNIT;
-    numBlocks = nblock;
+    numBlocks = 0;
+    compressedTier = NULL;
+    numPrioritizedFiles = 0;
+
+    if (compressed_size) {
+        compressedTier = new CompressedBlockTier(compressed_size, blocksize);
+    }
 
     spin_init(&bcacheLock);
     spin_init(&freeListLock);
 
     list_init(&freeList);
+    list_init(&retiredList);
 
     int rv = init_rw_lock(&fileListLock);
     if (rv != 0) {
@@ -1281,25 +2070,215 @@ BlockCacheManager::BlockCacheManager(uint64_t nblock, uint32_t blocksize) {
     freeListCount = 0;
 
     // Allocate entire buffer cache memory
-    block_ptr = (uint8_t *) malloc((uint64_t) blockSize * numBlocks);
-    bufferCache = block_ptr;
+    addBlocks(nblock);
+}
 
-    for (uint64_t i = 0; i < numBlocks; ++i) {
+bool BlockCacheManager::addBlocks(uint64_t nblock) {
+    void *chunk = NULL;
+    uint8_t *block_ptr;
+    BlockCacheItem *item;
+
+    if (nblock == 0) {
+        return true;
+    }
+
+    uint64_t chunk_size = (uint64_t) blockSize * nblock;
+    // Size of the part of the chunk that is backed by huge pages. Blocks
+    // must not straddle huge pages, so that each huge page can be released
+    // as a whole.
+    uint64_t huge_size = 0;
+    if (hugePages && BCACHE_HUGE_PAGE_SIZE % blockSize == 0) {
+        // Aligned to huge pages, so that the kernel can back the chunk with
+        // them and the hot read path takes fewer TLB misses. The size is not
+        // rounded up, so the tail that doesn't fill a huge page uses regular
+        // pages rather than wasting the rest of a huge page.
+        huge_size = chunk_size / BCACHE_HUGE_PAGE_SIZE * BCACHE_HUGE_PAGE_SIZE;
+        malloc_align(chunk, BCACHE_HUGE_PAGE_SIZE, chunk_size);
+    } else {
+        // Page-aligned, so that the pages of retired blocks can be released.
+        malloc_align(chunk, BCACHE_CHUNK_ALIGN, chunk_size);
+    }
+    if (!chunk) {
+        return false;
+    }
+    if (huge_size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(chunk, huge_size, MADV_HUGEPAGE);
+#endif
+        hugePageRanges[reinterpret_cast<uintptr_t>(chunk)] =
+            reinterpret_cast<uintptr_t>(chunk) + huge_size;
+    }
+    bufferChunks.push_back(chunk);
+
+    block_ptr = static_cast<uint8_t *>(chunk);
+    spin_lock(&freeListLock);
+    for (uint64_t i = 0; i < nblock; ++i) {
         item = new BlockCacheItem(BLK_NOT_FOUND, block_ptr, (0x0 | BCACHE_FREE), 0);
         block_ptr += blockSize;
         list_push_front(&freeList, &item->list_elem);
         freeListCount++;
     }
+    spin_unlock(&freeListLock);
+    numBlocks += nblock;
+    return true;
+}
+
+uintptr_t BlockCacheManager::getHugePage(BlockCacheItem *item) const {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(item->getBlockAddr());
+    auto entry = hugePageRanges.upper_bound(addr);
+    if (entry == hugePageRanges.begin()) {
+        return 0;
+    }
+    --entry;
+    if (addr >= entry->second) {
+        return 0;
+    }
+    // Chunks backed by huge pages are aligned to them.
+    return addr & ~(static_cast<uintptr_t>(BCACHE_HUGE_PAGE_SIZE) - 1);
 }
 
-BlockCacheManager* BlockCacheManager::init(uint64_t nblock, uint32_t blocksize) {
+void BlockCacheManager::retireBlock(BlockCacheItem *item) {
+    uintptr_t huge_page = getHugePage(item);
+    if (huge_page) {
+        // Releasing a part of a huge page would split it, so release the
+        // huge page as a whole once all its blocks are retired.
+        if (++numRetiredPerHugePage[huge_page] ==
+            BCACHE_HUGE_PAGE_SIZE / blockSize) {
+#if !defined(WIN32) && !defined(_WIN32)
+            madvise(reinterpret_cast<void *>(huge_page),
+                    BCACHE_HUGE_PAGE_SIZE, MADV_DONTNEED);
+#endif
+            numReleasedHugePages++;
+        }
+    } else if (blockSize % BCACHE_CHUNK_ALIGN == 0) {
+#if !defined(WIN32) && !defined(_WIN32)
+        // The address range stays valid (reads return zero-filled pages),
+        // so a racing optimistic reader can't fault on it.
+        madvise(item->getBlockAddr(), blockSize, MADV_DONTNEED);
+#endif
+    }
+    list_push_front(&retiredList, &item->list_elem);
+    numBlocks--;
+}
+
+void BlockCacheManager::reviveBlock(BlockCacheItem *item) {
+    uintptr_t huge_page = getHugePage(item);
+    if (huge_page) {
+        // A released huge page is faulted in again on its first access.
+        if (numRetiredPerHugePage[huge_page]-- ==
+            BCACHE_HUGE_PAGE_SIZE / blockSize) {
+            numReleasedHugePages--;
+        }
+        if (numRetiredPerHugePage[huge_page] == 0) {
+            numRetiredPerHugePage.erase(huge_page);
+        }
+    }
+    addToFreeBlockList(item);
+    numBlocks++;
+}
+
+uint64_t BlockCacheManager::retireFreeBlocksByHugePage(uint64_t max_blocks) {
+    std::map<uintptr_t, std::vector<BlockCacheItem *>> free_blocks;
+    std::vector<BlockCacheItem *> to_retire;
+
+    spin_lock(&freeListLock);
+    struct list_elem *elem = list_begin(&freeList);
+    while (elem) {
+        BlockCacheItem *item = reinterpret_cast<BlockCacheItem *>(elem);
+        free_blocks[getHugePage(item)].push_back(item);
+        elem = list_next(elem);
+    }
+
+    // Order the huge pages by the number of blocks that would remain in use
+    // after retiring all their free blocks. Blocks that are not backed by
+    // huge pages (page 0) come last.
+    std::vector<std::pair<uint64_t, uintptr_t>> order;
+    uint64_t blocks_per_page = BCACHE_HUGE_PAGE_SIZE / blockSize;
+    for (auto &entry : free_blocks) {
+        uint64_t in_use = blocks_per_page;
+        if (entry.first) {
+            auto retired = numRetiredPerHugePage.find(entry.first);
+            in_use -= (retired != numRetiredPerHugePage.end()) ?
+                      retired->second : 0;
+            in_use -= entry.second.size();
+        }
+        order.push_back(std::make_pair(in_use, entry.first));
+    }
+    std::sort(order.begin(), order.end());
+
+    for (auto &page : order) {
+        for (auto item : free_blocks[page.second]) {
+            if (to_retire.size() == max_blocks) {
+                break;
+            }
+            list_remove(&freeList, &item->list_elem);
+            freeListCount--;
+            to_retire.push_back(item);
+        }
+    }
+    spin_unlock(&freeListLock);
+
+    for (auto item : to_retire) {
+        retireBlock(item);
+    }
+    return to_retire.size();
+}
+
+uint64_t BlockCacheManager::getNumReleasedHugePages() {
+    LockHolder lock(resizeMutex);
+    return numReleasedHugePages;
+}
+
+fdb_status BlockCacheManager::resize(uint64_t nblock) {
+    if (nblock == 0) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    LockHolder lock(resizeMutex);
+
+    // Grow: reuse the retired blocks first, and then allocate a new chunk.
+    while (numBlocks < nblock) {
+        struct list_elem *elem = list_pop_front(&retiredList);
+        if (!elem) {
+            break;
+        }
+        reviveBlock(reinterpret_cast<BlockCacheItem *>(elem));
+    }
+    if (numBlocks < nblock && !addBlocks(nblock - numBlocks)) {
+        return FDB_RESULT_ALLOC_FAIL;
+    }
+
+    // Shrink: retire free blocks one at a time. Concurrent readers and
+    // writers are only blocked for a single eviction unit at a time.
+    while (numBlocks > nblock) {
+        if (!hugePageRanges.empty()) {
+            if (!retireFreeBlocksByHugePage(numBlocks - nblock)) {
+                performEviction();
+            }
+            continue;
+        }
+        BlockCacheItem *item = getFreeBlock();
+        if (item) {
+            retireBlock(item);
+        } else {
+            performEviction();
+        }
+    }
+
+    return FDB_RESULT_SUCCESS;
+}
+
+BlockCacheManager* BlockCacheManager::init(uint64_t nblock, uint32_t blocksize,
+                                           uint64_t compressed_size,
+                                           bool huge_pages) {
     BlockCacheManager* tmp = instance.load();
     if (tmp == nullptr) {
         // Ensure two threads don't both create an instance.
         LockHolder lock(instanceMutex);
         tmp = instance.load();
         if (tmp == nullptr) {
-            tmp = new BlockCacheManager(nblock, blocksize);
+            tmp = new BlockCacheManager(nblock, blocksize, compressed_size,
+                                        huge_pages);
             instance.store(tmp);
         }
     }
@@ -1342,8 +2321,17 @@ BlockCacheManager::~BlockCacheManager() {
     }
     writer_unlock(&fileListLock);
 
+    struct list_elem *retired = list_begin(&retiredList);
+    while (retired) {
+        BlockCacheItem *item = reinterpret_cast<BlockCacheItem *>(retired);
+        retired = list_remove(&retiredList, retired);
+        delete item;
+    }
+
     // Free entire buffer cache memory
-    free(bufferCache);
+    for (auto &chunk : bufferChunks) {
+        free_align(chunk);
+    }
 
     spin_lock(&bcacheLock);
     for (auto &file_entry : fileMap) {
@@ -1351,6 +2339,8 @@ BlockCacheManager::~BlockCacheManager() {
     }
     spin_unlock(&bcacheLock);
 
+    delete compressedTier;
+
     spin_destroy(&bcacheLock);
     spin_destroy(&freeListLock);
 
@@ -1387,6 +2377,20 @@ uint64_t BlockCacheManager::getNumImmutables(FileMgr *file) {
     return 0;
 }
 
+uint64_t BlockCacheManager::getCompressedTierUsage() const {
+    if (compressedTier) {
+        return compressedTier->getMemoryUsage();
+    }
+    return 0;
+}
+
+uint64_t BlockCacheManager::getNumCompressedBlocks() const {
+    if (compressedTier) {
+        return compressedTier->getNumItems();
+    }
+    return 0;
+}
+
 // LCOV_EXCL_START
 void BlockCacheManager::printItems() {
     size_t n=1;
@@ -1495,5 +2499,8 @@ void BlockCacheManager::printItems() {
     }
     printf("Documents: %d blocks\n", static_cast<int>(docs));
     printf("Index nodes: %d blocks\n", static_cast<int>(bnodes));
+    printf("Compressed tier: %d blocks, %d bytes\n",
+           static_cast<int>(getNumCompressedBlocks()),
+           static_cast<int>(getCompressedTierUsage()));
 }
 // LCOV_EXCL_STOP
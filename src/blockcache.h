@@ -20,6 +20,7 @@
 #include <atomic>
 #include <unordered_map>
 #include <list>
+#include <map>
 #include <vector>
 #include <mutex>
 #include <string>
@@ -33,6 +34,7 @@ typedef enum {
 
 class BlockCacheItem;
 class BlockCacheShard;
+class CompressedBlockTier;
 
 // Block cache file map with a file name as a key.
 typedef std::unordered_map<std::string, FileBlockCache *> bcache_file_map;
@@ -63,6 +65,30 @@ public:
 
     void setAccessTimestamp(uint64_t timestamp);
 
+    fdb_cache_priority_t getPriority(void) const;
+
+    /**
+     * Check if the number of cached blocks of the file is within the buffer
+     * cache reservation of the file.
+     *
+     * @return True if the file's blocks should not be evicted in favor of
+     *         the other files
+     */
+    bool isWithinReservation(void) const;
+
+    /**
+     * Check if the number of cached blocks of the file has reached the
+     * buffer cache limit of the file.
+     *
+     * @return True if the file should evict its own blocks to cache a new one
+     */
+    bool isOverCacheLimit(void) const;
+
+    /**
+     * Check if the file has a non-default eviction priority or reservation.
+     */
+    bool isPrioritized(void) const;
+
     /**
      * Check if a file block cache is empty or not.
      *
@@ -90,6 +116,11 @@ private:
     std::atomic<uint64_t> numImmutables;
     std::atomic<uint64_t> accessTimestamp;
     size_t numShards;
+    // Buffer cache reservation and limit of the file in the number of blocks
+    // (zero limit means no limit), and the eviction priority of the file.
+    uint64_t minReservedItems;
+    uint64_t maxItems;
+    fdb_cache_priority_t priority;
 };
 
 
@@ -105,10 +136,17 @@ public:
      *
      * @param nblock Number of blocks to be allocated in the cache
      * @param blocksize Size of each block in the cache
+     * @param compressed_size Memory budget in bytes of the second-tier cache
+     *        that keeps compressed copies of evicted clean blocks. The tier
+     *        is disabled if it is zero.
+     * @param huge_pages Flag indicating if the cache memory should be backed
+     *        by huge pages where supported
      * @return Pointer to the block cache manager
      */
     static BlockCacheManager* init(uint64_t nblock,
-                                   uint32_t blocksize);
+                                   uint32_t blocksize,
+                                   uint64_t compressed_size = 0,
+                                   bool huge_pages = false);
 
     /**
      * Get the singleton instance of the block cache manager.
@@ -206,6 +244,15 @@ public:
      */
     void removeCleanBlocks(FileMgr *file);
 
+    /**
+     * Collect the IDs of all the clean blocks cached for a given file,
+     * roughly ordered from the most recently used to the least recently used.
+     *
+     * @param file Pointer to the file manager instance
+     * @param bids Vector that the block IDs are appended to
+     */
+    void getHotBlocks(FileMgr *file, std::vector<bid_t> &bids);
+
     /**
      * Remove a give file from the block cache's global file list.
      *
@@ -254,6 +301,44 @@ public:
         return freeListCount;
     }
 
+    /**
+     * Return the number of blocks that the block cache can currently hold.
+     */
+    uint64_t getNumCacheBlocks() const {
+        return numBlocks;
+    }
+
+    /**
+     * Return the number of huge pages whose memory was returned to the OS,
+     * as all their blocks were taken out of the cache by shrinking.
+     */
+    uint64_t getNumReleasedHugePages();
+
+    /**
+     * Grow or shrink the block cache at runtime.
+     *
+     * Growing the cache adds new blocks to the free list. Shrinking the cache
+     * takes blocks out of the free list one at a time, and evicts blocks in
+     * the same way as a cache miss does whenever the free list is empty, so
+     * that readers and writers are never blocked for the whole resize. If the
+     * cache is backed by huge pages, the free blocks of the huge pages that
+     * are closest to being emptied are taken first.
+     *
+     * @param nblock New number of blocks in the block cache
+     * @return FDB_RESULT_SUCCESS on success
+     */
+    fdb_status resize(uint64_t nblock);
+
+    /**
+     * Return the memory in bytes used by the compressed second-tier cache.
+     */
+    uint64_t getCompressedTierUsage() const;
+
+    /**
+     * Return the number of blocks in the compressed second-tier cache.
+     */
+    uint64_t getNumCompressedBlocks() const;
+
     /**
      * Print the stats summary of the block cache.
      */
@@ -265,8 +350,11 @@ private:
      *
      * @param nblock Number of blocks to be allocated in the cache
      * @param blocksize Size of each block in the cache
+     * @param compressed_size Memory budget of the compressed second tier
+     * @param huge_pages Flag indicating if huge pages are used
      */
-    BlockCacheManager(uint64_t nblock, uint32_t blocksize);
+    BlockCacheManager(uint64_t nblock, uint32_t blocksize,
+                      uint64_t compressed_size, bool huge_pages);
 
     ~BlockCacheManager();
 
@@ -277,6 +365,23 @@ private:
      */
     void setScore(BlockCacheItem &item);
 
+    /**
+     * Try to read a given clean block from a shard without grabbing the
+     * shard lock. The block content is copied out and then validated
+     * against the item's version, so that no shared state is written
+     * on a hit.
+     *
+     * @param shard Pointer to the shard that a given block belongs to
+     * @param bid ID of a block to be read from the cache
+     * @param buf Pointer to the read buffer
+     * @param promote Flag indicating if a hit should mark the block as
+     *        recently referenced
+     * @return True if a given block is read successfully. False means that
+     *         the caller should fall back to the locked lookup.
+     */
+    bool readOptimistic(BlockCacheShard *shard, bid_t bid, void *buf,
+                        bool promote);
+
     /**
      * Add a given cache item to the free block list.
      *
@@ -325,11 +430,15 @@ private:
     /**
      * Perform cache eviction.
      *
+     * @param victim Pointer to a file block cache whose blocks should be
+     *        evicted. If NULL, a victim is chosen among all the files.
      */
-    void performEviction();
+    void performEviction(FileBlockCache *victim = NULL);
 
     /**
      * Choose a file block cache that is goint to be a victim for eviction.
+     * Files with lower priorities are chosen first, and files within their
+     * reservations are chosen only if no other file can be chosen.
      *
      * @return Pointer to a file block cache that is chosen as an eviction victim
      */
@@ -349,6 +458,50 @@ private:
                                 bool flush_all,
                                 bool immutables_only);
 
+    /**
+     * Allocate a new chunk of memory for a given number of blocks and add
+     * the blocks to the free list.
+     *
+     * @param nblock Number of blocks to be added
+     * @return True if the memory is allocated successfully
+     */
+    bool addBlocks(uint64_t nblock);
+
+    /**
+     * Take a free block out of the block cache. The item and its memory
+     * address are kept, as an optimistic reader may still be referencing
+     * them, but the memory pages are returned to the OS if possible. The
+     * memory of a huge page is returned once all its blocks are retired.
+     * The caller should grab resizeMutex.
+     *
+     * @param item Pointer to the free block to be retired
+     */
+    void retireBlock(BlockCacheItem *item);
+
+    /**
+     * Put a retired block back into the free list.
+     * The caller should grab resizeMutex.
+     *
+     * @param item Pointer to the retired block
+     */
+    void reviveBlock(BlockCacheItem *item);
+
+    /**
+     * Retire free blocks, taking all the free blocks of the huge page that
+     * is closest to being emptied first, so that its memory can be returned
+     * to the OS. The caller should grab resizeMutex.
+     *
+     * @param max_blocks Maximum number of blocks to be retired
+     * @return Number of blocks retired
+     */
+    uint64_t retireFreeBlocksByHugePage(uint64_t max_blocks);
+
+    /**
+     * Return the address of the huge page containing a given block, or 0 if
+     * the block is not backed by a huge page.
+     */
+    uintptr_t getHugePage(BlockCacheItem *item) const;
+
 
     // Singleton block cache manager and mutex guarding it's creation.
     static std::atomic<BlockCacheManager *> instance;
@@ -369,18 +522,38 @@ private:
     // file block cache list
     bcache_file_map fileMap;
     std::vector<FileBlockCache *> fileList;
+    // Number of files in the file list that have non-default eviction
+    // priorities or reservations (guarded by the file list lock)
+    size_t numPrioritizedFiles;
     std::list<FileBlockCache *> fileZombies;
     // Reader-Writer lock for the file list
     fdb_rw_lock fileListLock;
 
     // Number of blocks in the block cache
-    uint64_t numBlocks;
+    std::atomic<uint64_t> numBlocks;
     // Size of a block
     uint32_t blockSize;
     // Number of bytes to be written for each flush
     size_t flushUnit;
-    // Pointer to the block cache memory
-    void *bufferCache;
+    // Memory chunks backing the cache blocks. A chunk is added whenever the
+    // cache grows, and all of them are freed when the cache is destroyed.
+    std::vector<void *> bufferChunks;
+    // Flag indicating if the chunks are backed by (transparent) huge pages
+    bool hugePages;
+    // Start and end addresses of the huge page backed part of each chunk.
+    // The tail of a chunk that doesn't fill a huge page uses regular pages.
+    std::map<uintptr_t, uintptr_t> hugePageRanges;
+    // Number of retired blocks in each huge page (guarded by resizeMutex)
+    std::unordered_map<uintptr_t, uint64_t> numRetiredPerHugePage;
+    // Number of huge pages returned to the OS (guarded by resizeMutex)
+    uint64_t numReleasedHugePages;
+    // Blocks taken out of the cache by shrinking, reused first when the
+    // cache grows again (guarded by resizeMutex)
+    struct list retiredList;
+    // Serializes resize operations
+    std::mutex resizeMutex;
+    // Compressed second-tier cache (NULL if disabled)
+    CompressedBlockTier *compressedTier;
 
     DISALLOW_COPY_AND_ASSIGN(BlockCacheManager);
 };
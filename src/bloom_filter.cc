@@ -0,0 +1,535 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom_filter.h"
+#include "common.h"
+#include "hash_functions.h"
+#include "crc32.h"
+
+#include "memleak.h"
+
+// Note: the hash functions below are persisted along with the filters,
+//       so they must not depend on the build (e.g., CRC_DEFAULT).
+static inline void _bloom_hash(const void *key, size_t keylen,
+                               uint32_t *h1, uint32_t *h2)
+{
+    *h1 = crc32_8(key, keylen, 0);
+    // the second hash is used as the probing stride, so make it odd
+    *h2 = hash_djb2((uint8_t *)key, keylen) | 0x1;
+}
+
+BloomFilter::BloomFilter(uint32_t _bitsPerKey) :
+    bitsPerKey(_bitsPerKey)
+{ }
+
+void BloomFilter::addSegment(uint64_t capacity)
+{
+    Segment seg;
+    seg.capacity = capacity;
+    seg.count = 0;
+    // optimal number of probes: (bits per key) * ln(2)
+    seg.nprobes = bitsPerKey * 69 / 100;
+    if (seg.nprobes < 1) {
+        seg.nprobes = 1;
+    } else if (seg.nprobes > 30) {
+        seg.nprobes = 30;
+    }
+    seg.docOffset = BLK_NOT_FOUND;
+    seg.loaded = true;
+    seg.bits.assign((capacity * bitsPerKey + 7) / 8, 0);
+    segments.push_back(std::move(seg));
+}
+
+uint64_t BloomFilter::add(const void *key, size_t keylen)
+{
+    if (segments.empty()) {
+        addSegment(BLOOM_FILTER_INIT_CAPACITY);
+    } else if (segments.back().count >= segments.back().capacity) {
+        addSegment(segments.back().capacity * 2);
+    }
+
+    Segment &seg = segments.back();
+    uint64_t nbits = seg.bits.size() * 8;
+    uint64_t released = seg.docOffset;
+    uint32_t h1, h2;
+    uint32_t i;
+
+    _bloom_hash(key, keylen, &h1, &h2);
+    for (i = 0; i < seg.nprobes; ++i) {
+        uint64_t pos = ((uint64_t)h1 + (uint64_t)i * h2) % nbits;
+        seg.bits[pos / 8] |= (uint8_t)(0x1 << (pos % 8));
+    }
+    seg.count++;
+    seg.docOffset = BLK_NOT_FOUND;
+    return released;
+}
+
+bool BloomFilter::mayContain(const void *key, size_t keylen) const
+{
+    uint32_t h1, h2;
+    uint32_t i;
+
+    _bloom_hash(key, keylen, &h1, &h2);
+    for (auto &seg : segments) {
+        uint64_t nbits = seg.bits.size() * 8;
+        for (i = 0; i < seg.nprobes; ++i) {
+            uint64_t pos = ((uint64_t)h1 + (uint64_t)i * h2) % nbits;
+            if (!(seg.bits[pos / 8] & (0x1 << (pos % 8)))) {
+                break;
+            }
+        }
+        if (i == seg.nprobes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t BloomFilter::getExportSize() const
+{
+    size_t size = sizeof(uint64_t); // # segments
+    for (auto &seg : segments) {
+        // capacity, count, # probes, # bytes, doc offset
+        size += sizeof(uint64_t) * 5;
+        if (seg.docOffset == BLK_NOT_FOUND) {
+            size += seg.bits.size();
+        }
+    }
+    return size;
+}
+
+size_t BloomFilter::exportTo(uint8_t *buf) const
+{
+    /* << raw data structure >>
+     * [# segments]:        8 bytes
+     * ---
+     * [capacity]:          8 bytes
+     * [# keys]:            8 bytes
+     * [# probes]:          8 bytes
+     * [# bytes]:           8 bytes
+     * [doc offset]:        8 bytes (BLK_NOT_FOUND if the bit array follows,
+     *                               otherwise the document holding it)
+     * [bit array]:         x bytes
+     * ...
+     */
+    size_t offset = 0;
+    uint64_t _val;
+
+    _val = _endian_encode((uint64_t)segments.size());
+    memcpy(buf + offset, &_val, sizeof(_val));
+    offset += sizeof(_val);
+
+    for (auto &seg : segments) {
+        _val = _endian_encode(seg.capacity);
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+
+        _val = _endian_encode(seg.count);
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+
+        _val = _endian_encode((uint64_t)seg.nprobes);
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+
+        _val = _endian_encode((uint64_t)seg.bits.size());
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+
+        _val = _endian_encode(seg.docOffset);
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+
+        if (seg.docOffset == BLK_NOT_FOUND) {
+            memcpy(buf + offset, seg.bits.data(), seg.bits.size());
+            offset += seg.bits.size();
+        }
+    }
+    return offset;
+}
+
+size_t BloomFilter::importFrom(const uint8_t *buf, size_t len,
+                               uint64_t doc_offset)
+{
+    size_t offset = 0;
+    uint64_t i, nsegments, _val;
+
+    segments.clear();
+    if (len < sizeof(_val)) {
+        return 0;
+    }
+    memcpy(&_val, buf + offset, sizeof(_val));
+    offset += sizeof(_val);
+    nsegments = _endian_decode(_val);
+
+    for (i = 0; i < nsegments; ++i) {
+        Segment seg;
+        uint64_t nbytes;
+
+        if (len - offset < sizeof(_val) * 5) {
+            segments.clear();
+            return 0;
+        }
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        seg.capacity = _endian_decode(_val);
+
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        seg.count = _endian_decode(_val);
+
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        seg.nprobes = _endian_decode(_val);
+
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        nbytes = _endian_decode(_val);
+
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        seg.docOffset = _endian_decode(_val);
+
+        if (nbytes == 0 || seg.nprobes == 0) {
+            segments.clear();
+            return 0;
+        }
+        if (seg.docOffset == BLK_NOT_FOUND) {
+            // stored in this document
+            if (len - offset < nbytes) {
+                segments.clear();
+                return 0;
+            }
+            seg.bits.assign(buf + offset, buf + offset + nbytes);
+            offset += nbytes;
+            seg.docOffset = doc_offset;
+            seg.loaded = true;
+        } else {
+            // stored in an older document
+            seg.bits.assign(nbytes, 0);
+            seg.loaded = false;
+        }
+        segments.push_back(std::move(seg));
+    }
+    return offset;
+}
+
+void BloomFilter::loadSegmentsFrom(BloomFilter &other, uint64_t doc_offset)
+{
+    size_t i;
+    for (i = 0; i < segments.size() && i < other.segments.size(); ++i) {
+        Segment &seg = segments[i];
+        Segment &src = other.segments[i];
+        if (!seg.loaded && seg.docOffset == doc_offset &&
+            src.loaded && src.docOffset == doc_offset &&
+            src.bits.size() == seg.bits.size()) {
+            seg.bits.swap(src.bits);
+            seg.loaded = true;
+        }
+    }
+}
+
+uint64_t BloomFilter::markPersisted(uint64_t doc_offset)
+{
+    uint64_t n = 0;
+    for (auto &seg : segments) {
+        if (seg.docOffset == BLK_NOT_FOUND) {
+            seg.docOffset = doc_offset;
+            n++;
+        }
+    }
+    return n;
+}
+
+void BloomFilter::getDocRefs(std::map<uint64_t, uint64_t> &refs,
+                             std::set<uint64_t> &missing) const
+{
+    for (auto &seg : segments) {
+        if (!seg.loaded) {
+            missing.insert(seg.docOffset);
+        } else if (seg.docOffset != BLK_NOT_FOUND) {
+            refs[seg.docOffset]++;
+        }
+    }
+}
+
+KvsBloomFilters::KvsBloomFilters(uint32_t _bitsPerKey) :
+    bitsPerKey(_bitsPerKey), docOffset(BLK_NOT_FOUND),
+    kvInfoOffset(BLK_NOT_FOUND), dirty(true)
+{
+    init_rw_lock(&lock);
+}
+
+KvsBloomFilters::~KvsBloomFilters()
+{
+    clear();
+    destroy_rw_lock(&lock);
+}
+
+void KvsBloomFilters::clear()
+{
+    for (auto &entry : filters) {
+        delete entry.second;
+    }
+    filters.clear();
+    docRefs.clear();
+    staleDocs.clear();
+}
+
+void KvsBloomFilters::releaseDocRef(uint64_t doc_offset)
+{
+    auto entry = docRefs.find(doc_offset);
+    if (entry != docRefs.end() && --entry->second == 0) {
+        docRefs.erase(entry);
+        staleDocs.push_back(doc_offset);
+    }
+}
+
+void KvsBloomFilters::add(fdb_kvs_id_t kv_id, const void *key, size_t keylen)
+{
+    writer_lock(&lock);
+    BloomFilter *filter;
+    uint64_t released;
+    auto entry = filters.find(kv_id);
+    if (entry == filters.end()) {
+        filter = new BloomFilter(bitsPerKey);
+        filters.insert(std::make_pair(kv_id, filter));
+    } else {
+        filter = entry->second;
+    }
+    released = filter->add(key, keylen);
+    if (released != BLK_NOT_FOUND) {
+        releaseDocRef(released);
+    }
+    dirty = true;
+    writer_unlock(&lock);
+}
+
+bool KvsBloomFilters::mayContain(fdb_kvs_id_t kv_id,
+                                 const void *key, size_t keylen)
+{
+    bool ret = false;
+    reader_lock(&lock);
+    auto entry = filters.find(kv_id);
+    if (entry != filters.end()) {
+        ret = entry->second->mayContain(key, keylen);
+    }
+    reader_unlock(&lock);
+    return ret;
+}
+
+void KvsBloomFilters::exportFilters(void **data, size_t *len)
+{
+    /* << raw data structure >>
+     * [bits per key]:      8 bytes
+     * [# KV stores]:       8 bytes
+     * ---
+     * [KV store ID]:       8 bytes
+     * [filter]:            x bytes (see BloomFilter::exportTo())
+     * ...
+     */
+    size_t size = sizeof(uint64_t) * 2;
+    size_t offset = 0;
+    uint64_t _val;
+    uint8_t *buf;
+
+    reader_lock(&lock);
+    for (auto &entry : filters) {
+        size += sizeof(uint64_t) + entry.second->getExportSize();
+    }
+    buf = (uint8_t *)malloc(size);
+
+    _val = _endian_encode((uint64_t)bitsPerKey);
+    memcpy(buf + offset, &_val, sizeof(_val));
+    offset += sizeof(_val);
+
+    _val = _endian_encode((uint64_t)filters.size());
+    memcpy(buf + offset, &_val, sizeof(_val));
+    offset += sizeof(_val);
+
+    for (auto &entry : filters) {
+        _val = _endian_encode((uint64_t)entry.first);
+        memcpy(buf + offset, &_val, sizeof(_val));
+        offset += sizeof(_val);
+        offset += entry.second->exportTo(buf + offset);
+    }
+    reader_unlock(&lock);
+
+    *data = buf;
+    *len = offset;
+}
+
+void KvsBloomFilters::setPersisted(uint64_t doc_offset,
+                                   std::vector<uint64_t> &stale_docs)
+{
+    uint64_t n = 0;
+    writer_lock(&lock);
+    for (auto &entry : filters) {
+        n += entry.second->markPersisted(doc_offset);
+    }
+    stale_docs.swap(staleDocs);
+    staleDocs.clear();
+    if (n) {
+        docRefs[doc_offset] = n;
+    } else {
+        // no segment is held by this document, so it becomes stale once
+        // the next one is written
+        staleDocs.push_back(doc_offset);
+    }
+    docOffset = doc_offset;
+    dirty = false;
+    writer_unlock(&lock);
+}
+
+// read the fixed part of a filter document, and return its size
+size_t KvsBloomFilters::importHeader(const uint8_t *buf, size_t len,
+                                     uint64_t *nfilters)
+{
+    uint64_t _val;
+
+    if (len < sizeof(_val) * 2) {
+        return 0;
+    }
+    memcpy(&_val, buf, sizeof(_val));
+    if (_endian_decode(_val) != bitsPerKey) {
+        // the filters were built with a different configuration
+        return 0;
+    }
+    memcpy(&_val, buf + sizeof(_val), sizeof(_val));
+    *nfilters = _endian_decode(_val);
+    return sizeof(_val) * 2;
+}
+
+bool KvsBloomFilters::importFilters(const void *data, size_t len,
+                                    uint64_t doc_offset,
+                                    std::set<uint64_t> &missing)
+{
+    const uint8_t *buf = (const uint8_t *)data;
+    size_t offset;
+    uint64_t i, nfilters, _val;
+    std::map<uint64_t, uint64_t> refs;
+    bool ok = true;
+
+    writer_lock(&lock);
+    clear();
+
+    offset = importHeader(buf, len, &nfilters);
+    if (!offset) {
+        writer_unlock(&lock);
+        return false;
+    }
+
+    for (i = 0; i < nfilters; ++i) {
+        fdb_kvs_id_t kv_id;
+        size_t consumed;
+
+        if (len - offset < sizeof(_val)) {
+            ok = false;
+            break;
+        }
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        kv_id = _endian_decode(_val);
+
+        BloomFilter *filter = new BloomFilter(bitsPerKey);
+        consumed = filter->importFrom(buf + offset, len - offset, doc_offset);
+        if (!consumed) {
+            delete filter;
+            ok = false;
+            break;
+        }
+        offset += consumed;
+        filters.insert(std::make_pair(kv_id, filter));
+        filter->getDocRefs(refs, missing);
+    }
+
+    if (!ok) {
+        clear();
+        missing.clear();
+    }
+    writer_unlock(&lock);
+    return ok;
+}
+
+bool KvsBloomFilters::importSegments(const void *data, size_t len,
+                                     uint64_t doc_offset)
+{
+    const uint8_t *buf = (const uint8_t *)data;
+    size_t offset;
+    uint64_t i, nfilters, _val;
+    bool ok = true;
+
+    writer_lock(&lock);
+    offset = importHeader(buf, len, &nfilters);
+    if (!offset) {
+        writer_unlock(&lock);
+        return false;
+    }
+
+    for (i = 0; i < nfilters; ++i) {
+        fdb_kvs_id_t kv_id;
+        size_t consumed;
+
+        if (len - offset < sizeof(_val)) {
+            ok = false;
+            break;
+        }
+        memcpy(&_val, buf + offset, sizeof(_val));
+        offset += sizeof(_val);
+        kv_id = _endian_decode(_val);
+
+        BloomFilter other(bitsPerKey);
+        consumed = other.importFrom(buf + offset, len - offset, doc_offset);
+        if (!consumed) {
+            ok = false;
+            break;
+        }
+        offset += consumed;
+        auto entry = filters.find(kv_id);
+        if (entry != filters.end()) {
+            entry->second->loadSegmentsFrom(other, doc_offset);
+        }
+    }
+    writer_unlock(&lock);
+    return ok;
+}
+
+bool KvsBloomFilters::finishImport(uint64_t doc_offset)
+{
+    std::set<uint64_t> missing;
+    writer_lock(&lock);
+    docRefs.clear();
+    staleDocs.clear();
+    for (auto &entry : filters) {
+        entry.second->getDocRefs(docRefs, missing);
+    }
+    if (!missing.empty()) {
+        clear();
+        writer_unlock(&lock);
+        return false;
+    }
+    if (!docRefs.count(doc_offset)) {
+        staleDocs.push_back(doc_offset);
+    }
+    docOffset = doc_offset;
+    dirty = false;
+    writer_unlock(&lock);
+    return true;
+}
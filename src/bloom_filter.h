@@ -0,0 +1,237 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "internal_types.h"
+#include "atomic.h"
+
+/**
+ * Bloom filter over the keys of a single KV store.
+ *
+ * The number of keys is not known in advance, so the filter grows as a
+ * series of segments whose capacity doubles each time the last one is full
+ * (a scalable Bloom filter). A key is added to the last segment only, and a
+ * lookup probes every segment.
+ *
+ * Each segment remembers the filter document that holds its latest copy, so
+ * that only the segments changed since then need to be written again.
+ */
+class BloomFilter {
+public:
+    BloomFilter(uint32_t _bitsPerKey);
+
+    ~BloomFilter() { }
+
+    /**
+     * Add a key into the filter. If the key makes a persisted segment dirty,
+     * return the offset of the document that held the segment. Otherwise,
+     * return BLK_NOT_FOUND.
+     */
+    uint64_t add(const void *key, size_t keylen);
+
+    /**
+     * Return false if the key has never been added to the filter.
+     * Return true if the key may have been added.
+     */
+    bool mayContain(const void *key, size_t keylen) const;
+
+    /**
+     * Return the number of bytes required by exportTo().
+     */
+    size_t getExportSize() const;
+
+    /**
+     * Write the filter into the given buffer, and return the number of bytes
+     * written. Only the bit arrays of dirty segments are written; the other
+     * segments refer to the documents that hold them.
+     */
+    size_t exportTo(uint8_t *buf) const;
+
+    /**
+     * Read the filter from the given buffer of the document at 'doc_offset',
+     * and return the number of bytes consumed. Zero is returned if the data
+     * is malformed. Segments stored in other documents are left unloaded.
+     */
+    size_t importFrom(const uint8_t *buf, size_t len, uint64_t doc_offset);
+
+    /**
+     * Load the unloaded segments that are stored in the document at
+     * 'doc_offset', whose copy of this filter is given as 'other'.
+     */
+    void loadSegmentsFrom(BloomFilter &other, uint64_t doc_offset);
+
+    /**
+     * Record that the dirty segments have been written into the document at
+     * 'doc_offset', and return the number of such segments.
+     */
+    uint64_t markPersisted(uint64_t doc_offset);
+
+    /**
+     * Add the number of segments held by each document into 'refs'. Unloaded
+     * segments are added into 'missing' instead.
+     */
+    void getDocRefs(std::map<uint64_t, uint64_t> &refs,
+                    std::set<uint64_t> &missing) const;
+
+private:
+    struct Segment {
+        // Max number of keys this segment was sized for
+        uint64_t capacity;
+        // Number of keys added into this segment
+        uint64_t count;
+        // Number of bit probes per key
+        uint32_t nprobes;
+        // Offset of the document holding the latest copy of this segment,
+        // or BLK_NOT_FOUND if the segment is dirty
+        uint64_t docOffset;
+        // False until the bit array is read from 'docOffset'
+        bool loaded;
+        std::vector<uint8_t> bits;
+    };
+
+    void addSegment(uint64_t capacity);
+
+    uint32_t bitsPerKey;
+    std::vector<Segment> segments;
+};
+
+/**
+ * Bloom filters of all KV stores in a ForestDB file.
+ *
+ * A key is added when it is flushed from the WAL into the HB+trie, so that
+ * the filters always cover every key in the HB+trie of the file, including
+ * deleted ones. A lookup that misses the filter of its KV store does not need
+ * to descend the HB+trie.
+ *
+ * All KV stores' filters are persisted together as a system document whose
+ * offset is recorded at the end of the KV header document. The document only
+ * holds the segments changed since the previous one, and refers to older
+ * documents for the others. An older document becomes stale once none of its
+ * segments are referred to, and compaction writes all segments into a single
+ * document of the new file.
+ */
+class KvsBloomFilters {
+public:
+    KvsBloomFilters(uint32_t _bitsPerKey);
+
+    ~KvsBloomFilters();
+
+    /**
+     * Add a key of the given KV store. The caller should grab the file mutex.
+     */
+    void add(fdb_kvs_id_t kv_id, const void *key, size_t keylen);
+
+    /**
+     * Return false if the key definitely does not exist in the given
+     * KV store's HB+trie.
+     */
+    bool mayContain(fdb_kvs_id_t kv_id, const void *key, size_t keylen);
+
+    /**
+     * Export all filters into a newly allocated buffer.
+     */
+    void exportFilters(void **data, size_t *len);
+
+    /**
+     * Replace all filters with the ones in the given buffer of the latest
+     * filter document at 'doc_offset'. Return false if the data is malformed,
+     * in which case the filters are left empty. The offsets of the older
+     * documents that hold the remaining segments are returned in 'missing',
+     * which should be loaded by importSegments().
+     */
+    bool importFilters(const void *data, size_t len, uint64_t doc_offset,
+                       std::set<uint64_t> &missing);
+
+    /**
+     * Load the segments held by the older filter document at 'doc_offset'.
+     * Return false if the data is malformed.
+     */
+    bool importSegments(const void *data, size_t len, uint64_t doc_offset);
+
+    /**
+     * Return true if all segments are loaded, in which case the filters are
+     * marked as persisted in the latest document at 'doc_offset'.
+     */
+    bool finishImport(uint64_t doc_offset);
+
+    uint32_t getBitsPerKey() const {
+        return bitsPerKey;
+    }
+
+    /**
+     * Return true if keys have been added since the filters were last
+     * persisted.
+     */
+    bool isDirty() const {
+        return dirty;
+    }
+
+    /**
+     * Record that the dirty segments have been written into the document at
+     * 'doc_offset'. The offsets of the older documents that no longer hold
+     * any up-to-date segment are returned in 'stale_docs'.
+     */
+    void setPersisted(uint64_t doc_offset, std::vector<uint64_t> &stale_docs);
+
+    uint64_t getDocOffset() const {
+        return docOffset;
+    }
+
+    /**
+     * Record the offset of the KV header document that refers to the
+     * up-to-date filter document.
+     */
+    void setKvInfoOffset(uint64_t kv_info_offset) {
+        kvInfoOffset = kv_info_offset;
+    }
+
+    /**
+     * Return true if the KV header document at 'kv_info_offset' refers to
+     * a filter document that covers all keys in the HB+trie.
+     */
+    bool isPersistedAt(uint64_t kv_info_offset) const {
+        return !dirty && kvInfoOffset == kv_info_offset;
+    }
+
+private:
+    void clear();
+
+    size_t importHeader(const uint8_t *buf, size_t len, uint64_t *nfilters);
+
+    void releaseDocRef(uint64_t doc_offset);
+
+    uint32_t bitsPerKey;
+    std::unordered_map<fdb_kvs_id_t, BloomFilter *> filters;
+    // Number of up-to-date segments held by each filter document
+    std::map<uint64_t, uint64_t> docRefs;
+    // Filter documents that no longer hold any up-to-date segment
+    std::vector<uint64_t> staleDocs;
+    // Protects 'filters' from concurrent readers while keys are added
+    fdb_rw_lock lock;
+    // Offset of the last filter document, or BLK_NOT_FOUND
+    uint64_t docOffset;
+    // Offset of the KV header document that refers to 'docOffset'
+    uint64_t kvInfoOffset;
+    bool dirty;
+};
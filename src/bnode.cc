@@ -33,16 +33,25 @@ Bnode::Bnode() :
     level(1),
     nentry(0),
     metaSize(0),
-    refCount(0),
     curOffset(BLK_NOT_FOUND),
-    cmpFunc(nullptr)
+    referenced(false),
+    cmpFunc(nullptr),
+    prefixCompression(false),
+    prefixLen(0),
+    prefixExact(true),
+    exportBuf(nullptr),
+    deltaBase(nullptr),
+    deltaSize(0)
 {
     list_elem.prev = list_elem.next = nullptr;
     kvArr.adjustBaseOffset( nodeSize );
 }
 
 Bnode::~Bnode()
-{ }
+{
+    free(exportBuf);
+    delete deltaBase;
+}
 
 BnodeResult Bnode::inputSanityCheck( void *key,
                                      size_t keylen,
@@ -133,7 +142,26 @@ BnodeResult Bnode::addKv( void *key,
         // pointer to child node
         item = BsaItem(key, keylen, child_ptr);
     }
-    kvArr.insert( item );
+    item = kvArr.insert( item );
+
+    // the new key may share a shorter prefix with the other keys.
+    if (kvArr.getNumElems() == 1) {
+        prefixLen = keylen;
+        prefixExact = true;
+    } else if (!item.isEmpty()) {
+        BsaItem other = kvArr.first();
+        if (other.idx == item.idx) {
+            other = kvArr.next(other);
+        }
+        uint8_t *k1 = static_cast<uint8_t*>(key);
+        uint8_t *k2 = static_cast<uint8_t*>(other.key);
+        size_t len = MIN(prefixLen, MIN(keylen, other.keylen));
+        size_t i = 0;
+        while (i < len && k1[i] == k2[i]) {
+            ++i;
+        }
+        prefixLen = i;
+    }
 
     if (inc_nentry) {
         nentry++;
@@ -279,6 +307,8 @@ BnodeResult Bnode::removeKv( void *key,
 
     nentry--;
     nodeSize -= item.getSize();
+    // the remaining keys may share a longer prefix.
+    prefixExact = false;
 
     return BnodeResult::SUCCESS;
 }
@@ -292,6 +322,11 @@ void Bnode::migrateEntries( size_t cur_num_elems,
     Bnode *bnode = new Bnode();
     bnode->setLevel(level);
     bnode->setCmpFunc(cmpFunc);
+    bnode->setPrefixCompression(prefixCompression);
+    // both nodes keep a subset of the keys, which share at least 'prefixLen'.
+    bnode->prefixLen = prefixLen;
+    bnode->prefixExact = false;
+    prefixExact = false;
     new_nodes.push_back(bnode);
 
     // copy first_kvp ~ last_kvp
@@ -336,8 +371,12 @@ BnodeResult Bnode::splitNode( size_t nodesize_limit,
     bool skip_first_entry_set = false;
     size_t num_nodes = 0;
 
-    size_t est_num_nodes = (nodeSize / nodesize_limit) + 1;
-    size_t est_split_nodesize = nodeSize / est_num_nodes;
+    // Split by on-disk size. Each split node shares at least the common
+    // prefix of the current node, so its keys shrink at least by 'prefix_len'.
+    size_t prefix_len = getCommonPrefixLen();
+    size_t disk_size = getDiskSize();
+    size_t est_num_nodes = (disk_size / nodesize_limit) + 1;
+    size_t est_split_nodesize = disk_size / est_num_nodes;
 
     if ( est_num_nodes < 2 ||
          nentry < 4 ) {
@@ -353,7 +392,11 @@ BnodeResult Bnode::splitNode( size_t nodesize_limit,
     }
 
     BsaItem kvp, prev_kvp, first_kvp;
-    size_t cur_nodesize = Bnode::getDiskSpaceOfEmptyNode() + metaSize;
+    size_t empty_nodesize = Bnode::getDiskSpaceOfEmptyNode() + metaSize;
+    if (prefix_len) {
+        empty_nodesize += sizeof(uint16_t) + prefix_len;
+    }
+    size_t cur_nodesize = empty_nodesize;
     size_t cur_num_elems = 0;
 
     uint32_t new_array_size = 0;
@@ -368,7 +411,7 @@ BnodeResult Bnode::splitNode( size_t nodesize_limit,
 
         // Note: each split node should contain at least 2 entries,
         // although it exceeds the node size limit.
-        cur_nodesize += kvp.getSize();
+        cur_nodesize += kvp.getSize() - prefix_len;
         if ( cur_nodesize > est_split_nodesize &&
              cur_num_elems > 1 ) {
 
@@ -384,7 +427,7 @@ BnodeResult Bnode::splitNode( size_t nodesize_limit,
             }
 
             num_nodes++;
-            cur_nodesize = Bnode::getDiskSpaceOfEmptyNode() + metaSize;
+            cur_nodesize = empty_nodesize;
             cur_num_elems = 0;
         }
         prev_kvp = kvp;
@@ -400,6 +443,7 @@ BnodeResult Bnode::splitNode( size_t nodesize_limit,
         // adjust array size and num elems for this node
         kvArr.setArraySize( new_array_size );
         kvArr.setNumElems( new_num_elems );
+        prefixExact = false;
     }
 
     return BnodeResult::SUCCESS;
@@ -416,6 +460,9 @@ Bnode* Bnode::cloneNode()
     dst->setFlags(flags);
     dst->setMeta(meta, metaSize);
     dst->setCmpFunc(cmpFunc);
+    dst->setPrefixCompression(prefixCompression);
+    dst->prefixLen = prefixLen;
+    dst->prefixExact = prefixExact;
 
     // copy all key-value pair instances
     BsArray& src_arr = this->getKvArr();
@@ -428,15 +475,95 @@ Bnode* Bnode::cloneNode()
     return dst;
 }
 
+size_t Bnode::getCommonPrefixLen()
+{
+    size_t num_elems = kvArr.getNumElems();
+    if (!prefixCompression || num_elems < 2) {
+        return 0;
+    }
+
+    // the prefix is written once along with its length.
+    if ((num_elems - 1) * prefixLen <= sizeof(uint16_t)) {
+        return 0;
+    }
+    return prefixLen;
+}
+
+void Bnode::refreshCommonPrefixLen()
+{
+    size_t num_elems = kvArr.getNumElems();
+    if (prefixExact || !prefixCompression || num_elems < 2) {
+        return;
+    }
+
+    BsaItem first_kvp = kvArr.first();
+    uint8_t *first_key = static_cast<uint8_t*>(first_kvp.key);
+    size_t prefix_len = first_kvp.keylen;
+    BsaItem kvp;
+    if (cmpFunc) {
+        // keys are not sorted lexicographically => check all keys.
+        kvp = kvArr.next(first_kvp);
+    } else {
+        // the first and the last keys share the shortest common prefix.
+        kvp = kvArr.last();
+    }
+    while (!kvp.isEmpty() && prefix_len) {
+        uint8_t *key = static_cast<uint8_t*>(kvp.key);
+        size_t len = MIN(prefix_len, kvp.keylen);
+        size_t i = 0;
+        while (i < len && key[i] == first_key[i]) {
+            ++i;
+        }
+        prefix_len = i;
+        if (!cmpFunc) {
+            break;
+        }
+        kvp = kvArr.next(kvp);
+    }
+    prefixLen = prefix_len;
+    prefixExact = true;
+}
+
+size_t Bnode::getDiskSize()
+{
+    if (deltaSize) {
+        return deltaSize;
+    }
+    size_t prefix_len = getCommonPrefixLen();
+    if (!prefix_len) {
+        return nodeSize;
+    }
+    return nodeSize + sizeof(uint16_t) + prefix_len -
+           kvArr.getNumElems() * prefix_len;
+}
+
 void* Bnode::exportRaw()
 {
     uint8_t *ptr = static_cast<uint8_t*>(kvArr.getDataArray());
     uint16_t enc16;
     uint32_t enc32;
     size_t offset = 0;
+    size_t prefix_len = getCommonPrefixLen();
+    uint32_t raw_flags = flags & ~BNODE_FLAG_PREFIX_COMPRESSED;
+    uint32_t raw_size = nodeSize;
+
+    if (deltaSize) {
+        // the delta record is already built by prepareDelta().
+        return exportBuf;
+    }
+
+    if (prefix_len) {
+        // build the compressed node in a separate buffer,
+        // as 'dataArray' should keep the entire keys.
+        raw_size = getDiskSize();
+        raw_flags |= BNODE_FLAG_PREFIX_COMPRESSED;
+        free(exportBuf);
+        exportBuf = malloc(raw_size);
+        ptr = static_cast<uint8_t*>(exportBuf);
+    }
 
     // node size
-    enc32 = _endian_encode(nodeSize);
+    enc32 = _endian_encode(raw_size);
     memcpy(ptr + offset, &enc32, sizeof(enc32));
     offset += sizeof(enc32);
 
@@ -451,17 +578,256 @@ void* Bnode::exportRaw()
     offset += sizeof(enc16);
 
     // flags
-    enc32 = _endian_encode(flags);
+    enc32 = _endian_encode(raw_flags);
     memcpy(ptr + offset, &enc32, sizeof(enc32));
     offset += sizeof(enc32);
 
     // metadata size
     enc16 = _endian_encode(metaSize);
     memcpy(ptr + offset, &enc16, sizeof(enc16));
+    offset += sizeof(enc16);
+
+    if (!prefix_len) {
+        return ptr;
+    }
+
+    // metadata
+    memcpy(ptr + offset, getMeta(), metaSize);
+    offset += metaSize;
+
+    // common prefix
+    BsaItem kvp = kvArr.first();
+    enc16 = _endian_encode(static_cast<uint16_t>(prefix_len));
+    memcpy(ptr + offset, &enc16, sizeof(enc16));
+    offset += sizeof(enc16);
+    memcpy(ptr + offset, kvp.key, prefix_len);
+    offset += prefix_len;
+
+    // key-value pairs without the common prefix
+    uint8_t *kv_base = static_cast<uint8_t*>(kvArr.getDataArray()) +
+                       kvArr.getBaseOffset();
+    while (!kvp.isEmpty()) {
+        uint8_t *kv_ptr = kv_base + kvp.pos;
+        enc16 = _endian_encode(static_cast<uint16_t>(kvp.keylen - prefix_len));
+        memcpy(ptr + offset, &enc16, sizeof(enc16));
+        offset += sizeof(enc16);
+        // value length
+        memcpy(ptr + offset, kv_ptr + sizeof(uint16_t), sizeof(uint16_t));
+        offset += sizeof(uint16_t);
+        // key suffix and value, as stored in the array
+        size_t len = kvp.keylen - prefix_len + kvp.valuelen;
+        memcpy(ptr + offset,
+               kv_ptr + sizeof(uint16_t) * 2 + prefix_len, len);
+        offset += len;
+        kvp = kvArr.next(kvp);
+    }
 
     return ptr;
 }
 
+void Bnode::setDeltaBase(Bnode *base, std::vector<BnodeRegion>& chain)
+{
+    delete deltaBase;
+    deltaBase = base;
+    deltaChain.clear();
+    deltaChain.swap(chain);
+    // the node is mutable now; its size is that of the entire node.
+    deltaSize = 0;
+}
+
+void Bnode::releaseDeltaBase()
+{
+    delete deltaBase;
+    deltaBase = nullptr;
+}
+
+size_t Bnode::prepareDelta(size_t max_size)
+{
+    if (!deltaBase || deltaChain.empty() ||
+        deltaBase->getFlags() != flags) {
+        return 0;
+    }
+
+    // Collect the key-value pairs that are added or updated since the
+    // previous version (paired with false), and the removed keys (true).
+    std::vector<std::pair<BsaItem, bool>> changes;
+    size_t size = Bnode::getDiskSpaceOfEmptyNode() + metaSize +
+                  sizeof(uint64_t);
+    BsaItem kvp, base_kvp;
+
+    for (kvp = kvArr.first(); !kvp.isEmpty(); kvp = kvArr.next(kvp)) {
+        if (kvp.isValueChildPtr || kvp.valuelen == BNODE_DELTA_REMOVED) {
+            return 0;
+        }
+        base_kvp = deltaBase->findKv(kvp.key, kvp.keylen);
+        if (!base_kvp.isEmpty() &&
+            base_kvp.valuelen == kvp.valuelen &&
+            !memcmp(base_kvp.value, kvp.value, kvp.valuelen)) {
+            continue;
+        }
+        changes.push_back(std::make_pair(kvp, false));
+        size += sizeof(uint16_t) * 2 + kvp.keylen + kvp.valuelen;
+        if (size >= max_size) {
+            return 0;
+        }
+    }
+    BsArray& base_arr = deltaBase->getKvArr();
+    for (base_kvp = base_arr.first(); !base_kvp.isEmpty();
+         base_kvp = base_arr.next(base_kvp)) {
+        if (!findKv(base_kvp.key, base_kvp.keylen).isEmpty()) {
+            continue;
+        }
+        changes.push_back(std::make_pair(base_kvp, true));
+        size += sizeof(uint16_t) * 2 + base_kvp.keylen;
+        if (size >= max_size) {
+            return 0;
+        }
+    }
+    if (changes.size() > UINT16_MAX) {
+        return 0;
+    }
+
+    uint8_t *ptr;
+    uint16_t enc16;
+    uint32_t enc32;
+    uint64_t enc64;
+    size_t offset = 0;
+
+    free(exportBuf);
+    exportBuf = malloc(size);
+    ptr = static_cast<uint8_t*>(exportBuf);
+
+    // header, in the same layout as the entire node.
+    enc32 = _endian_encode(static_cast<uint32_t>(size));
+    memcpy(ptr + offset, &enc32, sizeof(enc32));
+    offset += sizeof(enc32);
+    enc16 = _endian_encode(level);
+    memcpy(ptr + offset, &enc16, sizeof(enc16));
+    offset += sizeof(enc16);
+    enc16 = _endian_encode(static_cast<uint16_t>(changes.size()));
+    memcpy(ptr + offset, &enc16, sizeof(enc16));
+    offset += sizeof(enc16);
+    enc32 = _endian_encode(static_cast<uint32_t>(
+                (flags & ~BNODE_FLAG_PREFIX_COMPRESSED) | BNODE_FLAG_DELTA));
+    memcpy(ptr + offset, &enc32, sizeof(enc32));
+    offset += sizeof(enc32);
+    enc16 = _endian_encode(metaSize);
+    memcpy(ptr + offset, &enc16, sizeof(enc16));
+    offset += sizeof(enc16);
+
+    // metadata
+    memcpy(ptr + offset, getMeta(), metaSize);
+    offset += metaSize;
+
+    // offset of the previous version
+    enc64 = _endian_encode(deltaChain.back().offset);
+    memcpy(ptr + offset, &enc64, sizeof(enc64));
+    offset += sizeof(enc64);
+
+    // changed key-value pairs
+    for (auto &entry: changes) {
+        BsaItem& item = entry.first;
+        uint16_t valuelen = entry.second ? BNODE_DELTA_REMOVED : item.valuelen;
+        enc16 = _endian_encode(item.keylen);
+        memcpy(ptr + offset, &enc16, sizeof(enc16));
+        offset += sizeof(enc16);
+        enc16 = _endian_encode(valuelen);
+        memcpy(ptr + offset, &enc16, sizeof(enc16));
+        offset += sizeof(enc16);
+        memcpy(ptr + offset, item.key, item.keylen);
+        offset += item.keylen;
+        if (!entry.second) {
+            memcpy(ptr + offset, item.value, item.valuelen);
+            offset += item.valuelen;
+        }
+    }
+
+    deltaSize = size;
+    return size;
+}
+
+BnodeResult Bnode::applyDelta(void *buf)
+{
+    if (!buf || !isRawDeltaRecord(buf)) {
+        return BnodeResult::INVALID_BUFFER;
+    }
+
+    uint8_t *ptr = static_cast<uint8_t*>(buf);
+    uint16_t enc16;
+    uint16_t num_changes, meta_size, keylen, valuelen;
+    size_t offset = sizeof(uint32_t); // skip record size
+
+    enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+    offset += sizeof(enc16);
+    level = _endian_decode(enc16);
+
+    enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+    offset += sizeof(enc16);
+    num_changes = _endian_decode(enc16);
+
+    offset += sizeof(uint32_t); // skip flags
+
+    enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+    offset += sizeof(enc16);
+    meta_size = _endian_decode(enc16);
+    if (meta_size) {
+        setMeta(ptr + offset, meta_size);
+    } else {
+        clearMeta();
+    }
+    offset += meta_size;
+
+    offset += sizeof(uint64_t); // skip previous offset
+
+    for (uint16_t i = 0; i < num_changes; ++i) {
+        enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+        offset += sizeof(enc16);
+        keylen = _endian_decode(enc16);
+        enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+        offset += sizeof(enc16);
+        valuelen = _endian_decode(enc16);
+
+        if (valuelen == BNODE_DELTA_REMOVED) {
+            removeKv(ptr + offset, keylen);
+            offset += keylen;
+        } else {
+            addKv(ptr + offset, keylen, ptr + offset + keylen, valuelen,
+                  nullptr, true);
+            offset += keylen + valuelen;
+        }
+    }
+
+    deltaSize = Bnode::readNodeSize(buf);
+    return BnodeResult::SUCCESS;
+}
+
+bool Bnode::isRawDeltaRecord(void *buf)
+{
+    // flags are located after node size, level, and # entry.
+    uint8_t *ptr = static_cast<uint8_t*>(buf);
+    uint32_t enc32 = *( reinterpret_cast<uint32_t*>(
+                           ptr + sizeof(uint32_t) + sizeof(uint16_t) * 2) );
+    return _endian_decode(enc32) & BNODE_FLAG_DELTA;
+}
+
+uint64_t Bnode::readDeltaPrevOffset(void *buf)
+{
+    // the offset is located right after the meta data.
+    uint8_t *ptr = static_cast<uint8_t*>(buf);
+    size_t offset = Bnode::getDiskSpaceOfEmptyNode() - sizeof(uint16_t);
+    uint16_t enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+    offset += sizeof(enc16) + _endian_decode(enc16);
+    uint64_t enc64;
+    memcpy(&enc64, ptr + offset, sizeof(enc64));
+    return _endian_decode(enc64);
+}
+
+void Bnode::releaseExportBuffer()
+{
+    free(exportBuf);
+    exportBuf = nullptr;
+}
+
 BnodeResult Bnode::importRaw(void *buf,
                              uint32_t buf_size)
 {
@@ -509,6 +875,59 @@ BnodeResult Bnode::importRaw(void *buf,
     // metadata
     offset += metaSize;
 
+    if (flags & BNODE_FLAG_PREFIX_COMPRESSED) {
+        // restore the entire keys, by prepending the common prefix.
+        uint16_t prefix_len;
+        enc16 = *( reinterpret_cast<uint16_t*>(ptr + offset) );
+        prefix_len = _endian_decode(enc16);
+        uint8_t *prefix = ptr + offset + sizeof(enc16);
+        size_t src_offset = offset + sizeof(enc16) + prefix_len;
+
+        uint32_t raw_size = nodeSize;
+        nodeSize = raw_size - sizeof(uint16_t) - prefix_len +
+                   static_cast<uint32_t>(nentry) * prefix_len;
+        uint32_t capacity = nodeSize + (buf_size - raw_size);
+        uint8_t *new_ptr = static_cast<uint8_t*>(malloc(capacity));
+        memcpy(new_ptr, ptr, offset);
+
+        size_t dst_offset = offset;
+        uint16_t keylen_local, valuelen_local;
+        for (uint16_t i = 0; i < nentry; ++i) {
+            enc16 = *( reinterpret_cast<uint16_t*>(ptr + src_offset) );
+            keylen_local = _endian_decode(enc16);
+            src_offset += sizeof(enc16);
+            enc16 = *( reinterpret_cast<uint16_t*>(ptr + src_offset) );
+            valuelen_local = _endian_decode(enc16);
+            src_offset += sizeof(enc16);
+
+            enc16 = _endian_encode(static_cast<uint16_t>(keylen_local +
+                                                         prefix_len));
+            memcpy(new_ptr + dst_offset, &enc16, sizeof(enc16));
+            dst_offset += sizeof(enc16);
+            memcpy(new_ptr + dst_offset, ptr + src_offset - sizeof(enc16),
+                   sizeof(enc16));
+            dst_offset += sizeof(enc16);
+            memcpy(new_ptr + dst_offset, prefix, prefix_len);
+            dst_offset += prefix_len;
+            memcpy(new_ptr + dst_offset, ptr + src_offset,
+                   keylen_local + valuelen_local);
+            dst_offset += keylen_local + valuelen_local;
+            src_offset += keylen_local + valuelen_local;
+        }
+
+        // 'buf' is freed here.
+        kvArr.setDataArrayBuffer(new_ptr, capacity);
+        flags &= ~BNODE_FLAG_PREFIX_COMPRESSED;
+        prefixCompression = true;
+        prefixLen = prefix_len;
+        prefixExact = true;
+    } else {
+        // the on-disk size of the node should not change until it is
+        // modified, so do not look for a common prefix here.
+        prefixLen = 0;
+        prefixExact = false;
+    }
+
     // adjust base offset
     kvArr.adjustBaseOffset(offset);
 
@@ -687,9 +1106,30 @@ INLINE int BsaCmp(BsaItem& aa, BsaItem& bb, void *aux)
     }
 }
 
+/**
+ * Return the first 8 bytes of the given key as a big-endian integer. Shorter
+ * keys are padded with zeros, so that a smaller prefix always means a smaller
+ * key in the lexicographical order.
+ */
+INLINE uint64_t BsaKeyPrefix(void *key, size_t keylen)
+{
+    uint8_t *ptr = static_cast<uint8_t*>(key);
+    uint64_t prefix = 0;
+    if (keylen >= sizeof(prefix)) {
+        memcpy(&prefix, ptr, sizeof(prefix));
+        return _dec64(prefix);
+    }
+    for (size_t i = 0; i < keylen; ++i) {
+        prefix |= static_cast<uint64_t>(ptr[i]) << (56 - 8 * i);
+    }
+    return prefix;
+}
 
 BsArray::BsArray() :
-    aux(nullptr), kvDataSize(0), arrayBaseOffset(0)
+    aux(nullptr), kvDataSize(0), arrayBaseOffset(0),
+    kvIndex(nullptr), hotPrefix(nullptr), keyPrefix(nullptr), kvPos(nullptr),
+    keyLen(nullptr),
+    flags(nullptr), numElems(0), indexCapacity(0), prefixSkip(0)
 {
     arrayCapacity = 32; // minimum blob size for malloc
     dataArray = malloc(arrayCapacity);
@@ -697,6 +1137,186 @@ BsArray::BsArray() :
 
 BsArray::~BsArray() {
     free(dataArray);
+    if (kvIndex) {
+        free_align(kvIndex);
+    }
+}
+
+void BsArray::setNumElems(uint32_t _num_elems)
+{
+    if (_num_elems > indexCapacity) {
+        setIndexCapacity(_num_elems);
+    }
+    if (_num_elems > numElems) {
+        memset(flags + numElems, 0, _num_elems - numElems);
+    }
+    numElems = _num_elems;
+}
+
+void BsArray::setIndexCapacity(uint32_t capacity)
+{
+    void *new_index = nullptr;
+    uint64_t *new_hot_prefix = nullptr;
+    uint64_t *new_key_prefix = nullptr;
+    uint32_t *new_kv_pos = nullptr;
+    uint16_t *new_key_len = nullptr;
+    uint8_t *new_flags = nullptr;
+
+    if (capacity) {
+        // the arrays are placed in descending order of their element size,
+        // so that all of them are properly aligned.
+        size_t index_size = getKvIndexSize(capacity);
+        malloc_align(new_index, BSA_INDEX_ALIGN, index_size);
+        new_hot_prefix = static_cast<uint64_t*>(new_index);
+        new_key_prefix = reinterpret_cast<uint64_t*>(
+            static_cast<uint8_t*>(new_index) + index_size -
+            capacity * kvIndexEntrySize);
+        new_kv_pos = reinterpret_cast<uint32_t*>(new_key_prefix + capacity);
+        new_key_len = reinterpret_cast<uint16_t*>(new_kv_pos + capacity);
+        new_flags = reinterpret_cast<uint8_t*>(new_key_len + capacity);
+        if (numElems) {
+            memcpy(new_key_prefix, keyPrefix, numElems * sizeof(uint64_t));
+            memcpy(new_kv_pos, kvPos, numElems * sizeof(uint32_t));
+            memcpy(new_key_len, keyLen, numElems * sizeof(uint16_t));
+            memcpy(new_flags, flags, numElems * sizeof(uint8_t));
+        }
+    }
+    if (kvIndex) {
+        free_align(kvIndex);
+    }
+
+    kvIndex = new_index;
+    hotPrefix = new_hot_prefix;
+    keyPrefix = new_key_prefix;
+    kvPos = new_kv_pos;
+    keyLen = new_key_len;
+    flags = new_flags;
+    indexCapacity = capacity;
+    updateHotPrefixes(0);
+}
+
+void BsArray::updateHotPrefixes(uint32_t idx)
+{
+    uint32_t i = idx / BSA_PREFIXES_PER_LINE;
+    for (; i * BSA_PREFIXES_PER_LINE < numElems; ++i) {
+        hotPrefix[i] = keyPrefix[i * BSA_PREFIXES_PER_LINE];
+    }
+}
+
+void BsArray::narrowSearchRange(uint64_t key_prefix, uint32_t& start,
+                                uint32_t& end)
+{
+    uint32_t num_lines = (numElems + BSA_PREFIXES_PER_LINE - 1) /
+                         BSA_PREFIXES_PER_LINE;
+    uint32_t lo = 0, hi = num_lines, middle;
+
+    // the first line whose first key prefix is not smaller than 'key_prefix'.
+    while (lo < hi) {
+        middle = (lo + hi) >> 1;
+        if (hotPrefix[middle] < key_prefix) {
+            lo = middle + 1;
+        } else {
+            hi = middle;
+        }
+    }
+    if (lo > 0 && (lo - 1) * BSA_PREFIXES_PER_LINE > start) {
+        start = (lo - 1) * BSA_PREFIXES_PER_LINE;
+    }
+
+    // the first line whose first key prefix is greater than 'key_prefix'.
+    hi = num_lines;
+    while (lo < hi) {
+        middle = (lo + hi) >> 1;
+        if (hotPrefix[middle] <= key_prefix) {
+            lo = middle + 1;
+        } else {
+            hi = middle;
+        }
+    }
+    if (lo < num_lines && lo * BSA_PREFIXES_PER_LINE < end) {
+        end = lo * BSA_PREFIXES_PER_LINE;
+    }
+}
+
+void BsArray::insertIndexEntry(uint32_t idx)
+{
+    if (numElems == indexCapacity) {
+        setIndexCapacity(indexCapacity ? indexCapacity * 2 : 8);
+    }
+    uint32_t amount = numElems - idx;
+    if (amount) {
+        memmove(keyPrefix + idx + 1, keyPrefix + idx,
+                amount * sizeof(uint64_t));
+        memmove(kvPos + idx + 1, kvPos + idx, amount * sizeof(uint32_t));
+        memmove(keyLen + idx + 1, keyLen + idx, amount * sizeof(uint16_t));
+        memmove(flags + idx + 1, flags + idx, amount * sizeof(uint8_t));
+    }
+    flags[idx] = 0;
+    numElems++;
+}
+
+void BsArray::eraseIndexEntry(uint32_t idx)
+{
+    uint32_t amount = numElems - idx - 1;
+    if (amount) {
+        memmove(keyPrefix + idx, keyPrefix + idx + 1,
+                amount * sizeof(uint64_t));
+        memmove(kvPos + idx, kvPos + idx + 1, amount * sizeof(uint32_t));
+        memmove(keyLen + idx, keyLen + idx + 1, amount * sizeof(uint16_t));
+        memmove(flags + idx, flags + idx + 1, amount * sizeof(uint8_t));
+    }
+    numElems--;
+}
+
+uint64_t BsArray::getKeyPrefix(void *key, size_t keylen) const
+{
+    return BsaKeyPrefix(static_cast<uint8_t*>(key) + prefixSkip,
+                        keylen - prefixSkip);
+}
+
+void BsArray::setIndexEntry(uint32_t idx, void *key, uint16_t keylen,
+                            void *value, uint16_t valuelen)
+{
+    keyLen[idx] = keylen;
+    if (keylen >= prefixSkip) {
+        keyPrefix[idx] = getKeyPrefix(key, keylen);
+    }
+    if (valuelen == HBTrie::getHvSize() &&
+        HBTrie::isDirtyChildTree(value)) {
+        // points to a dirty child b+tree root node.
+        flags[idx] |= BSA_KV_FLAG_DIRTY_CHILD_TREE;
+    } else {
+        flags[idx] &= ~BSA_KV_FLAG_DIRTY_CHILD_TREE;
+    }
+}
+
+void BsArray::refreshKeyPrefixes(bool force)
+{
+    size_t skip = 0;
+    if (!aux && numElems > 1) {
+        // the first and the last keys share the shortest common prefix.
+        BsaItem first_kvp = fetchItem(0);
+        BsaItem last_kvp = fetchItem(numElems - 1);
+        uint8_t *first_key = static_cast<uint8_t*>(first_kvp.key);
+        uint8_t *last_key = static_cast<uint8_t*>(last_kvp.key);
+        size_t len = MIN(first_kvp.keylen, last_kvp.keylen);
+        while (skip < len && first_key[skip] == last_key[skip]) {
+            ++skip;
+        }
+    }
+
+    if (!force && skip == prefixSkip) {
+        return;
+    }
+    prefixSkip = skip;
+
+    uint8_t *ptr = static_cast<uint8_t*>(dataArray) + arrayBaseOffset;
+    for (uint32_t i = 0; i < numElems; ++i) {
+        // skip key length and value length
+        keyPrefix[i] = getKeyPrefix(ptr + kvPos[i] + sizeof(uint16_t) * 2,
+                                    keyLen[i]);
+    }
+    updateHotPrefixes(0);
 }
 
 void BsArray::adjustBaseOffset(uint32_t _new_base)
@@ -716,7 +1336,7 @@ void BsArray::adjustBaseOffset(uint32_t _new_base)
 
 BsaItem BsArray::first(BsaItrType mode) {
     BsaItem not_found;
-    size_t num_elems = kvMeta.size();
+    size_t num_elems = numElems;
 
     if (!num_elems) {
         // no item in array
@@ -726,10 +1346,11 @@ BsaItem BsArray::first(BsaItrType mode) {
     if (mode != BsaItrType::NORMAL) {
         uint32_t i;
         for (i=0; i<num_elems; ++i) {
-            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY && kvMeta[i].isPtr) {
+            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY &&
+                (flags[i] & BSA_KV_FLAG_PTR)) {
                 return fetchItem(i);
             } else if (mode == BsaItrType::DIRTY_CHILD_TREE_ONLY &&
-                kvMeta[i].isDirtyChildTree) {
+                (flags[i] & BSA_KV_FLAG_DIRTY_CHILD_TREE)) {
                 return fetchItem(i);
             }
         }
@@ -741,7 +1362,7 @@ BsaItem BsArray::first(BsaItrType mode) {
 
 BsaItem BsArray::last(BsaItrType mode) {
     BsaItem not_found;
-    size_t num_elems = kvMeta.size();
+    size_t num_elems = numElems;
 
     if (!num_elems) {
         // no item in array
@@ -751,10 +1372,11 @@ BsaItem BsArray::last(BsaItrType mode) {
     if (mode != BsaItrType::NORMAL) {
         int i;
         for (i=static_cast<int>(num_elems)-1; i>=0; --i) {
-            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY && kvMeta[i].isPtr) {
+            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY &&
+                (flags[i] & BSA_KV_FLAG_PTR)) {
                 return fetchItem(i);
             } else if (mode == BsaItrType::DIRTY_CHILD_TREE_ONLY &&
-                kvMeta[i].isDirtyChildTree) {
+                (flags[i] & BSA_KV_FLAG_DIRTY_CHILD_TREE)) {
                 return fetchItem(i);
             }
         }
@@ -774,10 +1396,11 @@ BsaItem BsArray::prev(BsaItem& cur, BsaItrType mode) {
     if (mode != BsaItrType::NORMAL) {
         int i;
         for (i=static_cast<int>(cur.idx)-1; i>=0; --i) {
-            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY && kvMeta[i].isPtr) {
+            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY &&
+                (flags[i] & BSA_KV_FLAG_PTR)) {
                 return fetchItem(i);
             } else if (mode == BsaItrType::DIRTY_CHILD_TREE_ONLY &&
-                kvMeta[i].isDirtyChildTree) {
+                (flags[i] & BSA_KV_FLAG_DIRTY_CHILD_TREE)) {
                 return fetchItem(i);
             }
         }
@@ -789,7 +1412,7 @@ BsaItem BsArray::prev(BsaItem& cur, BsaItrType mode) {
 
 BsaItem BsArray::next(BsaItem& cur, BsaItrType mode) {
     BsaItem not_found;
-    size_t num_elems = kvMeta.size();
+    size_t num_elems = numElems;
 
     if ( cur.idx == num_elems - 1 ) {
         // no next item
@@ -799,10 +1422,11 @@ BsaItem BsArray::next(BsaItem& cur, BsaItrType mode) {
     if (mode != BsaItrType::NORMAL) {
         uint32_t i;
         for (i=cur.idx+1; i<num_elems; ++i) {
-            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY && kvMeta[i].isPtr) {
+            if (mode == BsaItrType::DIRTY_BTREE_NODE_ONLY &&
+                (flags[i] & BSA_KV_FLAG_PTR)) {
                 return fetchItem(i);
             } else if (mode == BsaItrType::DIRTY_CHILD_TREE_ONLY &&
-                kvMeta[i].isDirtyChildTree) {
+                (flags[i] & BSA_KV_FLAG_DIRTY_CHILD_TREE)) {
                 return fetchItem(i);
             }
         }
@@ -813,6 +1437,27 @@ BsaItem BsArray::next(BsaItem& cur, BsaItrType mode) {
 }
 
 BsaItem BsArray::find(BsaItem& key, bool smaller_key)
+{
+    if (aux || key.keylen < prefixSkip) {
+        return search(key, nullptr, smaller_key);
+    }
+
+    // Search with the key prefixes, assuming that the given key starts with
+    // the common prefix of all keys, and then check if it was the case by
+    // using the resulting key-value pair, which has just been fetched.
+    uint64_t key_prefix = getKeyPrefix(key.key, key.keylen);
+    BsaItem ret = search(key, &key_prefix, smaller_key);
+    if (prefixSkip) {
+        BsaItem chk = ret.isEmpty() ? fetchItem(0) : ret;
+        if (memcmp(key.key, chk.key, prefixSkip)) {
+            return search(key, nullptr, smaller_key);
+        }
+    }
+    return ret;
+}
+
+BsaItem BsArray::search(BsaItem& key, const uint64_t *key_prefix,
+                        bool smaller_key)
 {
     int cmp;
     uint32_t start = 0, middle = 0, end= 0;
@@ -820,14 +1465,13 @@ BsaItem BsArray::find(BsaItem& key, bool smaller_key)
     BsaItem not_found;
 
     // empty check
-    end = kvMeta.size();
+    end = numElems;
     if (!end) {
         return not_found;
     }
 
     // 1) compare with the smallest key
-    cur = fetchItem(0);
-    cmp = BsaCmp(key, cur, aux);
+    cmp = compareAt(key, key_prefix, 0, cur);
     if (cmp < 0) {
         // no smaller key
         return not_found;
@@ -837,8 +1481,7 @@ BsaItem BsArray::find(BsaItem& key, bool smaller_key)
     }
 
     // 2) compare with the greatest key
-    cur = fetchItem(end-1);
-    cmp = BsaCmp(key, cur, aux);
+    cmp = compareAt(key, key_prefix, end-1, cur);
     if (!smaller_key && cmp > 0) {
         // greater than greater key && exact key option
         return not_found;
@@ -847,13 +1490,16 @@ BsaItem BsArray::find(BsaItem& key, bool smaller_key)
         return cur;
     }
 
-    // 3) now do binary search
+    // 3) now do binary search, within the cache lines of 'keyPrefix'
+    //    that may contain the given key.
+    if (key_prefix) {
+        narrowSearchRange(*key_prefix, start, end);
+    }
     while (start+1 < end) {
         middle = (start + end) >> 1;
 
-        // get key at middle
-        cur = fetchItem(middle);
-        cmp = BsaCmp(key, cur, aux);
+        // compare with key at middle
+        cmp = compareAt(key, key_prefix, middle, cur);
         if (cmp < 0) {
             // given key < middle
             end = middle;
@@ -907,7 +1553,7 @@ BsaItem BsArray::insert(BsaItem& item) {
     BsaItem existing_item;
     BsaItem ret;
 
-    if (!kvMeta.size()) {
+    if (!numElems) {
         // empty array .. insert without searching
         return addToArray(item, 0, false);
     }
@@ -931,7 +1577,7 @@ BsaItem BsArray::insert(BsaItem& item) {
 }
 BsaItem BsArray::remove(BsaItem& item) {
     BsaItem not_found;
-    size_t num_elems = kvMeta.size();
+    size_t num_elems = numElems;
 
     if (!num_elems) {
         // empty array
@@ -955,14 +1601,20 @@ BsaItem BsArray::remove(BsaItem& item) {
 
             // adjust kvPos properly
             for (uint32_t i = existing_item.idx+1; i<num_elems; ++i) {
-                kvMeta[i].kvPos -= len;
+                kvPos[i] -= len;
             }
         }
 
         // erase element at 'existing_item.idx'.
-        kvMeta.erase(kvMeta.begin() + existing_item.idx);
+        eraseIndexEntry(existing_item.idx);
+        updateHotPrefixes(existing_item.idx);
 
         kvDataSize -= len;
+
+        if (existing_item.idx == 0 || existing_item.idx == numElems) {
+            // the common prefix may become longer.
+            refreshKeyPrefixes(false);
+        }
     }
 
     return existing_item;
@@ -972,8 +1624,6 @@ void BsArray::copyFromOtherArray(BsArray& src_array,
                                  BsaItem& start_item,
                                  BsaItem& end_item)
 {
-    std::vector<BsaKvMeta>& src_kv_meta = src_array.getKvMeta();
-
     uint32_t num_elems = end_item.idx - start_item.idx + 1;
     uint32_t data_size_to_copy = end_item.pos - start_item.pos + end_item.getSize();
 
@@ -986,15 +1636,11 @@ void BsArray::copyFromOtherArray(BsArray& src_array,
                        src_array.getBaseOffset();
     memcpy(dst_ptr, src_ptr + start_item.pos, data_size_to_copy);
 
-    // copy kvMeta from source
-    // Only 'isPtr' part is valid; 'kvPos' part will be updated
+    // copy flags from source
+    // Only BSA_KV_FLAG_PTR is valid; the rest of the index will be updated
     // in constructKvMetaArray() below.
-
-    // resize kvMeta
     setNumElems(num_elems);
-    std::copy(src_kv_meta.begin() + start_item.idx,
-              src_kv_meta.begin() + start_item.idx + num_elems,
-              kvMeta.begin());
+    memcpy(flags, src_array.flags + start_item.idx, num_elems);
 
     constructKvMetaArray(data_size_to_copy, num_elems, false);
 }
@@ -1009,14 +1655,16 @@ void BsArray::constructKvMetaArray(uint32_t kv_data_size,
 
     kvDataSize = kv_data_size;
 
-    // resize kvMeta
+    // resize the index
     setNumElems(num_elems);
+    // the common prefix is calculated at the end.
+    prefixSkip = 0;
 
     uint16_t keylen_local, valuelen_local;
     for (i=0; i<num_elems; ++i) {
-        kvMeta[i].kvPos = offset - arrayBaseOffset;
+        kvPos[i] = offset - arrayBaseOffset;
         if (reset_isptr) {
-            kvMeta[i].isPtr = false;
+            flags[i] &= ~BSA_KV_FLAG_PTR;
         }
 
         keylen_local = *(reinterpret_cast<uint16_t*>(ptr+offset));
@@ -1027,25 +1675,20 @@ void BsArray::constructKvMetaArray(uint32_t kv_data_size,
         valuelen_local = _endian_decode(valuelen_local);
         offset += sizeof(valuelen_local);
 
-        offset += keylen_local;
-
-        if (valuelen_local == HBTrie::getHvSize() &&
-            HBTrie::isDirtyChildTree(ptr+offset)) {
-            // points to a dirty child b+tree root node.
-            kvMeta[i].isDirtyChildTree = true;
-        } else {
-            kvMeta[i].isDirtyChildTree = false;
-        }
-
-        offset += valuelen_local;
+        setIndexEntry(i, ptr + offset, keylen_local,
+                      ptr + offset + keylen_local, valuelen_local);
+        offset += keylen_local + valuelen_local;
     }
+
+    updateHotPrefixes(0);
+    refreshKeyPrefixes(false);
 }
 
 BsaItem BsArray::fetchItem(uint32_t idx) {
     BsaItem ret;
     uint32_t offset = 0;
 
-    ret.pos = kvMeta[idx].kvPos;
+    ret.pos = kvPos[idx];
     uint8_t *ptr = (uint8_t*)dataArray + arrayBaseOffset + ret.pos;
 
     uint16_t keylen_local, valuelen_local;
@@ -1060,7 +1703,7 @@ BsaItem BsArray::fetchItem(uint32_t idx) {
     ret.key = ptr + offset;
     offset += ret.keylen;
 
-    if (kvMeta[idx].isPtr) {
+    if (flags[idx] & BSA_KV_FLAG_PTR) {
         // value is pointer
         uint64_t addr;
         memcpy(&addr, ptr + offset, sizeof(addr));
@@ -1077,6 +1720,29 @@ BsaItem BsArray::fetchItem(uint32_t idx) {
     return ret;
 }
 
+int BsArray::compareAt(BsaItem& key, const uint64_t *key_prefix, uint32_t idx,
+                       BsaItem& cur) {
+    if (key_prefix) {
+        uint64_t prefix = keyPrefix[idx];
+        if (*key_prefix != prefix) {
+            return (*key_prefix < prefix) ? -1 : 1;
+        }
+        uint16_t keylen = keyLen[idx];
+        if (key.keylen <= prefixSkip + sizeof(prefix) &&
+            keylen <= prefixSkip + sizeof(prefix)) {
+            // the prefixes hold the entire keys. As they are zero padded,
+            // the shorter key is the smaller one.
+            if (key.keylen != keylen) {
+                return (key.keylen < keylen) ? -1 : 1;
+            }
+            cur = fetchItem(idx);
+            return 0;
+        }
+    }
+    cur = fetchItem(idx);
+    return BsaCmp(key, cur, aux);
+}
+
 void BsArray::writeItem(BsaItem item, uint32_t position) {
     uint32_t offset = 0;
     uint16_t keylen_local, valuelen_local;
@@ -1112,7 +1778,7 @@ BsaItem BsArray::addToArray(BsaItem item, uint32_t idx, bool overwrite) {
     uint32_t new_item_len = item.getSize();
     uint32_t existing_item_len = 0;
     BsaItem existing_item, left_item;
-    size_t num_elems = kvMeta.size();
+    size_t num_elems = numElems;
 
     // calculate the offset where the item will be copied.
     if ( num_elems ) {
@@ -1163,33 +1829,32 @@ BsaItem BsArray::addToArray(BsaItem item, uint32_t idx, bool overwrite) {
                  amount );
         // adjust kvPos offsets
         for (uint32_t i = idx; i<num_elems; ++i) {
-            kvMeta[i].kvPos += gap;
+            kvPos[i] += gap;
         }
     }
 
     writeItem(item, offset);
 
-    if (overwrite) {
-        // overwrite
-        kvMeta[idx].kvPos = offset;
-        kvMeta[idx].isPtr = item.isValueChildPtr;
-    } else {
+    if (!overwrite) {
         // insert at 'idx'
-        BsaKvMeta new_meta_entry;
-        new_meta_entry.kvPos = offset;
-        new_meta_entry.isPtr = item.isValueChildPtr;
-        kvMeta.insert(kvMeta.begin() + idx, new_meta_entry);
+        insertIndexEntry(idx);
+    }
+    kvPos[idx] = offset;
+    if (item.isValueChildPtr) {
+        flags[idx] |= BSA_KV_FLAG_PTR;
+    } else {
+        flags[idx] &= ~BSA_KV_FLAG_PTR;
     }
     kvDataSize += gap;
 
     item.idx = idx;
     item.pos = offset;
 
-    if (item.valuelen == HBTrie::getHvSize() &&
-        HBTrie::isDirtyChildTree(item.value)) {
-        kvMeta[idx].isDirtyChildTree = true;
-    } else {
-        kvMeta[idx].isDirtyChildTree = false;
+    setIndexEntry(idx, item.key, item.keylen, item.value, item.valuelen);
+    updateHotPrefixes(idx);
+    if (!overwrite && (idx == 0 || idx == numElems - 1)) {
+        // the common prefix may become shorter.
+        refreshKeyPrefixes(false);
     }
 
     return item;
@@ -1208,7 +1873,9 @@ void BsArray::fitArrayAndKvMetaCapacity()
         arrayCapacity = arrayBaseOffset + kvDataSize;
         dataArray = realloc(dataArray, arrayCapacity);
     }
-    kvMeta.shrink_to_fit();
+    if (indexCapacity > numElems) {
+        setIndexCapacity(numElems);
+    }
 }
 
 
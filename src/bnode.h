@@ -29,6 +29,41 @@
 
 class Bnode;
 
+/**
+ * On-disk Bnode flag: the common prefix of all keys in the node is written
+ * once right after the meta data, and each key is stored without it.
+ */
+#define BNODE_FLAG_PREFIX_COMPRESSED (0x1)
+
+/**
+ * On-disk Bnode flag: the record only contains the key-value pairs that
+ * differ from the previous version of the node, which is located at the
+ * file offset written right after the meta data. See Bnode::prepareDelta().
+ */
+#define BNODE_FLAG_DELTA (0x2)
+
+/**
+ * Value length of a delta record entry that removes the key.
+ */
+#define BNODE_DELTA_REMOVED (0xffff)
+
+/**
+ * On-disk region of a B+tree node.
+ */
+struct BnodeRegion {
+    BnodeRegion(uint64_t _offset, uint32_t _size,
+                const std::vector<bid_t>& _bids) :
+        offset(_offset), size(_size), bids(_bids)
+    { }
+
+    // File offset of the node.
+    uint64_t offset;
+    // On-disk size of the node.
+    uint32_t size;
+    // List of block IDs where the node is written.
+    std::vector<bid_t> bids;
+};
+
 /**
  * Basic unit of key-value pair used in Bnode (BsArray) and Btree.
  */
@@ -91,22 +126,19 @@ struct BsaItem {
 };
 
 /**
- * Meta data structure for key-value pair in BsArray.
+ * Flags of a key-value pair in BsArray.
  */
-struct BsaKvMeta {
-    // Position of key-value pair.
-    uint32_t kvPos;
-    // Boolean flag indicates if corresponding key-value pair
-    // contains the pointer to a dirty inner child node (true),
-    // otherwise false.
-    bool isPtr;
-    // Boolean flag indicates if corresponding key-value pair
-    // contains the pointer to a dirty root node of next level child
-    // tree (true), otherwise false. Since the pointer to the next root
-    // node is treated as a (wrapped) value in B+tree level, 'isPtr'
-    // value will not be set to true together.
-    bool isDirtyChildTree;
-};
+// The key-value pair contains the pointer to a dirty inner child node.
+#define BSA_KV_FLAG_PTR (0x1)
+// The key-value pair contains the pointer to a dirty root node of next level
+// child tree. Since the pointer to the next root node is treated as a
+// (wrapped) value in B+tree level, BSA_KV_FLAG_PTR will not be set together.
+#define BSA_KV_FLAG_DIRTY_CHILD_TREE (0x2)
+
+// Alignment of the key-value pair index of BsArray (i.e., cache line size).
+#define BSA_INDEX_ALIGN (64)
+// Number of key prefixes in a cache line.
+#define BSA_PREFIXES_PER_LINE (BSA_INDEX_ALIGN / sizeof(uint64_t))
 
 enum class BsaItrType {
     // Traverse all items.
@@ -139,17 +171,37 @@ enum class BsaItrType {
  *       that can be directly written into DB file.
  *       All values in 'dataArray' are encoded in an endian-safe way.
  *
- * kvMeta[i].kvPos: location of KV i, excluding the memory region for 'meta'.
- *                  'kvPos' value starts from zero.
+ * The index of key-value pairs is kept in a separate, single allocation
+ * aligned to the cache line size, as a set of arrays:
+ *
+ * +-------------+-------------+---------+---------+---------+
+ * | hotPrefix[] | keyPrefix[] | kvPos[] | keyLen[]| flags[] |
+ * +-------------+-------------+---------+---------+---------+
+ *
+ * so that a binary search mostly touches the first cache lines holding
+ * 'hotPrefix', and then a single cache line of 'keyPrefix'.
+ *
+ * hotPrefix[i]: copy of keyPrefix[i * BSA_PREFIXES_PER_LINE], i.e., the first
+ *               key prefix in each cache line of 'keyPrefix'.
+ *
+ * kvPos[i]: location of KV i, excluding the memory region for 'meta'.
+ *           'kvPos' value starts from zero.
  *   e.g.)
  *   arrayBaseOffset = 15
- *   kvMeta[0].kvPos = 0
- *   kvMeta[1].kvPos = 20
+ *   kvPos[0] = 0
+ *   kvPos[1] = 20
  * then, 'KV 0' is located at dataArray+15,
  * and   'KV 1' is located at dataArray+15+20.
  *
- * kvMeta[i].isPtr: boolean flag that indicates if
- *                  KV i contains pointer (true) or binary data (false).
+ * flags[i]: BSA_KV_FLAG_PTR if KV i contains pointer rather than binary data,
+ *           and BSA_KV_FLAG_DIRTY_CHILD_TREE if it points to a dirty child
+ *           tree on HB+trie hierarchy.
+ *
+ * keyPrefix[i]: 8 bytes of the key of KV i right after the common prefix of
+ *               all keys in the array ('prefixSkip' bytes). If no custom
+ *               compare function is given, the binary search compares
+ *               these integers first, and fetches the actual key only
+ *               when they are equal and the keys are longer than that.
  *
  */
 class BsArray {
@@ -159,6 +211,7 @@ public:
 
     void setAux(void *_aux) {
         aux = _aux;
+        refreshKeyPrefixes(true);
     }
     void* getAux() const {
         return aux;
@@ -169,17 +222,12 @@ public:
     uint32_t getBaseOffset() const {
         return arrayBaseOffset;
     }
-    std::vector<BsaKvMeta>& getKvMeta() {
-        return kvMeta;
-    }
-
     uint32_t getArrayCapacity() const {
         return arrayCapacity;
     }
 
-    size_t getKvMetaMemConsumption() {
-        size_t capacity = kvMeta.capacity();
-        return capacity * sizeof(BsaKvMeta);
+    size_t getKvIndexMemConsumption() const {
+        return indexCapacity ? getKvIndexSize(indexCapacity) : 0;
     }
 
     uint32_t getArraySize() const {
@@ -188,12 +236,9 @@ public:
     void setArraySize(uint32_t _array_size) {
         kvDataSize = _array_size;
     }
-    void setNumElems(uint32_t _num_elems) {
-        // resize kvMeta
-        kvMeta.resize(_num_elems);
-    }
+    void setNumElems(uint32_t _num_elems);
     size_t getNumElems() const {
-        return kvMeta.size();
+        return numElems;
     }
 
     /**
@@ -319,7 +364,7 @@ public:
 
     /**
      * Copy a (partial) set of key-value pairs from the source array,
-     * and construct 'kvMeta'.
+     * and construct the index.
      *
      * @param src_array Source array.
      * @param start_item First key-value pair to be copied.
@@ -330,19 +375,19 @@ public:
                             BsaItem& end_item);
 
     /**
-     * Construct 'kvMeta' array for the current 'dataArray'.
+     * Construct the index of key-value pairs for the current 'dataArray'.
      *
      * @param kv_data_size Key-value pair data size to construct.
      * @param num_elems Number of key-value pairs.
-     * @param reset_isptr Flag to reset kvMeta[].isPtr value.
-     *        If false, all kvMeta[].isPtr will be set to false.
+     * @param reset_isptr Flag to reset BSA_KV_FLAG_PTR of all key-value pairs.
+     *        If false, the existing flags are kept.
      */
     void constructKvMetaArray(uint32_t kv_data_size,
                               uint32_t num_elems,
                               bool reset_isptr);
 
     /**
-     * Lessen the allocated memory space for 'dataArray' and 'kvMeta'
+     * Lessen the allocated memory space for 'dataArray' and the index
      * to fit into the actual array size.
      */
     void fitArrayAndKvMetaCapacity();
@@ -357,6 +402,115 @@ private:
      */
     BsaItem fetchItem(uint32_t idx);
 
+    /**
+     * Binary search for the given key. Used by find().
+     *
+     * @param key Key to find.
+     * @param key_prefix Prefix of 'key', or NULL if the key prefixes should
+     *        not be used.
+     * @param smaller_key Flag to return smaller key.
+     * @return Key-value pair found.
+     */
+    BsaItem search(BsaItem& key, const uint64_t *key_prefix, bool smaller_key);
+
+    /**
+     * Compare the given key with the key of the key-value pair at the given
+     * index. If 'key_prefix' is given, the key prefixes are compared
+     * first, and the key-value pair is fetched only if they are equal.
+     * Keys of up to 8 bytes after the common prefix are compared without
+     * reading the key itself.
+     *
+     * @param key Key to compare.
+     * @param key_prefix Prefix of 'key', or NULL if the key prefixes should
+     *        not be used.
+     * @param idx Index number of the key-value pair to compare with.
+     * @param cur Key-value pair at 'idx'. Valid only if the return value is 0.
+     * @return Negative value if 'key' is smaller, 0 if equal, and positive
+     *         value if 'key' is greater.
+     */
+    int compareAt(BsaItem& key, const uint64_t *key_prefix, uint32_t idx,
+                  BsaItem& cur);
+
+    /**
+     * Return the key prefix of the given key, which is stored in 'keyPrefix'.
+     */
+    uint64_t getKeyPrefix(void *key, size_t keylen) const;
+
+    /**
+     * Update the index entry of the key-value pair at the given index, except
+     * for its position.
+     *
+     * @param idx Index number of the key-value pair.
+     * @param key Key of the key-value pair.
+     * @param keylen Length of key.
+     * @param value Value of the key-value pair.
+     * @param valuelen Length of value.
+     */
+    void setIndexEntry(uint32_t idx, void *key, uint16_t keylen,
+                       void *value, uint16_t valuelen);
+
+    /**
+     * Re-calculate the length of the common prefix of all keys, and update
+     * all key prefixes if it has been changed.
+     *
+     * @param force Flag to update all key prefixes anyway.
+     */
+    void refreshKeyPrefixes(bool force);
+
+    /**
+     * Copy the first key prefix in each cache line of 'keyPrefix' into
+     * 'hotPrefix', for the key-value pairs from the given index number.
+     *
+     * @param idx Index number of the first key-value pair that has been
+     *        changed.
+     */
+    void updateHotPrefixes(uint32_t idx);
+
+    /**
+     * Narrow the range of the binary search [start, end) using 'hotPrefix'.
+     *
+     * @param key_prefix Prefix of the key to find.
+     * @param start Index number of the key-value pair smaller than the key.
+     * @param end Index number of the key-value pair greater than the key.
+     */
+    void narrowSearchRange(uint64_t key_prefix, uint32_t& start,
+                           uint32_t& end);
+
+    /**
+     * Return the size of the index for the given capacity.
+     */
+    static size_t getKvIndexSize(uint32_t capacity) {
+        // 'hotPrefix' is padded to the cache line size, so that each cache
+        // line of 'keyPrefix' corresponds to an entry of 'hotPrefix'.
+        size_t num_lines = (capacity + BSA_PREFIXES_PER_LINE - 1) /
+                           BSA_PREFIXES_PER_LINE;
+        size_t hot_size = (num_lines + BSA_PREFIXES_PER_LINE - 1) /
+                          BSA_PREFIXES_PER_LINE * BSA_INDEX_ALIGN;
+        return hot_size + capacity * kvIndexEntrySize;
+    }
+
+    /**
+     * Re-allocate the index with the given capacity, keeping the existing
+     * entries.
+     *
+     * @param capacity New capacity. Should not be smaller than 'numElems'.
+     */
+    void setIndexCapacity(uint32_t capacity);
+
+    /**
+     * Make room for a new index entry at the given index number.
+     *
+     * @param idx Index number of the new entry.
+     */
+    void insertIndexEntry(uint32_t idx);
+
+    /**
+     * Remove the index entry at the given index number.
+     *
+     * @param idx Index number of the entry to remove.
+     */
+    void eraseIndexEntry(uint32_t idx);
+
     /**
      * Write given key-value pair into the given position of the array.
      *
@@ -404,8 +558,24 @@ private:
     uint32_t arrayBaseOffset;
     // Size of memory segment for 'dataArray'.
     uint32_t arrayCapacity;
-    // Array for meta data of key-value pairs.
-    std::vector<BsaKvMeta> kvMeta;
+    // Index of key-value pairs; 'hotPrefix', 'keyPrefix', 'kvPos', 'keyLen'
+    // and 'flags' point to the arrays in this single allocation.
+    void* kvIndex;
+    uint64_t* hotPrefix;
+    uint64_t* keyPrefix;
+    uint32_t* kvPos;
+    uint16_t* keyLen;
+    uint8_t* flags;
+    // Number of key-value pairs.
+    uint32_t numElems;
+    // Number of key-value pairs that 'kvIndex' can hold.
+    uint32_t indexCapacity;
+    // Length of the common prefix of all keys, which is excluded from
+    // 'keyPrefix'. Always zero if a custom compare function is used.
+    uint16_t prefixSkip;
+    // Size of the index entry per key-value pair.
+    static const size_t kvIndexEntrySize = sizeof(uint64_t) + sizeof(uint32_t) +
+                                           sizeof(uint16_t) + sizeof(uint8_t);
 };
 
 
@@ -483,8 +653,8 @@ public:
         ret += sizeof(*this);
         // space for kvArr.dataArray
         ret += kvArr.getArrayCapacity();
-        // spcae for kvArr.kvMeta
-        ret += kvArr.getKvMetaMemConsumption();
+        // space for the index of kvArr
+        ret += kvArr.getKvIndexMemConsumption();
         // space for bidList
         ret += bidList.capacity() * sizeof(bid_t);
         return ret;
@@ -521,23 +691,25 @@ public:
                Bnode::getDiskSpaceOfEmptyNode();
     }
 
-    uint64_t getRefCount() const {
-        return refCount.load();
-    }
-
-    uint64_t incRefCount() {
-        return ++refCount;
+    /**
+     * Record a cache hit. The flag is only stored when it is not already set,
+     * so that repeated hits on a hot node don't keep writing to it.
+     */
+    void markReferenced() {
+        if (!referenced.load(std::memory_order_relaxed)) {
+            referenced.store(true, std::memory_order_relaxed);
+        }
     }
 
-    uint64_t decRefCount() {
-        if ( !refCount ) {
-            // This function is declared separately so that decRefCount() can still
-            // be inlined which is the most common path.
-            logBnodeErr(this, FDB_RESULT_READ_FAIL,
-                        "ref count is already zero");
-            return refCount;
+    /**
+     * Clear the cache hit flag and return its previous value.
+     */
+    bool clearReferenced() {
+        if (referenced.load(std::memory_order_relaxed)) {
+            referenced.store(false, std::memory_order_relaxed);
+            return true;
         }
-        return --refCount;
+        return false;
     }
 
     uint64_t getCurOffset() const {
@@ -547,10 +719,22 @@ public:
         curOffset = _offset;
     }
 
+    bool isPrefixCompression() const {
+        return prefixCompression;
+    }
+    void setPrefixCompression(bool to) {
+        prefixCompression = to;
+    }
+
     btree_new_cmp_func *getCmpFunc() const {
         return cmpFunc;
     }
     void setCmpFunc(btree_new_cmp_func *_func) {
+        if (cmpFunc == _func) {
+            // Clean nodes are shared by concurrent readers, each of which
+            // sets the same function; don't write to them unless necessary.
+            return;
+        }
         cmpFunc = _func;
         if (cmpFunc) {
             kvArr.setAux(this);
@@ -575,6 +759,76 @@ public:
     void clearBidList() {
         bidList.clear();
     }
+    const std::vector<bid_t>& getBidList() const {
+        return bidList;
+    }
+
+    /**
+     * Set the clean version that this dirty node has been derived from, so
+     * that the node can be written as a delta record against it.
+     *
+     * @param base Copy of the clean version, owned by this node.
+     * @param chain On-disk regions that the clean version consists of: its
+     *        last full image, followed by the delta records on top of it.
+     *        The list is moved into this node.
+     */
+    void setDeltaBase(Bnode *base, std::vector<BnodeRegion>& chain);
+
+    Bnode* getDeltaBase() const {
+        return deltaBase;
+    }
+
+    /**
+     * Free the copy of the clean version, once the node is written.
+     */
+    void releaseDeltaBase();
+
+    std::vector<BnodeRegion>& getDeltaChain() {
+        return deltaChain;
+    }
+
+    /**
+     * Return true if the node is (going to be) written as a delta record.
+     */
+    bool isDeltaRecord() const {
+        return deltaSize != 0;
+    }
+
+    /**
+     * Build a delta record against the version set by setDeltaBase(), which
+     * is exported by exportRaw() instead of the entire node. The previous
+     * version is the last region of the delta chain.
+     *
+     * @param max_size Maximum size of the delta record.
+     * @return Size of the delta record, or zero if the delta record is not
+     *         smaller than 'max_size', in which case the entire node should be
+     *         written.
+     */
+    size_t prepareDelta(size_t max_size);
+
+    /**
+     * Apply a delta record to the previous version of the node.
+     *
+     * @param buf Memory area containing the raw delta record.
+     * @return SUCCESS on success.
+     */
+    BnodeResult applyDelta(void *buf);
+
+    /**
+     * Check if the given raw B+tree node data is a delta record.
+     *
+     * @param buf Memory area containing raw data.
+     * @return True if the raw data is a delta record.
+     */
+    static bool isRawDeltaRecord(void *buf);
+
+    /**
+     * Read the offset of the previous version from the given delta record.
+     *
+     * @param buf Memory area containing the raw delta record.
+     * @return File offset of the previous version of the node.
+     */
+    static uint64_t readDeltaPrevOffset(void *buf);
 
     /**
      * Update meta data section.
@@ -711,17 +965,52 @@ public:
      */
     Bnode * cloneNode();
 
+    /**
+     * Return the length of the common key prefix that is truncated when the
+     * node is written into the DB file. It is zero if prefix compression is
+     * disabled, or does not save any space for the current set of keys.
+     * The length is maintained as keys are added, and may be shorter than
+     * the longest common prefix after keys are removed, until
+     * refreshCommonPrefixLen() is called.
+     *
+     * @return Length of the common key prefix.
+     */
+    size_t getCommonPrefixLen();
+
+    /**
+     * Re-calculate the longest common prefix of all keys if keys have been
+     * removed since it was last calculated. Called once before the node is
+     * written, as it scans all keys if a custom compare function is used.
+     */
+    void refreshCommonPrefixLen();
+
+    /**
+     * Return the size of the node when it is written into the DB file.
+     * It is smaller than the node size if the common key prefix is truncated.
+     *
+     * @return On-disk size of the node.
+     */
+    size_t getDiskSize();
+
     /**
      * Convert logical B+tree node structure to raw binary data.
      * To avoid unnecessary memcpy() overhead, it directly returns
      * the buffer address kept in the node. So caller function should not
      * destroy the memory region after use. It will be freed when the
      * node is destroyed.
+     * If the common key prefix is truncated, the data is built in a separate
+     * buffer of 'getDiskSize()' bytes, which can be released by
+     * releaseExportBuffer() once it is written.
      *
      * @return Pointer to the memory address of raw binary data.
      */
     void* exportRaw();
 
+    /**
+     * Free the separate buffer allocated by exportRaw(), if any.
+     */
+    void releaseExportBuffer();
+
     /**
      * Construct logical B+tree node structure from raw binary data.
      * To avoid unnecessary memcpy() overhead, given memory region is
@@ -801,17 +1090,34 @@ private:
     uint16_t metaSize;
     // Sorted array containing key-value pairs and meta data.
     BsArray kvArr;
-    // Reference counter for the given node. If this value is not zero, the node
-    // must not be ejected from the cache.
-    std::atomic<uint64_t> refCount;
     // File offset where this node is written. If this node is dirty so that
     // has not been flushed yet, the value is BLK_NOT_FOUND.
     std::atomic<uint64_t> curOffset;
+    // Set by cache hits instead of moving the node in the clean node list.
+    std::atomic<bool> referenced;
     // List of block IDs where this node is written.
     // Note that blocks cannot be consecutive due to CBR.
     std::vector<bid_t> bidList;
     // Key comparison function. Lexicographical order by default.
     btree_new_cmp_func *cmpFunc;
+    // Flag indicating if the common key prefix is truncated when the node
+    // is written.
+    bool prefixCompression;
+    // Length of a prefix shared by all keys, maintained by addKv().
+    size_t prefixLen;
+    // False if keys have been removed since 'prefixLen' was calculated, so
+    // that the keys may share a longer prefix.
+    bool prefixExact;
+    // Buffer containing the prefix-compressed raw data of the node,
+    // or its delta record.
+    void *exportBuf;
+    // Copy of the clean version that this dirty node has been derived from.
+    Bnode *deltaBase;
+    // On-disk regions of the previous versions that the node's delta record
+    // depends on, starting from the last full image of the node.
+    std::vector<BnodeRegion> deltaChain;
+    // Size of the delta record, or zero if the entire node is written.
+    uint32_t deltaSize;
 };
 
 
@@ -21,6 +21,13 @@
 
 std::atomic<BnodeCacheMgr*> BnodeCacheMgr::instance(nullptr);
 std::mutex BnodeCacheMgr::instanceMutex;
+std::atomic<uint64_t> BnodeCacheMgr::globalEpoch(1);
+std::unordered_set<BnodeCacheReader*> BnodeCacheMgr::readers;
+std::mutex BnodeCacheMgr::readersMutex;
+std::vector<std::pair<uint64_t, Bnode*>> BnodeCacheMgr::retiredNodes;
+std::atomic<size_t> BnodeCacheMgr::numRetiredNodes(0);
+std::atomic<uint64_t> BnodeCacheMgr::retiredNodesMemUsage(0);
+std::mutex BnodeCacheMgr::retiredNodesMutex;
 static uint64_t defaultCacheSize = 134217728;   // 128MB
 static uint64_t defaultFlushLimit = 1048576;    // 1MB
 
@@ -30,6 +37,101 @@ static uint64_t defaultFlushLimit = 1048576;    // 1MB
  */
 static std::hash<std::string> str_hash;
 
+// Number of retired bnodes that triggers an attempt to free them
+static const size_t BNODE_RECLAIM_THRESHOLD = 64;
+
+// Number of consecutive eviction passes that evict nothing (e.g., only the
+// protected bnode is left) after which eviction gives up
+static const size_t BNODE_MAX_IDLE_EVICTION_PASSES = 4;
+
+BnodeCacheReader::BnodeCacheReader()
+    : epoch(0), active(false)
+{
+    LockHolder lh(BnodeCacheMgr::readersMutex);
+    BnodeCacheMgr::readers.insert(this);
+}
+
+BnodeCacheReader::~BnodeCacheReader() {
+    leave();
+    LockHolder lh(BnodeCacheMgr::readersMutex);
+    BnodeCacheMgr::readers.erase(this);
+}
+
+void BnodeCacheReader::enter() {
+    if (active) {
+        return;
+    }
+    epoch.store(BnodeCacheMgr::globalEpoch.load());
+    // Pairs with the fence in reclaimBnodes(): either the reclaimer sees
+    // this epoch, or this reader sees the bnode removed from the cache.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    active = true;
+}
+
+void BnodeCacheReader::leave() {
+    if (!active) {
+        return;
+    }
+    epoch.store(0, std::memory_order_release);
+    active = false;
+    BnodeCacheMgr::reclaimBnodes(false);
+}
+
+void BnodeCacheMgr::retireBnode(Bnode* node) {
+    LockHolder lh(retiredNodesMutex);
+    retiredNodes.push_back(std::make_pair(globalEpoch.fetch_add(1), node));
+    numRetiredNodes.store(retiredNodes.size(), std::memory_order_relaxed);
+    retiredNodesMemUsage.fetch_add(node->getMemConsumption());
+}
+
+void BnodeCacheMgr::reclaimBnodes(bool force) {
+    if (!force && numRetiredNodes.load(std::memory_order_relaxed) <
+                  BNODE_RECLAIM_THRESHOLD) {
+        return;
+    }
+
+    std::vector<Bnode*> to_free;
+    {
+        std::unique_lock<std::mutex> lh(retiredNodesMutex, std::defer_lock);
+        if (force) {
+            lh.lock();
+        } else if (!lh.try_lock()) {
+            // Another thread is already reclaiming
+            return;
+        }
+
+        // A bnode retired at epoch 'e' can only be seen by the readers
+        // that entered their epochs at or before 'e'.
+        uint64_t min_epoch = static_cast<uint64_t>(-1);
+        if (!force) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            LockHolder rlh(readersMutex);
+            for (auto reader : readers) {
+                uint64_t reader_epoch = reader->epoch.load();
+                if (reader_epoch && reader_epoch < min_epoch) {
+                    min_epoch = reader_epoch;
+                }
+            }
+        }
+
+        size_t num_kept = 0;
+        for (auto &entry : retiredNodes) {
+            if (entry.first < min_epoch) {
+                to_free.push_back(entry.second);
+            } else {
+                retiredNodes[num_kept++] = entry;
+            }
+        }
+        retiredNodes.resize(num_kept);
+        numRetiredNodes.store(num_kept, std::memory_order_relaxed);
+    }
+
+    for (auto node : to_free) {
+        retiredNodesMemUsage.fetch_sub(node->getMemConsumption());
+        delete node;
+    }
+}
+
 FileBnodeCache::FileBnodeCache(std::string fname,
                                FileMgr* file,
                                size_t num_shards)
@@ -39,9 +141,14 @@ FileBnodeCache::FileBnodeCache(std::string fname,
       numVictims(0),
       numItems(0),
       numItemsWritten(0),
+      numMisses(0),
       accessTimestamp(0),
-      evictionInProgress(false)
+      evictionInProgress(false),
+      memUsage(0)
 {
+    minReservation = file->getConfig()->getCacheMinReservation();
+    maxLimit = file->getConfig()->getCacheMaxLimit();
+    priority = file->getConfig()->getCachePriority();
 
     for (size_t i = 0; i < num_shards; ++i) {
         shards.emplace_back(new BnodeCacheShard(i));
@@ -72,6 +179,10 @@ uint64_t FileBnodeCache::getNumItemsWritten(void) const {
     return numItemsWritten.load();
 }
 
+uint64_t FileBnodeCache::getNumMisses(void) const {
+    return numMisses.load();
+}
+
 uint64_t FileBnodeCache::getAccessTimestamp(void) const {
     return accessTimestamp.load(std::memory_order_relaxed);
 }
@@ -99,13 +210,13 @@ bool FileBnodeCache::empty() {
 
 void FileBnodeCache::acquireAllShardLocks() {
     for (size_t i = 0; i < shards.size(); ++i) {
-        spin_lock(&shards[i]->lock);
+        writer_lock(&shards[i]->lock);
     }
 }
 
 void FileBnodeCache::releaseAllShardLocks() {
     for (size_t i = 0; i < shards.size(); ++i) {
-        spin_unlock(&shards[i]->lock);
+        writer_unlock(&shards[i]->lock);
     }
 }
 
@@ -114,6 +225,22 @@ bool FileBnodeCache::setEvictionInProgress(bool to) {
     return evictionInProgress.compare_exchange_strong(inverse, to);
 }
 
+fdb_cache_priority_t FileBnodeCache::getPriority(void) const {
+    return priority;
+}
+
+bool FileBnodeCache::isWithinReservation(void) const {
+    return memUsage.load() <= minReservation;
+}
+
+bool FileBnodeCache::isOverCacheLimit(void) const {
+    return maxLimit && memUsage.load() >= maxLimit;
+}
+
+bool FileBnodeCache::isPrioritized(void) const {
+    return priority != FDB_CACHE_PRIORITY_NORMAL || minReservation;
+}
+
 BnodeCacheMgr* BnodeCacheMgr::init(uint64_t cache_size, uint64_t flush_limit) {
     BnodeCacheMgr* tmp = instance.load();
     if (tmp == nullptr) {
@@ -149,6 +276,7 @@ void BnodeCacheMgr::destroyInstance() {
         delete tmp;
         instance = nullptr;
     }
+    reclaimBnodes(true);
 }
 
 void BnodeCacheMgr::eraseFileHistory(FileMgr* file) {
@@ -169,7 +297,8 @@ BnodeCacheMgr::BnodeCacheMgr(uint64_t cache_size,
                              uint64_t flush_limit)
     : bnodeCacheLimit(cache_size),
       bnodeCacheCurrentUsage(0),
-      flushLimit(flush_limit)
+      flushLimit(flush_limit),
+      numPrioritizedFiles(0)
 {
     spin_init(&bnodeCacheLock);
     int rv = init_rw_lock(&fileListLock);
@@ -203,9 +332,38 @@ void BnodeCacheMgr::updateParams(uint64_t cache_size, uint64_t flush_limit) {
     flushLimit.store(flush_limit);
 }
 
+void BnodeCacheMgr::unlinkCleanBnode_UNLOCKED(FileBnodeCache* fcache,
+                                              size_t shard_num,
+                                              Bnode* node) {
+    fcache->shards[shard_num]->allNodes.erase(node->getCurOffset());
+    fcache->shards[shard_num]->unpublish(node);
+    list_remove(&fcache->shards[shard_num]->cleanNodes, &node->list_elem);
+    fcache->numItems--;
+    bnodeCacheCurrentUsage.fetch_sub(node->getMemConsumption());
+    fcache->memUsage.fetch_sub(node->getMemConsumption());
+    // Other readers may still be using the node.
+    retireBnode(node);
+}
+
 int BnodeCacheMgr::read(FileMgr* file,
                         Bnode** node,
                         cs_off_t offset) {
+    return readInternal(file, node, offset, false, false, nullptr);
+}
+
+int BnodeCacheMgr::read(FileMgr* file,
+                        Bnode** node,
+                        cs_off_t offset,
+                        btree_new_cmp_func *cmp_func) {
+    return readInternal(file, node, offset, false, true, cmp_func);
+}
+
+int BnodeCacheMgr::readInternal(FileMgr* file,
+                                Bnode** node,
+                                cs_off_t offset,
+                                bool prefetch,
+                                bool check_cmp_func,
+                                btree_new_cmp_func *cmp_func) {
 
     if (!file) {
         return FDB_RESULT_INVALID_ARGS;
@@ -228,57 +386,139 @@ int BnodeCacheMgr::read(FileMgr* file,
     }
 
     if (fcache) {
-        // file exists, update the access timestamp (in ms)
-        fcache->setAccessTimestamp(gethrtime() / 1000000);
+        // file exists, update the access timestamp (in ms); skip the store
+        // if it is unchanged so that concurrent readers don't keep
+        // invalidating the same cache line.
+        uint64_t now = gethrtime() / 1000000;
+        if (fcache->getAccessTimestamp() != now) {
+            fcache->setAccessTimestamp(now);
+        }
         size_t shard_num = str_hash(std::to_string(offset)) %
                            fcache->getNumShards();
+        // One-shot scans don't refresh the recency of the nodes they hit,
+        // nor do prefetches, which are not accesses yet.
+        bool one_shot = !prefetch && ScanReadScope::isActive(file);
+        bool promote = !prefetch && !one_shot;
+
+        // Cache hits neither grab the shard lock nor pin the node, as the
+        // caller's reader epoch keeps the node from being freed. Instead of
+        // moving the node in the clean node list, mark it as referenced;
+        // eviction gives such nodes another trip through the list.
+        // Cached nodes are shared by concurrent readers, so they are never
+        // modified; a node that was loaded without the caller's comparator
+        // (e.g., by the warmup) is replaced with a new copy instead.
+        auto usable = [check_cmp_func, cmp_func](Bnode* n) {
+            return !check_cmp_func || n->getCmpFunc() == cmp_func;
+        };
+
+        Bnode* cached = fcache->shards[shard_num]->lookup(offset);
+        if (cached && usable(cached)) {
+            *node = cached;
+            if (promote) {
+                cached->markReferenced();
+            }
+            return cached->getNodeSize();
+        }
 
-        spin_lock(&fcache->shards[shard_num]->lock);
-
+        // The node may be cached but not in the lookup table.
+        reader_lock(&fcache->shards[shard_num]->lock);
         auto entry = fcache->shards[shard_num]->allNodes.find(offset);
-        if (entry != fcache->shards[shard_num]->allNodes.end()) {
+        if (entry != fcache->shards[shard_num]->allNodes.end() &&
+            usable(entry->second)) {
             // cache hit
             *node = entry->second;
-            entry->second->incRefCount();
-
-            // Move the item to the back of the clean node list if the item is
-            // not dirty (to ensure that it is the last entry in this file's
-            // clean node list that is evicted which is done based on LRU)
-            if (fcache->shards[shard_num]->dirtyIndexNodes.find(
-                                        entry->second->getCurOffset()) ==
-                    fcache->shards[shard_num]->dirtyIndexNodes.end()) {
-
-                list_remove(&fcache->shards[shard_num]->cleanNodes,
-                            &entry->second->list_elem);
-                list_push_back(&fcache->shards[shard_num]->cleanNodes,
-                               &entry->second->list_elem);
+            fcache->shards[shard_num]->publish(entry->second);
+            if (promote) {
+                entry->second->markReferenced();
             }
+            reader_unlock(&fcache->shards[shard_num]->lock);
+            return (*node)->getNodeSize();
+        }
+        reader_unlock(&fcache->shards[shard_num]->lock);
 
-            spin_unlock(&fcache->shards[shard_num]->lock);
+        writer_lock(&fcache->shards[shard_num]->lock);
+
+        // Check again, as another reader may have loaded the node.
+        entry = fcache->shards[shard_num]->allNodes.find(offset);
+        if (entry != fcache->shards[shard_num]->allNodes.end() &&
+            !usable(entry->second) &&
+            !fcache->shards[shard_num]->dirtyIndexNodes.count(offset)) {
+            unlinkCleanBnode_UNLOCKED(fcache, shard_num, entry->second);
+            entry = fcache->shards[shard_num]->allNodes.end();
+        }
+        if (entry != fcache->shards[shard_num]->allNodes.end()) {
+            // cache hit
+            *node = entry->second;
+            fcache->shards[shard_num]->publish(entry->second);
+            if (promote) {
+                entry->second->markReferenced();
+            }
+            writer_unlock(&fcache->shards[shard_num]->lock);
             return (*node)->getNodeSize();
         } else {
             // cache miss
-            fdb_status status = fetchFromFile(file, node, offset);
+            if (!prefetch) {
+                fcache->numMisses++;
+            }
+            void *delta_buf = nullptr;
+            fdb_status status = fetchFromFile(file, node, offset, &delta_buf);
+            if (status == FDB_RESULT_SUCCESS && delta_buf) {
+                // The previous version of the node is read through the
+                // cache, without holding the lock of this shard.
+                writer_unlock(&fcache->shards[shard_num]->lock);
+                status = resolveDeltaRecord(file, node, delta_buf);
+                writer_lock(&fcache->shards[shard_num]->lock);
+
+                entry = fcache->shards[shard_num]->allNodes.find(offset);
+                if (status == FDB_RESULT_SUCCESS &&
+                    entry != fcache->shards[shard_num]->allNodes.end() &&
+                    !usable(entry->second) &&
+                    !fcache->shards[shard_num]->dirtyIndexNodes.count(offset)) {
+                    unlinkCleanBnode_UNLOCKED(fcache, shard_num,
+                                              entry->second);
+                    entry = fcache->shards[shard_num]->allNodes.end();
+                }
+                if (status == FDB_RESULT_SUCCESS &&
+                    entry != fcache->shards[shard_num]->allNodes.end()) {
+                    // loaded by another reader in the meantime
+                    delete *node;
+                    *node = entry->second;
+                    if (promote) {
+                        entry->second->markReferenced();
+                    }
+                    writer_unlock(&fcache->shards[shard_num]->lock);
+                    return (*node)->getNodeSize();
+                }
+            }
             if (status != FDB_RESULT_SUCCESS) {
                 // does not exist
-                spin_unlock(&fcache->shards[shard_num]->lock);
+                writer_unlock(&fcache->shards[shard_num]->lock);
                 return status;
             } else {
+                // Set the comparator before other readers can see the node.
+                (*node)->setCmpFunc(cmp_func);
                 // Add back to allBNodes hash table
                 fcache->shards[shard_num]->allNodes.insert(
                                 std::make_pair((*node)->getCurOffset(), *node));
-                // Add to back of clean node list
-                list_push_back(&fcache->shards[shard_num]->cleanNodes,
-                               &((*node)->list_elem));
+                fcache->shards[shard_num]->publish(*node);
+                // Add to back of clean node list, or to the front (i.e., the
+                // next to be evicted) if the node is read by a one-shot scan.
+                if (one_shot) {
+                    list_push_front(&fcache->shards[shard_num]->cleanNodes,
+                                    &((*node)->list_elem));
+                } else {
+                    list_push_back(&fcache->shards[shard_num]->cleanNodes,
+                                   &((*node)->list_elem));
+                }
                 bnodeCacheCurrentUsage.fetch_add((*node)->getMemConsumption());
+                fcache->memUsage.fetch_add((*node)->getMemConsumption());
                 fcache->numItems++;
-                (*node)->incRefCount();
-                spin_unlock(&fcache->shards[shard_num]->lock);
+                writer_unlock(&fcache->shards[shard_num]->lock);
 
                 // Do Eviction if necessary
                 // TODO: Implement an eviction daemon perhaps rather than having
                 //       the reader do it ..
-                performEviction(*node);
+                performEviction(*node, fcache);
 
                 return (*node)->getNodeSize();
             }
@@ -289,6 +529,175 @@ int BnodeCacheMgr::read(FileMgr* file,
     return 0;
 }
 
+static const size_t BNODE_BUFFER_HEADROOM = 256;
+
+bool BnodeCacheMgr::isCached(FileBnodeCache* fcache, cs_off_t offset) {
+    size_t shard_num = str_hash(std::to_string(offset)) %
+                       fcache->getNumShards();
+    reader_lock(&fcache->shards[shard_num]->lock);
+    bool cached = fcache->shards[shard_num]->allNodes.find(offset) !=
+                  fcache->shards[shard_num]->allNodes.end();
+    reader_unlock(&fcache->shards[shard_num]->lock);
+    return cached;
+}
+
+size_t BnodeCacheMgr::prefetch(FileMgr* file,
+                               struct async_io_handle *aio_handle,
+                               const cs_off_t *offsets,
+                               size_t num,
+                               btree_new_cmp_func *cmp_func) {
+    FileBnodeCache* fcache = file ? file->getBnodeCache() : nullptr;
+    if (!fcache || !num) {
+        return 0;
+    }
+
+    if (!aio_handle) {
+        // Read the uncached nodes synchronously, in the given order.
+        size_t num_loaded = 0;
+        for (size_t i = 0; i < num; ++i) {
+            if (isCached(fcache, offsets[i])) {
+                continue;
+            }
+            Bnode* bnode = nullptr;
+            if (readInternal(file, &bnode, offsets[i], true, false,
+                             cmp_func) > 0) {
+                ++num_loaded;
+            }
+        }
+        return num_loaded;
+    }
+
+#ifdef _ASYNC_IO
+#if !defined(WIN32) && !defined(_WIN32)
+    // Async reads bypass the block decryption in FileMgr::readBuf().
+    if (file->getEncryption()->ops) {
+        return 0;
+    }
+
+    // Submit a read for the block of each node that is not cached yet.
+    int num_subs = 0;
+    for (size_t i = 0; i < num; ++i) {
+        if (num_subs == static_cast<int>(aio_handle->queue_depth)) {
+            break;
+        }
+        if (isCached(fcache, offsets[i])) {
+            continue;
+        }
+        file->getOps()->aio_prep_read(file->getFopsHandle(), aio_handle,
+                                      num_subs, aio_handle->block_size,
+                                      offsets[i]);
+        ++num_subs;
+    }
+    if (num_subs == 0) {
+        return 0;
+    }
+
+    int ret = file->getOps()->aio_submit(file->getFopsHandle(),
+                                         aio_handle, num_subs);
+    if (ret != num_subs) {
+        // Nothing is lost; the nodes are read synchronously on demand.
+        return ret > 0 ? ret : 0;
+    }
+    return num_subs;
+#else // Plan to implement async I/O in other OSs (e.g., Windows, OSx)
+    return 0;
+#endif
+#else // Async I/O is not supported in the current OS.
+    return 0;
+#endif
+}
+
+size_t BnodeCacheMgr::reapPrefetch(FileMgr* file,
+                                   struct async_io_handle *aio_handle,
+                                   size_t num_pending,
+                                   bool wait,
+                                   btree_new_cmp_func *cmp_func) {
+#ifdef _ASYNC_IO
+#if !defined(WIN32) && !defined(_WIN32)
+    FileBnodeCache* fcache = file ? file->getBnodeCache() : nullptr;
+    if (!fcache || !aio_handle || !num_pending) {
+        return num_pending;
+    }
+
+    size_t blocksize = file->getBlockSize();
+    size_t blocksize_avail = blocksize - sizeof(IndexBlkMeta);
+    size_t num_loaded = 0;
+    size_t num_reaped = 0;
+    do {
+        int num_events = file->getOps()->aio_getevents(
+                                file->getFopsHandle(), aio_handle,
+                                wait ? 1 : 0, num_pending - num_reaped,
+                                wait ? (unsigned int) -1 : 0);
+        if (num_events < 0 || (num_events == 0 && wait)) {
+            // The reads can't be tracked anymore; give up on them.
+            num_reaped = num_pending;
+            break;
+        }
+        num_reaped += num_events;
+
+        struct io_event *io_evt = aio_handle->events;
+        for (; num_events > 0; --num_events, ++io_evt) {
+            if (io_evt->res != aio_handle->block_size) {
+                continue;
+            }
+            uint8_t *block = (uint8_t *) io_evt->obj->u.c.buf;
+            cs_off_t offset = *((uint64_t *) io_evt->data); // Original offset
+            size_t offset_of_block = offset % blocksize;
+            if (offset_of_block + sizeof(uint32_t) > blocksize_avail) {
+                continue;
+            }
+            size_t length = Bnode::readNodeSize(block + offset_of_block);
+            if (offset_of_block + length > blocksize_avail) {
+                // The node spans multiple blocks, leave it to fetchFromFile()
+                continue;
+            }
+
+            if (Bnode::isRawDeltaRecord(block + offset_of_block)) {
+                // Needs its previous version, leave it to read()
+                continue;
+            }
+
+            void *buf = malloc(length + BNODE_BUFFER_HEADROOM);
+            memcpy(buf, block + offset_of_block, length);
+            Bnode* bnode_out = new Bnode();
+            bnode_out->addBidList(offset / blocksize);
+            bnode_out->importRaw(buf, length + BNODE_BUFFER_HEADROOM);
+            bnode_out->setCurOffset(offset);
+            bnode_out->setCmpFunc(cmp_func);
+
+            size_t shard_num = str_hash(std::to_string(offset)) %
+                               fcache->getNumShards();
+            writer_lock(&fcache->shards[shard_num]->lock);
+            if (!fcache->shards[shard_num]->allNodes.insert(
+                                std::make_pair(offset, bnode_out)).second) {
+                // Loaded by another reader in the meantime
+                writer_unlock(&fcache->shards[shard_num]->lock);
+                delete bnode_out;
+                continue;
+            }
+            fcache->shards[shard_num]->publish(bnode_out);
+            list_push_back(&fcache->shards[shard_num]->cleanNodes,
+                           &bnode_out->list_elem);
+            bnodeCacheCurrentUsage.fetch_add(bnode_out->getMemConsumption());
+            fcache->memUsage.fetch_add(bnode_out->getMemConsumption());
+            fcache->numItems++;
+            writer_unlock(&fcache->shards[shard_num]->lock);
+            ++num_loaded;
+        }
+    } while (wait && num_reaped < num_pending);
+
+    if (num_loaded) {
+        performEviction(nullptr, fcache);
+    }
+    return num_reaped;
+#else // Plan to implement async I/O in other OSs (e.g., Windows, OSx)
+    return num_pending;
+#endif
+#else // Async I/O is not supported in the current OS.
+    return num_pending;
+#endif
+}
+
 int BnodeCacheMgr::write(FileMgr* file,
                          Bnode* node,
                          cs_off_t offset) {
@@ -314,7 +723,7 @@ int BnodeCacheMgr::write(FileMgr* file,
 
     size_t shard_num = str_hash(std::to_string(offset)) %
                        fcache->getNumShards();
-    spin_lock(&fcache->shards[shard_num]->lock);
+    writer_lock(&fcache->shards[shard_num]->lock);
 
     // search shard hash table
     auto entry = fcache->shards[shard_num]->allNodes.find(offset);
@@ -326,24 +735,26 @@ int BnodeCacheMgr::write(FileMgr* file,
             fdb_log(nullptr, FDB_RESULT_EEXIST,
                     "Fatal Error: Offset (%s) already in use (race)!",
                     std::to_string(offset).c_str());
-            spin_unlock(&fcache->shards[shard_num]->lock);
+            writer_unlock(&fcache->shards[shard_num]->lock);
             return FDB_RESULT_EEXIST;
         }
+        fcache->shards[shard_num]->publish(node);
         bnodeCacheCurrentUsage.fetch_add(node->getMemConsumption());
+        fcache->memUsage.fetch_add(node->getMemConsumption());
         fcache->numItems++;
         fcache->numItemsWritten++;
     } else {
         fdb_log(nullptr, FDB_RESULT_EEXIST,
                 "Fatal Error: Offset (%s) already in use!",
                 std::to_string(offset).c_str());
-        spin_unlock(&fcache->shards[shard_num]->lock);
+        writer_unlock(&fcache->shards[shard_num]->lock);
         return FDB_RESULT_EEXIST;
     }
 
     fcache->shards[shard_num]->dirtyIndexNodes[offset] = node;
-    spin_unlock(&fcache->shards[shard_num]->lock);
+    writer_unlock(&fcache->shards[shard_num]->lock);
 
-    performEviction(node);
+    performEviction(node, fcache);
 
     return node->getNodeSize();
 }
@@ -415,7 +826,8 @@ fdb_status BnodeCacheMgr::addLastBlockMeta(FileMgr* file, bid_t bid) {
     return status;
 }
 
-fdb_status BnodeCacheMgr::invalidateBnode(FileMgr* file, Bnode* node) {
+fdb_status BnodeCacheMgr::invalidateBnode(FileMgr* file, Bnode* node,
+                                          bool keep_unwritten) {
     if (!file || !node) {
         return FDB_RESULT_INVALID_ARGS;
     }
@@ -428,38 +840,41 @@ fdb_status BnodeCacheMgr::invalidateBnode(FileMgr* file, Bnode* node) {
     size_t shard_num = str_hash(std::to_string(node->getCurOffset())) %
                                 fcache->getNumShards();
 
-    if (node->getRefCount() <= 1) {
-        spin_lock(&fcache->shards[shard_num]->lock);
-        // Search shard hash table
-        auto entry = fcache->shards[shard_num]->allNodes.find(node->getCurOffset());
-        if (entry != fcache->shards[shard_num]->allNodes.end()) {
-            // Remove from all nodes list
-            fcache->shards[shard_num]->allNodes.erase(node->getCurOffset());
-            // Remove from dirty index nodes (if present)
-            fcache->shards[shard_num]->dirtyIndexNodes.erase(node->getCurOffset());
-            // Remove from clean nodes (if present)
-            list_remove(&fcache->shards[shard_num]->cleanNodes,
-                        &node->list_elem);
-            fcache->numItems--;
-            fcache->numItemsWritten--;
-            // Decrement memory usage
-            bnodeCacheCurrentUsage.fetch_sub(node->getMemConsumption());
-            spin_unlock(&fcache->shards[shard_num]->lock);
-        } else {
-            spin_unlock(&fcache->shards[shard_num]->lock);
-            fdb_log(nullptr, FDB_RESULT_KEY_NOT_FOUND,
-                    "Warning: Failed to remove bnode (at offset: %s) "
-                    "in file '%s', because it wasn't found in the cache!",
-                    std::to_string(node->getCurOffset()).c_str(),
-                    fcache->getFileName().c_str());
-            return FDB_RESULT_KEY_NOT_FOUND;
-        }
-    } else {
-        // failure of invalidation is used as one of conditions
-        // in BnodeMgr layer during node cloning, so we don't
-        // need to report warning here.
+    writer_lock(&fcache->shards[shard_num]->lock);
+    // Search shard hash table
+    auto entry = fcache->shards[shard_num]->allNodes.find(node->getCurOffset());
+    if (keep_unwritten &&
+        fcache->shards[shard_num]->dirtyIndexNodes.count(
+            node->getCurOffset())) {
+        writer_unlock(&fcache->shards[shard_num]->lock);
         return FDB_RESULT_FILE_IS_BUSY;
     }
+    if (entry == fcache->shards[shard_num]->allNodes.end()) {
+        // The node was evicted while the caller was using it, which is
+        // not an error as the caller is in a reader epoch.
+        writer_unlock(&fcache->shards[shard_num]->lock);
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+
+    // The cached node may be another copy of the same version of the node,
+    // read after the caller's copy was evicted.
+    Bnode* cached = entry->second;
+    // Remove from all nodes list
+    fcache->shards[shard_num]->allNodes.erase(entry);
+    fcache->shards[shard_num]->unpublish(cached);
+    // Remove from dirty index nodes (if present)
+    fcache->shards[shard_num]->dirtyIndexNodes.erase(cached->getCurOffset());
+    // Remove from clean nodes (if present)
+    list_remove(&fcache->shards[shard_num]->cleanNodes, &cached->list_elem);
+    fcache->numItems--;
+    fcache->numItemsWritten--;
+    // Decrement memory usage
+    bnodeCacheCurrentUsage.fetch_sub(cached->getMemConsumption());
+    fcache->memUsage.fetch_sub(cached->getMemConsumption());
+    writer_unlock(&fcache->shards[shard_num]->lock);
+
+    // Other readers may still be using the node.
+    retireBnode(cached);
 
     return FDB_RESULT_SUCCESS;
 }
@@ -501,7 +916,7 @@ void BnodeCacheMgr::removeCleanBnodes(FileMgr* file) {
 
         // Remove all clean blocksfrom each shard in the file
         for (size_t i = 0; i < fcache->getNumShards(); ++i) {
-            spin_lock(&fcache->shards[i]->lock);
+            writer_lock(&fcache->shards[i]->lock);
             elem = list_begin(&fcache->shards[i]->cleanNodes);
             while (elem) {
                 item = reinterpret_cast<Bnode*>(elem);
@@ -509,13 +924,53 @@ void BnodeCacheMgr::removeCleanBnodes(FileMgr* file) {
                 elem = list_remove(&fcache->shards[i]->cleanNodes, elem);
                 // Remove from the all node list
                 fcache->shards[i]->allNodes.erase(item->getCurOffset());
+                fcache->shards[i]->unpublish(item);
                 fcache->numItems--;
                 // Decrement memory usage
                 bnodeCacheCurrentUsage.fetch_sub(item->getMemConsumption());
+                fcache->memUsage.fetch_sub(item->getMemConsumption());
                 // Free the item
                 delete item;
             }
-            spin_unlock(&fcache->shards[i]->lock);
+            writer_unlock(&fcache->shards[i]->lock);
+        }
+    }
+}
+
+void BnodeCacheMgr::getHotBnodes(FileMgr* file,
+                                 std::vector<cs_off_t> &offsets) {
+    if (!file) {
+        return;
+    }
+
+    FileBnodeCache* fcache = file->getBnodeCache();
+    if (!fcache) {
+        return;
+    }
+
+    // Collect each shard's clean bnodes from the most recently used one,
+    // which is located at the back of the clean node list.
+    std::vector<std::vector<cs_off_t>> shard_offsets(fcache->getNumShards());
+    size_t max_len = 0;
+    for (size_t i = 0; i < fcache->getNumShards(); ++i) {
+        writer_lock(&fcache->shards[i]->lock);
+        struct list_elem* elem = list_end(&fcache->shards[i]->cleanNodes);
+        while (elem) {
+            Bnode* item = reinterpret_cast<Bnode*>(elem);
+            shard_offsets[i].push_back(item->getCurOffset());
+            elem = list_prev(elem);
+        }
+        writer_unlock(&fcache->shards[i]->lock);
+        max_len = std::max(max_len, shard_offsets[i].size());
+    }
+
+    // Interleave the per-shard lists so that the hottest bnodes of all the
+    // shards come first.
+    for (size_t pos = 0; pos < max_len; ++pos) {
+        for (auto &entry : shard_offsets) {
+            if (pos < entry.size()) {
+                offsets.push_back(entry[pos]);
+            }
         }
     }
 }
@@ -595,6 +1050,9 @@ FileBnodeCache* BnodeCacheMgr::createFileBnodeCache_UNLOCKED(FileMgr* file) {
 
     if (writer_lock(&fileListLock) == 0) {
         fileList.push_back(fcache);
+        if (fcache->isPrioritized()) {
+            numPrioritizedFiles++;
+        }
         writer_unlock(&fileListLock);
     } else {
         fdb_log(nullptr, FDB_RESULT_LOCK_FAIL,
@@ -634,11 +1092,47 @@ bool BnodeCacheMgr::freeFileBnodeCache(FileBnodeCache* fcache, bool force) {
     return true;
 }
 
-static const size_t BNODE_BUFFER_HEADROOM = 256;
+fdb_status BnodeCacheMgr::resolveDeltaRecord(FileMgr* file,
+                                             Bnode** node,
+                                             void *delta_buf) {
+    Bnode *prev_node;
+    uint64_t prev_offset = Bnode::readDeltaPrevOffset(delta_buf);
+
+    int ret = read(file, &prev_node, prev_offset);
+    if (ret <= 0) {
+        free(delta_buf);
+        delete *node;
+        *node = nullptr;
+        return ret < 0 ? static_cast<fdb_status>(ret) : FDB_RESULT_READ_FAIL;
+    }
+
+    // The previous version can be shared by other readers,
+    // so apply the changes to its copy.
+    Bnode *bnode_out = prev_node->cloneNode();
+    std::vector<BnodeRegion> chain = prev_node->getDeltaChain();
+    chain.push_back(BnodeRegion(prev_node->getCurOffset(),
+                                prev_node->getDiskSize(),
+                                prev_node->getBidList()));
+
+    bnode_out->setDeltaBase(nullptr, chain);
+    bnode_out->applyDelta(delta_buf);
+    free(delta_buf);
+
+    // take the location of the delta record.
+    for (auto &bid: (*node)->getBidList()) {
+        bnode_out->addBidList(bid);
+    }
+    bnode_out->setCurOffset((*node)->getCurOffset());
+    delete *node;
+    *node = bnode_out;
+
+    return FDB_RESULT_SUCCESS;
+}
 
 fdb_status BnodeCacheMgr::fetchFromFile(FileMgr* file,
                                         Bnode** node,
-                                        cs_off_t offset) {
+                                        cs_off_t offset,
+                                        void **delta_buf) {
 
     if (!file) {
         return FDB_RESULT_INVALID_ARGS;
@@ -727,10 +1221,16 @@ fdb_status BnodeCacheMgr::fetchFromFile(FileMgr* file,
         }
     }
 
-    bnode_out->importRaw(buf, length + BNODE_BUFFER_HEADROOM);
     bnode_out->setCurOffset(offset);
-    // 'buf' to be freed by client
     *node = bnode_out;
+    if (Bnode::isRawDeltaRecord(buf)) {
+        // to be applied to the previous version of the node by the caller.
+        *delta_buf = buf;
+        return status;
+    }
+
+    bnode_out->importRaw(buf, length + BNODE_BUFFER_HEADROOM);
+    // 'buf' to be freed by client
 
     return status;
 
@@ -805,7 +1305,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
     while (true) {
         if (count == 0) {
             for (size_t i = 0; i < fcache->getNumShards(); ++i) {
-                spin_lock(&fcache->shards[i]->lock);
+                writer_lock(&fcache->shards[i]->lock);
                 if (flush_all) {
                     // In case of flush_all, push all the dirty items to
                     // the temporary vector to sort those items with their offsets.
@@ -818,7 +1318,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                         dirty_nodes.push_back(std::make_pair(i, entry->second));
                     }
                 }
-                spin_unlock(&fcache->shards[i]->lock);
+                writer_unlock(&fcache->shards[i]->lock);
             }
 
             if (dirty_nodes.empty()) {
@@ -836,7 +1336,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
         size_t shard_num = dirty_entry.first;
         Bnode* dirty_bnode = dirty_entry.second;
 
-        spin_lock(&fcache->shards[shard_num]->lock);
+        writer_lock(&fcache->shards[shard_num]->lock);
 
         shard_dirty_tree = &fcache->shards[shard_num]->dirtyIndexNodes;
 
@@ -851,7 +1351,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
         if (!item_exist) {
             // The original item in the shard dirty index node map was removed.
             // Moving on to the next one in the cross-shard dirty node list
-            spin_unlock(&fcache->shards[shard_num]->lock);
+            writer_unlock(&fcache->shards[shard_num]->lock);
             if (count == dirty_nodes.size()) {
                 count = 0;
                 dirty_nodes.clear();
@@ -863,7 +1363,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
         shard_dirty_tree->erase(dirty_bnode->getCurOffset());
 
         if (sync) {
-            size_t nodesize = dirty_bnode->getNodeSize();
+            size_t nodesize = dirty_bnode->getDiskSize();
             size_t blocksize = fcache->getFileManager()->getBlockSize();
             size_t blocksize_avail = blocksize - sizeof(IndexBlkMeta);
             size_t offset_of_block = dirty_bnode->getCurOffset() % blocksize;
@@ -909,7 +1409,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                     temp_buf_args.cur_offset = prev_bid * blocksize + blocksize_avail;
                     status = writeCachedData(temp_buf_args);
                     if (status != FDB_RESULT_SUCCESS) {
-                        spin_unlock(&fcache->shards[shard_num]->lock);
+                        writer_unlock(&fcache->shards[shard_num]->lock);
                         return status;
                     }
                 }
@@ -922,7 +1422,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                 temp_buf_args.cur_offset = dirty_bnode->getCurOffset();
                 status = writeCachedData(temp_buf_args);
                 if (status != FDB_RESULT_SUCCESS) {
-                    spin_unlock(&fcache->shards[shard_num]->lock);
+                    writer_unlock(&fcache->shards[shard_num]->lock);
                     return status;
                 }
             } else {
@@ -944,7 +1444,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                     temp_buf_args.cur_offset = cur_bid * blocksize + offset_of_block;
                     status = writeCachedData(temp_buf_args);
                     if (status != FDB_RESULT_SUCCESS) {
-                        spin_unlock(&fcache->shards[shard_num]->lock);
+                        writer_unlock(&fcache->shards[shard_num]->lock);
                         return status;
                     }
 
@@ -961,7 +1461,7 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                         temp_buf_args.cur_offset = cur_bid * blocksize + blocksize_avail;
                         status = writeCachedData(temp_buf_args);
                         if (status != FDB_RESULT_SUCCESS) {
-                            spin_unlock(&fcache->shards[shard_num]->lock);
+                            writer_unlock(&fcache->shards[shard_num]->lock);
                             return status;
                         }
 
@@ -971,24 +1471,28 @@ fdb_status BnodeCacheMgr::flushDirtyIndexNodes(FileBnodeCache* fcache,
                 }
             }
 
+            dirty_bnode->releaseExportBuffer();
+
             // Move to the shard clean node list
             list_push_back(&fcache->shards[shard_num]->cleanNodes,
                            &dirty_bnode->list_elem);
-            flushed += dirty_bnode->getNodeSize();
+            flushed += nodesize;
         } else {
             // Not synced, just discarded
             fcache->numItems--;
             fcache->numItemsWritten--;
             // Remove from the all node list
             fcache->shards[shard_num]->allNodes.erase(dirty_bnode->getCurOffset());
+            fcache->shards[shard_num]->unpublish(dirty_bnode);
             // Decrement memory usage
             bnodeCacheCurrentUsage.fetch_sub(dirty_bnode->getMemConsumption());
+            fcache->memUsage.fetch_sub(dirty_bnode->getMemConsumption());
             flushed += dirty_bnode->getNodeSize();
-            // Free the dirty node as it can be simply discarded
-            delete dirty_bnode;
+            // The dirty node can be simply discarded, once no reader uses it
+            retireBnode(dirty_bnode);
         }
 
-        spin_unlock(&fcache->shards[shard_num]->lock);
+        writer_unlock(&fcache->shards[shard_num]->lock);
 
         if (count == dirty_nodes.size()) {
             count = 0;
@@ -1025,6 +1529,9 @@ bool BnodeCacheMgr::prepareDeallocationForFileBnodeCache(FileBnodeCache* fcache)
         for (auto entry = fileList.begin(); entry != fileList.end(); ++entry) {
             if (*entry == fcache) {
                 fileList.erase(entry);
+                if (fcache->isPrioritized()) {
+                    numPrioritizedFiles--;
+                }
                 found = true;
                 break;
             }
@@ -1070,21 +1577,41 @@ void BnodeCacheMgr::cleanUpInvalidFileBnodeCaches() {
     }
 }
 
-void BnodeCacheMgr::performEviction(Bnode *node_to_protect) {
+void BnodeCacheMgr::performEviction(Bnode *node_to_protect,
+                                    FileBnodeCache* fcache) {
     // The global bnode cache lock need not be acquired here because the
     // file's bnode cache instance (FileBnodeCache) can be freed only if
     // there are no database handles opened for the file.
 
-    struct list_elem* elem;
-    Bnode* item = nullptr;
     FileBnodeCache* victim = nullptr;
 
+    // If the file has used up its own limit, evict its bnodes rather than
+    // other files'.
+    if (fcache && fcache->isOverCacheLimit() &&
+        fcache->setEvictionInProgress(true)) {
+        fcache->refCount++;
+        bool success = evictFromFile(fcache, node_to_protect, true);
+        fcache->refCount--;
+        fcache->setEvictionInProgress(false);
+        if (!success) {
+            return;
+        }
+    }
+
+    // Free the evicted bnodes that are no longer used by any reader first,
+    // as they are counted in the memory usage.
+    reclaimBnodes(false);
+
     // Select the victim and then the clean blocks from the victim file, eject
     // items until memory usage falls 4K (max btree node size) less than
-    // the allowed bnodeCacheLimit.
+    // the allowed bnodeCacheLimit. Retired bnodes that readers still use
+    // cannot be freed, so stop once there is nothing left to evict.
     // TODO: Maybe implement a daemon task that does this eviction,
     //       rather than the reader/writer doing it.
-    while (bnodeCacheCurrentUsage.load() >= bnodeCacheLimit) {
+    size_t num_idle_passes = 0;
+    while (getMemoryUsage() >= bnodeCacheLimit &&
+           bnodeCacheCurrentUsage.load() > 0 &&
+           num_idle_passes < BNODE_MAX_IDLE_EVICTION_PASSES) {
         // Firstly, select the victim file
         victim = chooseEvictionVictim();
         if (victim && victim->setEvictionInProgress(true)) {
@@ -1104,77 +1631,127 @@ void BnodeCacheMgr::performEviction(Bnode *node_to_protect) {
             continue;
         }
 
-        size_t num_shards = victim->getNumShards();
-        size_t i = random(num_shards);
-        BnodeCacheShard* bshard = nullptr;
-        size_t toVisit = num_shards;
-
-        while (bnodeCacheCurrentUsage.load() > (bnodeCacheLimit - 4096) &&
-               toVisit-- != 0) {
-            i = (i + 1) % num_shards;   // Round-robin over empty shards
-            bshard = victim->shards[i].get();
-            spin_lock(&bshard->lock);
-            if (bshard->empty()) {
-                spin_unlock(&bshard->lock);
-                continue;
-            }
+        uint64_t num_victims = victim->numVictims.load();
+        if (!evictFromFile(victim, node_to_protect, false)) {
+            return;
+        }
+        if (victim->numVictims.load() == num_victims) {
+            num_idle_passes++;
+        } else {
+            num_idle_passes = 0;
+        }
 
-            if (list_empty(&bshard->cleanNodes)) {
-                spin_unlock(&bshard->lock);
-                // When the victim shard has no clean index node, evict
-                // some dirty blocks from shards.
-                fdb_status status = flushDirtyIndexNodes(victim, true, false);
-                if (status != FDB_RESULT_SUCCESS) {
-                    fdb_log(nullptr, status,
-                            "BnodeCacheMgr::performEviction(): Flushing dirty "
-                            "index nodes failed for shard %s in file '%s'",
-                            std::to_string(i).c_str(),
-                            victim->getFileName().c_str());
-                    return;
-                }
-                spin_lock(&bshard->lock);
-            }
+        victim->refCount--;
+        victim->setEvictionInProgress(false);
+        victim = nullptr;
+    }
 
-            elem = list_pop_front(&bshard->cleanNodes);
-            if (elem) {
-                item = reinterpret_cast<Bnode*>(elem);
-                if (item != node_to_protect && item->getRefCount() == 0) {
-                    victim->numVictims++;
+    // Free the evicted bnodes that are no longer used by any reader
+    reclaimBnodes(false);
+}
+
+bool BnodeCacheMgr::evictFromFile(FileBnodeCache* victim,
+                                  Bnode* node_to_protect,
+                                  bool file_limit) {
+    struct list_elem* elem;
+    Bnode* item = nullptr;
+    size_t num_shards = victim->getNumShards();
+    size_t i = random(num_shards);
+    BnodeCacheShard* bshard = nullptr;
+    size_t toVisit = num_shards;
+
+    while (toVisit-- != 0) {
+        if (file_limit) {
+            if (victim->memUsage.load() + 4096 <= victim->maxLimit) {
+                break;
+            }
+        } else if (getMemoryUsage() <= (bnodeCacheLimit - 4096)) {
+            break;
+        }
 
-                    victim->numItems--;
-                    // Remove from the shard nodes list
-                    bshard->allNodes.erase(item->getCurOffset());
-                    // Decrement mem usage stat
-                    bnodeCacheCurrentUsage.fetch_sub(item->getMemConsumption());
+        i = (i + 1) % num_shards;   // Round-robin over empty shards
+        bshard = victim->shards[i].get();
+        writer_lock(&bshard->lock);
+        if (bshard->empty()) {
+            writer_unlock(&bshard->lock);
+            continue;
+        }
 
-                    // Free bnode instance
-                    delete item;
-                } else {
-                    list_push_back(&bshard->cleanNodes,
-                                   &item->list_elem);
-                }
+        if (list_empty(&bshard->cleanNodes)) {
+            writer_unlock(&bshard->lock);
+            // When the victim shard has no clean index node, evict
+            // some dirty blocks from shards.
+            fdb_status status = flushDirtyIndexNodes(victim, true, false);
+            if (status != FDB_RESULT_SUCCESS) {
+                fdb_log(nullptr, status,
+                        "BnodeCacheMgr::performEviction(): Flushing dirty "
+                        "index nodes failed for shard %s in file '%s'",
+                        std::to_string(i).c_str(),
+                        victim->getFileName().c_str());
+                return false;
             }
-            spin_unlock(&bshard->lock);
+            writer_lock(&bshard->lock);
         }
 
-        victim->refCount--;
-        victim->setEvictionInProgress(false);
-        victim = nullptr;
+        elem = list_pop_front(&bshard->cleanNodes);
+        if (elem) {
+            item = reinterpret_cast<Bnode*>(elem);
+            if (item->clearReferenced()) {
+                // The node was hit since it was last visited by eviction;
+                // give it another trip through the list.
+                list_push_back(&bshard->cleanNodes, &item->list_elem);
+            } else if (item != node_to_protect) {
+                victim->numVictims++;
+
+                victim->numItems--;
+                // Remove from the shard nodes list
+                bshard->allNodes.erase(item->getCurOffset());
+                bshard->unpublish(item);
+                // Decrement mem usage stat
+                bnodeCacheCurrentUsage.fetch_sub(item->getMemConsumption());
+                victim->memUsage.fetch_sub(item->getMemConsumption());
+
+                // Free bnode instance once no reader uses it
+                retireBnode(item);
+            } else {
+                list_push_back(&bshard->cleanNodes,
+                               &item->list_elem);
+            }
+        }
+        writer_unlock(&bshard->lock);
     }
+
+    return true;
 }
 
 static const size_t MAX_VICTIM_SELECTIONS = 5;
 static const size_t MIN_TIMESTAMP_GAP = 15000;  // 15 seconds
 
+// Victim candidates of the same eviction class
+struct bnode_victim_class {
+    bnode_victim_class()
+        : min_timestamp(static_cast<uint64_t>(-1)), max_timestamp(0),
+          max_items(0), victim_by_time(-1), victim_by_items(-1) { }
+
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    uint64_t max_items;
+    int victim_by_time;
+    int victim_by_items;
+};
+
+// Files within their reservations are put into the classes following all
+// the priority classes.
+static const size_t BNODE_NUM_PRIORITIES = FDB_CACHE_PRIORITY_HIGH + 1;
+static const size_t BNODE_NUM_VICTIM_CLASSES = BNODE_NUM_PRIORITIES * 2;
+
 FileBnodeCache* BnodeCacheMgr::chooseEvictionVictim() {
     FileBnodeCache* ret = nullptr;
 
-    uint64_t max_items = 0;
-    uint64_t min_timestamp = static_cast<uint64_t>(-1);
-    uint64_t max_timestamp = 0;
     uint64_t victim_timestamp, victim_num_items;
-    int victim_idx, victim_by_time = -1, victim_by_items = -1;
+    int victim_idx;
     size_t num_attempts;
+    bnode_victim_class classes[BNODE_NUM_VICTIM_CLASSES];
 
     if (reader_lock(&fileListLock) == 0) {
         // Pick the victim that has the oldest access timestamp
@@ -1182,6 +1759,11 @@ FileBnodeCache* BnodeCacheMgr::chooseEvictionVictim() {
         // the oldest and the newest timestamps is greater than
         // the threshold. Otherwise, pick the victim that has the
         // largest number of cached items among the files.
+        // The selected files are grouped by their priorities and
+        // reservations, and the victim is picked from the first
+        // group that has any file. If any file has a non-default
+        // priority or reservation, all the files are examined instead
+        // of random ones so that they are honored.
         num_attempts = fileList.size() / 10 + 1;
         if (num_attempts > MAX_VICTIM_SELECTIONS) {
             num_attempts = MAX_VICTIM_SELECTIONS;
@@ -1190,34 +1772,46 @@ FileBnodeCache* BnodeCacheMgr::chooseEvictionVictim() {
                 ++num_attempts;
             }
         }
+        bool scan_all = numPrioritizedFiles > 0;
+        if (scan_all) {
+            num_attempts = fileList.size();
+        }
 
         for (size_t i = 0; i < num_attempts && !fileList.empty(); ++i) {
-            victim_idx = rand() % fileList.size();
+            victim_idx = scan_all ? i : rand() % fileList.size();
             victim_timestamp = fileList[victim_idx]->getAccessTimestamp();
             victim_num_items = fileList[victim_idx]->numItems;
 
             if (victim_num_items) {
-                if (victim_timestamp < min_timestamp) {
-                    min_timestamp = victim_timestamp;
-                    victim_by_time = victim_idx;
+                size_t class_idx = fileList[victim_idx]->getPriority();
+                if (fileList[victim_idx]->isWithinReservation()) {
+                    class_idx += BNODE_NUM_PRIORITIES;
+                }
+                bnode_victim_class &vclass = classes[class_idx];
+
+                if (victim_timestamp < vclass.min_timestamp) {
+                    vclass.min_timestamp = victim_timestamp;
+                    vclass.victim_by_time = victim_idx;
                 }
-                if (victim_timestamp > max_timestamp) {
-                    max_timestamp = victim_timestamp;
+                if (victim_timestamp > vclass.max_timestamp) {
+                    vclass.max_timestamp = victim_timestamp;
                 }
-                if (victim_num_items > max_items) {
-                    max_items = victim_num_items;
-                    victim_by_items = victim_idx;
+                if (victim_num_items > vclass.max_items) {
+                    vclass.max_items = victim_num_items;
+                    vclass.victim_by_items = victim_idx;
                 }
             }
         }
 
-        if (max_timestamp - min_timestamp > MIN_TIMESTAMP_GAP) {
-            if (victim_by_time != -1) {
-                ret = fileList.at(victim_by_time);
+        for (size_t i = 0; i < BNODE_NUM_VICTIM_CLASSES && !ret; ++i) {
+            bnode_victim_class &vclass = classes[i];
+            if (vclass.victim_by_items == -1) {
+                continue;
             }
-        } else {
-            if (victim_by_items != -1) {
-                ret = fileList.at(victim_by_items);
+            if (vclass.max_timestamp - vclass.min_timestamp > MIN_TIMESTAMP_GAP) {
+                ret = fileList.at(vclass.victim_by_time);
+            } else {
+                ret = fileList.at(vclass.victim_by_items);
             }
         }
 
@@ -1249,13 +1843,14 @@ void BnodeCacheMgr::removeSelectBnodes(FileMgr* file,
     for (auto node : nodes) {
         size_t shard_num = str_hash(std::to_string(node->getCurOffset())) %
                            fcache->getNumShards();
-        spin_lock(&fcache->shards[shard_num]->lock);
+        writer_lock(&fcache->shards[shard_num]->lock);
 
         // Search shard hash table
         auto entry = fcache->shards[shard_num]->allNodes.find(node->getCurOffset());
         if (entry != fcache->shards[shard_num]->allNodes.end()) {
             // Remove from all nodes list
             fcache->shards[shard_num]->allNodes.erase(node->getCurOffset());
+            fcache->shards[shard_num]->unpublish(node);
             // Remove from dirty index nodes (if present)
             fcache->shards[shard_num]->dirtyIndexNodes.erase(node->getCurOffset());
             // Remove from clean nodes (if present)
@@ -1265,8 +1860,9 @@ void BnodeCacheMgr::removeSelectBnodes(FileMgr* file,
             fcache->numItemsWritten--;
             // Decrement memory usage
             bnodeCacheCurrentUsage.fetch_sub(node->getMemConsumption());
+            fcache->memUsage.fetch_sub(node->getMemConsumption());
         }
 
-        spin_unlock(&fcache->shards[shard_num]->lock);
+        writer_unlock(&fcache->shards[shard_num]->lock);
     }
 }
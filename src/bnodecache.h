@@ -27,6 +27,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "libforestdb/fdb_types.h"
@@ -38,6 +39,7 @@
 
 // Forward declaration
 class FileMgr;
+struct async_io_handle;
 
 /**
  * Index Block Meta structure that is suffixed at the end of
@@ -69,23 +71,64 @@ struct IndexBlkMeta {
     uint8_t marker;
 };
 
+/**
+ * Reader of the bnode cache. Cache hits don't pin the bnodes they return;
+ * instead, a reader enters an epoch before its first read and leaves it once
+ * it doesn't use any of the bnodes anymore. A bnode removed from the cache is
+ * freed only after all the readers that may have seen it have left their
+ * epochs.
+ *
+ * A reader is used by a single thread at a time.
+ */
+class BnodeCacheReader {
+public:
+    BnodeCacheReader();
+
+    ~BnodeCacheReader();
+
+    /* Enter an epoch, if the reader is not in one already */
+    void enter();
+
+    /* Leave the current epoch, if any */
+    void leave();
+
+    bool isActive() const {
+        return active;
+    }
+
+private:
+    friend class BnodeCacheMgr;
+
+    // Global epoch at the time the reader entered its epoch, or zero if the
+    // reader is not in an epoch
+    std::atomic<uint64_t> epoch;
+    bool active;
+};
+
+// Number of slots in the lock-free lookup table of a shard (log2)
+#define BNODE_SHARD_LOOKUP_BITS (10)
+
 /**
  * Shard Bnodecache instance
  */
 class BnodeCacheShard {
 public:
     BnodeCacheShard(size_t _id)
-        : id(_id)
+        : id(_id),
+          lookupTable(new std::atomic<Bnode*>[1 << BNODE_SHARD_LOOKUP_BITS])
     {
-        spin_init(&lock);
+        init_rw_lock(&lock);
         list_init(&cleanNodes);
+        for (size_t i = 0; i < (1 << BNODE_SHARD_LOOKUP_BITS); ++i) {
+            lookupTable[i].store(nullptr, std::memory_order_relaxed);
+        }
     }
 
     ~BnodeCacheShard() {
         for (auto entry : allNodes) {
             delete entry.second;
         }
-        spin_destroy(&lock);
+        destroy_rw_lock(&lock);
     }
 
 private:
@@ -101,10 +144,49 @@ private:
         return list_empty(&cleanNodes) && dirtyIndexNodes.empty();
     }
 
+    static size_t getLookupSlot(uint64_t offset) {
+        return (offset * 0x9e3779b97f4a7c15ULL) >>
+               (64 - BNODE_SHARD_LOOKUP_BITS);
+    }
+
+    /**
+     * Find a bnode without grabbing the shard lock. A slot holds only one of
+     * the bnodes mapped to it, so that a miss here doesn't mean that the
+     * bnode is not cached. The caller should be in a reader epoch.
+     */
+    Bnode* lookup(uint64_t offset) {
+        Bnode* node = lookupTable[getLookupSlot(offset)].load(
+                                                std::memory_order_acquire);
+        if (node && node->getCurOffset() == offset) {
+            return node;
+        }
+        return nullptr;
+    }
+
+    // Caller should grab the shard lock (in either mode) and the node
+    // should be in 'allNodes'.
+    void publish(Bnode* node) {
+        lookupTable[getLookupSlot(node->getCurOffset())].store(
+                                                node, std::memory_order_release);
+    }
+
+    // Caller should grab the shard lock in exclusive mode.
+    void unpublish(Bnode* node) {
+        std::atomic<Bnode*>& slot =
+            lookupTable[getLookupSlot(node->getCurOffset())];
+        if (slot.load(std::memory_order_relaxed) == node) {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
     // Shard id
     size_t id;
-    // Lock to synchronize access to cleanNodes, dirtyIndexNodes, allNodes
-    spin_t lock;
+    // Lock to synchronize access to cleanNodes, dirtyIndexNodes, allNodes.
+    // Cache misses grab it in shared mode first.
+    fdb_rw_lock lock;
+    // Direct-mapped table of a subset of 'allNodes', which cache hits
+    // look up without grabbing the lock
+    std::unique_ptr<std::atomic<Bnode*>[]> lookupTable;
     // LRU list of clean index nodes
     struct list cleanNodes;
     // Tree map of dirty index nodes
@@ -140,6 +222,9 @@ public:
     /* Fetch the total number of items written to the bnode cache */
     uint64_t getNumItemsWritten(void) const;
 
+    /* Fetch the number of reads that missed the bnode cache */
+    uint64_t getNumMisses(void) const;
+
     /* Get the last time of access for this bnode cache */
     uint64_t getAccessTimestamp(void) const;
 
@@ -164,6 +249,18 @@ public:
     /* Sets eviction in progress flag */
     bool setEvictionInProgress(bool to);
 
+    /* Fetch the eviction priority of the file */
+    fdb_cache_priority_t getPriority(void) const;
+
+    /* Check if the memory usage is within the reservation of the file */
+    bool isWithinReservation(void) const;
+
+    /* Check if the memory usage has exceeded the limit of the file */
+    bool isOverCacheLimit(void) const;
+
+    /* Check if the file has a non-default eviction priority or reservation */
+    bool isPrioritized(void) const;
+
 private:
     friend class BnodeCacheMgr;
 
@@ -177,10 +274,20 @@ private:
     std::atomic<uint64_t> numVictims;
     std::atomic<uint64_t> numItems;
     std::atomic<uint64_t> numItemsWritten;
+    // Reads that went to the file, not counting prefetched nodes
+    std::atomic<uint64_t> numMisses;
     std::atomic<uint64_t> accessTimestamp;
 
     // Flag if eviction is running on this victim
     std::atomic<bool> evictionInProgress;
+
+    // Memory used by the bnodes of this file
+    std::atomic<uint64_t> memUsage;
+    // Bnode cache reservation and limit of the file in bytes (zero limit
+    // means no limit), and the eviction priority of the file
+    uint64_t minReservation;
+    uint64_t maxLimit;
+    fdb_cache_priority_t priority;
 };
 
 typedef std::pair<Bnode*, cs_off_t> bnode_offset_t;
@@ -191,6 +298,8 @@ typedef std::pair<Bnode*, cs_off_t> bnode_offset_t;
  * for the bnode cache and the eviction operations.
  */
 class BnodeCacheMgr {
+    friend class BnodeCacheReader;
+
 public:
     /**
      * Instantiate the bnode cache manager
@@ -222,7 +331,9 @@ public:
      static void eraseFileHistory(FileMgr* file);
 
     /**
-     * Fetches bnode at the specified offset.
+     * Fetches bnode at the specified offset. The bnode is not pinned, so the
+     * caller should be in a reader epoch (see BnodeCacheReader) and must not
+     * use the bnode after leaving it.
      *
      * @param file Pointer to the FileMgr instance
      * @param node Pointer reference to the retrieved bnode
@@ -232,6 +343,59 @@ public:
      */
     int read(FileMgr* file, Bnode** node, cs_off_t offset);
 
+    /**
+     * Same as above, but the returned bnode compares its keys with the
+     * given function. The function is set when the bnode is loaded, as
+     * cached bnodes are shared by readers and are never modified; a cached
+     * bnode that was loaded with another function (e.g., by the warmup) is
+     * replaced with a new copy.
+     */
+    int read(FileMgr* file, Bnode** node, cs_off_t offset,
+             btree_new_cmp_func *cmp_func);
+
+    /**
+     * Loads the bnodes at the given offsets into the cache ahead of their
+     * use, without pinning them or refreshing the recency of cached ones.
+     * With an async I/O handle, the reads of the uncached nodes are only
+     * submitted and the nodes are inserted by reapPrefetch(); nodes that
+     * span multiple blocks are left to be read on demand. Without one, the
+     * uncached nodes are read synchronously, and the caller should be in a
+     * reader epoch (see BnodeCacheReader).
+     *
+     * @param file Pointer to the FileMgr instance
+     * @param aio_handle Async I/O handle initialized for the file, or null
+     * @param offsets Array of bnode offsets to be loaded
+     * @param num Number of offsets in the array
+     * @param cmp_func Key comparison function of the loaded bnodes
+     *
+     * @returns the number of reads submitted with an async I/O handle,
+     *          or the number of bnodes loaded without one
+     */
+    size_t prefetch(FileMgr* file,
+                    struct async_io_handle *aio_handle,
+                    const cs_off_t *offsets,
+                    size_t num,
+                    btree_new_cmp_func *cmp_func);
+
+    /**
+     * Inserts the bnodes of the completed prefetch reads into the cache.
+     * The buffers of the async I/O handle must not be reused for new reads
+     * until all the submitted ones are reaped.
+     *
+     * @param file Pointer to the FileMgr instance
+     * @param aio_handle Async I/O handle the reads were submitted with
+     * @param num_pending Number of submitted reads not reaped yet
+     * @param wait Wait for all the pending reads to complete
+     * @param cmp_func Key comparison function of the loaded bnodes
+     *
+     * @returns the number of reads reaped
+     */
+    size_t reapPrefetch(FileMgr* file,
+                        struct async_io_handle *aio_handle,
+                        size_t num_pending,
+                        bool wait,
+                        btree_new_cmp_func *cmp_func);
+
     /**
      * Writes/overwrites a btree node at the specified offset.
      *
@@ -274,15 +438,19 @@ public:
     fdb_status addLastBlockMeta(FileMgr* file, bid_t bid);
 
     /**
-     * Removes the bnode from the cache iff the ref count is less
-     * than or equal to one.
+     * Removes the bnode from the cache. It is freed once all the readers
+     * that may still use it have left their epochs.
      *
      * @param file Pointer to the FileMgr instance
      * @param node Pointer to the Bnode
+     * @param keep_unwritten If true, the bnode is not removed if it has not
+     *                       been written into the file yet, as a delta record
+     *                       will refer to it
      *
      * @returns FDB_RESULT_SUCCESS on success
      */
-    fdb_status invalidateBnode(FileMgr* file, Bnode* node);
+    fdb_status invalidateBnode(FileMgr* file, Bnode* node,
+                               bool keep_unwritten = false);
 
     /**
      * Create a file block cache for a given file
@@ -313,6 +481,15 @@ public:
      */
     void removeDirtyBnodes(FileMgr* file);
 
+    /**
+     * Collect the offsets of all the clean bnodes cached for a given file,
+     * roughly ordered from the most recently used to the least recently used.
+     *
+     * @param file Pointer to the file manager instance
+     * @param offsets Vector that the bnode offsets are appended to
+     */
+    void getHotBnodes(FileMgr* file, std::vector<cs_off_t> &offsets);
+
     void updateBnodeCacheLimit(uint64_t to) {
         bnodeCacheLimit.store(to);
     }
@@ -325,7 +502,15 @@ public:
      * Fetch the current memory usage by the bnodeCache.
      */
     uint64_t getMemoryUsage() {
-        return bnodeCacheCurrentUsage.load();
+        // Evicted bnodes still take memory until they are freed
+        return bnodeCacheCurrentUsage.load() + retiredNodesMemUsage.load();
+    }
+
+    /**
+     * Fetch the memory limit of the bnodeCache.
+     */
+    uint64_t getCacheLimit() {
+        return bnodeCacheLimit.load();
     }
 
 private:
@@ -352,6 +537,28 @@ private:
      */
     void updateParams(uint64_t cache_size, uint64_t flush_limit);
 
+    /**
+     * Fetches bnode at the specified offset, see read(). A prefetching read
+     * neither counts as a miss nor refreshes the recency of a cached bnode.
+     * A loaded bnode compares its keys with 'cmp_func', and a cached one is
+     * only returned if it does the same, unless 'check_cmp_func' is false.
+     */
+    int readInternal(FileMgr* file, Bnode** node, cs_off_t offset,
+                     bool prefetch, bool check_cmp_func,
+                     btree_new_cmp_func *cmp_func);
+
+    /**
+     * Remove a clean bnode from the cache, and retire it as other readers
+     * may still be using it. The shard lock should be grabbed by the caller.
+     */
+    void unlinkCleanBnode_UNLOCKED(FileBnodeCache* fcache, size_t shard_num,
+                                   Bnode* node);
+
+    /**
+     * Check if the bnode at the given offset is cached for a file.
+     */
+    static bool isCached(FileBnodeCache* fcache, cs_off_t offset);
+
 
     /**
      * Discard all the clean bnodes for a given file from the bnode cache.
@@ -384,12 +591,32 @@ private:
      * @param file Pointer to file manager instance
      * @param node Pointer reference to the retrieved bnode
      * @param offset offset where the the bnode is to be retrieved from
+     * @param delta_buf Raw data returned if the bnode is a delta record, in
+     *                  which case the retrieved bnode is empty and should be
+     *                  passed to resolveDeltaRecord()
      *
      * @return FDB_RESULT_SUCCESS on success.
      */
     fdb_status fetchFromFile(FileMgr* file,
                              Bnode** node,
-                             cs_off_t offset);
+                             cs_off_t offset,
+                             void **delta_buf);
+
+    /**
+     * Rebuild a bnode from its delta record, by applying the record to the
+     * previous version of the bnode. The caller should not hold any shard
+     * lock, as the previous version is read through the cache.
+     *
+     * @param file Pointer to file manager instance
+     * @param node Pointer reference to the empty bnode returned by
+     *             fetchFromFile(), replaced with the rebuilt bnode
+     * @param delta_buf Raw data of the delta record, freed by this function
+     *
+     * @return FDB_RESULT_SUCCESS on success.
+     */
+    fdb_status resolveDeltaRecord(FileMgr* file,
+                                  Bnode** node,
+                                  void *delta_buf);
 
     /**
      * Flush some dirty bnodes from a given file bnode cache
@@ -424,11 +651,29 @@ private:
      * Perform cache eviction
      *
      * @param node_to_protect Bnode that should not be evicted during this call.
+     * @param fcache File bnode cache that node_to_protect was cached in. If
+     *        the file has exceeded its own limit, its bnodes are evicted first.
      */
-    void performEviction(Bnode *node_to_protect);
+    void performEviction(Bnode *node_to_protect,
+                         FileBnodeCache* fcache = nullptr);
 
     /**
-     * Choose a file bnode cache that is going to be a victim for eviction
+     * Evict clean bnodes from a given victim file, until the memory usage
+     * falls below the limit.
+     *
+     * @param victim File bnode cache whose bnodes are evicted
+     * @param node_to_protect Bnode that should not be evicted during this call
+     * @param file_limit True if the victim's own limit is to be satisfied,
+     *        rather than the global cache limit
+     * @return False if flushing dirty bnodes of the victim failed
+     */
+    bool evictFromFile(FileBnodeCache* victim, Bnode* node_to_protect,
+                       bool file_limit);
+
+    /**
+     * Choose a file bnode cache that is going to be a victim for eviction.
+     * Files with lower priorities are chosen first, and files within their
+     * reservations are chosen only if no other file can be chosen.
      *
      * @return Pointer to a file bnode cache that is chosen as an eviction victim
      */
@@ -486,10 +731,42 @@ private:
     fdb_rw_lock fileListLock;
     // File block cache list
     std::vector<FileBnodeCache*> fileList;
+    // Number of files in the file list that have non-default eviction
+    // priorities or reservations (guarded by fileListLock)
+    size_t numPrioritizedFiles;
     // File zombies
     std::list<FileBnodeCache*> fileZombies;
 
     //Singleton bnode cache manager and a mutex guard
     static std::atomic<BnodeCacheMgr*> instance;
     static std::mutex instanceMutex;
+
+    /**
+     * Hand over a bnode that was removed from the cache, to be freed once
+     * no reader epoch can refer to it anymore.
+     */
+    static void retireBnode(Bnode* node);
+
+    /**
+     * Free the retired bnodes that no reader can refer to anymore.
+     *
+     * @param force If false, nothing is done unless enough bnodes have been
+     *              retired. If true, all the retired bnodes are freed
+     *              regardless of the readers.
+     */
+    static void reclaimBnodes(bool force);
+
+    // Epoch that is advanced every time a bnode is retired (starts at 1, as
+    // zero means that a reader is not in an epoch)
+    static std::atomic<uint64_t> globalEpoch;
+    // Registered readers and a mutex guard
+    static std::unordered_set<BnodeCacheReader*> readers;
+    static std::mutex readersMutex;
+    // Retired bnodes along with the epochs at which they were retired,
+    // and a mutex guard
+    static std::vector<std::pair<uint64_t, Bnode*>> retiredNodes;
+    static std::atomic<size_t> numRetiredNodes;
+    // Memory consumed by the retired bnodes that are not freed yet
+    static std::atomic<uint64_t> retiredNodesMemUsage;
+    static std::mutex retiredNodesMutex;
 };
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <algorithm>
 #include <unordered_map>
 
 #include "libforestdb/forestdb.h"
@@ -26,6 +27,7 @@
 #include "internal_types.h"
 #include "bnode.h"
 #include "bnodemgr.h"
+#include "version.h"
 
 
 static const size_t block_meta_size = sizeof(IndexBlkMeta);
@@ -36,7 +38,11 @@ BnodeMgr::BnodeMgr() :
     curOffset(0),
     logCallback(nullptr),
     nlivenodes(0),
-    ndeltanodes(0)
+    ndeltanodes(0),
+    aioReady(false),
+    aioTried(false),
+    numPrefetchInFlight(0),
+    prefetchCmpFunc(nullptr)
 { }
 
 BnodeMgr::~BnodeMgr()
@@ -46,42 +52,87 @@ BnodeMgr::~BnodeMgr()
         bnode = entry;
         delete bnode;
     }
+    destroyAioHandle();
 }
 
 void BnodeMgr::setFile(FileMgr *_file)
 {
+    if (file != _file) {
+        cancelPrefetch();
+        destroyAioHandle();
+        curBid = BLK_NOT_FOUND;
+        curOffset = 0;
+    }
     file = _file;
 }
 
+void BnodeMgr::destroyAioHandle()
+{
+    if (aioReady) {
+        reapPrefetchedNodes(true);
+        file->getOps()->aio_destroy(file->getFopsHandle(), &aioHandle);
+    }
+    aioReady = false;
+    aioTried = false;
+}
+
 void BnodeMgr::addDirtyNode(Bnode* bnode)
 {
+    if (file) {
+        bnode->setPrefixCompression(ver_bnode_prefix_support(file->getVersion()));
+    }
     dirtyNodes.insert( bnode );
 }
 
 void BnodeMgr::removeDirtyNode(Bnode* bnode)
 {
     dirtyNodes.erase( bnode );
+
+    // the previous versions of the node are not referred to anymore.
+    for (auto &entry: bnode->getDeltaChain()) {
+        markRegionStale(entry.offset, entry.size, entry.bids);
+    }
+    bnode->getDeltaChain().clear();
+    bnode->releaseDeltaBase();
+}
+
+bool BnodeMgr::isDeltaRecordEnabled() const
+{
+    return file && ver_bnode_delta_support(file->getVersion());
 }
 
 Bnode* BnodeMgr::getMutableNodeFromClean(Bnode* clean_bnode)
 {
     Bnode* bnode_out;
-    fdb_status ret = BnodeCacheMgr::get()->invalidateBnode(file, clean_bnode);
-
-    // make the region of previous clean node as stale.
-    markBnodeStale(clean_bnode);
-
-    if (ret == FDB_RESULT_SUCCESS) {
-        // clean node is ejected from cache.
-        // now we can modify it as a dirty node without cloning.
-        releaseCleanNode(clean_bnode);
-        clean_bnode->setCurOffset(BLK_NOT_FOUND);
-        clean_bnode->clearBidList();
-        bnode_out = clean_bnode;
+    Bnode* delta_base = nullptr;
+    std::vector<BnodeRegion> delta_chain;
+    bool delta_enabled = isDeltaRecordEnabled();
+    // The clean node is cloned below in any case, so the result is ignored:
+    // the node may have been evicted already (FDB_RESULT_KEY_NOT_FOUND), or
+    // kept in the cache until its pending write is flushed, as the delta
+    // record refers to it (FDB_RESULT_FILE_IS_BUSY).
+    BnodeCacheMgr::get()->invalidateBnode(file, clean_bnode, delta_enabled);
+
+    if (delta_enabled) {
+        // The clean node is still needed if the new version is written as
+        // a delta record against it. Keep a copy of it, as the clean node
+        // is freed once no reader uses it anymore.
+        delta_chain = clean_bnode->getDeltaChain();
+        delta_chain.push_back(BnodeRegion(clean_bnode->getCurOffset(),
+                                          clean_bnode->getDiskSize(),
+                                          clean_bnode->getBidList()));
+        delta_base = clean_bnode->cloneNode();
     } else {
-        // clean node cannot be ejected.
-        // make a dirty clone of the node.
-        bnode_out = clean_bnode->cloneNode();
+        // make the region of previous clean node as stale.
+        markBnodeStale(clean_bnode);
+    }
+
+    // Cache hits don't pin the nodes, so other readers may still be using
+    // the clean node even after it is removed from the cache.
+    // Make a dirty clone of the node.
+    bnode_out = clean_bnode->cloneNode();
+    if (delta_base) {
+        bnode_out->setDeltaBase(delta_base, delta_chain);
     }
     addDirtyNode(bnode_out);
 
@@ -90,11 +141,17 @@ Bnode* BnodeMgr::getMutableNodeFromClean(Bnode* clean_bnode)
 
 void BnodeMgr::markBnodeStale(Bnode *bnode)
 {
-    size_t arr_size = bnode->getBidListSize();
+    markRegionStale(bnode->getCurOffset(), bnode->getDiskSize(),
+                    bnode->getBidList());
+}
+
+void BnodeMgr::markRegionStale(uint64_t node_offset,
+                               size_t node_size,
+                               const std::vector<bid_t>& bids)
+{
+    size_t arr_size = bids.size();
     size_t i;
     size_t blocksize = file->getBlockSize();
-    uint64_t node_offset = bnode->getCurOffset();
-    size_t node_size = bnode->getNodeSize();
 
     if (arr_size == 1) {
         // the node is written in a single block
@@ -145,53 +202,149 @@ void BnodeMgr::markBnodeStale(Bnode *bnode)
             file->addStaleRegion(node_offset, blocksize - (node_offset % blocksize));
         } else if (i < arr_size - 1) {
             // intermediate block => entire block
-            file->addStaleRegion(bnode->getBidFromList(i) * blocksize, blocksize);
+            file->addStaleRegion(bids[i] * blocksize, blocksize);
         } else {
             // the last block
             size_t rest_size = node_size;
             rest_size += sizeof(IndexBlkMeta) * (arr_size - 1); // meta size
             rest_size -= (blocksize - (node_offset % blocksize)); // first block
             rest_size -= (blocksize * (arr_size - 2)); // intermediate blocks
-            file->addStaleRegion(bnode->getBidFromList(i) * blocksize, rest_size);
+            file->addStaleRegion(bids[i] * blocksize, rest_size);
         }
     }
 }
 
-Bnode* BnodeMgr::readNode(uint64_t offset)
+Bnode* BnodeMgr::readNode(uint64_t offset, btree_new_cmp_func *cmp_func)
 {
     Bnode* bnode_out;
 
-    int ret = BnodeCacheMgr::get()->read(file, &bnode_out, offset);
+    cacheReader.enter();
+    int ret = BnodeCacheMgr::get()->read(file, &bnode_out, offset, cmp_func);
     if (ret <= 0) {
         fdb_log(logCallback, static_cast<fdb_status>(ret),
                 "Failed to read the B+tree index node at "
                 "offset %" _F64 " in a file %s",
                 offset, file->getFileName());
+        if (cleanNodes.empty()) {
+            cacheReader.leave();
+        }
         return nullptr;
     }
-    bnode_out->setCurOffset(offset);
 
-    if (cleanNodes.find(bnode_out) != cleanNodes.end()) {
-        // Same clean node already exists in the current BnodeMgr,
-        // so we should not increase its ref count once again.
-        // => decrease the ref count that was increased by BnodeCache.
-        bnode_out->decRefCount();
-    } else {
-        cleanNodes.insert( bnode_out );
-    }
+    cleanNodes.insert( bnode_out );
 
     return bnode_out;
 }
 
+size_t BnodeMgr::prefetchNodes(const cs_off_t *offsets, size_t num,
+                               btree_new_cmp_func *cmp_func)
+{
+    if (!file || !num) {
+        return 0;
+    }
+    if (!aioTried) {
+        aioTried = true;
+        memset(&aioHandle, 0x0, sizeof(aioHandle));
+        aioHandle.queue_depth = BTREEV2_PREFETCH_DEPTH;
+        aioHandle.block_size = file->getBlockSize();
+        aioHandle.fops_handle = file->getFopsHandle();
+        aioReady = (file->getOps()->aio_init(file->getFopsHandle(),
+                                             &aioHandle)
+                    == FDB_RESULT_SUCCESS);
+    }
+    if (!aioReady) {
+        if (pendingPrefetch.empty()) {
+            prefetchCmpFunc = cmp_func;
+        } else if (prefetchCmpFunc != cmp_func) {
+            reapPrefetchedNodes();
+            prefetchCmpFunc = cmp_func;
+        }
+        pendingPrefetch.insert(pendingPrefetch.end(), offsets, offsets + num);
+        return num;
+    }
+    // The buffers of the handle are reused by the new reads.
+    if (numPrefetchInFlight) {
+        reapPrefetchedNodes(true);
+    }
+    prefetchCmpFunc = cmp_func;
+    numPrefetchInFlight = BnodeCacheMgr::get()->prefetch(file, &aioHandle,
+                                                         offsets, num,
+                                                         cmp_func);
+    return num;
+}
+
+void BnodeMgr::reapPrefetchedNodes(bool wait)
+{
+    if (numPrefetchInFlight) {
+        numPrefetchInFlight -= BnodeCacheMgr::get()->reapPrefetch(
+                                    file, &aioHandle, numPrefetchInFlight,
+                                    wait, prefetchCmpFunc);
+    }
+    if (pendingPrefetch.empty()) {
+        return;
+    }
+
+    // Read the deferred nodes in the file order.
+    std::sort(pendingPrefetch.begin(), pendingPrefetch.end());
+    cacheReader.enter();
+    BnodeCacheMgr::get()->prefetch(file, nullptr, pendingPrefetch.data(),
+                                   pendingPrefetch.size(), prefetchCmpFunc);
+    if (cleanNodes.empty()) {
+        cacheReader.leave();
+    }
+    pendingPrefetch.clear();
+}
+
+void BnodeMgr::cancelPrefetch()
+{
+    pendingPrefetch.clear();
+    reapPrefetchedNodes(true);
+}
+
+void BnodeMgr::prepareDeltaRecord( Bnode *bnode )
+{
+    std::vector<BnodeRegion>& chain = bnode->getDeltaChain();
+    size_t max_size = bnode->getDiskSize() * BTREEV2_DELTA_MAX_RATIO / 100;
+
+    // The first region is the full image of the node, and the rest are the
+    // delta records on top of it. Bound the amount of data to be read to
+    // rebuild the node.
+    for (size_t i = 1; i < chain.size() && max_size; ++i) {
+        max_size = (chain[i].size < max_size) ? max_size - chain[i].size : 0;
+    }
+
+    if (chain.size() > BTREEV2_DELTA_MAX_CHAIN || !max_size ||
+        !bnode->prepareDelta(max_size)) {
+        // Consolidate: write the entire node, so that none of the previous
+        // versions is referred to anymore.
+        for (auto &entry: chain) {
+            markRegionStale(entry.offset, entry.size, entry.bids);
+        }
+        chain.clear();
+    }
+    bnode->releaseDeltaBase();
+}
+
 uint64_t BnodeMgr::assignDirtyNodeOffset( Bnode *bnode )
 {
+    // the on-disk size of the node is fixed from here on.
+    bnode->refreshCommonPrefixLen();
+    if (bnode->getDeltaBase()) {
+        prepareDeltaRecord(bnode);
+    }
+
     size_t blocksize = file->getBlockSize();
     size_t blocksize_avail = blocksize - block_meta_size;
-    size_t nodesize = bnode->getNodeSize();
+    size_t nodesize = bnode->getDiskSize();
     uint64_t offset;
 
+    if ( curBid != BLK_NOT_FOUND && !file->isWritable( curBid ) ) {
+        // the block kept by markEndOfDirtyIndexBlocks() has been committed
+        // by another handle; committed blocks are never written again.
+        closeCurBlock();
+    }
+
     if ( curBid == BLK_NOT_FOUND ||
-         !file->isWritable( curBid ) ||
          curOffset + 4 > blocksize_avail ) {
         // allocate a new block if
         // 1) first block has not been allocated yet, OR
@@ -245,14 +398,43 @@ uint64_t BnodeMgr::assignDirtyNodeOffset( Bnode *bnode )
     return offset;
 }
 
-void BnodeMgr::markEndOfIndexBlocks()
+void BnodeMgr::closeCurBlock()
 {
-    // mark the rest of space of the current block as stale
     size_t blocksize = file->getBlockSize();
-    file->addStaleRegion(curBid * blocksize + curOffset, blocksize - curOffset);
+    if (curBid != BLK_NOT_FOUND && curOffset < blocksize) {
+        file->addStaleRegion(curBid * blocksize + curOffset,
+                             blocksize - curOffset);
+    }
+    curBid = BLK_NOT_FOUND;
+    curOffset = 0;
+}
+
+void BnodeMgr::markEndOfIndexBlocks()
+{
+    if (curBid == BLK_NOT_FOUND) {
+        return;
+    }
 
     // add block marker
     BnodeCacheMgr::get()->addLastBlockMeta(file, curBid);
+
+    // mark the rest of space of the current block as stale
+    closeCurBlock();
+}
+
+void BnodeMgr::markEndOfDirtyIndexBlocks()
+{
+    if (curBid == BLK_NOT_FOUND) {
+        return;
+    }
+
+    // add block marker, which is overwritten if the next batch continues
+    // a node into the next block.
+    BnodeCacheMgr::get()->addLastBlockMeta(file, curBid);
+
+    // The rest of space is used by the next batch before the commit, so the
+    // small nodes of consecutive batches share the block. It is marked as
+    // stale by the commit (or once the block turns out to be committed).
 }
 
 void BnodeMgr::moveDirtyNodesToBcache()
@@ -278,16 +460,16 @@ void BnodeMgr::moveDirtyNodesToBcache()
 
 void BnodeMgr::releaseCleanNode( Bnode *bnode )
 {
-    bnode->decRefCount();
     cleanNodes.erase( bnode );
+    if (cleanNodes.empty()) {
+        cacheReader.leave();
+    }
 }
 
 void BnodeMgr::releaseCleanNodes()
 {
-    for (auto &entry: cleanNodes) {
-        entry->decRefCount();
-    }
     cleanNodes.clear();
+    cacheReader.leave();
 }
 
 
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 
 #include "common.h"
 #include "avltree.h"
@@ -81,11 +82,9 @@ public:
     void removeDirtyNode(Bnode* bnode);
 
     /**
-     * Make given clean node writable.
-     * If other thread is currently accessing the same clean node,
-     * create a dirty clone of the node. If the clean node is being
-     * accessed by the caller thread only, then directly switch the
-     * clean node as dirty.
+     * Make given clean node writable, by removing it from the cache and
+     * creating a dirty clone of it. The clean node itself is not modified,
+     * as other threads may still be accessing it.
      *
      * @param clean_bnode Pointer to clean node.
      * @return Writable dirty node.
@@ -97,15 +96,54 @@ public:
      * This API first searches the in-memory cache, and then read the DB
      * file on cache miss.
      *
+     * The node is shared with other readers, and should not be modified.
+     *
      * @param offset File offset of the index node to read.
+     * @param cmp_func Key comparison function of the B+tree that the node
+     *        belongs to.
      * @return Bnode class instance.
      */
-    Bnode* readNode(uint64_t offset);
+    Bnode* readNode(uint64_t offset, btree_new_cmp_func *cmp_func = nullptr);
+
+    /**
+     * Load B+tree nodes at the given offsets into the cache ahead of their
+     * use, so that a forward scan doesn't wait for each of them in turn.
+     * The reads are submitted through asynchronous I/O and reaped later by
+     * reapPrefetchedNodes(). If asynchronous I/O is not available for the
+     * file, the offsets are kept and read in one batch by the next
+     * reapPrefetchedNodes() call instead.
+     *
+     * @param offsets File offsets of the index nodes to load.
+     * @param num Number of offsets.
+     * @param cmp_func Key comparison function of the B+tree that the nodes
+     *        belong to.
+     * @return Number of nodes requested to be loaded.
+     */
+    size_t prefetchNodes(const cs_off_t *offsets, size_t num,
+                         btree_new_cmp_func *cmp_func);
+
+    /**
+     * Insert the nodes of the completed prefetch reads into the cache,
+     * or read the deferred ones if asynchronous I/O is not available.
+     *
+     * @param wait Wait for all the in-flight prefetch reads.
+     */
+    void reapPrefetchedNodes(bool wait = false);
+
+    /**
+     * Drop the deferred prefetch requests and wait for the in-flight ones.
+     */
+    void cancelPrefetch();
 
     /**
      * Calculate and assign a DB file offset, where the given dirty node
      * will be written back. Note that 16-byte meta data is added for
      * each index block, and it is also included in the offset calculation.
+     * If the node has been derived from a clean node, only its changes are
+     * written as a delta record, unless the delta chain becomes too long or
+     * the changes are not small enough.
+     * Nodes are packed into the latest block as long as it has not been
+     * committed, even across batches (see markEndOfDirtyIndexBlocks()).
      *
      * @param bnode Pointer to dirty node.
      * @return Offset where the dirty node will be written.
@@ -115,24 +153,34 @@ public:
     /**
      * After writing multiple B+tree nodes, mark the rest of space in the last
      * block as stale and append index block meta including block marker.
+     * This should be called for the batch that is committed.
      */
     void markEndOfIndexBlocks();
 
+    /**
+     * Same as markEndOfIndexBlocks(), but for the batch written by a WAL
+     * flush that is not committed yet (i.e., dirty WAL flush). The rest of
+     * space in the last block is kept for the next batch, so that the small
+     * nodes of many KV stores are packed together until the commit.
+     */
+    void markEndOfDirtyIndexBlocks();
+
     /**
      * Move all dirty nodes into B+tree node cache.
      */
     void moveDirtyNodesToBcache();
 
     /**
-     * Decrease the reference counter of the given clean node, to make it
-     * ejectable from the cache.
+     * Stop using the given clean node. The reader epoch of the bnode cache
+     * is left once no clean node is used anymore.
      *
-     * @param bnode Pointer to
+     * @param bnode Pointer to the clean node.
      */
     void releaseCleanNode( Bnode *bnode );
 
     /**
-     * Decrease reference counters of all present clean nodes.
+     * Stop using all present clean nodes, and leave the reader epoch of
+     * the bnode cache.
      */
     void releaseCleanNodes();
 
@@ -147,10 +195,49 @@ private:
      */
     void markBnodeStale(Bnode *bnode);
 
+    /**
+     * Mark the given on-disk region of a Bnode as stale.
+     *
+     * @param node_offset File offset of the node.
+     * @param node_size On-disk size of the node.
+     * @param bids List of block IDs where the node is written.
+     */
+    void markRegionStale(uint64_t node_offset,
+                         size_t node_size,
+                         const std::vector<bid_t>& bids);
+
+    /**
+     * Return true if dirty nodes can be written as delta records.
+     */
+    bool isDeltaRecordEnabled() const;
+
+    /**
+     * Mark the rest of space in the latest block as stale, as no more nodes
+     * will be written into it.
+     */
+    void closeCurBlock();
+
+    /**
+     * Decide if the given dirty node is written as a delta record, and
+     * build the record if so. Otherwise, the previous versions of the node
+     * are marked as stale.
+     *
+     * @param bnode Pointer to dirty node.
+     */
+    void prepareDeltaRecord(Bnode *bnode);
+
+    /**
+     * Release the async I/O handle used for prefetching, if any.
+     */
+    void destroyAioHandle();
+
     // FileMgr instance.
     FileMgr *file;
     // Set of clean nodes that are currently accessed by the B+tree.
     std::unordered_set<Bnode*> cleanNodes;
+    // Reader epoch of the bnode cache, which is held while 'cleanNodes'
+    // is not empty.
+    BnodeCacheReader cacheReader;
     // Set of dirty nodes that are created in the current batch.
     std::unordered_set<Bnode*> dirtyNodes;
     // Latest block ID for dirty node allocation.
@@ -165,5 +252,17 @@ private:
     int64_t nlivenodes;
     // The number of delta nodes.
     int64_t ndeltanodes;
+    // Async I/O handle for node prefetching, initialized on first use.
+    struct async_io_handle aioHandle;
+    // True if 'aioHandle' is initialized.
+    bool aioReady;
+    // True if the initialization of 'aioHandle' was already attempted.
+    bool aioTried;
+    // Number of prefetch reads submitted through 'aioHandle' not reaped yet.
+    size_t numPrefetchInFlight;
+    // Offsets of the nodes to prefetch without asynchronous I/O.
+    std::vector<cs_off_t> pendingPrefetch;
+    // Key comparison function of the nodes being prefetched.
+    btree_new_cmp_func *prefetchCmpFunc;
 };
 
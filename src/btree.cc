@@ -717,6 +717,104 @@ btree_result BTree::find(void *key, void *value_buf)
     return BTREE_RESULT_SUCCESS;
 }
 
+btree_result BTree::scanLeaves(btree_leaf_func *func, void *ctx)
+{
+    btree_result br = scanLeavesFrom(root_bid, height, func, ctx);
+    bhandle->operationEnd();
+    return br;
+}
+
+btree_result BTree::scanLeavesFrom(bid_t bid, uint16_t level,
+                                   btree_leaf_func *func, void *ctx)
+{
+    void *addr;
+    uint8_t *k = alca(uint8_t, ksize);
+    uint8_t *v = alca(uint8_t, vsize);
+    struct bnode *node;
+    btree_result br = BTREE_RESULT_SUCCESS;
+    bid_t child;
+    idx_t i;
+
+    addr = bhandle->read(bid);
+    if (!addr) {
+        return BTREE_RESULT_FAIL;
+    }
+    node = _fetch_bnode(addr, level);
+    if (node->level != level) {
+        return BTREE_RESULT_FAIL;
+    }
+
+    kv_ops->initKVVar(k, v);
+    if (level == 1) {
+        // the root node is the only leaf node
+        if (node->nentry > 0) {
+            kv_ops->getKV(node, 0, k, NULL);
+            func(k, bid, ctx);
+        }
+    } else {
+        for (i = 0; i < node->nentry && br == BTREE_RESULT_SUCCESS; ++i) {
+            kv_ops->getKV(node, i, k, v);
+            child = kv_ops->value2bid(v);
+            child = _endian_decode(child);
+            if (level == 2) {
+                func(k, child, ctx);
+            } else {
+                br = scanLeavesFrom(child, level - 1, func, ctx);
+            }
+        }
+    }
+    kv_ops->freeKVVar(k, v);
+    return br;
+}
+
+btree_result BTree::findInLeaf(bid_t leaf_bid, void *key, void *value_buf,
+                               int *position)
+{
+    void *addr;
+    uint8_t *k = alca(uint8_t, ksize);
+    uint8_t *v = alca(uint8_t, vsize);
+    struct bnode *node;
+    btree_result br = BTREE_RESULT_FAIL;
+    idx_t idx;
+
+    addr = bhandle->read(leaf_bid);
+    if (!addr) {
+        *position = BTREE_LEAF_INVALID;
+        return BTREE_RESULT_FAIL;
+    }
+    node = _fetch_bnode(addr, 1);
+    if (node->level != 1 || node->nentry == 0 ||
+        __ksize(node->kvsize) != ksize || __vsize(node->kvsize) != vsize) {
+        bhandle->operationEnd();
+        *position = BTREE_LEAF_INVALID;
+        return BTREE_RESULT_FAIL;
+    }
+
+    kv_ops->initKVVar(k, v);
+    kv_ops->getKV(node, node->nentry - 1, k, NULL);
+    if (kv_ops->cmp(key, k, aux) > 0) {
+        *position = BTREE_LEAF_AFTER;
+    } else {
+        // findEntry() fails only if the key is smaller than the first key
+        idx = findEntry(node, key);
+        if (idx == BTREE_IDX_NOT_FOUND) {
+            *position = BTREE_LEAF_BEFORE;
+        } else {
+            kv_ops->getKV(node, idx, k, v);
+            if (!kv_ops->cmp(key, k, aux)) {
+                kv_ops->setValue(value_buf, v);
+                br = BTREE_RESULT_SUCCESS;
+            } else {
+                *position = BTREE_LEAF_ABSENT;
+            }
+        }
+    }
+
+    bhandle->operationEnd();
+    kv_ops->freeKVVar(k, v);
+    return br;
+}
+
 int BTree::splitNode(void *key, struct bnode **node, bid_t *bid, idx_t *idx,
                      int i, struct list *kv_ins_list, size_t nsplitnode,
                      void *k, void *v, int8_t *modified, int8_t *minkey_replace,
@@ -1622,3 +1720,16 @@ btree_result BTreeIterator::next(void *key_buf, void *value_buf)
     return br;
 }
 
+btree_result BTreeIterator::getCurLeafKeyBounds(void *min_key_buf,
+                                            void *max_key_buf)
+{
+    struct bnode *node = node_arr ? node_arr[0] : NULL;
+    if (!node || node->nentry == 0) {
+        return BTREE_RESULT_FAIL;
+    }
+
+    BTreeKVOps *kv_ops = btree->getKVOps();
+    kv_ops->getKV(node, 0, min_key_buf, NULL);
+    kv_ops->getKV(node, node->nentry - 1, max_key_buf, NULL);
+    return BTREE_RESULT_SUCCESS;
+}
@@ -67,6 +67,13 @@ struct btree_meta{
 
 typedef struct bnode* bnoderef;
 typedef int btree_cmp_func(void *key1, void *key2, void *aux);
+typedef void btree_leaf_func(void *key, bid_t bid, void *ctx);
+
+// Position of a key relative to a leaf node, returned by BTree::findInLeaf().
+#define BTREE_LEAF_BEFORE (-1)
+#define BTREE_LEAF_ABSENT (0)
+#define BTREE_LEAF_AFTER (1)
+#define BTREE_LEAF_INVALID (2)
 
 /**
  * B+tree key-value operation wrapper class definition.
@@ -316,6 +323,18 @@ public:
     // Remove the given key.
     btree_result remove(void *key);
 
+    // Call 'func' for each leaf node in key order, with the smallest key
+    // that the parent node routes to it (the first key of a single-node tree).
+    btree_result scanLeaves(btree_leaf_func *func, void *ctx);
+    // Get the value for the given key from the leaf node at 'leaf_bid' only,
+    // without descending from the root. On failure, 'position' is set to
+    // BTREE_LEAF_BEFORE or BTREE_LEAF_AFTER if the key is out of the leaf's
+    // key range, BTREE_LEAF_ABSENT if the key is within the range but does
+    // not exist, or BTREE_LEAF_INVALID if the block is not a non-empty leaf
+    // node of this B+tree.
+    btree_result findInLeaf(bid_t leaf_bid, void *key, void *value_buf,
+                            int *position);
+
     uint8_t getKSize() const {
         return ksize;
     }
@@ -426,6 +445,9 @@ private:
                          idx_t *idx, int i, struct list *kv_ins_list,
                          void *k, void *v, int8_t *modified, int8_t *minkey_replace,
                          int8_t *ins, int8_t *moved);
+
+    btree_result scanLeavesFrom(bid_t bid, uint16_t level,
+                                btree_leaf_func *func, void *ctx);
 };
 
 typedef struct {
@@ -464,6 +486,15 @@ public:
     // Move cursor to the next key.
     btree_result next(void *key_buf, void *value_buf);
 
+    // Get the BID of the leaf node that the lastly returned key belongs to,
+    // or BLK_NOT_FOUND if no leaf node is loaded.
+    bid_t getCurLeafBid() const {
+        return (node_arr && node_arr[0]) ? bid_arr[0] : BTREE_BLK_NOT_FOUND;
+    }
+
+    // Get the smallest and largest keys of the leaf node above.
+    btree_result getCurLeafKeyBounds(void *min_key_buf, void *max_key_buf);
+
     BTree* getBTree() const {
         return btree;
     }
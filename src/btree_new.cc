@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <algorithm>
 
 #include "libforestdb/forestdb.h"
 #include "fdb_engine.h"
@@ -176,6 +177,7 @@ BtreeV2::~BtreeV2() {
 BtreeV2Result BtreeV2::init()
 {
     rootAddr = BtreeNodeAddr(BLK_NOT_FOUND, nullptr);
+    rightmostPath.clear();
     nentry = 0;
     height = 1;
 
@@ -189,9 +191,10 @@ BtreeV2Result BtreeV2::initFromAddr(BtreeNodeAddr root_addr)
     }
 
     rootAddr = root_addr;
+    rightmostPath.clear();
     if (!rootAddr.isDirty) {
         // clean root node
-        Bnode *root = bMgr->readNode(rootAddr.offset);
+        Bnode *root = bMgr->readNode(rootAddr.offset, cmpFunc);
         height = root->getLevel();
         // TODO: reading / storing 'nentry' from / to the root node .
         bMgr->releaseCleanNode(root);
@@ -235,7 +238,7 @@ BtreeV2Result BtreeV2::updateMeta( BtreeV2Meta meta )
             node = rootAddr.ptr;
         } else {
             // Clean node .. read from file,
-            Bnode *clean_node = bMgr->readNode( rootAddr.offset );
+            Bnode *clean_node = bMgr->readNode( rootAddr.offset, cmpFunc );
 
             // And make a new writable dirty root node.
             node = bMgr->getMutableNodeFromClean(clean_node);
@@ -256,7 +259,7 @@ Bnode* BtreeV2::getRootNode()
         return rootAddr.ptr;
     } else {
         // clean node .. read from file.
-        return bMgr->readNode( rootAddr.offset );
+        return bMgr->readNode( rootAddr.offset, cmpFunc );
     }
 }
 
@@ -306,6 +309,9 @@ BtreeV2Result BtreeV2::insertMulti( std::vector<BtreeKvPair>& kv_list )
     BtreeNodeAddr addr = rootAddr;
     BtreeKey empty_key(nullptr, 0);
 
+    // Nodes on the rightmost path may be split or replaced below.
+    rightmostPath.clear();
+
     br = _insert( kv_list, nullptr, empty_key, addr,
                   0, kv_list.size() - 1, parent_actions );
 
@@ -319,11 +325,137 @@ BtreeV2Result BtreeV2::insertMulti( std::vector<BtreeKvPair>& kv_list )
 
 BtreeV2Result BtreeV2::insert( BtreeKvPair kv )
 {
+    if ( appendRightmost(kv) ) {
+        return BtreeV2Result::SUCCESS;
+    }
+
     std::vector<BtreeKvPair> kv_list(1, kv);
 
     return insertMulti( kv_list );
 }
 
+int BtreeV2::compareKeys( void *key1, size_t keylen1,
+                          void *key2, size_t keylen2 )
+{
+    if (cmpFunc) {
+        return cmpFunc(key1, keylen1, key2, keylen2);
+    }
+    int cmp = memcmp(key1, key2, MIN(keylen1, keylen2));
+    if (cmp != 0 || keylen1 == keylen2) {
+        return cmp;
+    }
+    return (keylen1 < keylen2) ? -1 : 1;
+}
+
+bool BtreeV2::loadRightmostPath()
+{
+    if ( !rootAddr.isDirty ) {
+        rightmostPath.clear();
+        return false;
+    }
+    if ( rightmostPath.size() == height &&
+         rightmostPath.back() == rootAddr.ptr ) {
+        // still valid
+        return true;
+    }
+
+    // Follow the last entry of each node from the root, which works only
+    // as long as all the nodes on the way are dirty.
+    rightmostPath.assign(height, nullptr);
+    Bnode *node = rootAddr.ptr;
+    for (size_t level = height; level > 1; --level) {
+        rightmostPath[level - 1] = node;
+        BsaItem kvp = node->getKvArr().last();
+        if ( kvp.isEmpty() || !kvp.isValueChildPtr ) {
+            rightmostPath.clear();
+            return false;
+        }
+        node = static_cast<Bnode*>(kvp.value);
+    }
+    rightmostPath[0] = node;
+    return true;
+}
+
+bool BtreeV2::appendRightmost( BtreeKvPair& kv )
+{
+    if ( !loadRightmostPath() ) {
+        return false;
+    }
+
+    Bnode *leaf = rightmostPath[0];
+    BsaItem last = leaf->getKvArr().last();
+    if ( last.isEmpty() ||
+         compareKeys(kv.key, kv.keylen, last.key, last.keylen) <= 0 ) {
+        // not an append => take the regular path.
+        return false;
+    }
+
+    size_t kv_size = BsaItem(kv.key, kv.keylen, kv.value, kv.valuelen).getSize();
+    if ( leaf->getNodeSize() + kv_size <= getNodeSizeLimit(1) ) {
+        leaf->addKv( kv.key, kv.keylen, kv.value, kv.valuelen,
+                     nullptr, true );
+    } else {
+        // Leave the full leaf node as it is, and start a new one. As the new
+        // key is the largest one, no other key needs to be moved.
+        Bnode *new_leaf = new Bnode();
+        bMgr->addDirtyNode( new_leaf );
+        new_leaf->setCmpFunc(cmpFunc);
+        new_leaf->addKv( kv.key, kv.keylen, kv.value, kv.valuelen,
+                         nullptr, true );
+        addRightmostNode(new_leaf, 1);
+    }
+    nentry++;
+
+    return true;
+}
+
+void BtreeV2::addRightmostNode( Bnode *node, size_t level )
+{
+    void *min_key = nullptr;
+    size_t min_keylen = 0;
+    node->findMinKey(min_key, min_keylen);
+
+    if ( level == height ) {
+        // The root node itself is full => create a new root node on top of
+        // the old one and the new one.
+        Bnode *old_root = rootAddr.ptr;
+        Bnode *new_root = new Bnode();
+        void *root_min_key = nullptr;
+        size_t root_min_keylen = 0;
+        bMgr->addDirtyNode( new_root );
+        new_root->setLevel(level + 1);
+        new_root->setCmpFunc(cmpFunc);
+        old_root->findMinKey(root_min_key, root_min_keylen);
+        new_root->addKv( root_min_key, root_min_keylen, nullptr, 0,
+                         old_root, true );
+        new_root->addKv( min_key, min_keylen, nullptr, 0, node, true );
+
+        // move existing meta data from the old root to the new root
+        new_root->setMeta(old_root->getMeta(), old_root->getMetaSize());
+        old_root->clearMeta();
+
+        height = new_root->getLevel();
+        rootAddr = BtreeNodeAddr(BLK_NOT_FOUND, new_root);
+        rightmostPath[level - 1] = node;
+        rightmostPath.push_back(new_root);
+        return;
+    }
+
+    Bnode *parent = rightmostPath[level];
+    size_t kv_size = BsaItem(min_key, min_keylen, node).getSize();
+    if ( parent->getNodeSize() + kv_size <= getNodeSizeLimit(level + 1) ) {
+        parent->addKv( min_key, min_keylen, nullptr, 0, node, true );
+    } else {
+        Bnode *new_parent = new Bnode();
+        bMgr->addDirtyNode( new_parent );
+        new_parent->setLevel(level + 1);
+        new_parent->setCmpFunc(cmpFunc);
+        new_parent->addKv( min_key, min_keylen, nullptr, 0, node, true );
+        addRightmostNode(new_parent, level + 1);
+    }
+    rightmostPath[level - 1] = node;
+}
+
 BtreeV2Result BtreeV2::_insert( std::vector<BtreeKvPair>& kv_list,
                                 Bnode *parent_node,
                                 BtreeKey ref_key,
@@ -349,7 +481,7 @@ BtreeV2Result BtreeV2::_insert( std::vector<BtreeKvPair>& kv_list,
             node = node_addr.ptr;
         } else {
             // Clean node .. read from file,
-            Bnode *clean_node = bMgr->readNode( node_addr.offset );
+            Bnode *clean_node = bMgr->readNode( node_addr.offset, cmpFunc );
 
             // And make a new writable dirty node.
             node = bMgr->getMutableNodeFromClean(clean_node);
@@ -436,7 +568,7 @@ BtreeV2Result BtreeV2::_insert( std::vector<BtreeKvPair>& kv_list,
     // 4) split if necessary
     std::list<Bnode*> new_nodes;
     size_t nodesize_limit = getNodeSizeLimit(node->getLevel());
-    if (node->getNodeSize() > nodesize_limit) {
+    if (node->getDiskSize() > nodesize_limit) {
         node->splitNode(nodesize_limit, new_nodes);
     }
 
@@ -497,6 +629,8 @@ BtreeV2Result BtreeV2::removeMulti( std::vector<BtreeKvPair>& kv_list )
     BtreeNodeAddr node_addr = rootAddr;
     BtreeKey empty_key(nullptr, 0);
 
+    rightmostPath.clear();
+
     br = _remove( kv_list, nullptr, empty_key, node_addr,
                   0, kv_list.size() - 1, parent_actions );
 
@@ -541,7 +675,7 @@ BtreeV2Result BtreeV2::_remove( std::vector<BtreeKvPair>& kv_list,
             node = node_addr.ptr;
         } else {
             // Clean node .. read from file,
-            Bnode *clean_node = bMgr->readNode( node_addr.offset );
+            Bnode *clean_node = bMgr->readNode( node_addr.offset, cmpFunc );
 
             // And make a new writable dirty node.
             node = bMgr->getMutableNodeFromClean(clean_node);
@@ -694,13 +828,11 @@ BtreeV2Result BtreeV2::_find( BtreeKvPair& kv,
             node = node_addr.ptr;
         } else {
             // clean node .. read from file.
-            node = bMgr->readNode( node_addr.offset );
+            // (shared with other readers, the cache sets its cmp function.)
+            node = bMgr->readNode( node_addr.offset, cmpFunc );
         }
     }
 
-    // Set custom cmp function.
-    node->setCmpFunc(cmpFunc);
-
     BsaItem kvp;
     if ( node->getLevel() > 1 ) {
         // intermediate node
@@ -870,7 +1002,7 @@ void BtreeV2::shrinkHeight()
         // clean child node .. read and make a dirty clone
         Bnode *clean_node;
         uint64_t offset = BtreeV2::value2offset( kvp );
-        clean_node = bMgr->readNode( offset );
+        clean_node = bMgr->readNode( offset, cmpFunc );
 
         new_root = bMgr->getMutableNodeFromClean(clean_node);
     }
@@ -977,7 +1109,11 @@ BtreeV2Result BtreeV2::_writeDirtyNodes(Bnode *cur_node,
 
 BtreeIteratorV2::BtreeIteratorV2(BtreeV2 *_btree) :
                                  btree(_btree),
-                                 lastResult(BnodeIteratorResult::NO_MORE_ENTRY)
+                                 lastResult(BnodeIteratorResult::NO_MORE_ENTRY),
+                                 prefetchParentOffset(BLK_NOT_FOUND),
+                                 prefetchMark(0),
+                                 prefetchEnd(0),
+                                 prefetchDepth(BTREEV2_PREFETCH_MIN_DEPTH)
 {
     // Initialize the array of BnodeIterators as one single zero filled blob
     uint8_t *bnodeArrayBuf = new uint8_t[sizeof(BnodeIterator)
@@ -992,7 +1128,11 @@ BtreeIteratorV2::BtreeIteratorV2(BtreeV2 *_btree,
                                  void *start_key,
                                  size_t start_keylen) :
                                  btree(_btree),
-                                 lastResult(BnodeIteratorResult::NO_MORE_ENTRY)
+                                 lastResult(BnodeIteratorResult::NO_MORE_ENTRY),
+                                 prefetchParentOffset(BLK_NOT_FOUND),
+                                 prefetchMark(0),
+                                 prefetchEnd(0),
+                                 prefetchDepth(BTREEV2_PREFETCH_MIN_DEPTH)
 {
     // Initialize the array of BnodeIterators as one single zero filled blob
     uint8_t *bnodeArrayBuf = new uint8_t[sizeof(BnodeIterator)
@@ -1004,6 +1144,7 @@ BtreeIteratorV2::BtreeIteratorV2(BtreeV2 *_btree,
 }
 
 BtreeIteratorV2::~BtreeIteratorV2() {
+    btree->bMgr->cancelPrefetch();
     for (int cursor = btree->getHeight() - 1; cursor >= 0; --cursor) {
         Bnode *oldBnode = bnodeItrs[cursor].getIteratorBnode();
         if (oldBnode) { // Release reference to bnode from the cursor
@@ -1048,7 +1189,7 @@ BnodeIteratorResult BtreeIteratorV2::fetchBnode(Bnode * & node,
         node = cachedBnode;
         return BnodeIteratorResult::SUCCESS;
     } // else read the node afresh from disk..
-    node = btree->bMgr->readNode(node_offset);
+    node = btree->bMgr->readNode(node_offset, btree->cmpFunc);
     if (!node) { // Error reading or btree not yet populated
         return BnodeIteratorResult::INVALID_NODE;
     }
@@ -1062,9 +1203,59 @@ BnodeIteratorResult BtreeIteratorV2::fetchBnode(Bnode * & node,
     return BnodeIteratorResult::SUCCESS;
 }
 
+void BtreeIteratorV2::prefetchLeaves()
+{
+    // Only the parents of leaf nodes (level 2) trigger prefetching.
+    if (btree->height < 2) {
+        return;
+    }
+    btree->bMgr->reapPrefetchedNodes();
+
+    Bnode *parent = bnodeItrs[1].getIteratorBnode();
+    uint32_t cur_idx = bnodeItrs[1].getKv().idx;
+    uint32_t start = cur_idx + 1;
+    if (parent->getCurOffset() != prefetchParentOffset) {
+        prefetchParentOffset = parent->getCurOffset();
+    } else if (cur_idx < prefetchMark) {
+        return; // not yet in the last prefetch window
+    } else {
+        // The scan keeps going, read further ahead.
+        start = std::max(start, prefetchEnd);
+        prefetchDepth = std::min(prefetchDepth * 2,
+                                 static_cast<uint32_t>(BTREEV2_PREFETCH_DEPTH));
+    }
+
+    BsArray& kv_arr = parent->getKvArr();
+    cs_off_t offsets[BTREEV2_PREFETCH_DEPTH];
+    size_t num = 0;
+    BsaItem kvp = bnodeItrs[1].getKv();
+    while (!kvp.isEmpty() && kvp.idx < start) {
+        kvp = kv_arr.next(kvp);
+    }
+    while (!kvp.isEmpty() && num < prefetchDepth) {
+        offsets[num++] = BtreeV2::value2offset(kvp);
+        kvp = kv_arr.next(kvp);
+    }
+    prefetchMark = start;
+    prefetchEnd = start + num;
+    if (num) {
+        btree->bMgr->prefetchNodes(offsets, num, btree->cmpFunc);
+    }
+}
+
+void BtreeIteratorV2::resetPrefetch()
+{
+    btree->bMgr->cancelPrefetch();
+    prefetchParentOffset = BLK_NOT_FOUND;
+    prefetchMark = 0;
+    prefetchEnd = 0;
+    prefetchDepth = BTREEV2_PREFETCH_MIN_DEPTH;
+}
+
 BnodeIteratorResult BtreeIteratorV2::seekGreaterOrEqualBT(void *key,
                                                           size_t keylen)
 {
+    resetPrefetch();
     if (!btree || btree->rootAddr.offset == BLK_NOT_FOUND) {
         lastResult = BnodeIteratorResult::INVALID_NODE;
     } else {
@@ -1137,6 +1328,7 @@ BtreeIteratorV2::seekGreaterOrEqualRecursiveBT(uint64_t node_offset,
 BnodeIteratorResult BtreeIteratorV2::seekSmallerOrEqualBT(void *key,
                                                           size_t keylen)
 {
+    resetPrefetch();
     if (!btree || btree->rootAddr.offset == BLK_NOT_FOUND) {
         lastResult = BnodeIteratorResult::INVALID_NODE;
     } else {
@@ -1174,6 +1366,7 @@ BtreeIteratorV2::seekSmallerOrEqualRecursiveBT(uint64_t node_offset,
 
 BnodeIteratorResult BtreeIteratorV2::beginBT()
 {
+    resetPrefetch();
     if (!btree || btree->rootAddr.offset == BLK_NOT_FOUND) {
         lastResult = BnodeIteratorResult::INVALID_NODE;
     } else {
@@ -1197,6 +1390,9 @@ BnodeIteratorResult BtreeIteratorV2::beginRecursiveBT(uint64_t node_offset)
             // not found
             return result;
         }
+        if (curIdx == 1) { // Entered a parent of leaves => read ahead
+            prefetchLeaves();
+        }
         // recursive call
         BsaItem kvp = bnodeItrs[curIdx].getKv();
         uint64_t next_offset = BtreeV2::value2offset(kvp);
@@ -1209,6 +1405,7 @@ BnodeIteratorResult BtreeIteratorV2::beginRecursiveBT(uint64_t node_offset)
 
 BnodeIteratorResult BtreeIteratorV2::endBT()
 {
+    resetPrefetch();
     if (!btree || btree->rootAddr.offset == BLK_NOT_FOUND) {
         lastResult = BnodeIteratorResult::INVALID_NODE;
     } else {
@@ -1297,6 +1494,9 @@ BnodeIteratorResult BtreeIteratorV2::nextRecursiveBT(uint16_t level)
         // Intermediate node in the Btree has an entry => read that bnode
         BsaItem kvp = bnodeItrs[level].getKv();
         uint64_t child_offset = BtreeV2::value2offset(kvp);
+        if (level == 1) { // Moving to the next leaf => keep reading ahead
+            prefetchLeaves();
+        }
         return beginRecursiveBT(child_offset);//Forward iteration => Fetch start
     } // else leaf node level => simply return
     return ret;
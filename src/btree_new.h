@@ -236,6 +236,8 @@ public:
 
     /**
      * Insert a single key-value pair into the tree.
+     * Keys greater than any existing key (e.g., sequence numbers) are
+     * appended to the rightmost leaf node without a root-to-leaf search.
      *
      * @param kv Key-value pair to insert.
      * @return SUCCESS on success.
@@ -466,6 +468,43 @@ private:
     BtreeV2Result _writeDirtyNodes(Bnode *cur_node,
                                    bool visit_child_tree);
 
+    /**
+     * Compare two keys, using the custom comparison function if assigned.
+     *
+     * @return Negative, zero, or positive if 'key1' is smaller than, equal
+     *         to, or greater than 'key2', respectively.
+     */
+    int compareKeys( void *key1, size_t keylen1, void *key2, size_t keylen2 );
+
+    /**
+     * Make 'rightmostPath' point to the nodes on the rightmost path of the
+     * tree, if all of them are dirty.
+     *
+     * @return True if 'rightmostPath' is usable.
+     */
+    bool loadRightmostPath();
+
+    /**
+     * If the given key is greater than the largest key in the tree, append
+     * the key-value pair to the rightmost leaf node directly, without
+     * descending from the root node. When the leaf node is full, a new
+     * rightmost leaf node is started instead of splitting the full one.
+     *
+     * @param kv Key-value pair to append.
+     * @return True if the pair has been appended.
+     */
+    bool appendRightmost( BtreeKvPair& kv );
+
+    /**
+     * Add the given new node next to the rightmost node of the given level,
+     * as the last child of the parent node. A full parent node is not split;
+     * a new rightmost parent node is added instead, up to the root node.
+     *
+     * @param node New rightmost node.
+     * @param level Level of the new node.
+     */
+    void addRightmostNode( Bnode *node, size_t level );
+
     // Bnode manager instance.
     BnodeMgr *bMgr;
     // Height of tree.
@@ -476,6 +515,9 @@ private:
     uint64_t nentry;
     // Custom comparison function (nullptr if not assigned).
     btree_new_cmp_func *cmpFunc;
+    // Dirty nodes on the rightmost path (index 0: leaf node, the last
+    // one: root node), used by appendRightmost().
+    std::vector<Bnode*> rightmostPath;
 };
 
 class BtreeIteratorV2 {
@@ -579,6 +621,16 @@ private:
     // Result of last iterator movement. This is needed since getBT() should
     // fail if nextBT(), prevBT() etc fail.
     BnodeIteratorResult lastResult;
+    // Offset of the parent node whose leaves were last prefetched.
+    uint64_t prefetchParentOffset;
+    // Index of the first child in the last prefetch window of that parent;
+    // reaching it triggers the next window.
+    uint32_t prefetchMark;
+    // Index of the first child in that parent that is not prefetched yet.
+    uint32_t prefetchEnd;
+    // Number of leaves in the next prefetch window, which grows as long as
+    // the scan keeps going.
+    uint32_t prefetchDepth;
 
     /**
      * Recursively descend from root to leaf to expected key as in diagram above
@@ -634,4 +686,18 @@ private:
      * @return BnodeIteratorResult::SUCCESS or BnodeIteratorResult::INVALID_NODE
      */
     BnodeIteratorResult fetchBnode(Bnode * &node, uint64_t node_offset);
+
+    /**
+     * Called as a forward scan moves to the next leaf. Reaps the leaves
+     * prefetched so far, and once the scan reaches the last prefetch window
+     * of the parent node, requests the leaves that follow that window. The
+     * window starts at BTREEV2_PREFETCH_MIN_DEPTH leaves and doubles on
+     * each request up to BTREEV2_PREFETCH_DEPTH.
+     */
+    void prefetchLeaves();
+
+    /**
+     * Forget the prefetch window, as the iterator is repositioned.
+     */
+    void resetPrefetch();
 };
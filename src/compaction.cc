@@ -27,11 +27,14 @@
 #include "libforestdb/forestdb.h"
 
 #include "bgflusher.h"
+#include "blobstore.h"
 #include "btree.h"
 #include "btree_new.h"
 #include "bnodemgr.h"
 #include "btreeblock.h"
 #include "btree_kv.h"
+#include "bloom_filter.h"
+#include "secondary_index.h"
 #include "compaction.h"
 #include "compactor.h"
 #include "docio.h"
@@ -118,6 +121,7 @@ static int64_t _fdb_doc_move(void *dbhandle,
     FdbKvsHandle *handle = reinterpret_cast<FdbKvsHandle*>(dbhandle);
     DocioHandle *new_dhandle = reinterpret_cast<DocioHandle*>(void_new_dhandle);
     struct docio_object doc;
+    BlobMoveScope blob_scope(handle->file, new_dhandle->getFile());
 
     // read doc from old file
     doc.key = NULL;
@@ -145,6 +149,18 @@ static int64_t _fdb_doc_move(void *dbhandle,
     return new_offset;
 }
 
+// Let the new file keep referring to the blob files of the old file, whose
+// docs are cloned into the new file without being read.
+static void _fdb_inherit_blob_files(FileMgr *old_file, FileMgr *new_file)
+{
+    BlobStore *blob_store = old_file->getBlobStore();
+    if (blob_store) {
+        new_file->initBlobStore(
+            new BlobStore(new_file->getFileName(), new_file->getOps(), 0, 0))
+            ->inheritFiles(blob_store);
+    }
+}
+
 fdb_status Compaction::compactFile(FdbFileHandle *fhandle,
                                    const char *new_filename,
                                    bool in_place_compaction,
@@ -175,6 +191,10 @@ fdb_status Compaction::compactFile(FdbFileHandle *fhandle,
     FdbEngine::initFileConfig(&handle->config, &fconfig);
     fconfig.addOptions(FILEMGR_CREATE);
     fconfig.addOptions(FILEMGR_EXCL_CREATE); // Fail if the file already exists
+    if (ver_blob_support(handle->file->getVersion())) {
+        // references to blob bodies are moved into the new file
+        fconfig.setBlobFiles(true);
+    }
     if (new_encryption_key) {
         fconfig.setEncryptionKey(*new_encryption_key);
     }
@@ -624,6 +644,49 @@ fdb_status Compaction::createFile(const std::string file_name,
     fileMgr->fhandleAdd(handle->fhandle);
     fileMgr->setInPlaceCompaction(in_place_compaction);
 
+    if (handle->kvs && handle->config.bloom_filter_bits_per_key) {
+        // All keys are moved into the new file through WAL flushes, so its
+        // Bloom filters are rebuilt from scratch along with the new HB+trie.
+        KvsBloomFilters *filters =
+            new KvsBloomFilters(handle->config.bloom_filter_bits_per_key);
+        fileMgr->mutexLock();
+        if (!fileMgr->initBloomFilters(filters)) {
+            delete filters;
+        }
+        fileMgr->mutexUnlock();
+    }
+
+    KvsSecondaryIndexes *sindexes = handle->file->getSecondaryIndexes();
+    if (sindexes) {
+        // Same as Bloom filters, secondary indexes are repopulated by the
+        // WAL flushes into the new file.
+        fileMgr->initSecondaryIndexes(sindexes->cloneEmpty());
+    }
+
+    if (ver_blob_support(fileMgr->getVersion())) {
+        // References to blob bodies are moved into the new file as they are,
+        // except for the ones in mostly stale blob files, whose live bodies
+        // are relocated into the new file's blob file.
+        // The in-place compacted file is renamed to the original name
+        // later, so its new blob files are named after the original file,
+        // and destroying the file removes them.
+        bool encrypted = fconfig.getEncryptionKey()->algorithm !=
+                         FDB_ENCRYPTION_NONE;
+        std::string blob_name(fileMgr->getFileName());
+        if (in_place_compaction) {
+            blob_name = CompactionManager::getInstance()->
+                            getVirtualFileName(blob_name);
+        }
+        BlobStore *new_blob_store = fileMgr->initBlobStore(
+            new BlobStore(blob_name.c_str(), fileMgr->getOps(),
+                          encrypted ? 0 : handle->config.blob_threshold,
+                          handle->config.blob_gc_threshold));
+        BlobStore *blob_store = handle->file->getBlobStore();
+        if (blob_store) {
+            new_blob_store->prepareRelocation(blob_store);
+        }
+    }
+
     docHandle = new DocioHandle(fileMgr,
                                 handle->config.compress_document_body,
                                 &handle->log_callback);
@@ -721,6 +784,9 @@ void Compaction::cleanUpCompactionErr(FdbKvsHandle *handle) {
         btreeHandle->resetSubblockInfo();
     }
     FileMgr::setCompactionState(fileMgr, NULL, FILE_REMOVED_PENDING);
+    if (fileMgr->getBlobStore()) {
+        fileMgr->getBlobStore()->setActiveFileObsolete();
+    }
     fileMgr->fhandleRemove(handle->fhandle);
     uint64_t fileVersion = fileMgr->getVersion();
     FileMgr::close(fileMgr, true /* clean up cache */, fileMgr->getFileName(),
@@ -768,6 +834,7 @@ fdb_status Compaction::copyDocsUptoMarker(FdbKvsHandle *rhandle,
     ErrLogCallback *log_callback = &rhandle->log_callback;
     uint64_t version = 0;
     fdb_status fs;
+    ScanReadScope scan_scope(rhandle->file);
 
     last_hdr_revnum = rhandle->file->getHeaderRevnum(last_hdr_bid);
     marker_revnum = rhandle->file->getHeaderRevnum(marker_bid);
@@ -982,6 +1049,8 @@ fdb_status Compaction::copyWalDocs(FdbKvsHandle *handle,
     fdb_compact_decision decision;
     ErrLogCallback *log_callback;
     fdb_status fs = FDB_RESULT_SUCCESS;
+    // Bodies in blob files are not copied, but their references are.
+    BlobMoveScope blob_scope(handle->file, fileMgr);
 
     gettimeofday(&tv, NULL);
     cur_timestamp = tv.tv_sec;
@@ -1246,6 +1315,10 @@ fdb_status Compaction::copyDocs(FdbKvsHandle *handle,
     FdbKvsHandle new_handle;
     timestamp_t cur_timestamp;
     fdb_status fs = FDB_RESULT_SUCCESS;
+    // Documents and index blocks of the old file are read only once.
+    ScanReadScope scan_scope(handle->file);
+    // Bodies in blob files are not copied, but their references are.
+    BlobMoveScope blob_scope(handle->file, fileMgr);
 
     bid_t compactor_curr_bid, writer_curr_bid;
     bid_t compactor_prev_bid, writer_prev_bid;
@@ -1586,11 +1659,14 @@ fdb_status Compaction::cloneDocs(FdbKvsHandle *handle, size_t *prob)
     bid_t compactor_prev_bid, writer_prev_bid;
     struct _fdb_key_cmp_info cmp_info;
     bool locked = false;
+    ScanReadScope scan_scope(handle->file);
 
     timestamp_t cur_timestamp;
     fdb_status fs = FDB_RESULT_SUCCESS;
     blocksize = handle->file->getConfig()->getBlockSize();
 
+    _fdb_inherit_blob_files(handle->file, fileMgr);
+
     compactor_prev_bid = 0;
     writer_prev_bid = handle->file->getPos() /
                       handle->file->getConfig()->getBlockSize();
@@ -1924,6 +2000,9 @@ fdb_status Compaction::copyDelta(FdbKvsHandle *handle,
     fdb_status fs = FDB_RESULT_SUCCESS;
     ErrLogCallback *log_callback;
     uint8_t *hdr_buf = alca(uint8_t, blocksize);
+    ScanReadScope scan_scope(handle->file);
+    // Bodies in blob files are not copied, but their references are.
+    BlobMoveScope blob_scope(handle->file, fileMgr);
 
     bid_t compactor_bid_prev, writer_bid_prev;
     bid_t compactor_curr_bid, writer_curr_bid;
@@ -2502,6 +2581,8 @@ void Compaction::cloneBatchedDelta(FdbKvsHandle *handle,
     bool locked = false;
     fdb_status fs = FDB_RESULT_SUCCESS;
 
+    _fdb_inherit_blob_files(file, new_file);
+
     cmp_info.kvs_config = handle->kvs_config;
     cmp_info.kvs = handle->kvs;
 
@@ -2761,6 +2842,13 @@ fdb_status Compaction::commitAndRemovePending(FdbKvsHandle *handle,
     LatencyStats::migrate(old_file, new_file);
 #endif // _LATENCY_STATS
 
+    BlobStore *blob_store = old_file->getBlobStore();
+    if (blob_store) {
+        // blob files that the new file does not refer to are removed along
+        // with the old file
+        blob_store->setObsoleteFiles(new_file->getBlobStore());
+    }
+
     // Mark the old file as "remove_pending".
     // Note that a file deletion will be pended until there is no handle
     // referring the file.
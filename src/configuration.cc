@@ -116,6 +116,30 @@ fdb_config get_default_config(void) {
     // Flush limit in bytes for non-block aligned buffer cache
     fconfig.bcache_flush_limit = 1048576;
 
+    // Compressed second-tier buffer cache is disabled by default.
+    fconfig.compressed_buffercache_size = 0;
+
+    // No per-file buffer cache reservation and limit by default.
+    fconfig.buffercache_min_reservation = 0;
+    fconfig.buffercache_max_limit = 0;
+    fconfig.buffercache_priority = FDB_CACHE_PRIORITY_NORMAL;
+
+    // No global memory budget by default.
+    fconfig.memory_budget = 0;
+
+    // The buffer cache is backed by regular pages by default.
+    fconfig.buffercache_huge_pages = false;
+
+    // No Bloom filters by default.
+    fconfig.bloom_filter_bits_per_key = 0;
+
+    // Document bodies are kept in the file itself by default.
+    fconfig.blob_threshold = 0;
+    fconfig.blob_gc_threshold = FDB_DEFAULT_BLOB_GC_THRESHOLD;
+
+    // B+trees with custom comparison functions are never split by default.
+    fconfig.leaf_height_limit = FDB_DEFAULT_LEAF_HEIGHT_LIMIT;
+
     return fconfig;
 }
 
@@ -179,6 +203,26 @@ bool validate_fdb_config(fdb_config *fconfig) {
         return false;
     }
 
+    if (fconfig->buffercache_priority > FDB_CACHE_PRIORITY_HIGH) {
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Buffer cache priority (%d) : Not recognized! "
+                "[Allowed options: FDB_CACHE_PRIORITY_LOW (%d), "
+                "FDB_CACHE_PRIORITY_NORMAL (%d), FDB_CACHE_PRIORITY_HIGH (%d)]\n",
+                fconfig->buffercache_priority, FDB_CACHE_PRIORITY_LOW,
+                FDB_CACHE_PRIORITY_NORMAL, FDB_CACHE_PRIORITY_HIGH);
+        return false;
+    }
+
+    if (fconfig->buffercache_max_limit &&
+        fconfig->buffercache_max_limit < fconfig->buffercache_min_reservation) {
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Buffer cache max limit (%" _F64 ") less than "
+                "min reservation (%" _F64 ")!\n",
+                fconfig->buffercache_max_limit,
+                fconfig->buffercache_min_reservation);
+        return false;
+    }
+
     if ((fconfig->flags & FDB_OPEN_FLAG_CREATE) &&
         (fconfig->flags & FDB_OPEN_FLAG_RDONLY)) {
         fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
@@ -197,6 +241,29 @@ bool validate_fdb_config(fdb_config *fconfig) {
         return false;
     }
 
+    if (fconfig->blob_gc_threshold > 100) {
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Blob GC threshold (%u) greater than 100!\n",
+                fconfig->blob_gc_threshold);
+        return false;
+    }
+
+    if (fconfig->blob_threshold && !fconfig->multi_kv_instances) {
+        // The blob file stats are persisted along with the KV header.
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Blob files (threshold %u) require the multi "
+                "KV instance mode!\n", fconfig->blob_threshold);
+        return false;
+    }
+
+    if (fconfig->bloom_filter_bits_per_key && !fconfig->multi_kv_instances) {
+        // The Bloom filters are persisted along with the KV header.
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Bloom filters (%u bits per key) require the "
+                "multi KV instance mode!\n", fconfig->bloom_filter_bits_per_key);
+        return false;
+    }
+
     if (fconfig->compactor_sleep_duration == 0) {
         // Sleep duration should be larger than zero
         fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
@@ -251,6 +318,14 @@ bool validate_fdb_config(fdb_config *fconfig) {
         // num_keeping_headers should be greater than zero
         return false;
     }
+    if (fconfig->bloom_filter_bits_per_key > MAX_BLOOM_FILTER_BITS_PER_KEY) {
+        fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
+                "Config Error: Bloom filter bits per key (%u) greater than "
+                "allowed value (%d)!\n",
+                fconfig->bloom_filter_bits_per_key,
+                MAX_BLOOM_FILTER_BITS_PER_KEY);
+        return false;
+    }
     if (fconfig->num_background_threads > FDB_EXPOOL_MAX_THREADS) {
         fdb_log(NULL, FDB_RESULT_INVALID_ARGS,
                 "Config Error: Num background threads (%" _F64 ") greater than "
@@ -545,13 +545,22 @@ inline bid_t DocioHandle::_appendDoc_Docio(struct docio_object *doc)
     struct docio_length length, _length;
 
     length = doc->length;
-    length.bodylen_ondisk = length.bodylen;
+    if (!(length.flag & DOCIO_BLOB)) {
+        // otherwise, 'bodylen_ondisk' is the size of a moved blob reference
+        length.bodylen_ondisk = length.bodylen;
+    }
+
+    fdb_status blob_status = FDB_RESULT_SUCCESS;
+    void *blob_ref = _appendBlobBody_Docio(doc, &length, &blob_status);
+    if (blob_status != FDB_RESULT_SUCCESS) {
+        return BLK_NOT_FOUND;
+    }
 
 #ifdef _DOC_COMP
     int ret;
     void *compbuf = NULL;
     uint32_t compbuf_len = 0;
-    if (doc->length.bodylen > 0 && compress_document_body) {
+    if (!blob_ref && doc->length.bodylen > 0 && compress_document_body) {
         compbuf_len = snappy_max_compressed_length(length.bodylen);
         compbuf = (void *)malloc(compbuf_len);
 
@@ -574,11 +583,13 @@ inline bid_t DocioHandle::_appendDoc_Docio(struct docio_object *doc)
         docsize = sizeof(struct docio_length) + length.keylen + length.metalen;
         docsize += compbuf_len;
     } else {
-        docsize = sizeof(struct docio_length) + length.keylen + length.metalen + length.bodylen;
+        docsize = sizeof(struct docio_length) + length.keylen + length.metalen +
+                  length.bodylen_ondisk;
         compbuf_len = length.bodylen;
     }
 #else
-    docsize = sizeof(struct docio_length) + length.keylen + length.metalen + length.bodylen;
+    docsize = sizeof(struct docio_length) + length.keylen + length.metalen +
+              length.bodylen_ondisk;
 #endif
     docsize += sizeof(timestamp_t);
 
@@ -620,7 +631,12 @@ inline bid_t DocioHandle::_appendDoc_Docio(struct docio_object *doc)
     }
 
     // copy body (optional)
-    if (length.bodylen > 0) {
+    if (blob_ref) {
+        // reference to the body in a blob file
+        memcpy((uint8_t *)buf + offset, blob_ref, length.bodylen_ondisk);
+        offset += length.bodylen_ondisk;
+        free(blob_ref);
+    } else if (length.bodylen > 0) {
 #ifdef _DOC_COMP
         if (length.flag & DOCIO_COMPRESSED) {
             // compressed body
@@ -652,6 +668,55 @@ inline bid_t DocioHandle::_appendDoc_Docio(struct docio_object *doc)
     return ret_offset;
 }
 
+BlobStore *DocioHandle::_getBlobStore_Docio()
+{
+    BlobStore *store = file_Docio->getBlobStore();
+    if (!store) {
+        // the file refers to blob files, but does not write new bodies into
+        // them (e.g., it is opened without the blob threshold)
+        store = file_Docio->initBlobStore(
+            new BlobStore(file_Docio->getFileName(), file_Docio->getOps(),
+                          0, 0));
+    }
+    return store;
+}
+
+void *DocioHandle::_appendBlobBody_Docio(struct docio_object *doc,
+                                         struct docio_length *length,
+                                         fdb_status *status)
+{
+    BlobStore *store = file_Docio->getBlobStore();
+    BlobRef ref;
+
+    if (length->flag & DOCIO_BLOB) {
+        // the body is a reference moved from the old file by compaction
+        if (!ref.decode(doc->body, length->bodylen_ondisk)) {
+            *status = FDB_RESULT_FILE_CORRUPTION;
+            fdb_log(log_callback, *status,
+                    "Error in decoding the blob reference of a doc to be "
+                    "moved into a database file '%s'",
+                    file_Docio->getFileName());
+            return NULL;
+        }
+        *status = _getBlobStore_Docio()->moveRef(ref, log_callback);
+    } else if (store && !(length->flag & DOCIO_SYSTEM) &&
+               store->isBlobBody(length->bodylen)) {
+        *status = store->append(doc->body, length->bodylen, ref,
+                                log_callback);
+    } else {
+        return NULL;
+    }
+    if (*status != FDB_RESULT_SUCCESS) {
+        return NULL;
+    }
+
+    void *ref_buf = (void *)malloc(ref.encodedSize());
+    ref.encode(ref_buf);
+    length->flag |= DOCIO_BLOB;
+    length->bodylen_ondisk = ref.encodedSize();
+    return ref_buf;
+}
+
 bid_t DocioHandle::appendCommitMark_Docio(uint64_t doc_offset)
 {
     // Note: should adapt DOCIO_COMMIT_MARK_SIZE if this function is modified.
@@ -689,7 +754,12 @@ bid_t DocioHandle::appendCommitMark_Docio(uint64_t doc_offset)
 bid_t DocioHandle::appendDoc_Docio(struct docio_object *doc,
                        uint8_t deleted, uint8_t txn_enabled)
 {
-    doc->length.flag = DOCIO_NORMAL;
+    uint8_t blob = 0;
+    if (BlobMoveScope::isTarget(file_Docio)) {
+        // the body is a reference to a blob body, moved by compaction
+        blob = doc->length.flag & DOCIO_BLOB;
+    }
+    doc->length.flag = DOCIO_NORMAL | blob;
     if (deleted) {
         doc->length.flag |= DOCIO_DELETED;
     }
@@ -1219,6 +1289,7 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
     fdb_seqnum_t _seqnum;
     timestamp_t _timestamp;
     void *comp_body = NULL;
+    void *blob_ref = NULL;
 
     fdb_status status = FDB_RESULT_SUCCESS;
     struct docio_length _length;
@@ -1291,7 +1362,13 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
         meta_alloc = true;
     }
     if (doc->body == NULL && doc->length.bodylen) {
-        doc->body = (void *)malloc(doc->length.bodylen);
+        if ((doc->length.flag & DOCIO_BLOB) &&
+            BlobMoveScope::isSource(file_Docio)) {
+            // only the reference to the body is moved
+            doc->body = (void *)malloc(doc->length.bodylen_ondisk);
+        } else {
+            doc->body = (void *)malloc(doc->length.bodylen);
+        }
         body_alloc = true;
     }
 
@@ -1348,8 +1425,22 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
         return _offset;
     }
 
+    if (doc->length.flag & DOCIO_BLOB) {
+        // the body is kept in a blob file, and the doc only has its reference
+        blob_ref = (void *)malloc(doc->length.bodylen_ondisk);
+        _offset = _readDocComponent_Docio(_offset, doc->length.bodylen_ondisk,
+                                            blob_ref);
+        if (_offset < 0) {
+            fdb_log(log_callback, (fdb_status) _offset,
+                    "Error in reading a blob reference with offset %" _F64
+                    ", length %d from a database file '%s'", offset,
+                    doc->length.bodylen_ondisk, file_Docio->getFileName());
+            free(blob_ref);
+            free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
+            return _offset;
+        }
 #ifdef _DOC_COMP
-    if (doc->length.flag & DOCIO_COMPRESSED) {
+    } else if (doc->length.flag & DOCIO_COMPRESSED) {
         comp_body = (void*)malloc(doc->length.bodylen_ondisk);
         _offset = _readCompressedDocComponent_Docio(_offset, doc->length.bodylen,
                                                  doc->length.bodylen_ondisk, doc->body,
@@ -1365,6 +1456,7 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
             free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
             return _offset;
         }
+#endif
     } else {
         _offset = _readDocComponent_Docio(_offset, doc->length.bodylen,
                                             doc->body);
@@ -1377,18 +1469,6 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
             return _offset;
         }
     }
-#else
-    _offset = _readDocComponent_Docio(_offset, doc->length.bodylen,
-                                        doc->body);
-    if (_offset < 0) {
-        fdb_log(log_callback, (fdb_status) _offset,
-                "Error in reading a doc with offset %" _F64 ", length %d "
-                "from a database file '%s'", offset, doc->length.bodylen,
-                file_Docio->getFileName());
-        free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
-        return _offset;
-    }
-#endif
 
 #ifdef __CRC32
     uint32_t crc_file, crc;
@@ -1404,6 +1484,7 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
         if (comp_body) {
             free(comp_body);
         }
+        free(blob_ref);
         free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
         return _offset;
     }
@@ -1428,7 +1509,12 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
                        crc,
                        file_Docio->getCrcMode());
 
-    if (doc->length.flag & DOCIO_COMPRESSED) {
+    if (doc->length.flag & DOCIO_BLOB) {
+        crc = get_checksum(reinterpret_cast<const uint8_t*>(blob_ref),
+                           doc->length.bodylen_ondisk,
+                           crc,
+                           file_Docio->getCrcMode());
+    } else if (doc->length.flag & DOCIO_COMPRESSED) {
         crc = get_checksum(reinterpret_cast<const uint8_t*>(comp_body),
                            doc->length.bodylen_ondisk,
                            crc,
@@ -1449,11 +1535,21 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
                 "bodylen_ondisk %d offset %" _F64, file_Docio->getFileName(),
                 crc, crc_file, _length.keylen, _length.metalen,
                 _length.bodylen, _length.bodylen_ondisk, offset);
+        free(blob_ref);
         free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
         return (int64_t) FDB_RESULT_CHECKSUM_ERROR;
     }
 #endif
 
+    if (blob_ref) {
+        int64_t ret = _readBlobBody_Docio(doc, blob_ref);
+        free(blob_ref);
+        if (ret < 0) {
+            free_docio_object(doc, key_alloc, meta_alloc, body_alloc);
+            return ret;
+        }
+    }
+
     uint8_t free_meta = meta_alloc && !doc->length.metalen;
     uint8_t free_body = body_alloc && !doc->length.bodylen;
     free_docio_object(doc, false, free_meta, free_body);
@@ -1461,6 +1557,47 @@ int64_t DocioHandle::readDoc_Docio(uint64_t offset,
     return _offset;
 }
 
+int64_t DocioHandle::_readBlobBody_Docio(struct docio_object *doc,
+                                         void *blob_ref)
+{
+    if (BlobMoveScope::isSource(file_Docio)) {
+        // return the reference as the body, so that compaction moves the
+        // reference instead of the body
+        memcpy(doc->body, blob_ref, doc->length.bodylen_ondisk);
+        return FDB_RESULT_SUCCESS;
+    }
+
+    BlobRef ref;
+    if (!ref.decode(blob_ref, doc->length.bodylen_ondisk) ||
+        ref.length != doc->length.bodylen) {
+        fdb_log(log_callback, FDB_RESULT_FILE_CORRUPTION,
+                "File corruption: Invalid blob reference of a doc with "
+                "bodylen %d in a database file '%s'", doc->length.bodylen,
+                file_Docio->getFileName());
+        return (int64_t) FDB_RESULT_FILE_CORRUPTION;
+    }
+    fdb_status fs = _getBlobStore_Docio()->read(ref, doc->body, log_callback);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return (int64_t) fs;
+    }
+    // the body is returned as it is, while 'bodylen_ondisk' still tells the
+    // size of the doc in the file
+    doc->length.flag &= ~DOCIO_BLOB;
+    return FDB_RESULT_SUCCESS;
+}
+
+void DocioHandle::markBlobStale_Docio(uint64_t offset, uint32_t length)
+{
+    void *blob_ref = (void *)malloc(length);
+    BlobRef ref;
+
+    if (_readDocComponent_Docio(offset, length, blob_ref) >= 0 &&
+        ref.decode(blob_ref, length)) {
+        _getBlobStore_Docio()->markStale(ref);
+    }
+    free(blob_ref);
+}
+
 int DocioHandle::_submitAsyncIORequests_Docio(struct docio_object *doc_array,
                                      size_t doc_idx,
                                      struct async_io_handle *aio_handle,
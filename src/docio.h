@@ -19,6 +19,7 @@
 #define _JSAHN_DOCIO_H
 
 #include "filemgr.h"
+#include "blobstore.h"
 #include "common.h"
 
 typedef uint16_t keylen_t;
@@ -113,6 +114,15 @@ public:
                           struct docio_object *doc,
                           bool read_on_cache_miss);
 
+    /**
+     * Mark the body of a document kept in a blob file as stale.
+     *
+     * @param offset File offset to the document's reference to its body
+     *        (i.e., the offset returned by readDocKeyMeta_Docio())
+     * @param length Length of the reference (i.e., bodylen_ondisk)
+     */
+    void markBlobStale_Docio(uint64_t offset, uint32_t length);
+
     /**
      * Read a batch of docs using async reads if possible
      *
@@ -209,6 +219,11 @@ private:
     struct docio_length _decodeLength_Docio(struct docio_length length);
     uint8_t _docio_length_checksum(struct docio_length length);
     bid_t _appendDoc_Docio(struct docio_object *doc);
+    BlobStore *_getBlobStore_Docio();
+    void *_appendBlobBody_Docio(struct docio_object *doc,
+                                struct docio_length *length,
+                                fdb_status *status);
+    int64_t _readBlobBody_Docio(struct docio_object *doc, void *blob_ref);
 
     fdb_status _readThroughBuffer_Docio(bid_t bid, bool read_on_cache_miss);
     bool _checkBuffer_Docio(uint64_t bmp_revnum);
@@ -246,6 +261,7 @@ private:
 #define DOCIO_TXN_DIRTY (0x08)
 #define DOCIO_TXN_COMMITTED (0x10)
 #define DOCIO_SYSTEM (0x20) /* system document */
+#define DOCIO_BLOB (0x40) /* body is kept in a blob file */
 #ifdef DOCIO_LEN_STRUCT_ALIGN
     // this structure will occupy 16 bytes
     struct docio_length {
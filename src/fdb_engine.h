@@ -463,6 +463,21 @@ public:
      */
     size_t getBufferCacheUsed();
 
+    /**
+     * Resize the buffer cache shared by all ForestDB files at runtime.
+     *
+     * @param cache_size New buffer cache size in bytes
+     * @return FDB_RESULT_SUCCESS on success.
+     */
+    fdb_status setBufferCacheSize(uint64_t cache_size);
+
+    /**
+     * Get the current memory usage of each ForestDB component.
+     *
+     * @param usage Pointer to the memory usage structure to be filled
+     */
+    void getMemoryUsage(fdb_memory_usage *usage);
+
     /**
      * Return the overall disk space actively used by a ForestDB file.
      * Note that this doesn't include the disk space used by stale btree nodes
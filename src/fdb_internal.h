@@ -126,6 +126,13 @@ hbtrie_cmp_func * fdb_kvs_find_cmp_chunk(void *chunk, void *aux);
 void fdb_kvs_header_reset_all_stats(FileMgr *file);
 void fdb_kvs_header_create(FileMgr *file);
 uint64_t fdb_kvs_header_append(FdbKvsHandle *handle);
+void fdb_kvs_bloom_filters_init(FdbKvsHandle *handle,
+                                bid_t trie_root_bid,
+                                uint64_t kv_info_offset,
+                                uint64_t header_flags,
+                                uint64_t version);
+void fdb_kvs_blob_stats_init(FdbKvsHandle *handle, uint64_t kv_info_offset,
+                             uint64_t version);
 
 class KvsHeader;
 
@@ -357,7 +364,7 @@ INLINE void _fdb_dirty_update_finalize(FdbKvsHandle *handle,
 
             handle->bnodeMgr->moveDirtyNodesToBcache();
             BnodeCacheMgr::get()->flush(handle->file);
-            handle->bnodeMgr->markEndOfIndexBlocks();
+            handle->bnodeMgr->markEndOfDirtyIndexBlocks();
 
             // set new dirty root info
             _fdb_export_dirty_root(handle, dirty_idtree_root, dirty_seqtree_root);
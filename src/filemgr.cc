@@ -25,12 +25,17 @@
 #include <sys/time.h>
 #endif
 
+#include <algorithm>
 #include <sstream>
 
 #include "filemgr.h"
 #include "filemgr_ops.h"
 #include "hash_functions.h"
 #include "blockcache.h"
+#include "bloom_filter.h"
+#include "secondary_index.h"
+#include "seq_model.h"
+#include "blobstore.h"
 #include "bnodecache.h"
 #include "wal.h"
 #include "list.h"
@@ -55,6 +60,11 @@
 // NBUCKET must be power of 2
 #define NBUCKET (1024)
 
+// Under a memory budget, the buffer cache keeps at least 1/8 of the budget,
+// and grows back in steps of 1/16 of the budget.
+#define FILEMGR_BUDGET_MIN_CACHE_SHARE (8)
+#define FILEMGR_BUDGET_GROW_SHARE (16)
+
 static FileMgrConfig global_config;
 
 std::atomic<bool> FileMgr::fileMgrInitialized(false);
@@ -283,7 +293,10 @@ FileMgr::FileMgr()
       ioInprog(0), fMgrWal(nullptr), exPoolCtx(this), fMgrOps(nullptr),
       fMgrStatus(FILE_NORMAL), fileConfig(nullptr), bCache(nullptr),
       bnodeCache(nullptr), inPlaceCompaction(false),
-      fsType(0), kvHeader(nullptr), throttlingDelay(0), fMgrVersion(0),
+      fsType(0), kvHeader(nullptr), bloomFilters(nullptr),
+      bloomFiltersInit(false), secondaryIndexes(nullptr), seqModels(nullptr),
+      blobStore(nullptr),
+      throttlingDelay(0), fMgrVersion(0),
       fMgrSb(nullptr), kvsStatOps(this), crcMode(CRC_DEFAULT),
       staleData(nullptr), latestDirtyUpdate(nullptr),
       bcacheHits(0), bcacheMisses(0)
@@ -382,6 +395,23 @@ FileMgr::~FileMgr()
     spin_destroy(&handleIdxLock);
  }
 
+// Return the cache size in bytes that fits in the global memory budget
+// along with the WAL indexes, but not larger than a given cache size.
+static uint64_t _filemgr_get_cache_target(uint64_t cache_size)
+{
+    uint64_t budget = global_config.getMemoryBudget();
+    if (!budget) {
+        return cache_size;
+    }
+
+    uint64_t others = Wal::getTotalMemOverhead_Wal() +
+                      SecondaryIndex::getTotalMemUsage() +
+                      global_config.getCompressedCacheSize();
+    uint64_t target = (budget > others) ? (budget - others) : 0;
+    target = std::max(target, budget / FILEMGR_BUDGET_MIN_CACHE_SHARE);
+    return std::min(target, cache_size);
+}
+
 void FileMgr::init(FileMgrConfig *config)
 {
     // global initialization
@@ -395,14 +425,19 @@ void FileMgr::init(FileMgrConfig *config)
             // Block-aligned or non-block-aligned based on the latest file
             // version supported.
             if (global_config.getNcacheBlock() > 0) {
+                uint64_t cache_size = _filemgr_get_cache_target(
+                        static_cast<uint64_t>(global_config.getNcacheBlock()) *
+                        global_config.getBlockSize());
                 if (ver_btreev2_format(ver_get_latest_magic())) {
-                    BnodeCacheMgr::init(static_cast<uint64_t>(
-                                            global_config.getNcacheBlock()) *
-                                        global_config.getBlockSize(),
+                    BnodeCacheMgr::init(cache_size,
                                         global_config.getFlushLimit());
                 } else {
-                    BlockCacheManager::init(global_config.getNcacheBlock(),
-                                            global_config.getBlockSize());
+                    BlockCacheManager::init(std::max(cache_size /
+                                                global_config.getBlockSize(),
+                                                (uint64_t)1),
+                                            global_config.getBlockSize(),
+                                            global_config.getCompressedCacheSize(),
+                                            global_config.getHugePages());
                 }
             }
 
@@ -892,14 +927,118 @@ uint64_t FileMgr::getBcacheUsedSpace(void)
             bcache_space = BnodeCacheMgr::get()->getMemoryUsage();
         } else {
             // Block-aligned cache is configured
-            bcache_space = BlockCacheManager::getInstance()->getNumFreeBlocks();
-            bcache_space = (global_config.getNcacheBlock() - bcache_space)
+            BlockCacheManager *bcache = BlockCacheManager::getInstance();
+            bcache_space = (bcache->getNumCacheBlocks() -
+                            bcache->getNumFreeBlocks())
                            * global_config.getBlockSize();
+            bcache_space += BlockCacheManager::getInstance()->
+                            getCompressedTierUsage();
         }
     }
     return bcache_space;
 }
 
+fdb_status FileMgr::setCacheSize(uint64_t cache_size)
+{
+    LockHolder lock(FileMgr::initMutex);
+
+    if (!fileMgrInitialized || global_config.getNcacheBlock() <= 0) {
+        // The buffer cache was disabled when ForestDB was initialized.
+        return FDB_RESULT_INVALID_CONFIG;
+    }
+
+    uint64_t nblock = cache_size / global_config.getBlockSize();
+    if (nblock == 0) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    uint64_t target = _filemgr_get_cache_target(nblock *
+                                                global_config.getBlockSize());
+    if (ver_btreev2_format(ver_get_latest_magic())) {
+        // Bnodes are allocated on demand; the new limit is enforced by
+        // subsequent evictions.
+        BnodeCacheMgr::get()->updateBnodeCacheLimit(target);
+    } else {
+        fs = BlockCacheManager::getInstance()->resize(
+                std::max(target / global_config.getBlockSize(), (uint64_t)1));
+    }
+
+    if (fs == FDB_RESULT_SUCCESS) {
+        // Files opened from now on get the new cache size in their configs.
+        global_config.setNcacheBlock(static_cast<int>(nblock));
+    }
+    return fs;
+}
+
+void FileMgr::rebalanceMemoryBudget(void)
+{
+    UniqueLock lh(FileMgr::initMutex, std::try_to_lock);
+    if (!lh.owns_lock() || !fileMgrInitialized ||
+        !global_config.getMemoryBudget() ||
+        global_config.getNcacheBlock() <= 0) {
+        return;
+    }
+
+    uint64_t blocksize = global_config.getBlockSize();
+    uint64_t cache_size = (uint64_t)global_config.getNcacheBlock() * blocksize;
+    uint64_t target = _filemgr_get_cache_target(cache_size);
+
+    if (ver_btreev2_format(ver_get_latest_magic())) {
+        BnodeCacheMgr::get()->updateBnodeCacheLimit(target);
+        return;
+    }
+
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+    uint64_t capacity = bcache->getNumCacheBlocks() * blocksize;
+    uint64_t grow_unit = global_config.getMemoryBudget() /
+                         FILEMGR_BUDGET_GROW_SHARE;
+    // Shrink right away, but grow back only in large enough steps so that
+    // the cache isn't resized at every commit.
+    if (target < capacity ||
+        target >= capacity + grow_unit ||
+        (target == cache_size && capacity < cache_size)) {
+        bcache->resize(std::max(target / blocksize, (uint64_t)1));
+    }
+}
+
+bool FileMgr::isOverMemoryBudget(void)
+{
+    uint64_t budget = global_config.getMemoryBudget();
+    if (!budget) {
+        return false;
+    }
+    // The buffer cache can't give up its minimum share of the budget.
+    return Wal::getTotalMemOverhead_Wal() +
+           global_config.getCompressedCacheSize() +
+           budget / FILEMGR_BUDGET_MIN_CACHE_SHARE > budget;
+}
+
+void FileMgr::getMemoryUsage(fdb_memory_usage *usage)
+{
+    memset(usage, 0x0, sizeof(fdb_memory_usage));
+    usage->wal = Wal::getTotalMemOverhead_Wal();
+    usage->secondary_index = SecondaryIndex::getTotalMemUsage();
+    usage->budget = global_config.getMemoryBudget();
+
+    if (fileMgrInitialized && global_config.getNcacheBlock() > 0) {
+        if (ver_btreev2_format(ver_get_latest_magic())) {
+            usage->bnode_cache = BnodeCacheMgr::get()->getMemoryUsage();
+        } else {
+            BlockCacheManager *bcache = BlockCacheManager::getInstance();
+            uint64_t capacity = bcache->getNumCacheBlocks();
+            usage->block_cache_capacity = capacity *
+                                          global_config.getBlockSize();
+            usage->block_cache = (capacity - bcache->getNumFreeBlocks()) *
+                                 global_config.getBlockSize();
+            usage->compressed_cache = bcache->getCompressedTierUsage();
+        }
+    }
+
+    usage->total = usage->block_cache_capacity + usage->compressed_cache +
+                   usage->bnode_cache + usage->wal + usage->secondary_index;
+}
+
 FdbTaskable::FdbTaskable(FileMgr *file) : fileExPoolCtx(file),
     // Workload Policy allows ExecutorPool to have tasks grouped by priority
     // The first parameter marks the file as low (default) or high priority
@@ -913,6 +1052,46 @@ task_gid_t FdbTaskable::getGID() const {
     return task_gid_t(fileExPoolCtx->getFopsHandle());
 }
 
+// Suffix of the sidecar file that keeps the hot cache entries of a DB file
+#define FILEMGR_WARMUP_SUFFIX ".warmup"
+#define FILEMGR_WARMUP_TEMP_SUFFIX ".tmp"
+#define FILEMGR_WARMUP_MAGIC (0xdeadcafebeef0001ULL)
+
+struct filemgr_warmup_header {
+    uint64_t magic;
+    // Commit header that the persisted cache entries belong to
+    uint64_t header_revnum;
+    uint64_t header_bid;
+    uint64_t num_entries;
+    uint32_t blocksize;
+    uint32_t crc;
+};
+
+static std::string _filemgr_get_warmup_filename(const char *filename)
+{
+    return std::string(filename) + FILEMGR_WARMUP_SUFFIX;
+}
+
+// Return the free space of the cache that a given file is cached in.
+static uint64_t _filemgr_get_cache_free_space(FileMgr *file)
+{
+    if (ver_btreev2_format(file->getVersion())) {
+        BnodeCacheMgr *bnode_cache = BnodeCacheMgr::get();
+        if (!bnode_cache) {
+            return 0;
+        }
+        uint64_t limit = bnode_cache->getCacheLimit();
+        uint64_t usage = bnode_cache->getMemoryUsage();
+        return (limit > usage) ? (limit - usage) : 0;
+    }
+
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+    if (!bcache) {
+        return 0;
+    }
+    return bcache->getNumFreeBlocks() * file->getBlockSize();
+}
+
 struct filemgr_prefetch_args {
     FileMgr *file;
     uint64_t duration;
@@ -920,12 +1099,81 @@ struct filemgr_prefetch_args {
     void *aux;
 };
 
+// Read the cache entries persisted on the last close of the file.
+static void _filemgr_warmup_cache(struct filemgr_prefetch_args *args,
+                                  std::vector<uint64_t> &offsets)
+{
+    FileMgr *file = args->file;
+    bool btreev2 = ver_btreev2_format(file->getVersion());
+    // The bnodes read below are not used, but the reads still need to be
+    // done in a reader epoch.
+    BnodeCacheReader bnode_reader;
+    uint64_t blocksize = file->getBlockSize();
+    uint8_t *buf = alca(uint8_t, blocksize);
+    struct timeval begin, cur, gap;
+
+    // Keep the hottest entries that fit into the free cache space, and then
+    // read them in the order of their offsets so that the disk is accessed
+    // sequentially.
+    size_t max_entries = _filemgr_get_cache_free_space(file) / blocksize;
+    if (offsets.size() > max_entries) {
+        offsets.resize(max_entries);
+    }
+    std::sort(offsets.begin(), offsets.end());
+
+    gettimeofday(&begin, NULL);
+    for (auto &offset : offsets) {
+        gettimeofday(&cur, NULL);
+        gap = _utime_gap(begin, cur);
+        if (file->prefetchStatus.load() == FILEMGR_PREFETCH_ABORT ||
+            gap.tv_sec >= (int64_t)args->duration ||
+            _filemgr_get_cache_free_space(file) < blocksize) {
+            break;
+        }
+
+        if (btreev2) {
+            Bnode *node = nullptr;
+            bnode_reader.enter();
+            int ret = BnodeCacheMgr::get()->read(file, &node, offset);
+            bnode_reader.leave();
+            if (ret <= 0) {
+                fdb_log(args->log_callback, FDB_RESULT_READ_FAIL,
+                        "Prefetch thread failed to read a bnode at offset "
+                        "%" _F64 " from a database file '%s'",
+                        offset, file->getFileName());
+                break;
+            }
+        } else {
+            bid_t bid = offset / blocksize;
+            if (file->read_FileMgr(bid, buf, NULL, true) != FDB_RESULT_SUCCESS) {
+                fdb_log(args->log_callback, FDB_RESULT_READ_FAIL,
+                        "Prefetch thread failed to read a block with block "
+                        "id %" _F64 " from a database file '%s'",
+                        bid, file->getFileName());
+                break;
+            }
+        }
+    }
+}
+
 static void *_filemgr_prefetch_thread(void *voidargs)
 {
     struct filemgr_prefetch_args *args = (struct filemgr_prefetch_args*)voidargs;
 
+    // If the hot cache entries were persisted on the last close, warm up the
+    // cache with them instead of scanning the file.
+    std::vector<uint64_t> warmup_offsets;
+    if (args->file->loadWarmupFile(warmup_offsets)) {
+        _filemgr_warmup_cache(args, warmup_offsets);
+        args->file->prefetchStatus.store(FILEMGR_PREFETCH_TERMINATED);
+        free(args);
+        return NULL;
+    }
+
     // Applies to block-aligned buffer cache only for now
     if (ver_btreev2_format(args->file->getVersion())) {
+        args->file->prefetchStatus.store(FILEMGR_PREFETCH_TERMINATED);
+        free(args);
         return nullptr;
     }
 
@@ -996,20 +1244,21 @@ static void *_filemgr_prefetch_thread(void *voidargs)
 // prefetch the given DB file
 void FileMgr::prefetch(ErrLogCallback *log_callback)
 {
-    // Applies to block-aligned buffer cache only for now
-    if (ver_btreev2_format(getVersion())) {
+    // Applies to block-aligned buffer cache only for now, unless the hot
+    // bnodes of the file were persisted on the last close.
+    if (ver_btreev2_format(getVersion()) &&
+        doesFileExist(_filemgr_get_warmup_filename(fileName).c_str())
+            != FDB_RESULT_SUCCESS) {
         return;
     }
 
-    uint64_t bcache_free_space;
-    bcache_free_space = BlockCacheManager::getInstance()->getNumFreeBlocks();
-    bcache_free_space *= getBlockSize();
+    uint64_t cache_free_space = _filemgr_get_cache_free_space(this);
 
-    // block cache should have free space larger than FILEMGR_PREFETCH_UNIT
+    // cache should have free space larger than FILEMGR_PREFETCH_UNIT
     acquireSpinLock();
     filemgr_prefetch_status_t cond = FILEMGR_PREFETCH_IDLE;
     if (getLastCommit() > 0 &&
-        bcache_free_space >= FILEMGR_PREFETCH_UNIT &&
+        cache_free_space >= FILEMGR_PREFETCH_UNIT &&
         prefetchStatus.compare_exchange_strong(cond, FILEMGR_PREFETCH_RUNNING)) {
         // invoke prefetch thread
         struct filemgr_prefetch_args *args;
@@ -1023,6 +1272,151 @@ void FileMgr::prefetch(ErrLogCallback *log_callback)
     releaseSpinLock();
 }
 
+void FileMgr::storeWarmupFile()
+{
+    std::vector<uint64_t> offsets;
+    uint64_t last_commit = getLastCommit();
+
+    if (ver_btreev2_format(getVersion())) {
+        std::vector<cs_off_t> bnode_offsets;
+        BnodeCacheMgr::get()->getHotBnodes(this, bnode_offsets);
+        for (auto &offset : bnode_offsets) {
+            if (offset < 0) {
+                continue;
+            }
+            uint64_t uoffset = static_cast<uint64_t>(offset);
+            if (uoffset < last_commit) {
+                offsets.push_back(_endian_encode(uoffset));
+            }
+        }
+    } else {
+        std::vector<bid_t> bids;
+        BlockCacheManager::getInstance()->getHotBlocks(this, bids);
+        for (auto &bid : bids) {
+            if (bid * blockSize < last_commit) {
+                offsets.push_back(_endian_encode(bid * blockSize));
+            }
+        }
+    }
+
+    if (offsets.empty() || getHeaderBid() == BLK_NOT_FOUND) {
+        // Nothing to warm up; make sure that a stale list is not used.
+        removeWarmupFile(fileName);
+        return;
+    }
+
+    struct filemgr_warmup_header header;
+    header.magic = _endian_encode(FILEMGR_WARMUP_MAGIC);
+    header.header_revnum = _endian_encode(getHeaderRevnum());
+    header.header_bid = _endian_encode(getHeaderBid());
+    header.num_entries = _endian_encode(static_cast<uint64_t>(offsets.size()));
+    header.blocksize = _endian_encode(blockSize);
+    size_t entries_len = offsets.size() * sizeof(uint64_t);
+    uint32_t crc = get_checksum(reinterpret_cast<const uint8_t*>(&header),
+                                offsetof(struct filemgr_warmup_header, crc));
+    crc = get_checksum(reinterpret_cast<const uint8_t*>(offsets.data()),
+                       entries_len, crc, CRC_DEFAULT);
+    header.crc = _endian_encode(crc);
+
+    // The list is written into a temporary file that replaces the old list
+    // only once it is complete, so that a truncated list is never left.
+    std::string warmup_file = _filemgr_get_warmup_filename(fileName);
+    std::string temp_file = warmup_file + FILEMGR_WARMUP_TEMP_SUFFIX;
+    fdb_fileops_handle fops_warmup;
+    fdb_status status = FileMgr::fileOpen(temp_file.c_str(), fMgrOps,
+                                          &fops_warmup,
+                                          O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (status != FDB_RESULT_SUCCESS) {
+        return;
+    }
+    // The warmup list is only a hint, so it is not synced and any write
+    // failure just removes it.
+    bool written = false;
+    ssize_t ret = fMgrOps->pwrite(fops_warmup, &header, sizeof(header), 0);
+    if (ret == static_cast<ssize_t>(sizeof(header))) {
+        ret = fMgrOps->pwrite(fops_warmup, offsets.data(), entries_len,
+                              sizeof(header));
+        written = (ret == static_cast<ssize_t>(entries_len));
+    }
+    FileMgr::fileClose(fMgrOps, fops_warmup);
+    if (!written) {
+        remove(temp_file.c_str());
+        removeWarmupFile(fileName);
+        return;
+    }
+    // rename() does not replace an existing file on Windows.
+    remove(warmup_file.c_str());
+    if (rename(temp_file.c_str(), warmup_file.c_str()) < 0) {
+        remove(temp_file.c_str());
+    }
+}
+
+bool FileMgr::loadWarmupFile(std::vector<uint64_t> &offsets)
+{
+    std::string warmup_file = _filemgr_get_warmup_filename(fileName);
+    fdb_fileops_handle fops_warmup;
+    fdb_status status = FileMgr::fileOpen(warmup_file.c_str(), fMgrOps,
+                                          &fops_warmup, O_RDONLY, 0644);
+    if (status != FDB_RESULT_SUCCESS) {
+        return false;
+    }
+
+    bool valid = false;
+    struct filemgr_warmup_header header;
+    ssize_t ret = fMgrOps->pread(fops_warmup, &header, sizeof(header), 0);
+    cs_off_t file_size = fMgrOps->goto_eof(fops_warmup);
+    if (ret == static_cast<ssize_t>(sizeof(header))) {
+        uint64_t num_entries = _endian_decode(header.num_entries);
+        size_t entries_len = num_entries * sizeof(uint64_t);
+        // The list is valid only if it was written for the latest commit
+        // header of the file.
+        if (_endian_decode(header.magic) == FILEMGR_WARMUP_MAGIC &&
+            _endian_decode(header.blocksize) == blockSize &&
+            _endian_decode(header.header_revnum) == getHeaderRevnum() &&
+            _endian_decode(header.header_bid) == getHeaderBid() &&
+            file_size == static_cast<cs_off_t>(sizeof(header) + entries_len)) {
+            offsets.resize(num_entries);
+            ret = fMgrOps->pread(fops_warmup, offsets.data(), entries_len,
+                                 sizeof(header));
+            if (ret == static_cast<ssize_t>(entries_len)) {
+                uint32_t crc = get_checksum(
+                                   reinterpret_cast<const uint8_t*>(&header),
+                                   offsetof(struct filemgr_warmup_header, crc));
+                crc = get_checksum(reinterpret_cast<const uint8_t*>(offsets.data()),
+                                   entries_len, crc, CRC_DEFAULT);
+                valid = (crc == _endian_decode(header.crc));
+            }
+        }
+    }
+    FileMgr::fileClose(fMgrOps, fops_warmup);
+
+    // The list is consumed by this open, and will be persisted again on the
+    // next close.
+    removeWarmupFile(fileName);
+
+    if (!valid) {
+        offsets.clear();
+        return false;
+    }
+    for (auto &offset : offsets) {
+        offset = _endian_decode(offset);
+    }
+    return !offsets.empty();
+}
+
+void FileMgr::removeWarmupFile(const char *filename)
+{
+    std::string warmup_file = _filemgr_get_warmup_filename(filename);
+    if (doesFileExist(warmup_file.c_str()) == FDB_RESULT_SUCCESS) {
+        remove(warmup_file.c_str());
+    }
+    // a list that was being written when the process crashed
+    std::string temp_file = warmup_file + FILEMGR_WARMUP_TEMP_SUFFIX;
+    if (doesFileExist(temp_file.c_str()) == FDB_RESULT_SUCCESS) {
+        remove(temp_file.c_str());
+    }
+}
+
 fdb_status FileMgr::doesFileExist(const char *filename) {
     struct filemgr_ops *ops = get_filemgr_ops();
     fdb_fileops_handle fops_handle;
@@ -1295,6 +1689,12 @@ filemgr_open_result FileMgr::open(std::string filename,
         break;
     } while (true);
 
+    if (!file->accessHeader()->size && config->getBlobFiles() &&
+        !ver_btreev2_format(file->getVersion())) {
+        // a new file whose docs can keep their bodies in blob files
+        file->setVersion(FILEMGR_MAGIC_004);
+    }
+
     if (!file->staleData) {
         // this means that superblock is not used.
         // init with dummy instance.
@@ -1793,6 +2193,17 @@ fdb_status FileMgr::close(FileMgr *file,
 
             // we can release lock becuase no one will open this file
             file->releaseSpinLock();
+            FileMgr *old_file = FileMgrMap::get()->fetchEntry(file->oldFileName);
+            BlobStore *blob_store = file->getBlobStore();
+            if (blob_store && old_file &&
+                old_file->getFileStatus() == FILE_REMOVED_PENDING) {
+                // the older file is still open, and might refer to the blob
+                // files that became obsolete; remove them along with it.
+                BlobStore *old_blob_store = old_file->initBlobStore(
+                    new BlobStore(old_file->getFileName(), old_file->getOps(),
+                                  0, 0));
+                old_blob_store->takeObsoleteFiles(blob_store);
+            }
             FileMgrMap::get()->removeEntry(file->getFileName());
 
             spin_unlock(&fileMgrOpenlock);
@@ -1892,6 +2303,21 @@ void FileMgr::freeFunc(FileMgr *file)
         thread_join(file->prefetchTid, &ret);
     }
 
+    if (file->fMgrStatus.load() == FILE_REMOVED_PENDING) {
+        FileMgr::removeWarmupFile(file->fileName);
+        if (file->blobStore.load()) {
+            file->blobStore.load()->removeObsoleteFiles();
+        }
+    } else if (global_config.getNcacheBlock() > 0 &&
+               file->fileConfig->getPrefetchDuration() > 0 &&
+               !file->inPlaceCompaction &&
+               (file->fMgrStatus.load() == FILE_NORMAL ||
+                file->fMgrStatus.load() == FILE_CLOSED)) {
+        // persist the hot cache entries so that the next open of the file
+        // can warm up the cache with them
+        file->storeWarmupFile();
+    }
+
     // remove all cached blocks
     file->removeAllBufferBlocks();
 
@@ -1899,6 +2325,10 @@ void FileMgr::freeFunc(FileMgr *file)
         // multi KV intance mode & KV header exists
         file->free_kv_header(file);
     }
+    delete file->bloomFilters.load();
+    delete file->secondaryIndexes.load();
+    delete file->seqModels.load();
+    delete file->blobStore.load();
 
     // free global transaction
     file->fMgrWal->removeTransaction_Wal(&file->globalTxn);
@@ -2582,6 +3012,17 @@ fdb_status FileMgr::commitBid(bid_t bid, uint64_t bmp_revnum, bool sync,
         }
     }
 
+    // Bodies in blob files should be durable before the header that refers
+    // to them.
+    BlobStore *blob_store = getBlobStore();
+    if (sync && blob_store) {
+        result = blob_store->sync(log_callback);
+        if (result != FDB_RESULT_SUCCESS) {
+            clearIoInprog();
+            return (fdb_status)result;
+        }
+    }
+
     acquireSpinLock();
 
     uint16_t header_len = fMgrHeader.size;
@@ -2816,6 +3257,42 @@ void FileMgr::setCompactionState(FileMgr *old_file, FileMgr *new_file,
     }
 }
 
+bool FileMgr::initBloomFilters(KvsBloomFilters *filters) {
+    if (bloomFiltersInit) {
+        return false;
+    }
+    bloomFilters.store(filters);
+    bloomFiltersInit = true;
+    return true;
+}
+
+KvsSecondaryIndexes* FileMgr::initSecondaryIndexes(KvsSecondaryIndexes *sindexes) {
+    KvsSecondaryIndexes *expected = nullptr;
+    if (!secondaryIndexes.compare_exchange_strong(expected, sindexes)) {
+        delete sindexes;
+        return expected;
+    }
+    return sindexes;
+}
+
+KvsSeqModels* FileMgr::initSeqModels(KvsSeqModels *models) {
+    KvsSeqModels *expected = nullptr;
+    if (!seqModels.compare_exchange_strong(expected, models)) {
+        delete models;
+        return expected;
+    }
+    return models;
+}
+
+BlobStore* FileMgr::initBlobStore(BlobStore *store) {
+    BlobStore *expected = nullptr;
+    if (!blobStore.compare_exchange_strong(expected, store)) {
+        delete store;
+        return expected;
+    }
+    return store;
+}
+
 bool FileMgr::setKVHeader(KvsHeader *kv_header,
                           void (*free_kv_header)(FileMgr *file)) {
     bool ret;
@@ -2940,6 +3417,22 @@ void FileMgr::removePending(FileMgr *old_file,
 
         spin_unlock(&old_file->fMgrLock);
 
+#if !(defined(WIN32) || defined(_WIN32))
+        BlobStore *blob_store = old_file->getBlobStore();
+        if (blob_store) {
+            spin_lock(&fileMgrOpenlock);
+            FileMgr *older_file = FileMgrMap::get()->fetchEntry(
+                                                    old_file->oldFileName);
+            if (!older_file ||
+                older_file->getFileStatus() != FILE_REMOVED_PENDING) {
+                // unlink the obsolete blob files along with the old file,
+                // unless an older file still open might refer to them
+                blob_store->unlinkObsoleteFiles(log_callback);
+            }
+            spin_unlock(&fileMgrOpenlock);
+        }
+#endif
+
     } else {
         // immediatly remove
         // LCOV_EXCL_START
@@ -3110,6 +3603,11 @@ fdb_status FileMgr::destroyFile(std::string filename,
         }
     }
 
+    if (status == FDB_RESULT_SUCCESS) {
+        FileMgr::removeWarmupFile(filename.c_str());
+        BlobStore::removeBlobFiles(filename.c_str());
+    }
+
     if (!destroy_file_set) { // top level or non-recursive call
         destroy_set->clear();
     }
@@ -3981,6 +4479,21 @@ KvsOpsStat* KvsStatOperations::migrateOpStats(FileMgr *old_file,
     return ret;
 }
 
+thread_local FileMgr *ScanReadScope::scanFile = NULL;
+
+ScanReadScope::ScanReadScope(FileMgr *file, bool enable)
+    : prevFile(scanFile)
+{
+    if (enable) {
+        scanFile = file;
+    }
+}
+
+ScanReadScope::~ScanReadScope()
+{
+    scanFile = prevFile;
+}
+
 #ifdef _LATENCY_STATS
 void LatencyStats::init(struct latency_stat *val) {
     val->lat_max = 0;
@@ -48,6 +48,7 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #ifdef _PLATFORM_LIB_AVAILABLE
 #include <platform/histogram.h>
@@ -67,11 +68,14 @@ class SuperblockBase;
 class FileMgrConfig {
 public:
     FileMgrConfig()
-        : blocksize(FDB_BLOCKSIZE), ncacheblock(0),
+        : blocksize(FDB_BLOCKSIZE), ncacheblock(0), compressed_cache_size(0),
+          memory_budget(0), huge_pages(false), blob_files(false),
           flushlimit(1048576), flag(0), chunksize(sizeof(uint64_t)),
           options(0x00), seqtree_opt(FDB_SEQTREE_NOT_USE), prefetch_duration(0),
           num_wal_shards(DEFAULT_NUM_WAL_PARTITIONS),
           num_bcache_shards(DEFAULT_NUM_BCACHE_PARTITIONS),
+          cache_min_reservation(0), cache_max_limit(0),
+          cache_priority(FDB_CACHE_PRIORITY_NORMAL),
           block_reusing_threshold(65/*default*/),
           num_keeping_headers(5/*default*/)
     {
@@ -89,6 +93,10 @@ public:
                   uint64_t _num_keeping_headers)
         : blocksize(_blocksize),
           ncacheblock(_ncacheblock),
+          compressed_cache_size(0),
+          memory_budget(0),
+          huge_pages(false),
+          blob_files(false),
           flushlimit(_flushlimit),
           flag(_flag),
           chunksize(_chunksize),
@@ -97,6 +105,9 @@ public:
           prefetch_duration(_prefetch_duration),
           num_wal_shards(_num_wal_shards),
           num_bcache_shards(_num_bcache_shards),
+          cache_min_reservation(0),
+          cache_max_limit(0),
+          cache_priority(FDB_CACHE_PRIORITY_NORMAL),
           block_reusing_threshold(_block_reusing_threshold),
           num_keeping_headers(_num_keeping_headers)
     {
@@ -109,6 +120,10 @@ public:
     void operator=(const FileMgrConfig& config) {
         blocksize = config.blocksize;
         ncacheblock = config.ncacheblock;
+        compressed_cache_size = config.compressed_cache_size;
+        memory_budget = config.memory_budget;
+        huge_pages = config.huge_pages;
+        blob_files = config.blob_files;
         flushlimit = config.flushlimit;
         flag = config.flag;
         seqtree_opt = config.seqtree_opt;
@@ -117,6 +132,9 @@ public:
         prefetch_duration = config.prefetch_duration;
         num_wal_shards = config.num_wal_shards;
         num_bcache_shards = config.num_bcache_shards;
+        cache_min_reservation = config.cache_min_reservation;
+        cache_max_limit = config.cache_max_limit;
+        cache_priority = config.cache_priority;
         encryption_key = config.encryption_key;
         block_reusing_threshold.store(config.block_reusing_threshold.load(),
                                       std::memory_order_relaxed);
@@ -132,6 +150,22 @@ public:
         ncacheblock = to;
     }
 
+    void setCompressedCacheSize(uint64_t to) {
+        compressed_cache_size = to;
+    }
+
+    void setMemoryBudget(uint64_t to) {
+        memory_budget = to;
+    }
+
+    void setHugePages(bool to) {
+        huge_pages = to;
+    }
+
+    void setBlobFiles(bool to) {
+        blob_files = to;
+    }
+
     void setFlushLimit(size_t to) {
         flushlimit = to;
     }
@@ -172,6 +206,18 @@ public:
         num_bcache_shards = to;
     }
 
+    void setCacheMinReservation(uint64_t to) {
+        cache_min_reservation = to;
+    }
+
+    void setCacheMaxLimit(uint64_t to) {
+        cache_max_limit = to;
+    }
+
+    void setCachePriority(fdb_cache_priority_t to) {
+        cache_priority = to;
+    }
+
     void setEncryptionKey(fdb_encryption_algorithm_t to,
                           uint8_t byte) {
         encryption_key.algorithm = to;
@@ -198,6 +244,22 @@ public:
         return ncacheblock;
     }
 
+    uint64_t getCompressedCacheSize() const {
+        return compressed_cache_size;
+    }
+
+    uint64_t getMemoryBudget() const {
+        return memory_budget;
+    }
+
+    bool getHugePages() const {
+        return huge_pages;
+    }
+
+    bool getBlobFiles() const {
+        return blob_files;
+    }
+
     size_t getFlushLimit() const {
         return flushlimit;
     }
@@ -230,6 +292,18 @@ public:
         return num_bcache_shards;
     }
 
+    uint64_t getCacheMinReservation() const {
+        return cache_min_reservation;
+    }
+
+    uint64_t getCacheMaxLimit() const {
+        return cache_max_limit;
+    }
+
+    fdb_cache_priority_t getCachePriority() const {
+        return cache_priority;
+    }
+
     fdb_encryption_key* getEncryptionKey() {
         return &encryption_key;
     }
@@ -245,6 +319,14 @@ public:
 private:
     int blocksize;
     int ncacheblock;
+    uint64_t compressed_cache_size;
+    // Global memory budget shared by the caches and WAL indexes (in bytes)
+    uint64_t memory_budget;
+    // Back the buffer cache memory with huge pages
+    bool huge_pages;
+    // Create new files in the format that keeps large document bodies in
+    // blob files (FILEMGR_MAGIC_004)
+    bool blob_files;
     size_t flushlimit;
     int flag;
     int chunksize;
@@ -253,6 +335,10 @@ private:
     uint64_t prefetch_duration;
     uint16_t num_wal_shards;
     uint16_t num_bcache_shards;
+    // Per-file buffer cache reservation, limit (in bytes), and priority
+    uint64_t cache_min_reservation;
+    uint64_t cache_max_limit;
+    fdb_cache_priority_t cache_priority;
     fdb_encryption_key encryption_key;
     // Stale block reusing threshold
     std::atomic<uint64_t> block_reusing_threshold;
@@ -416,6 +502,10 @@ enum {
 #define DLOCK_MAX (41) /* a prime number */
 class Wal;
 class KvsHeader;
+class KvsBloomFilters;
+class KvsSecondaryIndexes;
+class KvsSeqModels;
+class BlobStore;
 class FileBlockCache;
 class FileBnodeCache;
 
@@ -780,6 +870,64 @@ public:
         this->free_kv_header = free_kv_header;
     }
 
+    /**
+     * Set up the per-KV store Bloom filters of the file. This is done only
+     * once, when the file is opened for the first time, and the filters are
+     * not used if 'filters' is NULL. The caller should grab the file mutex.
+     *
+     * @param filters Filters covering all keys in the file's HB+trie.
+     * @return False if the filters were already set up, in which case
+     *         the caller should free 'filters'.
+     */
+    bool initBloomFilters(KvsBloomFilters *filters);
+
+    bool isBloomFiltersInitialized() const {
+        return bloomFiltersInit;
+    }
+
+    KvsBloomFilters* getBloomFilters() const {
+        return bloomFilters.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Set up the secondary indexes of the file, if they have not been set up
+     * yet. Otherwise, 'sindexes' is freed.
+     *
+     * @param sindexes Secondary indexes to be used for the file.
+     * @return Secondary indexes used for the file.
+     */
+    KvsSecondaryIndexes* initSecondaryIndexes(KvsSecondaryIndexes *sindexes);
+
+    KvsSecondaryIndexes* getSecondaryIndexes() const {
+        return secondaryIndexes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Set up the sequence number models of the file, if they have not been
+     * set up yet. Otherwise, 'models' is freed.
+     *
+     * @param models Sequence number models to be used for the file.
+     * @return Sequence number models used for the file.
+     */
+    KvsSeqModels* initSeqModels(KvsSeqModels *models);
+
+    KvsSeqModels* getSeqModels() const {
+        return seqModels.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Set up the blob files of the file, if they have not been set up yet.
+     * Otherwise, 'store' is freed.
+     *
+     * @param store Blob store to be used for the file.
+     * @return Blob store used for the file.
+     */
+    BlobStore* initBlobStore(BlobStore *store);
+
+    BlobStore* getBlobStore() const {
+        return blobStore.load(std::memory_order_relaxed);
+    }
+
     void setThrottlingDelay(uint64_t delay_us);
 
     uint32_t getThrottlingDelay() const;
@@ -998,6 +1146,39 @@ public:
 
     static uint64_t getBcacheUsedSpace(void);
 
+    /**
+     * Resize the global buffer cache (or bnode cache) at runtime.
+     *
+     * @param cache_size New cache size in bytes
+     * @return FDB_RESULT_SUCCESS on success
+     */
+    static fdb_status setCacheSize(uint64_t cache_size);
+
+    /**
+     * Adjust the capacity of the global buffer cache (or bnode cache) so that
+     * the caches and the WAL indexes of all the open files stay within the
+     * global memory budget. The cache never grows beyond the configured
+     * buffer cache size. This is a no-op if no budget is set, or if another
+     * thread is already adjusting the cache.
+     */
+    static void rebalanceMemoryBudget(void);
+
+    /**
+     * Check if the WAL indexes of all the open files use more memory than
+     * the global memory budget can provide, even after the buffer cache
+     * has shrunk to its minimum share of the budget.
+     *
+     * @return True if the budget is set and the WAL indexes should be flushed
+     */
+    static bool isOverMemoryBudget(void);
+
+    /**
+     * Get the current memory usage of each ForestDB component.
+     *
+     * @param usage Pointer to the memory usage structure to be filled
+     */
+    static void getMemoryUsage(fdb_memory_usage *usage);
+
     /**
      * This is a helper function that does 'file open ops' on a file
      *
@@ -1273,6 +1454,24 @@ public:
         return bcacheMisses.load();
     }
 
+    /**
+     * Load the offsets of the cache entries persisted on the last close of
+     * the file, and remove the warmup sidecar file. The entries are returned
+     * only if they were persisted for the current commit header.
+     *
+     * @param offsets Vector that the offsets of hot cache entries are
+     *        returned in, ordered from the hottest one
+     * @return True if any valid entry is loaded
+     */
+    bool loadWarmupFile(std::vector<uint64_t> &offsets);
+
+    /**
+     * Remove the warmup sidecar file of a given DB file if it exists.
+     *
+     * @param filename Name of the DB file
+     */
+    static void removeWarmupFile(const char *filename);
+
     // variables related to prefetching
     std::atomic<uint8_t> prefetchStatus;
     thread_t prefetchTid;
@@ -1327,6 +1526,13 @@ private:
      */
     void prefetch(ErrLogCallback *log_callback);
 
+    /**
+     * Persist the offsets of the hot cache entries of the file into its
+     * warmup sidecar file, so that the prefetch thread can read them back
+     * when the file is opened next time.
+     */
+    void storeWarmupFile();
+
     /**
      * CRC32 check for a given buffer
      *
@@ -1385,6 +1591,15 @@ private:
     filemgr_fs_type_t fsType;
     KvsHeader *kvHeader;
     void (*free_kv_header)(FileMgr *file); // callback function
+    // Per-KV store Bloom filters, or NULL if they are not used
+    std::atomic<KvsBloomFilters *> bloomFilters;
+    bool bloomFiltersInit;
+    // Secondary indexes registered by the application, or NULL if none
+    std::atomic<KvsSecondaryIndexes *> secondaryIndexes;
+    // Per-KV store models of the seq index, or NULL if not built yet
+    std::atomic<KvsSeqModels *> seqModels;
+    // Blob files holding large document bodies, or NULL if none is used yet
+    std::atomic<BlobStore *> blobStore;
     std::atomic<uint32_t> throttlingDelay;
 
     // File format version
@@ -1476,6 +1691,36 @@ struct filemgr_fhandle_idx_node {
     struct avl_node avl;
 };
 
+/**
+ * Scoped hint that the calling thread is a one-shot sequential reader of a
+ * given file (e.g., compaction or a scan iterator). While an instance is
+ * alive, blocks and B+tree nodes of the file that are brought into the
+ * cache by this thread are admitted at the cold end of the LRU list, and
+ * cache hits don't refresh their recency, so that the scan doesn't evict
+ * the working set of other readers.
+ */
+class ScanReadScope {
+public:
+    ScanReadScope(FileMgr *file, bool enable = true);
+
+    ~ScanReadScope();
+
+    /**
+     * Check if the calling thread is currently scanning a given file.
+     *
+     * @param file Pointer to the file manager instance
+     * @return True if reads of the file should bypass the LRU promotion
+     */
+    static bool isActive(FileMgr *file) {
+        return file && scanFile == file;
+    }
+
+private:
+    FileMgr *prevFile;
+    // File being scanned by the current thread, if any.
+    static thread_local FileMgr *scanFile;
+};
+
 /**
  * Convert a given errno value to the corresponding fdb_status value.
  *
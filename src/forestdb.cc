@@ -54,6 +54,10 @@
 #include "system_resource_stats.h"
 #include "version.h"
 #include "staleblock.h"
+#include "bloom_filter.h"
+#include "secondary_index.h"
+#include "seq_model.h"
+#include "blobstore.h"
 
 #ifdef __DEBUG
 #ifndef __DEBUG_FDB
@@ -893,7 +897,8 @@ fdb_status _fdb_clone_snapshot(FdbKvsHandle *handle_in,
                                       (void *)handle_out->dhandle,
                                       _fdb_readkey_wrap);
         // set aux for cmp wrapping function
-        handle_out->trie->setLeafHeightLimit(0xff);
+        handle_out->trie->setLeafHeightLimit(
+                               handle_in->trie->getLeafHeightLimit());
         handle_out->trie->setLeafCmp(_fdb_custom_cmp_wrap);
         if (handle_out->kvs) {
             handle_out->trie->setMapFunction(fdb_kvs_find_cmp_chunk);
@@ -1497,6 +1502,11 @@ static uint64_t _fdb_export_header_flags(FdbKvsHandle *handle)
         // the default KVS is based on custom key order
         rv |= FDB_FLAG_ROOT_CUSTOM_CMP;
     }
+    KvsBloomFilters *filters = handle->file->getBloomFilters();
+    if (filters && filters->isPersistedAt(handle->kv_info_offset)) {
+        // the KV header refers to Bloom filters covering all keys
+        rv |= FDB_FLAG_BLOOM_FILTER;
+    }
     return rv;
 }
 
@@ -2048,6 +2058,28 @@ size_t fdb_get_buffer_cache_used() {
     return 0;
 }
 
+LIBFDB_API
+fdb_status fdb_get_memory_usage(fdb_memory_usage *usage) {
+    if (!usage) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    FdbEngine *fdb_engine = FdbEngine::getInstance();
+    if (fdb_engine) {
+        fdb_engine->getMemoryUsage(usage);
+        return FDB_RESULT_SUCCESS;
+    }
+    return FDB_RESULT_ENGINE_NOT_INSTANTIATED;
+}
+
+LIBFDB_API
+fdb_status fdb_set_cache_size(uint64_t cache_size) {
+    FdbEngine *fdb_engine = FdbEngine::getInstance();
+    if (fdb_engine) {
+        return fdb_engine->setBufferCacheSize(cache_size);
+    }
+    return FDB_RESULT_ENGINE_NOT_INSTANTIATED;
+}
+
 LIBFDB_API
 fdb_status fdb_cancel_compaction(fdb_file_handle *fhandle)
 {
@@ -2123,7 +2155,9 @@ fdb_status FdbEngine::init(fdb_config *config) {
             // We temporarily disable validity checking of block cache size
             // on Android platform at this time.
             double ram_size = (double) get_memory_size();
-            if (ram_size * BCACHE_MEMORY_THRESHOLD < (double) _config.buffercache_size) {
+            if (ram_size * BCACHE_MEMORY_THRESHOLD <
+                (double) (_config.buffercache_size +
+                          _config.compressed_buffercache_size)) {
                 return FDB_RESULT_TOO_BIG_BUFFER_CACHE;
             }
 #endif
@@ -2136,6 +2170,9 @@ fdb_status FdbEngine::init(fdb_config *config) {
             // Initialize file manager configs and global block cache
             f_config.setBlockSize(_config.blocksize);
             f_config.setNcacheBlock(_config.buffercache_size / _config.blocksize);
+            f_config.setCompressedCacheSize(_config.compressed_buffercache_size);
+            f_config.setMemoryBudget(_config.memory_budget);
+            f_config.setHugePages(_config.buffercache_huge_pages);
             f_config.setSeqtreeOpt(_config.seqtree_opt);
             FileMgr::init(&f_config);
             FileMgr::setLazyFileDeletion(true,
@@ -2208,6 +2245,7 @@ void FdbEngine::initFileConfig(const fdb_config *config,
                                FileMgrConfig *fconfig) {
     fconfig->setBlockSize(config->blocksize);
     fconfig->setNcacheBlock(config->buffercache_size / config->blocksize);
+    fconfig->setCompressedCacheSize(config->compressed_buffercache_size);
     fconfig->setChunkSize(config->chunksize);
 
     fconfig->addOptions(0x0);
@@ -2232,7 +2270,14 @@ void FdbEngine::initFileConfig(const fdb_config *config,
     fconfig->setPrefetchDuration(config->prefetch_duration);
     fconfig->setNumWalShards(config->num_wal_partitions);
     fconfig->setNumBcacheShards(config->num_bcache_partitions);
+    fconfig->setCacheMinReservation(config->buffercache_min_reservation);
+    fconfig->setCacheMaxLimit(config->buffercache_max_limit);
+    fconfig->setCachePriority(config->buffercache_priority);
     fconfig->setEncryptionKey(config->encryption_key);
+    // blob files are not encrypted, so encrypted files keep bodies inline
+    fconfig->setBlobFiles(config->blob_threshold &&
+                          config->encryption_key.algorithm ==
+                          FDB_ENCRYPTION_NONE);
     fconfig->setBlockReusingThreshold(config->block_reusing_threshold);
     fconfig->setNumKeepingHeaders(config->num_keeping_headers);
 }
@@ -2465,6 +2510,22 @@ fdb_status FdbEngine::openFdb(FdbKvsHandle *handle,
     handle->dhandle = new DocioHandle(handle->file, config->compress_document_body,
                                       &handle->log_callback);
 
+    if (ver_blob_support(handle->file->getVersion()) &&
+        !handle->file->getBlobStore()) {
+        // large document bodies are kept in blob files next to the file,
+        // unless the file is encrypted (blob files are not). They are named
+        // after the original file if the file was compacted in-place.
+        bool encrypted = handle->file->getEncryption()->ops != nullptr;
+        std::string blob_name(handle->file->getFileName());
+        if (handle->file->isInPlaceCompactionSet()) {
+            blob_name = virtual_filename;
+        }
+        handle->file->initBlobStore(
+            new BlobStore(blob_name.c_str(), handle->file->getOps(),
+                          encrypted ? 0 : config->blob_threshold,
+                          config->blob_gc_threshold));
+    }
+
     // fetch previous superblock bitmap info if exists
     // (this should be done after 'handle->dhandle' is initialized)
     SuperblockBase *sb = handle->file->getSb();
@@ -2807,6 +2868,10 @@ fdb_status FdbEngine::openFdb(FdbKvsHandle *handle,
         if (!locked) {
             handle->file->mutexLock();
         }
+        // set up Bloom filters before the first KV header is appended
+        fdb_kvs_bloom_filters_init(handle, trie_root_bid, kv_info_offset,
+                                   header_flags, version);
+        fdb_kvs_blob_stats_init(handle, kv_info_offset, version);
         if (kv_info_offset == BLK_NOT_FOUND) {
             // there is no KV header .. create & initialize
             fdb_kvs_header_create(handle->file);
@@ -2898,7 +2963,7 @@ fdb_status FdbEngine::openFdb(FdbKvsHandle *handle,
                                   handle->bhandle,
                                   (void *)handle->dhandle, _fdb_readkey_wrap);
         // set aux for cmp wrapping function
-        handle->trie->setLeafHeightLimit(0xff);
+        handle->trie->setLeafHeightLimit(config->leaf_height_limit);
         handle->trie->setLeafCmp(_fdb_custom_cmp_wrap);
         if (handle->kvs) {
             handle->trie->setMapFunction(fdb_kvs_find_cmp_chunk);
@@ -3178,6 +3243,15 @@ fdb_status FdbEngine::get(FdbKvsHandle *handle, fdb_doc *doc,
 
     handle->op_stats->num_gets++;
 
+    KvsBloomFilters *filters = handle->file->getBloomFilters();
+    if (wr == FDB_RESULT_KEY_NOT_FOUND && filters && handle->kvs &&
+        !handle->kvs_config.custom_cmp &&
+        !filters->mayContain(handle->kvs->getKvsId(), doc->key, doc->keylen)) {
+        // the key has never been flushed into the HB+trie
+        END_HANDLE_BUSY(handle);
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+
     if (wr == FDB_RESULT_KEY_NOT_FOUND) {
         _fdb_sync_dirty_root(handle);
 
@@ -3263,6 +3337,37 @@ fdb_status FdbEngine::get(FdbKvsHandle *handle, fdb_doc *doc,
     return FDB_RESULT_KEY_NOT_FOUND;
 }
 
+// Look up the seqnum through the sequence number model of the KV store,
+// which reads one or two leaf nodes of the seq index instead of descending
+// it from the root.
+static seq_model_result _fdb_seq_model_find(FdbKvsHandle *handle,
+                                            fdb_seqnum_t seqnum,
+                                            uint64_t *offset_out)
+{
+    KvsSeqModels *models = handle->file->getSeqModels();
+    if (!models || handle->shandle ||
+        ver_btreev2_format(handle->file->getVersion()) ||
+        handle->bhandle->getDirtyUpdate()) {
+        // dirty nodes may be updated in place without changing their BIDs,
+        // so the model is used for committed nodes only
+        return SEQ_MODEL_MISS;
+    }
+
+    if (!handle->kvs) {
+        return models->find(0, handle->seqtree, seqnum, offset_out);
+    }
+
+    BTree subtree;
+    uint8_t _kv_id[sizeof(fdb_kvs_id_t)];
+    fdb_kvs_id_t kv_id = handle->kvs->getKvsId();
+    kvid2buf(sizeof(fdb_kvs_id_t), kv_id, _kv_id);
+    if (handle->seqtrie->findSubBtree(_kv_id, sizeof(fdb_kvs_id_t),
+                                      &subtree) != HBTRIE_RESULT_SUCCESS) {
+        return SEQ_MODEL_MISS;
+    }
+    return models->find(kv_id, &subtree, seqnum, offset_out);
+}
+
 fdb_status FdbEngine::getBySeq(FdbKvsHandle *handle,
                                fdb_doc *doc,
                                bool metaOnly)
@@ -3337,7 +3442,11 @@ fdb_status FdbEngine::getBySeq(FdbKvsHandle *handle,
         _fdb_sync_dirty_root(handle);
 
         _seqnum = _endian_encode(doc->seqnum);
-        if (handle->kvs) {
+        seq_model_result smr = _fdb_seq_model_find(handle, doc->seqnum,
+                                                   &offset);
+        if (smr != SEQ_MODEL_MISS) {
+            br = (smr == SEQ_MODEL_FOUND)?(BTREE_RESULT_SUCCESS):(br);
+        } else if (handle->kvs) {
             int size_id, size_seq;
             uint8_t *kv_seqnum;
             hbtrie_result hr;
@@ -3524,6 +3633,27 @@ fdb_status FdbEngine::getByOffset(FdbKvsHandle *handle, fdb_doc *doc)
     return FDB_RESULT_SUCCESS;
 }
 
+// Extract the secondary key of a document that is being written, if its
+// KV store has a secondary index. Return false if it does not.
+static bool _fdb_sindex_extract(FdbKvsHandle *handle,
+                                fdb_doc *doc,
+                                std::string &skey_out)
+{
+    KvsSecondaryIndexes *sindexes = handle->file->getSecondaryIndexes();
+    if (!sindexes) {
+        return false;
+    }
+    SecondaryIndex *sindex =
+        sindexes->getIndex(handle->kvs ? handle->kvs->getKvsId() : 0);
+    if (!sindex) {
+        return false;
+    }
+    uint8_t *skey_buf = alca(uint8_t, FDB_MAX_KEYLEN);
+    size_t skeylen = sindex->extractKey(doc, skey_buf);
+    skey_out.assign((char *)skey_buf, skeylen);
+    return true;
+}
+
 fdb_status FdbEngine::set(FdbKvsHandle *handle, fdb_doc *doc)
 {
     if (!handle) {
@@ -3688,6 +3818,11 @@ fdb_set_start:
     if (!txn) {
         txn = file->getGlobalTxn();
     }
+    // Extract the secondary key while the document is at hand, so that the
+    // WAL flush does not need to read the document back.
+    std::string sindex_key;
+    bool has_sindex_key = !doc->deleted &&
+                          _fdb_sindex_extract(handle, doc, sindex_key);
     if (handle->kvs) {
         // multi KV instance mode
         fdb_doc kv_ins_doc = *doc;
@@ -3695,14 +3830,15 @@ fdb_set_start:
         kv_ins_doc.keylen = _doc.length.keylen;
         if (!immediate_remove) {
             file->getWal()->insert_Wal(txn, &cmp_info, &kv_ins_doc, offset,
-                       WAL_INS_WRITER);
+                       WAL_INS_WRITER, has_sindex_key ? &sindex_key : NULL);
         } else {
             file->getWal()->immediateRemove_Wal(txn, &cmp_info, &kv_ins_doc, offset,
                                  WAL_INS_WRITER);
         }
     } else {
         if (!immediate_remove) {
-            file->getWal()->insert_Wal(txn, &cmp_info, doc, offset, WAL_INS_WRITER);
+            file->getWal()->insert_Wal(txn, &cmp_info, doc, offset, WAL_INS_WRITER,
+                                       has_sindex_key ? &sindex_key : NULL);
         } else {
             file->getWal()->immediateRemove_Wal(txn, &cmp_info, doc, offset,
                                            WAL_INS_WRITER);
@@ -3935,12 +4071,14 @@ fdb_commit_start:
 
     if (handle->file->getWal()->getNumFlushable_Wal() > _fdb_get_wal_threshold(handle) ||
         handle->file->getWal()->getDirtyStatus_Wal() == FDB_WAL_PENDING ||
-        opt & FDB_COMMIT_MANUAL_WAL_FLUSH) {
+        opt & FDB_COMMIT_MANUAL_WAL_FLUSH ||
+        FileMgr::isOverMemoryBudget()) {
         // wal flush when
         // 1. wal size exceeds threshold
         // 2. wal is already flushed before commit
         //    (in this case, flush the rest of entries)
         // 3. user forces to manually flush wal
+        // 4. the global memory budget is exceeded
 
         struct filemgr_dirty_update_node *prev_node = NULL, *new_node = NULL;
 
@@ -4119,6 +4257,10 @@ fdb_commit_start:
     handle->dirty_updates = 0;
     handle->file->mutexUnlock();
 
+    // Let the buffer cache give up or take back memory as the WAL indexes
+    // grow or get flushed.
+    FileMgr::rebalanceMemoryBudget();
+
     LATENCY_STAT_END(handle->file, FDB_LATENCY_COMMITS);
     handle->op_stats->num_commits++;
     END_HANDLE_BUSY(handle);
@@ -4462,6 +4604,11 @@ fdb_status FdbEngine::rollback(FdbKvsHandle **handle_ptr, fdb_seqnum_t seqnum)
         handle_in->file->mutexLock();
         old_seqnum = handle_in->file->getSeqnum();
         handle_in->file->setSeqnum(seqnum);
+        // The secondary index still holds the rolled-back entries; it is
+        // rebuilt lazily by the next secondary iterator.
+        if (handle_in->file->getSecondaryIndexes()) {
+            handle_in->file->getSecondaryIndexes()->invalidate(0);
+        }
         handle_in->file->mutexUnlock();
 
         bool sync = !(handle_in->config.durability_opt & FDB_DRB_ASYNC);
@@ -4607,6 +4754,9 @@ fdb_status FdbEngine::rollbackAll(FdbFileHandle *fhandle,
         file->mutexLock();
         old_seqnum = file->getSeqnum();
         file->setSeqnum(handle->seqnum);
+        if (file->getSecondaryIndexes()) {
+            file->getSecondaryIndexes()->invalidateAll();
+        }
         file->mutexUnlock();
 
         bool sync = !(handle->config.durability_opt & FDB_DRB_ASYNC);
@@ -4734,6 +4884,20 @@ size_t FdbEngine::getBufferCacheUsed() {
     return (size_t) FileMgr::getBcacheUsedSpace();
 }
 
+void FdbEngine::getMemoryUsage(fdb_memory_usage *usage) {
+    FileMgr::getMemoryUsage(usage);
+}
+
+fdb_status FdbEngine::setBufferCacheSize(uint64_t cache_size) {
+#if !defined(_ANDROID_) && !defined(__ANDROID__)
+    double ram_size = (double) get_memory_size();
+    if (ram_size * BCACHE_MEMORY_THRESHOLD < (double) cache_size) {
+        return FDB_RESULT_TOO_BIG_BUFFER_CACHE;
+    }
+#endif
+    return FileMgr::setCacheSize(cache_size);
+}
+
 size_t FdbEngine::estimateSpaceUsedInternal(FdbKvsHandle *handle)
 {
     size_t ret = 0;
@@ -5595,6 +5759,58 @@ INLINE int _fdb_seq_entry_cmp(struct avl_node *a, struct avl_node *b, void *aux)
     }
 }
 
+// Update the secondary index entry of a document flushed from the WAL, if
+// the KV store has a secondary index. The secondary key extracted by the
+// writer is used if it exists; otherwise (e.g., documents written before
+// the index was registered, or moved by the compactor) the document is read.
+static void _fdb_sindex_update(FdbKvsHandle *handle,
+                               fdb_kvs_id_t kv_id,
+                               struct wal_item *item)
+{
+    KvsSecondaryIndexes *sindexes = handle->file->getSecondaryIndexes();
+    SecondaryIndex *sindex = sindexes ? sindexes->getIndex(kv_id) : NULL;
+    if (!sindex) {
+        return;
+    }
+
+    size_t size_chunk = handle->kvs ? handle->config.chunksize : 0;
+    std::string pkey((char *)item->header->key + size_chunk,
+                     item->header->keylen - size_chunk);
+    if (item->action != WAL_ACT_INSERT) {
+        sindex->update(pkey, NULL);
+        return;
+    }
+
+    std::string skey;
+    if (item->sindex_key) {
+        uint16_t skeylen;
+        memcpy(&skeylen, item->sindex_key, sizeof(skeylen));
+        skey.assign((char *)item->sindex_key + sizeof(skeylen), skeylen);
+    } else {
+        struct docio_object _doc;
+        memset(&_doc, 0, sizeof(_doc));
+        if (handle->dhandle->readDoc_Docio(item->offset, &_doc, true) <= 0) {
+            free_docio_object(&_doc, true, true, true);
+            return;
+        }
+        fdb_doc doc;
+        memset(&doc, 0, sizeof(doc));
+        doc.key = (uint8_t *)_doc.key + size_chunk;
+        doc.keylen = _doc.length.keylen - size_chunk;
+        doc.meta = _doc.meta;
+        doc.metalen = _doc.length.metalen;
+        doc.body = _doc.body;
+        doc.bodylen = _doc.length.bodylen;
+        doc.seqnum = _doc.seqnum;
+        doc.offset = item->offset;
+        uint8_t *skey_buf = alca(uint8_t, FDB_MAX_KEYLEN);
+        size_t skeylen = sindex->extractKey(&doc, skey_buf);
+        skey.assign((char *)skey_buf, skeylen);
+        free_docio_object(&_doc, true, true, true);
+    }
+    sindex->update(pkey, skey.empty() ? NULL : &skey);
+}
+
 fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
                                         struct wal_item *item,
                                         struct avl_tree *stale_seqnum_list,
@@ -5654,6 +5870,14 @@ fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
         _offset = _endian_encode(item->offset);
         DocMetaForIndex old_meta;
 
+        KvsBloomFilters *filters = handle->file->getBloomFilters();
+        if (filters && handle->kvs) {
+            // add the key before it becomes visible in the HB+trie
+            size_t size_chunk = handle->config.chunksize;
+            filters->add(kv_id, (uint8_t *)item->header->key + size_chunk,
+                         item->header->keylen - size_chunk);
+        }
+
         if (btreev2) {
             uint8_t meta_flag = (item->action == WAL_ACT_REMOVE)?
                                 FDB_DOC_META_DELETED : 0x0;
@@ -5678,6 +5902,7 @@ fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
             }
             old_offset = _endian_decode(old_offset);
         }
+        _fdb_sindex_update(handle, kv_id, item);
 
         if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
             _seqnum = _endian_encode(item->seqnum);
@@ -5759,6 +5984,10 @@ fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
                 old_seqnum = _doc.seqnum;
                 old_doc_size = _fdb_get_docsize(_doc.length);
                 is_old_doc_deleted = _doc.length.flag & DOCIO_DELETED;
+                if (_doc.length.flag & DOCIO_BLOB) {
+                    handle->dhandle->markBlobStale_Docio(
+                        _offset, _doc.length.bodylen_ondisk);
+                }
             }
 
             file->markDocStale(old_offset, old_doc_size);
@@ -5815,6 +6044,8 @@ fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
         }
 
         if (hr == HBTRIE_RESULT_SUCCESS) {
+            _fdb_sindex_update(handle, kv_id, item);
+
             uint64_t old_seqnum = SEQNUM_NOT_USED;
             uint32_t old_doc_size = 0;
             bool is_old_doc_deleted = false;
@@ -5845,6 +6076,10 @@ fdb_status WalFlushCallbacks::flushItem(void *dbhandle,
                 old_seqnum = _doc.seqnum;
                 old_doc_size = _fdb_get_docsize(_doc.length);
                 is_old_doc_deleted = _doc.length.flag & DOCIO_DELETED;
+                if (_doc.length.flag & DOCIO_BLOB) {
+                    handle->dhandle->markBlobStale_Docio(
+                        _offset, _doc.length.bodylen_ondisk);
+                }
             }
 
             file->markDocStale(old_offset, old_doc_size);
@@ -5908,9 +6143,13 @@ uint64_t WalFlushCallbacks::getOldOffset(void *dbhandle,
     if (item->action == WAL_ACT_REMOVE) {
         // For immediate remove, old_offset value is critical
         // so that we should get an exact value.
+        // Note that the value is a DocMetaForIndex in V2 format.
+        DocMetaForIndex old_meta;
+        old_meta.offset = 0;
         handle->trie->find(item->header->key,
                            item->header->keylen,
-                           (void*)&old_offset);
+                           (void*)&old_meta);
+        old_offset = old_meta.offset;
     } else {
         handle->trie->findOffset(item->header->key,
                                  item->header->keylen,
@@ -5926,6 +6165,38 @@ uint64_t WalFlushCallbacks::getOldOffset(void *dbhandle,
     return old_offset;
 }
 
+// Invalidate the sequence number models of the KV stores whose documents
+// have been flushed from the WAL. Each model is rebuilt by the first lookup
+// on the new seq index, rather than by scanning the seq index on every flush.
+static void _fdb_seq_model_invalidate(FdbKvsHandle *handle,
+                                      struct avl_tree *kvs_delta_stats)
+{
+    if (handle->config.seqtree_opt != FDB_SEQTREE_USE ||
+        ver_btreev2_format(handle->file->getVersion())) {
+        return;
+    }
+
+    KvsSeqModels *models = handle->file->getSeqModels();
+    if (!models) {
+        models = handle->file->initSeqModels(new KvsSeqModels());
+    }
+
+    struct avl_node *node = avl_first(kvs_delta_stats);
+    while (node) {
+        struct wal_kvs_delta_stat *delta_stat =
+            _get_entry(node, struct wal_kvs_delta_stat, avl_entry);
+        node = avl_next(node);
+        if (handle->kvs) {
+            // Looking up the root of the sub-tree in the HB+trie would read
+            // index blocks in the middle of the flush, so leave it to the next
+            // lookup, which only runs on the latest version of the seq index.
+            models->invalidate(delta_stat->kv_id, BLK_NOT_FOUND);
+        } else {
+            models->invalidate(0, handle->seqtree->getRootBid());
+        }
+    }
+}
+
 void WalFlushCallbacks::purgeSeqTreeEntry(void *dbhandle,
                                           struct avl_tree *stale_seqnum_list,
                                           struct avl_tree *kvs_delta_stats)
@@ -5993,6 +6264,9 @@ void WalFlushCallbacks::purgeSeqTreeEntry(void *dbhandle,
         avl_remove(stale_seqnum_list, &seq_entry->avl_entry);
         free(seq_entry);
     }
+
+    // the seq index will not be changed any more by this flush
+    _fdb_seq_model_invalidate(handle, kvs_delta_stats);
 }
 
 void WalFlushCallbacks::updateKvsDeltaStats(FileMgr *file,
@@ -6026,6 +6300,26 @@ void _fdb_dump_handle(FdbKvsHandle *h) {
     fprintf(stderr, "config: blocksize %d\n", h->config.blocksize);
     fprintf(stderr, "config: buffercache_size %" _F64 "\n",
             h->config.buffercache_size);
+    fprintf(stderr, "config: compressed_buffercache_size %" _F64 "\n",
+            h->config.compressed_buffercache_size);
+    fprintf(stderr, "config: buffercache_min_reservation %" _F64 "\n",
+            h->config.buffercache_min_reservation);
+    fprintf(stderr, "config: buffercache_max_limit %" _F64 "\n",
+            h->config.buffercache_max_limit);
+    fprintf(stderr, "config: buffercache_priority %d\n",
+            h->config.buffercache_priority);
+    fprintf(stderr, "config: memory_budget %" _F64 "\n",
+            h->config.memory_budget);
+    fprintf(stderr, "config: buffercache_huge_pages %d\n",
+            h->config.buffercache_huge_pages);
+    fprintf(stderr, "config: bloom_filter_bits_per_key %u\n",
+            h->config.bloom_filter_bits_per_key);
+    fprintf(stderr, "config: blob_threshold %u\n",
+            h->config.blob_threshold);
+    fprintf(stderr, "config: blob_gc_threshold %d\n",
+            h->config.blob_gc_threshold);
+    fprintf(stderr, "config: leaf_height_limit %d\n",
+            h->config.leaf_height_limit);
     fprintf(stderr, "config: wal_threshold %" _F64 "\n",
             h->config.wal_threshold);
     fprintf(stderr, "config: wal_flush_before_commit %d\n",
@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <string>
+#include <unordered_map>
+
 #include "hbtrie.h"
 #include "list.h"
 #include "btree.h"
@@ -130,7 +133,8 @@ int HBTrie::reformKeyReverse(void *key, int keylen)
 
 HBTrie::HBTrie() :
     chunksize(0), valuelen(0), flag(0x0), leaf_height_limit(0), btree_nodesize(0),
-    root_bid(0), rootAddr(), btreeblk_handle(NULL), fileHB(NULL), doc_handle(NULL),
+    numLeafExtensions(0), root_bid(0), rootAddr(), btreeblk_handle(NULL),
+    fileHB(NULL), doc_handle(NULL),
     btree_kv_ops(NULL), btree_leaf_kv_ops(NULL), readkey(NULL), map(NULL),
     last_map_chunk(NULL), getCmpFuncCB(nullptr)
 {
@@ -192,6 +196,8 @@ void HBTrie::initTrie(int _chunksize, int _valuelen, int _btree_nodesize,
     readkey = _readkey;
     flag = 0x0;
     leaf_height_limit = 0;
+    numLeafExtensions = 0;
+    leafStats.clear();
     map = NULL;
     getCmpFuncCB = nullptr;
 
@@ -931,6 +937,44 @@ hbtrie_result HBTrie::findPartial(void *rawkey, int rawkeylen, void *valuebuf)
     return _find(key, keylen, valuebuf, NULL, HBTRIE_PARTIAL_MATCH);
 }
 
+hbtrie_result HBTrie::findSubBtree(void *rawprefix, int rawprefixlen,
+                                   BTree *btree_out)
+{
+    uint8_t *value = alca(uint8_t, valuelen);
+    uint8_t *buf = alca(uint8_t, btree_nodesize);
+    struct hbtrie_meta hbmeta;
+    metasize_t metasize;
+    btree_result br;
+    bid_t bid;
+
+    if (rawprefixlen <= 0 || rawprefixlen % chunksize ||
+        findPartial(rawprefix, rawprefixlen, value) != HBTRIE_RESULT_SUCCESS ||
+        !valueIsMsbSet(value)) {
+        // the value points to a document rather than a B+tree
+        return HBTRIE_RESULT_FAIL;
+    }
+
+    valueClearMsb(value);
+    bid = btree_kv_ops->value2bid(value);
+    bid = _endian_decode(bid);
+    br = btree_out->initFromBid(btreeblk_handle, btree_kv_ops,
+                                btree_nodesize, bid);
+    if (br != BTREE_RESULT_SUCCESS) {
+        return HBTRIE_RESULT_FAIL;
+    }
+    btree_out->setAux(aux);
+
+    metasize = btree_out->readMeta(buf);
+    if (metasize == 0) {
+        return HBTRIE_RESULT_FAIL;
+    }
+    fetchMeta(metasize, &hbmeta, buf);
+    if (_is_leaf_btree(hbmeta.chunkno) ||
+        hbmeta.chunkno != rawprefixlen / chunksize) {
+        return HBTRIE_RESULT_FAIL;
+    }
+    return HBTRIE_RESULT_SUCCESS;
+}
 
 hbtrie_result HBTrie::_remove(void *rawkey, int rawkeylen, uint8_t flag)
 {
@@ -1031,7 +1075,111 @@ hbtrie_result HBTrie::removePartial(void *rawkey, int rawkeylen)
     return _remove(rawkey, rawkeylen, HBTRIE_PARTIAL_MATCH);
 }
 
-void HBTrie::extendLeafTree(struct list *btreelist,
+// Estimate the height of a B+tree holding 'nentry' entries with the given
+// per-node fanout.
+static inline size_t _estimate_btree_height(uint64_t nentry, uint64_t fanout)
+{
+    size_t height = 1;
+    uint64_t capacity = fanout;
+    while (capacity < nentry) {
+        capacity *= fanout;
+        height++;
+    }
+    return height;
+}
+
+bool HBTrie::getLeafStats(const void *prefix, size_t prefix_len,
+                          struct hbtrie_leaf_stats *stats_out) const
+{
+    auto entry = leafStats.find(std::string((const char *)prefix, prefix_len));
+    if (entry == leafStats.end()) {
+        return false;
+    }
+    *stats_out = entry->second;
+    return true;
+}
+
+bool HBTrie::isLeafTreeExtendable(struct list *keys,
+                                  size_t minchunkno,
+                                  BTree *leaf_btree,
+                                  struct hbtrie_leaf_stats *stats)
+{
+    /*
+     * After extension, the keys of the leaf b-tree are grouped by their chunk
+     * right after the common prefix: the new (non-leaf) b-tree indexes one
+     * entry per distinct chunk, and each group with more than one key becomes
+     * a new leaf b-tree below it. The number of distinct chunks is a measure
+     * of the entropy of key suffixes; if it is too low (e.g., most keys share
+     * the next chunk as well), extension only adds one more level on top of
+     * a leaf b-tree that is almost as tall as the current one.
+     *
+     * The new b-tree orders the chunks byte-wise, so the extension would
+     * also reorder the keys if the leaf b-tree's comparison function does
+     * not order their chunks byte-wise.
+     */
+    std::unordered_map<std::string, uint64_t> groups;
+    std::string prev_chunk;
+    bool byte_ordered = true;
+    struct list_elem *e;
+    struct _key_item *item;
+    uint64_t nkeys = 0, max_group = 0, keylen_sum = 0;
+    uint64_t fanout_leaf, fanout_normal;
+    size_t offset = minchunkno * chunksize;
+    size_t height_after;
+
+    e = list_begin(keys);
+    while (e) {
+        item = _get_entry(e, struct _key_item, le);
+        e = list_next(e);
+        if (item->keylen <= offset) {
+            // stored in the meta section of the new b-tree
+            continue;
+        }
+        std::string chunk((char *)item->key + offset,
+                          MIN((size_t)chunksize, item->keylen - offset));
+        if (chunk < prev_chunk) {
+            byte_ordered = false;
+        }
+        prev_chunk = chunk;
+        uint64_t count = ++groups[chunk];
+        max_group = MAX(max_group, count);
+        keylen_sum += item->keylen;
+        nkeys++;
+    }
+    stats->height = leaf_btree->getHeight();
+    stats->nkeys = nkeys;
+    stats->ndistinct = groups.size();
+    stats->max_group = max_group;
+    stats->fanout = 0;
+    stats->height_after = 0;
+    if (nkeys == 0) {
+        // nothing to be indexed by the new b-tree
+        return false;
+    }
+
+    fanout_normal = btree_nodesize / (chunksize + valuelen);
+    fanout_leaf = leaf_btree->getBlkSize() /
+                  (keylen_sum / nkeys + sizeof(uint16_t) + valuelen);
+    fanout_normal = MAX(fanout_normal, 2);
+    fanout_leaf = MAX(fanout_leaf, 2);
+
+    height_after = _estimate_btree_height(groups.size(), fanout_normal);
+    if (max_group > 1) {
+        height_after += _estimate_btree_height(max_group, fanout_leaf);
+    }
+    stats->fanout = fanout_leaf;
+    stats->height_after = height_after;
+    return byte_ordered && height_after < leaf_btree->getHeight();
+}
+
+bool HBTrie::isLeafTreeDue(void *pre_str, size_t pre_str_len,
+                           uint16_t height)
+{
+    auto entry = leafStats.find(std::string((char *)pre_str, pre_str_len));
+    return entry == leafStats.end() || entry->second.height < height;
+}
+
+bool HBTrie::extendLeafTree(struct list *btreelist,
                             struct btreelist_item *btreeitem,
                             void *pre_str,
                             size_t pre_str_len)
@@ -1107,6 +1255,25 @@ void HBTrie::extendLeafTree(struct list *btreelist,
     }
     delete it;
 
+    struct hbtrie_leaf_stats &stats =
+        leafStats[std::string((char *)pre_str, pre_str_len)];
+    stats.extended = isLeafTreeExtendable(&keys, minchunkno,
+                                          &btreeitem->btree, &stats);
+    if (!stats.extended) {
+        // keep the leaf b-tree as it is
+        e = list_begin(&keys);
+        while (e) {
+            item = _get_entry(e, struct _key_item, le);
+            e = list_remove(&keys, e);
+            free(item->key);
+            free(item->value);
+            free(item);
+        }
+        free(key_str);
+        return false;
+    }
+    numLeafExtensions++;
+
     // construct new (non-leaf) b-tree
     if (hbmeta.value) {
         // insert tree's prefix into the list
@@ -1165,6 +1332,7 @@ void HBTrie::extendLeafTree(struct list *btreelist,
     }
 
     free(key_str);
+    return true;
 }
 
 hbtrie_result HBTrie::_insert(void *rawkey, int rawkeylen,
@@ -1404,11 +1572,19 @@ hbtrie_result HBTrie::_insert(void *rawkey, int rawkeylen,
                 }
                 freeLeafKey(k);
 
-                if (btreeitem->btree.getHeight() > leaf_height_limit) {
+                // A leaf b-tree taller than the limit is evaluated on its
+                // first insert (even if it was already taller than the limit
+                // before), but once it turns out not to be worth extending,
+                // it is re-evaluated only when its height grows, so that it
+                // does not pay for a full scan on every insert.
+                if (btreeitem->btree.getHeight() > leaf_height_limit &&
+                    isLeafTreeDue(key, curchunkno * chunksize,
+                                  btreeitem->btree.getHeight()) &&
+                    extendLeafTree(&btreelist, btreeitem, key,
+                                   curchunkno * chunksize)) {
                     // height growth .. extend!
                     // btreelist is cleared out within extendLeafTree when
                     // btreeCascacdedUpdate is invoked.
-                    extendLeafTree(&btreelist, btreeitem, key, curchunkno * chunksize);
                     deallocateBuffer(&docrawkey, rawkey_buffer_index);
                     deallocateBuffer(&dockey, key_buffer_index);
                     return ret_result;
@@ -3158,6 +3334,64 @@ hbtrie_result HBTrieIterator::nextValueOnly(void *value_buf)
     return hr;
 }
 
+bid_t HBTrieIterator::getCurLeafBid()
+{
+    struct list_elem *e = list_end(&btreeit_list);
+    if (!e) {
+        return BLK_NOT_FOUND;
+    }
+    struct btreeit_item *item = _get_entry(e, struct btreeit_item, le);
+    if (!item->leaf) {
+        return BLK_NOT_FOUND;
+    }
+    return item->btree_it->getCurLeafBid();
+}
+
+hbtrie_result HBTrieIterator::getCurLeafKeyBounds(void *min_key_buf,
+                                              size_t& min_keylen_out,
+                                              void *max_key_buf,
+                                              size_t& max_keylen_out)
+{
+    struct list_elem *e = list_end(&btreeit_list);
+    if (!e || !curkey) {
+        return HBTRIE_RESULT_FAIL;
+    }
+    struct btreeit_item *item = _get_entry(e, struct btreeit_item, le);
+    if (!item->leaf) {
+        return HBTRIE_RESULT_FAIL;
+    }
+
+    uint8_t chunksize = trie->getChunkSize();
+    uint8_t *k_min = alca(uint8_t, chunksize);
+    uint8_t *k_max = alca(uint8_t, chunksize);
+    memset(k_min, 0, chunksize);
+    memset(k_max, 0, chunksize);
+    if (item->btree_it->getCurLeafKeyBounds(k_min, k_max) != BTREE_RESULT_SUCCESS) {
+        return HBTRIE_RESULT_FAIL;
+    }
+    BTreeKVOps *leaf_kv_ops = trie->getBtreeLeafKvOps();
+    if (leaf_kv_ops->isInfVarKey(k_min) || leaf_kv_ops->isInfVarKey(k_max)) {
+        freeLeafKey(k_min);
+        freeLeafKey(k_max);
+        return HBTRIE_RESULT_FAIL;
+    }
+
+    // keys in a leaf B+tree share the chunks preceding the B+tree, and
+    // the rest of each key is stored in the B+tree as it is
+    size_t prefixlen = item->chunkno * chunksize;
+    size_t len;
+    memcpy(min_key_buf, curkey, prefixlen);
+    getLeafKey(k_min, (uint8_t*)min_key_buf + prefixlen, len);
+    min_keylen_out = prefixlen + len;
+    memcpy(max_key_buf, curkey, prefixlen);
+    getLeafKey(k_max, (uint8_t*)max_key_buf + prefixlen, len);
+    max_keylen_out = prefixlen + len;
+
+    freeLeafKey(k_min);
+    freeLeafKey(k_max);
+    return HBTRIE_RESULT_SUCCESS;
+}
+
 // move iterator's cursor to the end of the key range.
 // hbtrie_prev() call after hbtrie_last() will return the last key.
 hbtrie_result HBTrieIterator::last()
@@ -24,6 +24,7 @@
 #include "list.h"
 #include "memory_pool.h"
 
+#include <string>
 #include <unordered_map>
 
 #ifdef __cplusplus
@@ -54,6 +55,29 @@ struct hbtrie_meta {
     void *prefix;
 };
 
+/**
+ * Statistics of a leaf B+tree (using variable-length key), collected when
+ * HB+trie decides whether to extend it into regular sub B+trees.
+ */
+struct hbtrie_leaf_stats {
+    // Height of the leaf B+tree.
+    uint16_t height;
+    // Number of keys in the leaf B+tree.
+    uint64_t nkeys;
+    // Estimated number of keys per node of the leaf B+tree.
+    uint64_t fanout;
+    // Number of distinct chunks right after the common prefix of the keys,
+    // which measures the entropy of key suffixes.
+    uint64_t ndistinct;
+    // Largest number of keys sharing the same chunk after the common prefix.
+    uint64_t max_group;
+    // Estimated lookup depth (new sub B+tree and its tallest child leaf
+    // B+tree) if the leaf B+tree is extended.
+    uint16_t height_after;
+    // True if the leaf B+tree has been extended.
+    bool extended;
+};
+
 
 /**
  * Callback function for HB+trie, to fetch the entire full key string.
@@ -457,6 +481,34 @@ public:
         return leaf_height_limit;
     }
 
+    /**
+     * Return the number of leaf B+trees that have been extended into regular
+     * sub B+trees so far.
+     */
+    uint64_t getNumLeafExtensions() const {
+        return numLeafExtensions;
+    }
+
+    /**
+     * Get the statistics of the leaf B+tree for the given prefix, as of the
+     * last time that its extension was evaluated.
+     *
+     * @param prefix Prefix of the leaf B+tree (i.e., the chunks of the keys
+     *        up to the leaf B+tree).
+     * @param prefix_len Length of the prefix.
+     * @param stats_out Pointer to the statistics to be returned.
+     * @return True if the extension of the leaf B+tree has been evaluated.
+     */
+    bool getLeafStats(const void *prefix, size_t prefix_len,
+                      struct hbtrie_leaf_stats *stats_out) const;
+
+    /**
+     * Return the number of leaf B+trees whose extension has been evaluated.
+     */
+    size_t getNumLeafStats() const {
+        return leafStats.size();
+    }
+
     void setLeafCmp(btree_cmp_func* _cmp) {
         btree_leaf_kv_ops->setCmpFunc(_cmp);
     }
@@ -496,6 +548,20 @@ public:
     hbtrie_result findOffset(void *rawkey, int rawkeylen, void *valuebuf);
     hbtrie_result findPartial(void *rawkey, int rawkeylen, void *valuebuf);
 
+    /**
+     * Load the B+tree that indexes the chunk right after the given prefix,
+     * e.g., the B+tree of a KV store's sequence numbers in the seq-trie.
+     *
+     * @param rawprefix Prefix consisting of whole chunks.
+     * @param rawprefixlen Length of the prefix.
+     * @param btree_out B+tree instance to be initialized.
+     * @return HBTRIE_RESULT_FAIL if there is no such B+tree (e.g., only a
+     *         single key starts with the prefix), or if the B+tree is a leaf
+     *         B+tree or skips chunks.
+     */
+    hbtrie_result findSubBtree(void *rawprefix, int rawprefixlen,
+                               BTree *btree_out);
+
     hbtrie_result remove(void *rawkey, int rawkeylen);
     hbtrie_result removePartial(void *rawkey, int rawkeylen);
     hbtrie_result remove_vlen(void *rawkey, int rawkeylen,
@@ -632,6 +698,10 @@ private:
     uint8_t flag;
     uint8_t leaf_height_limit;
     uint32_t btree_nodesize;
+    uint64_t numLeafExtensions;
+    // Statistics of leaf B+trees taller than 'leaf_height_limit', keyed by
+    // their prefix.
+    std::unordered_map<std::string, struct hbtrie_leaf_stats> leafStats;
     // root node BID for old format.
     bid_t root_bid;
     // root offset (or pointer) for V2 format.
@@ -783,19 +853,52 @@ private:
 
     hbtrie_result _remove(void *rawkey, int rawkeylen, uint8_t flag);
 
+    /**
+     * Check if extending a leaf B+tree whose keys are in the given list
+     * would shorten its lookup path, by estimating the height of the new
+     * sub B+tree and its largest child leaf B+tree from the distribution of
+     * the chunks right after the common prefix ('minchunkno').
+     *
+     * @param keys List of '_key_item' scanned from the leaf B+tree.
+     * @param minchunkno Number of chunks shared by all keys.
+     * @param leaf_btree Leaf B+tree to be extended.
+     * @param stats Statistics of the leaf B+tree to be filled.
+     * @return True if the leaf B+tree should be extended.
+     */
+    bool isLeafTreeExtendable(struct list *keys,
+                              size_t minchunkno,
+                              BTree *leaf_btree,
+                              struct hbtrie_leaf_stats *stats);
+
+    /**
+     * Check if the extension of the leaf B+tree for the given prefix should
+     * be evaluated, i.e., it has not been evaluated yet, or it has grown
+     * taller since the last evaluation.
+     *
+     * @param pre_str Prefix of the leaf B+tree.
+     * @param pre_str_len Length of the prefix.
+     * @param height Current height of the leaf B+tree.
+     * @return True if the extension should be evaluated.
+     */
+    bool isLeafTreeDue(void *pre_str, size_t pre_str_len, uint16_t height);
+
     /**
      * Extend given leaf B+tree (using variable-length key) so as to convert it
      * to a set of regular sub B+trees (using fixed-chunk key) of a HB+trie.
-     * Note that this method is called only when 'leaf_height_limit' is greater
-     * than zero, but current ForestDB does not use this functionality.
+     * Note that this method is called only when the height of the leaf B+tree
+     * is greater than 'leaf_height_limit', which ForestDB sets from
+     * 'fdb_config.leaf_height_limit' (disabled by default). The leaf B+tree
+     * is left untouched if the extension is not expected to pay off (see
+     * isLeafTreeExtendable()); it is re-evaluated the next time its height
+     * grows. The result is recorded in 'leafStats'.
      *
      * @param btreelist List for B+tree instances.
      * @param btreeitem B+tree instance to be extended.
      * @param pre_str Prefix of the B+tree to be extended.
      * @param pre_str_len Length of the prefix.
-     * @return void.
+     * @return True if the leaf B+tree has been extended.
      */
-    void extendLeafTree(struct list *btreelist,
+    bool extendLeafTree(struct list *btreelist,
                         struct btreelist_item *btreeitem,
                         void *pre_str,
                         size_t pre_str_len);
@@ -979,6 +1082,29 @@ public:
      */
     hbtrie_result last();
 
+    /**
+     * Return the BID of the leaf node that the lastly returned key belongs
+     * to, if the key comes from a leaf B+tree. Otherwise, BLK_NOT_FOUND is
+     * returned, as the other B+trees do not keep entire keys in their nodes.
+     */
+    bid_t getCurLeafBid();
+
+    /**
+     * Get the smallest and largest keys in the leaf node above, read from the
+     * iterator's copy of the node. Every key in the node lies between these
+     * two keys, so that a range condition satisfied by both of them is
+     * satisfied by all keys in the node. Nothing is persisted for this, and
+     * it does not help a seek skip any subtree.
+     *
+     * @param min_key_buf Buffer for the smallest key.
+     * @param min_keylen_out Length of the smallest key.
+     * @param max_key_buf Buffer for the largest key.
+     * @param max_keylen_out Length of the largest key.
+     * @return HBTRIE_RESULT_SUCCESS if the keys are returned.
+     */
+    hbtrie_result getCurLeafKeyBounds(void *min_key_buf, size_t& min_keylen_out,
+                                  void *max_key_buf, size_t& max_keylen_out);
+
 private:
     HBTrie *trie;
     struct list btreeit_list;
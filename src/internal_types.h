@@ -46,6 +46,11 @@ class WalItr;
 #define FDB_MAX_KEYLEN_INTERNAL (65520)
 
 // Versioning information...
+// Version 005 - Version 003 with compressed index nodes (common key
+//               prefixes and delta records)
+#define FILEMGR_MAGIC_005 (UINT64_C(0xdeadcafebeefc005))
+// Version 004 - Version 002 with document bodies kept in blob files
+#define FILEMGR_MAGIC_004 (UINT64_C(0xdeadcafebeefc004))
 // Version 003 - New non-block aligned BtreeV2
 #define FILEMGR_MAGIC_003 (UINT64_C(0xdeadcafebeefc003))
 // Version 002 - added stale-block tree info
@@ -496,6 +501,7 @@ struct stale_regions {
 #define FDB_FLAG_SEQTREE_USE (0x1)
 #define FDB_FLAG_ROOT_INITIALIZED (0x2)
 #define FDB_FLAG_ROOT_CUSTOM_CMP (0x4)
+#define FDB_FLAG_BLOOM_FILTER (0x8)
 
 
 #define FDB_DOC_META_DELETED (0x1)
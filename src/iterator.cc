@@ -111,7 +111,8 @@ FdbIterator::FdbIterator(FdbKvsHandle *_handle,
       seqtreeIterator(nullptr), seqtrieIterator(nullptr),
       seqNum(0), iterOpt(opt), iterDirection(FDB_ITR_DIR_NONE),
       iterStatus(FDB_ITR_IDX), iterOffset(BLK_NOT_FOUND),
-      dHandle(nullptr), getOffset(0), iterType(FDB_ITR_REG)
+      dHandle(nullptr), getOffset(0), iterType(FDB_ITR_REG),
+      boundsLeafBid(BLK_NOT_FOUND), leafWithinLimits(false)
 {
     iterKey.data = (void*)malloc(FDB_MAX_KEYLEN_INTERNAL);
     // set to zero the first <chunksize> bytes
@@ -226,7 +227,7 @@ FdbIterator::FdbIterator(FdbKvsHandle *_handle,
       startSeqnum(start_seq), iterOpt(opt), iterDirection(FDB_ITR_DIR_NONE),
       iterStatus(FDB_ITR_IDX), iterKey({nullptr, 0}),
       iterOffset(BLK_NOT_FOUND), dHandle(nullptr), getOffset(0),
-      iterType(FDB_ITR_SEQ)
+      iterType(FDB_ITR_SEQ), boundsLeafBid(BLK_NOT_FOUND), leafWithinLimits(false)
 {
     // For easy API call, treat zero seq as 0xffff...
     // (because zero seq number is not used)
@@ -497,6 +498,8 @@ fdb_status FdbIterator::seek(const void *seek_key,
     struct docio_object _doc;
     fdb_status ret;
     LATENCY_STAT_START();
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
 
     dHandle = NULL; // setup for get() to return FAIL
 
@@ -563,6 +566,7 @@ fdb_status FdbIterator::seek(const void *seek_key,
     delete hbtrieIterator;
     hbtrieIterator = new HBTrieIterator(iterHandle->trie,
                                         seek_key_kv, seek_keylen_kv);
+    boundsLeafBid = BLK_NOT_FOUND;
 
 fetch_hbtrie:
     if (seek_pref == FDB_ITR_SEEK_HIGHER) {
@@ -906,6 +910,7 @@ fetch_hbtrie:
                                                         seek_key_kv,
                                                         seek_keylen_kv);
                     iterOffset = BLK_NOT_FOUND;
+                    boundsLeafBid = BLK_NOT_FOUND;
                 }
             }
         } else {
@@ -945,6 +950,8 @@ fetch_hbtrie:
 fdb_status FdbIterator::seekToMin() {
     size_t size_chunk = iterHandle->config.chunksize;
     fdb_status ret;
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
     LATENCY_STAT_START();
 
     // Initialize direction iteration to FORWARD just in case this function was
@@ -972,6 +979,7 @@ fdb_status FdbIterator::seekToMin() {
     delete hbtrieIterator;
     hbtrieIterator = new HBTrieIterator(iterHandle->trie,
                                         startKey.data, startKey.len);
+    boundsLeafBid = BLK_NOT_FOUND;
 
     // reset WAL tree cursor using search because of the sharded nature of WAL
     if (treeCursorStart) {
@@ -987,6 +995,8 @@ fdb_status FdbIterator::seekToMin() {
 
 fdb_status FdbIterator::seekToMax() {
     fdb_status ret;
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
     LATENCY_STAT_START();
 
     if (!hbtrieIterator) {
@@ -1001,6 +1011,8 @@ fdb_status FdbIterator::seekToMax() {
 
 fdb_status FdbIterator::iterateToPrev() {
     fdb_status result = FDB_RESULT_SUCCESS;
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
     LATENCY_STAT_START();
 
     if (!BEGIN_HANDLE_BUSY(iterHandle)) {
@@ -1033,6 +1045,8 @@ fdb_status FdbIterator::iterateToPrev() {
 
 fdb_status FdbIterator::iterateToNext() {
     fdb_status result = FDB_RESULT_SUCCESS;
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
     LATENCY_STAT_START();
 
     if (!BEGIN_HANDLE_BUSY(iterHandle)) {
@@ -1076,6 +1090,8 @@ fdb_status FdbIterator::get(fdb_doc **doc, bool metaOnly) {
     size_t size_chunk = iterHandle->config.chunksize;
     bool alloced_key, alloced_meta, alloced_body;
     LATENCY_STAT_START();
+    ScanReadScope scan_scope(iterHandle->file,
+                             iterOpt & FDB_ITR_ONE_SHOT_SCAN);
 
     dhandle = dHandle;
     if (!dhandle || getOffset == BLK_NOT_FOUND) {
@@ -1172,6 +1188,7 @@ fdb_status FdbIterator::iterate(itr_seek_t seek_type) {
     hbtrie_result hr = HBTRIE_RESULT_SUCCESS;
     DocioHandle *dhandle;
     struct wal_item *snap_item = NULL;
+    bool in_range;
 
     if (seek_type == ITR_SEEK_PREV && iterDirection != FDB_ITR_REVERSE) {
         iterOffset = BLK_NOT_FOUND; // need to re-examine Trie/trees
@@ -1326,13 +1343,15 @@ start:
         break;
     }
 
+    in_range = false;
     if (offset == iterOffset) {
         // take key[hb-trie] & and fetch the prev/next key[hb-trie] in next turn
         iterOffset = BLK_NOT_FOUND;
         iterStatus = FDB_ITR_IDX;
+        in_range = isCurLeafWithinLimits();
     }
 
-    if (startKey.data) {
+    if (startKey.data && !in_range) {
         cmp = _fdb_key_cmp(this, startKey.data,
                            startKey.len, key, keylen);
 
@@ -1350,7 +1369,7 @@ start:
         }
     }
 
-    if (endKey.data) {
+    if (endKey.data && !in_range) {
         cmp = _fdb_key_cmp(this,
                            endKey.data, endKey.len,
                            key, keylen);
@@ -1375,6 +1394,32 @@ start:
     return FDB_RESULT_SUCCESS;
 }
 
+bool FdbIterator::isCurLeafWithinLimits() {
+    if (!startKey.data && !endKey.data) {
+        return false;
+    }
+
+    bid_t leaf_bid = hbtrieIterator->getCurLeafBid();
+    if (leaf_bid == BLK_NOT_FOUND) {
+        return false;
+    }
+    if (leaf_bid != boundsLeafBid) {
+        // the cursor has moved into another leaf node
+        uint8_t *min_key = alca(uint8_t, FDB_MAX_KEYLEN_INTERNAL);
+        uint8_t *max_key = alca(uint8_t, FDB_MAX_KEYLEN_INTERNAL);
+        size_t min_keylen, max_keylen;
+
+        boundsLeafBid = leaf_bid;
+        leafWithinLimits =
+            hbtrieIterator->getCurLeafKeyBounds(min_key, min_keylen,
+                                            max_key, max_keylen)
+                == HBTRIE_RESULT_SUCCESS &&
+            validateRangeLimits(min_key, min_keylen) &&
+            validateRangeLimits(max_key, max_keylen);
+    }
+    return leafWithinLimits;
+}
+
 bool FdbIterator::validateRangeLimits(void *ret_key,
                                       const size_t ret_keylen) {
     int cmp;
@@ -1442,6 +1487,7 @@ fdb_status FdbIterator::seekToMaxKey() {
         hbtrieIterator = new HBTrieIterator(iterHandle->trie,
                                             endKey.data,
                                             endKey.len);
+        boundsLeafBid = BLK_NOT_FOUND;
 
         // get first key
         hbtrieIterator->prev(iterKey.data, iterKey.len, (void*)&iterOffset);
@@ -1676,10 +1722,13 @@ start_seq:
             goto start_seq; // B-tree item exists in WAL, skip for now
         }
         // Also look in HB-Trie to eliminate duplicates
+        // as 'offset' is located at the beginning of doc_meta,
+        // we can use it for legacy code as well.
+        DocMetaForIndex hb_meta;
         uint64_t hboffset;
         struct docio_object _hbdoc;
         hr = iterHandle->trie->find(_doc.key, _doc.length.keylen,
-                                 (void *)&hboffset);
+                                 (void *)&hb_meta);
         if (!ver_btreev2_format(iterHandle->file->getVersion())) {
             iterHandle->bhandle->flushBuffer();
         }
@@ -1692,7 +1741,7 @@ start_seq:
             int64_t _offset;
             _hbdoc.key = _doc.key;
             _hbdoc.meta = NULL;
-            hboffset = _endian_decode(hboffset);
+            hboffset = _endian_decode(hb_meta.offset);
             _offset = iterHandle->dhandle->readDocKeyMeta_Docio(hboffset,
                                                              &_hbdoc, true);
             if (_offset <= 0) {
@@ -1863,10 +1912,13 @@ start_seq:
             goto start_seq; // B-tree item exists in WAL, skip for now
         }
         // Also look in HB-Trie to eliminate duplicates
+        // as 'offset' is located at the beginning of doc_meta,
+        // we can use it for legacy code as well.
+        DocMetaForIndex hb_meta;
         uint64_t hboffset;
         struct docio_object _hbdoc;
         hr = iterHandle->trie->find(_doc.key, _doc.length.keylen,
-                                 (void *)&hboffset);
+                                 (void *)&hb_meta);
         if (!ver_btreev2_format(iterHandle->file->getVersion())) {
             iterHandle->bhandle->flushBuffer();
         }
@@ -1879,7 +1931,7 @@ start_seq:
             int64_t _offset;
             _hbdoc.key = _doc.key;
             _hbdoc.meta = NULL;
-            hboffset = _endian_decode(hboffset);
+            hboffset = _endian_decode(hb_meta.offset);
             _offset = iterHandle->dhandle->readDocKeyMeta_Docio(hboffset,
                                                              &_hbdoc,
                                                              true);
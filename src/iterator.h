@@ -188,6 +188,11 @@ private:
 
     bool validateRangeLimits(void *ret_key, const size_t ret_keylen);
 
+    /* Check if all keys in the HB+trie leaf node under the cursor are
+       within the range limits, using the node's first and last keys, so
+       that the range limits are validated once per leaf node */
+    bool isCurLeafWithinLimits();
+
     /* Operation for a regular iterator to seek to largest key */
     fdb_status seekToMaxKey();
 
@@ -249,5 +254,9 @@ private:
     uint64_t getOffset;
     // Type of iterator
     fdb_iterator_type_t iterType;
+    // BID of the HB+trie leaf node whose key range was last checked
+    bid_t boundsLeafBid;
+    // True if all keys of 'boundsLeafBid' are within the range limits
+    bool leafWithinLimits;
 };
 
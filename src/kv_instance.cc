@@ -35,6 +35,8 @@
 #include "btreeblock.h"
 #include "version.h"
 #include "staleblock.h"
+#include "bloom_filter.h"
+#include "secondary_index.h"
 
 #include "memleak.h"
 #include "timing.h"
@@ -372,9 +374,15 @@ void fdb_kvs_header_copy(FdbKvsHandle *handle,
     spin_unlock(&handle->file->getKVHeader_UNLOCKED()->lock);
 }
 
+// mark the optional sections at the end of the KV header
+static const uint64_t kvs_header_bloom_magic = UINT64_C(0x424c4f4f4d444c54);
+static const uint64_t kvs_header_blob_magic = UINT64_C(0x424c4f4253544154);
+
 // export KV header info to raw data
 static void _fdb_kvs_header_export(KvsHeader *kv_header,
-                                   void **data, size_t *len, uint64_t version)
+                                   void **data, size_t *len, uint64_t version,
+                                   uint64_t bloom_offset,
+                                   uint64_t blob_offset)
 {
     /* << raw data structure >>
      * [# KV instances]:        8 bytes
@@ -391,6 +399,12 @@ static void _fdb_kvs_header_export(KvsHeader *kv_header,
      * [delta size]:            8 bytes (since MAGIC_001)
      * [# deleted docs]:        8 bytes (since MAGIC_001)
      * ...
+     * ---
+     * (optional sections, each of which is)
+     * [section magic]:         8 bytes (Bloom filters or blob file stats)
+     * [section doc]:           8 bytes (offset of the section document)
+     * ...
+     *
      *    Please note that if the above format is changed, please also change...
      *    _fdb_kvs_get_snap_info()
      *    _fdb_kvs_header_import()
@@ -439,6 +453,12 @@ static void _fdb_kvs_header_export(KvsHeader *kv_header,
         }
         a = avl_next(a);
     }
+    if (bloom_offset != BLK_NOT_FOUND) {
+        size += sizeof(uint64_t) * 2;
+    }
+    if (blob_offset != BLK_NOT_FOUND) {
+        size += sizeof(uint64_t) * 2;
+    }
 
     *data = (void *)malloc(size);
 
@@ -511,11 +531,81 @@ static void _fdb_kvs_header_export(KvsHeader *kv_header,
         a = avl_next(a);
     }
 
+    if (bloom_offset != BLK_NOT_FOUND) {
+        uint64_t _magic = _endian_encode(kvs_header_bloom_magic);
+        memcpy((uint8_t*)*data + offset, &_magic, sizeof(_magic));
+        offset += sizeof(_magic);
+
+        uint64_t _bloom_offset = _endian_encode(bloom_offset);
+        memcpy((uint8_t*)*data + offset, &_bloom_offset, sizeof(_bloom_offset));
+        offset += sizeof(_bloom_offset);
+    }
+
+    if (blob_offset != BLK_NOT_FOUND) {
+        uint64_t _magic = _endian_encode(kvs_header_blob_magic);
+        memcpy((uint8_t*)*data + offset, &_magic, sizeof(_magic));
+        offset += sizeof(_magic);
+
+        uint64_t _blob_offset = _endian_encode(blob_offset);
+        memcpy((uint8_t*)*data + offset, &_blob_offset, sizeof(_blob_offset));
+        offset += sizeof(_blob_offset);
+    }
+
     *len = size;
 
     spin_unlock(&kv_header->lock);
 }
 
+// return the offset of the document of the section with the given magic,
+// recorded at the end of the raw KV header data, or BLK_NOT_FOUND if there
+// is none
+static uint64_t _fdb_kvs_header_get_doc_offset(void *data, size_t len,
+                                               uint64_t version,
+                                               uint64_t magic)
+{
+    uint64_t i, offset = 0;
+    uint64_t n_kv, _n_kv, _magic, _doc_offset;
+    uint16_t _name_len;
+
+    if (len < sizeof(_n_kv) + sizeof(fdb_kvs_id_t)) {
+        return BLK_NOT_FOUND;
+    }
+
+    // # KV instances
+    memcpy(&_n_kv, (uint8_t*)data + offset, sizeof(_n_kv));
+    offset += sizeof(_n_kv);
+    n_kv = _endian_decode(_n_kv);
+
+    // ID counter
+    offset += sizeof(fdb_kvs_id_t);
+
+    for (i = 0; i < n_kv; ++i) {
+        if (offset + sizeof(_name_len) > len) {
+            return BLK_NOT_FOUND;
+        }
+        memcpy(&_name_len, (uint8_t*)data + offset, sizeof(_name_len));
+        offset += sizeof(_name_len);
+        offset += _endian_decode(_name_len);
+        // ID, seqnum, # live index nodes, # docs, data size, flags
+        offset += sizeof(uint64_t) * 6;
+        if (ver_is_atleast_magic_001(version)) {
+            // delta size, # deleted docs
+            offset += sizeof(uint64_t) * 2;
+        }
+    }
+
+    while (offset + sizeof(uint64_t) * 2 <= len) {
+        memcpy(&_magic, (uint8_t*)data + offset, sizeof(_magic));
+        offset += sizeof(_magic);
+        memcpy(&_doc_offset, (uint8_t*)data + offset, sizeof(_doc_offset));
+        offset += sizeof(_doc_offset);
+        if (_endian_decode(_magic) == magic) {
+            return _endian_decode(_doc_offset);
+        }
+    }
+    return BLK_NOT_FOUND;
+}
+
 void _fdb_kvs_header_import(KvsHeader *kv_header,
                             void *data, size_t len, uint64_t version,
                             bool only_seq_nums)
@@ -779,18 +869,129 @@ uint64_t _kvs_stat_get_sum_attr(void *data, uint64_t version,
     return ret;
 }
 
+// append the segments of the Bloom filters that have changed since the last
+// append, and return the offset of the up-to-date filter document
+static uint64_t _fdb_kvs_bloom_filters_append(FdbKvsHandle *handle,
+                                              KvsBloomFilters *filters)
+{
+    char *doc_key = alca(char, 32);
+    void *data;
+    size_t len;
+    uint64_t bloom_offset;
+    std::vector<uint64_t> stale_docs;
+    struct docio_object doc;
+    struct docio_length doc_len;
+
+    if (!filters->isDirty() && filters->getDocOffset() != BLK_NOT_FOUND) {
+        return filters->getDocOffset();
+    }
+
+    filters->exportFilters(&data, &len);
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    sprintf(doc_key, "KV_bloom_filters");
+    doc.key = (void *)doc_key;
+    doc.meta = NULL;
+    doc.body = data;
+    doc.length.keylen = strlen(doc_key) + 1;
+    doc.length.metalen = 0;
+    doc.length.bodylen = len;
+    doc.seqnum = 0;
+    bloom_offset = handle->dhandle->appendSystemDoc_Docio(&doc);
+    free(data);
+
+    if (bloom_offset == BLK_NOT_FOUND) {
+        return BLK_NOT_FOUND;
+    }
+    filters->setPersisted(bloom_offset, stale_docs);
+
+    // older filter documents whose segments have all been rewritten
+    for (uint64_t stale_offset : stale_docs) {
+        if (handle->dhandle->readDocLength_Docio(&doc_len, stale_offset)
+            == FDB_RESULT_SUCCESS) {
+            // mark stale
+            handle->file->markDocStale(stale_offset,
+                                       _fdb_get_docsize(doc_len));
+        }
+    }
+
+    return bloom_offset;
+}
+
+// append the stats of the blob files if they have changed since the last
+// append, and return the offset of the up-to-date stats document
+static uint64_t _fdb_kvs_blob_stats_append(FdbKvsHandle *handle,
+                                           BlobStore *blob_store)
+{
+    char *doc_key = alca(char, 32);
+    void *data;
+    size_t len;
+    uint64_t blob_offset, prev_offset;
+    struct docio_object doc;
+    struct docio_length doc_len;
+
+    if (!blob_store->isStatsDirty() &&
+        blob_store->getStatsOffset() != BLK_NOT_FOUND) {
+        return blob_store->getStatsOffset();
+    }
+
+    blob_store->exportStats(&data, &len);
+
+    prev_offset = blob_store->getStatsOffset();
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    sprintf(doc_key, "KV_blob_files");
+    doc.key = (void *)doc_key;
+    doc.meta = NULL;
+    doc.body = data;
+    doc.length.keylen = strlen(doc_key) + 1;
+    doc.length.metalen = 0;
+    doc.length.bodylen = len;
+    doc.seqnum = 0;
+    blob_offset = handle->dhandle->appendSystemDoc_Docio(&doc);
+    free(data);
+
+    if (blob_offset == BLK_NOT_FOUND) {
+        return BLK_NOT_FOUND;
+    }
+    blob_store->setStatsPersisted(blob_offset);
+
+    if (prev_offset != BLK_NOT_FOUND) {
+        if (handle->dhandle->readDocLength_Docio(&doc_len, prev_offset)
+            == FDB_RESULT_SUCCESS) {
+            // mark stale
+            handle->file->markDocStale(prev_offset,
+                                       _fdb_get_docsize(doc_len));
+        }
+    }
+
+    return blob_offset;
+}
+
 uint64_t fdb_kvs_header_append(FdbKvsHandle *handle)
 {
     char *doc_key = alca(char, 32);
     void *data;
     size_t len;
     uint64_t kv_info_offset, prev_offset;
+    uint64_t bloom_offset = BLK_NOT_FOUND;
+    uint64_t blob_offset = BLK_NOT_FOUND;
     struct docio_object doc;
     struct docio_length doc_len;
     FileMgr *file = handle->file;
     DocioHandle *dhandle = handle->dhandle;
+    KvsBloomFilters *filters = file->getBloomFilters();
+    BlobStore *blob_store = file->getBlobStore();
+
+    if (filters) {
+        bloom_offset = _fdb_kvs_bloom_filters_append(handle, filters);
+    }
+    if (blob_store && ver_blob_support(file->getVersion())) {
+        blob_offset = _fdb_kvs_blob_stats_append(handle, blob_store);
+    }
 
-    _fdb_kvs_header_export(file->getKVHeader_UNLOCKED(), &data, &len, file->getVersion());
+    _fdb_kvs_header_export(file->getKVHeader_UNLOCKED(), &data, &len,
+                           file->getVersion(), bloom_offset, blob_offset);
 
     prev_offset = handle->kv_info_offset;
 
@@ -806,6 +1007,11 @@ uint64_t fdb_kvs_header_append(FdbKvsHandle *handle)
     kv_info_offset = dhandle->appendSystemDoc_Docio(&doc);
     free(data);
 
+    if (filters && bloom_offset != BLK_NOT_FOUND) {
+        // DB headers pointing to this KV header can trust the filters
+        filters->setKvInfoOffset(kv_info_offset);
+    }
+
     if (prev_offset != BLK_NOT_FOUND) {
         if (handle->dhandle->readDocLength_Docio(&doc_len, prev_offset)
             == FDB_RESULT_SUCCESS) {
@@ -843,6 +1049,140 @@ void fdb_kvs_header_read(KvsHeader *kv_header,
     free_docio_object(&doc, true, true, true);
 }
 
+// read the Bloom filters referred by the KV header at 'kv_info_offset'
+static bool _fdb_kvs_bloom_filters_read(FdbKvsHandle *handle,
+                                        KvsBloomFilters *filters,
+                                        uint64_t kv_info_offset,
+                                        uint64_t version)
+{
+    int64_t offset;
+    uint64_t bloom_offset;
+    std::set<uint64_t> missing;
+    struct docio_object doc;
+    bool ret;
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    offset = handle->dhandle->readDoc_Docio(kv_info_offset, &doc, true);
+    if (offset <= 0) {
+        return false;
+    }
+    bloom_offset = _fdb_kvs_header_get_doc_offset(doc.body,
+                                                  doc.length.bodylen,
+                                                  version,
+                                                  kvs_header_bloom_magic);
+    free_docio_object(&doc, true, true, true);
+    if (bloom_offset == BLK_NOT_FOUND) {
+        return false;
+    }
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    offset = handle->dhandle->readDoc_Docio(bloom_offset, &doc, true);
+    if (offset <= 0) {
+        return false;
+    }
+    ret = filters->importFilters(doc.body, doc.length.bodylen, bloom_offset,
+                                 missing);
+    free_docio_object(&doc, true, true, true);
+
+    // segments that have not changed since older filter documents
+    for (auto it = missing.begin(); ret && it != missing.end(); ++it) {
+        memset(&doc, 0, sizeof(struct docio_object));
+        offset = handle->dhandle->readDoc_Docio(*it, &doc, true);
+        if (offset <= 0) {
+            ret = false;
+            break;
+        }
+        ret = filters->importSegments(doc.body, doc.length.bodylen, *it);
+        free_docio_object(&doc, true, true, true);
+    }
+
+    if (ret && filters->finishImport(bloom_offset)) {
+        filters->setKvInfoOffset(kv_info_offset);
+        return true;
+    }
+    return false;
+}
+
+void fdb_kvs_bloom_filters_init(FdbKvsHandle *handle,
+                                bid_t trie_root_bid,
+                                uint64_t kv_info_offset,
+                                uint64_t header_flags,
+                                uint64_t version)
+{
+    FileMgr *file = handle->file;
+    KvsBloomFilters *filters = NULL;
+
+    if (file->isBloomFiltersInitialized()) {
+        return;
+    }
+
+    if (handle->config.bloom_filter_bits_per_key) {
+        filters = new KvsBloomFilters(handle->config.bloom_filter_bits_per_key);
+        if (trie_root_bid != BLK_NOT_FOUND) {
+            // The HB+trie is not empty, so the filters can be used only if
+            // the last DB header says that the persisted ones are up-to-date.
+            bool loaded = false;
+            if ((header_flags & FDB_FLAG_BLOOM_FILTER) &&
+                kv_info_offset != BLK_NOT_FOUND) {
+                loaded = _fdb_kvs_bloom_filters_read(handle, filters,
+                                                     kv_info_offset, version);
+            }
+            if (!loaded) {
+                // not available until the file is compacted
+                delete filters;
+                filters = NULL;
+            }
+        }
+    }
+
+    if (!file->initBloomFilters(filters)) {
+        delete filters;
+    }
+}
+
+void fdb_kvs_blob_stats_init(FdbKvsHandle *handle, uint64_t kv_info_offset,
+                             uint64_t version)
+{
+    BlobStore *blob_store = handle->file->getBlobStore();
+    int64_t offset;
+    uint64_t blob_offset;
+    struct docio_object doc;
+
+    if (!blob_store || blob_store->getStatsOffset() != BLK_NOT_FOUND ||
+        kv_info_offset == BLK_NOT_FOUND) {
+        return;
+    }
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    offset = handle->dhandle->readDoc_Docio(kv_info_offset, &doc, true);
+    if (offset <= 0) {
+        return;
+    }
+    blob_offset = _fdb_kvs_header_get_doc_offset(doc.body,
+                                                 doc.length.bodylen,
+                                                 version,
+                                                 kvs_header_blob_magic);
+    free_docio_object(&doc, true, true, true);
+    if (blob_offset == BLK_NOT_FOUND) {
+        return;
+    }
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    offset = handle->dhandle->readDoc_Docio(blob_offset, &doc, true);
+    if (offset <= 0) {
+        return;
+    }
+    if (blob_store->importStats(doc.body, doc.length.bodylen)) {
+        blob_store->setStatsPersisted(blob_offset);
+    } else {
+        fdb_log(&handle->log_callback, FDB_RESULT_FILE_CORRUPTION,
+                "Invalid blob file stats with the offset %" _F64 " in a "
+                "database file '%s'", blob_offset,
+                handle->file->getFileName());
+    }
+    free_docio_object(&doc, true, true, true);
+}
+
 fdb_seqnum_t fdb_kvs_get_committed_seqnum(FdbKvsHandle *handle)
 {
     uint8_t *buf;
@@ -1993,6 +2333,12 @@ fdb_status FdbEngine::rollbackKvs(FdbKvsHandle **handle_ptr, fdb_seqnum_t seqnum
         fdb_kvs_set_seqnum(handle_in->file,
                            handle_in->kvs->getKvsId(), seqnum);
         handle_in->seqnum = seqnum;
+        // The secondary index still holds the rolled-back entries; it is
+        // rebuilt lazily by the next secondary iterator.
+        if (handle_in->file->getSecondaryIndexes()) {
+            handle_in->file->getSecondaryIndexes()->invalidate(
+                                        handle_in->kvs->getKvsId());
+        }
         handle_in->file->mutexUnlock();
 
         super_handle->rollback_revnum = handle->rollback_revnum;
@@ -2395,6 +2741,16 @@ fdb_kvs_remove_start:
     // discard all WAL entries
     file->getWal()->closeKvs_Wal(kv_id, &root_handle->log_callback);
 
+    // drop the secondary index, or only its entries if the KV store is
+    // still used (i.e., the default KV store, or recreated by a rollback).
+    if (file->getSecondaryIndexes()) {
+        if (rollback_recreate || kv_id == 0) {
+            file->getSecondaryIndexes()->invalidate(kv_id);
+        } else {
+            file->getSecondaryIndexes()->removeIndex(kv_id);
+        }
+    }
+
     bid_t dirty_idtree_root = BLK_NOT_FOUND;
     bid_t dirty_seqtree_root = BLK_NOT_FOUND;
     struct filemgr_dirty_update_node *prev_node = NULL, *new_node = NULL;
@@ -0,0 +1,587 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "secondary_index.h"
+#include "fdb_internal.h"
+#include "filemgr.h"
+#include "kvs_handle.h"
+
+#include "memleak.h"
+
+std::atomic<uint64_t> SecondaryIndex::totalMemUsage(0);
+
+// Estimated memory taken by an entry, including the nodes of 'entries' and
+// 'skeys' that hold it.
+static inline uint64_t _sindex_entry_mem(const std::string &pkey,
+                                         const std::string &skey)
+{
+    return 2 * (sizeof(SecondaryIndex::Entry) + pkey.size() + skey.size()) +
+           64;
+}
+
+SecondaryIndex::SecondaryIndex(fdb_secondary_key_fn _extractor, void *_ctx) :
+    extractor(_extractor), ctx(_ctx), state(State::INVALID), memUsage(0)
+{
+    init_rw_lock(&lock);
+}
+
+SecondaryIndex::~SecondaryIndex()
+{
+    totalMemUsage.fetch_sub(memUsage, std::memory_order_relaxed);
+    destroy_rw_lock(&lock);
+}
+
+void SecondaryIndex::setExtractor(fdb_secondary_key_fn _extractor, void *_ctx)
+{
+    writer_lock(&lock);
+    extractor = _extractor;
+    ctx = _ctx;
+    writer_unlock(&lock);
+}
+
+size_t SecondaryIndex::extractKey(fdb_doc *doc, void *skey_buf)
+{
+    fdb_secondary_key_fn _extractor;
+    void *_ctx;
+    size_t skeylen;
+
+    reader_lock(&lock);
+    _extractor = extractor;
+    _ctx = ctx;
+    reader_unlock(&lock);
+
+    skeylen = _extractor(doc, skey_buf, FDB_MAX_KEYLEN, _ctx);
+    if (skeylen > FDB_MAX_KEYLEN) {
+        // not indexed
+        return 0;
+    }
+    return skeylen;
+}
+
+void SecondaryIndex::_update(const std::string &pkey,
+                             const std::string *skey)
+{
+    auto old = skeys.find(pkey);
+    if (old != skeys.end()) {
+        if (skey && old->second == *skey) {
+            // secondary key has not changed
+            return;
+        }
+        entries.erase(Entry(old->second, pkey));
+        memUsage -= _sindex_entry_mem(pkey, old->second);
+        totalMemUsage.fetch_sub(_sindex_entry_mem(pkey, old->second),
+                                std::memory_order_relaxed);
+        skeys.erase(old);
+    }
+    if (skey) {
+        entries.insert(Entry(*skey, pkey));
+        skeys.insert(std::make_pair(pkey, *skey));
+        memUsage += _sindex_entry_mem(pkey, *skey);
+        totalMemUsage.fetch_add(_sindex_entry_mem(pkey, *skey),
+                                std::memory_order_relaxed);
+    }
+}
+
+void SecondaryIndex::_clear()
+{
+    entries.clear();
+    skeys.clear();
+    updatedKeys.clear();
+    totalMemUsage.fetch_sub(memUsage, std::memory_order_relaxed);
+    memUsage = 0;
+}
+
+void SecondaryIndex::update(const std::string &pkey, const std::string *skey)
+{
+    writer_lock(&lock);
+    if (state == State::BUILDING) {
+        updatedKeys.insert(pkey);
+    }
+    if (state != State::INVALID) {
+        _update(pkey, skey);
+    }
+    writer_unlock(&lock);
+}
+
+bool SecondaryIndex::beginBuild()
+{
+    buildLock.lock();
+    writer_lock(&lock);
+    if (state == State::VALID) {
+        writer_unlock(&lock);
+        buildLock.unlock();
+        return false;
+    }
+    _clear();
+    state = State::BUILDING;
+    writer_unlock(&lock);
+    return true;
+}
+
+void SecondaryIndex::addBuiltEntry(fdb_doc *doc)
+{
+    uint8_t *skey_buf = alca(uint8_t, FDB_MAX_KEYLEN);
+    size_t skeylen = extractKey(doc, skey_buf);
+    if (skeylen == 0) {
+        return;
+    }
+    std::string pkey((char *)doc->key, doc->keylen);
+    std::string skey((char *)skey_buf, skeylen);
+
+    writer_lock(&lock);
+    // skip documents updated since the build began, or all documents if the
+    // index has been invalidated during the build
+    if (state == State::BUILDING && !updatedKeys.count(pkey)) {
+        _update(pkey, &skey);
+    }
+    writer_unlock(&lock);
+}
+
+void SecondaryIndex::endBuild(bool success)
+{
+    writer_lock(&lock);
+    updatedKeys.clear();
+    if (success && state == State::BUILDING) {
+        state = State::VALID;
+    } else {
+        _clear();
+        state = State::INVALID;
+    }
+    writer_unlock(&lock);
+    buildLock.unlock();
+}
+
+void SecondaryIndex::invalidate()
+{
+    writer_lock(&lock);
+    _clear();
+    state = State::INVALID;
+    writer_unlock(&lock);
+}
+
+bool SecondaryIndex::isValid()
+{
+    bool ret;
+    reader_lock(&lock);
+    ret = (state == State::VALID);
+    reader_unlock(&lock);
+    return ret;
+}
+
+bool SecondaryIndex::findNext(const Entry &cur, bool inclusive,
+                              const std::string *max_skey, Entry &entry_out)
+{
+    bool ret = false;
+
+    reader_lock(&lock);
+    auto entry = inclusive ? entries.lower_bound(cur)
+                           : entries.upper_bound(cur);
+    if (entry != entries.end() &&
+        (!max_skey || entry->first <= *max_skey)) {
+        entry_out = *entry;
+        ret = true;
+    }
+    reader_unlock(&lock);
+    return ret;
+}
+
+size_t SecondaryIndex::getNumEntries()
+{
+    size_t ret;
+    reader_lock(&lock);
+    ret = entries.size();
+    reader_unlock(&lock);
+    return ret;
+}
+
+KvsSecondaryIndexes::KvsSecondaryIndexes()
+{ }
+
+KvsSecondaryIndexes::~KvsSecondaryIndexes()
+{
+    for (auto &entry : indexes) {
+        delete entry.second;
+    }
+    for (auto &sindex : removedIndexes) {
+        delete sindex;
+    }
+}
+
+bool KvsSecondaryIndexes::registerIndex(fdb_kvs_id_t kv_id,
+                                        fdb_secondary_key_fn extractor,
+                                        void *ctx)
+{
+    LockHolder lh(lock);
+    auto entry = indexes.find(kv_id);
+    if (entry != indexes.end()) {
+        entry->second->setExtractor(extractor, ctx);
+        return false;
+    }
+    indexes.insert(std::make_pair(kv_id, new SecondaryIndex(extractor, ctx)));
+    return true;
+}
+
+SecondaryIndex *KvsSecondaryIndexes::getIndex(fdb_kvs_id_t kv_id)
+{
+    LockHolder lh(lock);
+    auto entry = indexes.find(kv_id);
+    if (entry == indexes.end()) {
+        return NULL;
+    }
+    return entry->second;
+}
+
+KvsSecondaryIndexes *KvsSecondaryIndexes::cloneEmpty()
+{
+    KvsSecondaryIndexes *ret = new KvsSecondaryIndexes();
+    LockHolder lh(lock);
+    for (auto &entry : indexes) {
+        ret->registerIndex(entry.first, entry.second->getExtractor(),
+                           entry.second->getCtx());
+        // all the documents are flushed into the new file's indexes while
+        // they are moved, so the indexes need not be built by a scan.
+        SecondaryIndex *sindex = ret->indexes[entry.first];
+        sindex->beginBuild();
+        sindex->endBuild(true);
+    }
+    return ret;
+}
+
+void KvsSecondaryIndexes::invalidate(fdb_kvs_id_t kv_id)
+{
+    LockHolder lh(lock);
+    auto entry = indexes.find(kv_id);
+    if (entry != indexes.end()) {
+        entry->second->invalidate();
+    }
+}
+
+void KvsSecondaryIndexes::removeIndex(fdb_kvs_id_t kv_id)
+{
+    LockHolder lh(lock);
+    auto entry = indexes.find(kv_id);
+    if (entry != indexes.end()) {
+        // writers that looked up the index before may still be using it
+        entry->second->invalidate();
+        removedIndexes.push_back(entry->second);
+        indexes.erase(entry);
+    }
+}
+
+void KvsSecondaryIndexes::invalidateAll()
+{
+    LockHolder lh(lock);
+    for (auto &entry : indexes) {
+        entry.second->invalidate();
+    }
+}
+
+// Add the entry of the document at 'offset' to the index being built, unless
+// the document has been deleted.
+static void _fdb_sindex_add_doc(fdb_kvs_handle *handle,
+                                SecondaryIndex *sindex,
+                                uint64_t offset)
+{
+    size_t size_chunk = handle->kvs ? handle->config.chunksize : 0;
+    struct docio_object _doc;
+
+    memset(&_doc, 0, sizeof(_doc));
+    if (handle->dhandle->readDoc_Docio(offset, &_doc, true) <= 0) {
+        free_docio_object(&_doc, true, true, true);
+        return;
+    }
+    if (!(_doc.length.flag & DOCIO_DELETED)) {
+        fdb_doc doc;
+        memset(&doc, 0, sizeof(doc));
+        doc.key = (uint8_t *)_doc.key + size_chunk;
+        doc.keylen = _doc.length.keylen - size_chunk;
+        doc.meta = _doc.meta;
+        doc.metalen = _doc.length.metalen;
+        doc.body = _doc.body;
+        doc.bodylen = _doc.length.bodylen;
+        doc.seqnum = _doc.seqnum;
+        doc.offset = offset;
+        sindex->addBuiltEntry(&doc);
+    }
+    free_docio_object(&_doc, true, true, true);
+}
+
+// Build the secondary index of the KV store of 'handle' by scanning the
+// documents flushed into its HB+trie, unless the index is already valid.
+// Like the entries maintained by WAL flushes, documents still in the WAL are
+// not indexed until they are flushed.
+static fdb_status _fdb_sindex_build(fdb_kvs_handle *handle,
+                                    SecondaryIndex *sindex)
+{
+    if (!sindex->beginBuild()) {
+        return FDB_RESULT_SUCCESS;
+    }
+
+    // Documents flushed from the WAL from now on are indexed by the flush,
+    // and the scan below does not overwrite them with their older versions.
+    // The in-memory snapshot pins the HB+trie, including the flushes that
+    // have not been committed yet, while only the HB+trie is scanned.
+    fdb_kvs_handle *snap;
+    fdb_status fs = fdb_snapshot_open(handle, &snap, FDB_SNAPSHOT_INMEM);
+    if (fs != FDB_RESULT_SUCCESS) {
+        sindex->endBuild(false);
+        return fs;
+    }
+
+    size_t size_chunk = snap->kvs ? snap->config.chunksize : 0;
+    uint8_t *prefix = alca(uint8_t, size_chunk + 1);
+    if (size_chunk) {
+        kvid2buf(size_chunk, snap->kvs->getKvsId(), prefix);
+    }
+    uint8_t *key_buf = alca(uint8_t, FDB_MAX_KEYLEN_INTERNAL);
+    size_t keylen;
+    DocMetaForIndex hb_meta;
+    bool is_btree_v2 = ver_btreev2_format(snap->file->getVersion());
+
+    HBTrieIterator *it = new HBTrieIterator(snap->trie,
+                                            size_chunk ? prefix : NULL,
+                                            size_chunk);
+    while (it->next(key_buf, keylen, (void *)&hb_meta) ==
+           HBTRIE_RESULT_SUCCESS) {
+        if (is_btree_v2) {
+            snap->bnodeMgr->releaseCleanNodes();
+        } else {
+            snap->bhandle->flushBuffer();
+        }
+        if (keylen < size_chunk || memcmp(key_buf, prefix, size_chunk)) {
+            // beyond the KV store
+            break;
+        }
+        _fdb_sindex_add_doc(snap, sindex, _endian_decode(hb_meta.offset));
+    }
+    delete it;
+    if (is_btree_v2) {
+        snap->bnodeMgr->releaseCleanNodes();
+    } else {
+        snap->bhandle->flushBuffer();
+    }
+
+    fdb_kvs_close(snap);
+    sindex->endBuild(true);
+    return FDB_RESULT_SUCCESS;
+}
+
+// Build a private index of the snapshot 'handle' from all its documents
+// (including the ones in its WAL), as the shared index keeps following the
+// WAL flushes after the snapshot is taken.
+static fdb_status _fdb_sindex_build_snapshot(fdb_kvs_handle *handle,
+                                             SecondaryIndex *sindex)
+{
+    sindex->beginBuild();
+
+    fdb_iterator *it;
+    fdb_status fs = fdb_iterator_init(handle, &it, NULL, 0, NULL, 0,
+                                      FDB_ITR_NO_DELETES);
+    if (fs != FDB_RESULT_SUCCESS) {
+        sindex->endBuild(false);
+        return fs;
+    }
+
+    fdb_doc *doc = NULL;
+    do {
+        if (fdb_iterator_get(it, &doc) != FDB_RESULT_SUCCESS) {
+            break;
+        }
+        sindex->addBuiltEntry(doc);
+        fdb_doc_free(doc);
+        doc = NULL;
+    } while (fdb_iterator_next(it) == FDB_RESULT_SUCCESS);
+
+    fdb_iterator_close(it);
+    sindex->endBuild(true);
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_register_secondary_index(fdb_kvs_handle *handle,
+                                        fdb_secondary_key_fn extractor,
+                                        void *ctx)
+{
+    if (!handle) {
+        return FDB_RESULT_INVALID_HANDLE;
+    }
+    if (!extractor || handle->shandle) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    // make the handle refer to the latest file (after compaction) before
+    // the index is registered.
+    fdb_status fs = fdb_check_file_reopen(handle, NULL);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+
+    FileMgr *file = handle->file;
+    fdb_kvs_id_t kv_id = handle->kvs ? handle->kvs->getKvsId() : 0;
+    KvsSecondaryIndexes *sindexes =
+        file->initSecondaryIndexes(new KvsSecondaryIndexes());
+
+    // Register the index under the file lock, so that WAL flushes (and
+    // writers) either see the index or have finished before the scan starts.
+    file->mutexLock();
+    sindexes->registerIndex(kv_id, extractor, ctx);
+    file->mutexUnlock();
+
+    return _fdb_sindex_build(handle, sindexes->getIndex(kv_id));
+}
+
+LIBFDB_API
+fdb_status fdb_secondary_iterator_init(fdb_kvs_handle *handle,
+                                       fdb_secondary_iterator **iterator,
+                                       const void *min_skey,
+                                       size_t min_skeylen,
+                                       const void *max_skey,
+                                       size_t max_skeylen)
+{
+    if (!handle) {
+        return FDB_RESULT_INVALID_HANDLE;
+    }
+    if (!iterator || min_skeylen > FDB_MAX_KEYLEN ||
+        max_skeylen > FDB_MAX_KEYLEN) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    if (!handle->shandle) {
+        fdb_status fs = fdb_check_file_reopen(handle, NULL);
+        if (fs != FDB_RESULT_SUCCESS) {
+            return fs;
+        }
+    }
+
+    KvsSecondaryIndexes *sindexes = handle->file->getSecondaryIndexes();
+    fdb_kvs_id_t kv_id = handle->kvs ? handle->kvs->getKvsId() : 0;
+    SecondaryIndex *sindex = sindexes ? sindexes->getIndex(kv_id) : NULL;
+    if (!sindex) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    bool own_index = false;
+    if (handle->shandle) {
+        // the shared index may already have entries newer than the snapshot
+        sindex = new SecondaryIndex(sindex->getExtractor(), sindex->getCtx());
+        own_index = true;
+        fdb_status fs = _fdb_sindex_build_snapshot(handle, sindex);
+        if (fs != FDB_RESULT_SUCCESS) {
+            delete sindex;
+            return fs;
+        }
+    } else if (!sindex->isValid()) {
+        // invalidated by a rollback, which should be built again from the
+        // latest documents.
+        fdb_status fs = _fdb_sindex_build(handle, sindex);
+        if (fs != FDB_RESULT_SUCCESS) {
+            return fs;
+        }
+    }
+
+    FdbSecondaryIterator *it = new FdbSecondaryIterator();
+    it->handle = handle;
+    it->index = sindex;
+    it->ownIndex = own_index;
+    it->hasMax = (max_skey != NULL);
+    if (max_skey) {
+        it->maxSkey.assign((const char *)max_skey, max_skeylen);
+    }
+
+    SecondaryIndex::Entry start;
+    if (min_skey) {
+        start.first.assign((const char *)min_skey, min_skeylen);
+    }
+    it->valid = sindex->findNext(start, true,
+                                 it->hasMax ? &it->maxSkey : NULL, it->cur);
+
+    *iterator = it;
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_secondary_iterator_next(fdb_secondary_iterator *iterator)
+{
+    if (!iterator) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    if (!iterator->valid) {
+        return FDB_RESULT_ITERATOR_FAIL;
+    }
+
+    SecondaryIndex::Entry next;
+    if (!iterator->index->findNext(iterator->cur, false,
+                                   iterator->hasMax ? &iterator->maxSkey : NULL,
+                                   next)) {
+        // stay at the last entry
+        return FDB_RESULT_ITERATOR_FAIL;
+    }
+    iterator->cur = next;
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_secondary_iterator_get(fdb_secondary_iterator *iterator,
+                                      fdb_doc **doc)
+{
+    if (!iterator || !doc) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    if (!iterator->valid) {
+        return FDB_RESULT_ITERATOR_FAIL;
+    }
+
+    const std::string &pkey = iterator->cur.second;
+    bool alloced_doc = false;
+    fdb_status fs;
+
+    if (*doc == NULL) {
+        fs = fdb_doc_create(doc, pkey.data(), pkey.size(), NULL, 0, NULL, 0);
+        if (fs != FDB_RESULT_SUCCESS) {
+            return fs;
+        }
+        alloced_doc = true;
+    } else {
+        if (!(*doc)->key) {
+            (*doc)->key = (void *)malloc(pkey.size());
+        }
+        memcpy((*doc)->key, pkey.data(), pkey.size());
+        (*doc)->keylen = pkey.size();
+    }
+
+    fs = fdb_get(iterator->handle, *doc);
+    if (fs != FDB_RESULT_SUCCESS && alloced_doc) {
+        fdb_doc_free(*doc);
+        *doc = NULL;
+    }
+    return fs;
+}
+
+LIBFDB_API
+fdb_status fdb_secondary_iterator_close(fdb_secondary_iterator *iterator)
+{
+    if (!iterator) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    if (iterator->ownIndex) {
+        delete iterator->index;
+    }
+    delete iterator;
+    return FDB_RESULT_SUCCESS;
+}
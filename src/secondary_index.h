@@ -0,0 +1,237 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "libforestdb/forestdb.h"
+#include "internal_types.h"
+#include "atomic.h"
+
+/**
+ * Secondary index of a single KV store.
+ *
+ * Each entry is a pair of {secondary key, primary key}, where the secondary
+ * key is given by the extractor callback registered by the application.
+ * Entries are updated when the WAL flushes documents into the HB+trie. The
+ * secondary key of each indexed document is kept along with its primary key,
+ * so that the old entry of a document can be replaced without reading its
+ * old version.
+ */
+class SecondaryIndex {
+public:
+    typedef std::pair<std::string, std::string> Entry;
+
+    SecondaryIndex(fdb_secondary_key_fn _extractor, void *_ctx);
+
+    ~SecondaryIndex();
+
+    void setExtractor(fdb_secondary_key_fn _extractor, void *_ctx);
+
+    fdb_secondary_key_fn getExtractor() const {
+        return extractor;
+    }
+
+    void *getCtx() const {
+        return ctx;
+    }
+
+    /**
+     * Extract the secondary key of the given document into 'skey_buf',
+     * whose size should be FDB_MAX_KEYLEN.
+     *
+     * @return Length of the secondary key, or zero if the document is not
+     *         indexed.
+     */
+    size_t extractKey(fdb_doc *doc, void *skey_buf);
+
+    /**
+     * Replace the entry of the document 'pkey' with the given secondary key,
+     * or remove it if 'skey' is NULL. This is a no-op if the index is not
+     * valid.
+     */
+    void update(const std::string &pkey, const std::string *skey);
+
+    /**
+     * Start building the index from the existing documents, and clear its
+     * entries. Entries updated by WAL flushes until endBuild() is called are
+     * not overwritten by addBuiltEntry(), as the document scan may return
+     * their older versions.
+     *
+     * @return False if the index is already valid (e.g., built by another
+     *         thread in the meantime), in which case nothing needs to be done.
+     */
+    bool beginBuild();
+
+    /**
+     * Add the entry of a document returned by the scan started by
+     * beginBuild().
+     */
+    void addBuiltEntry(fdb_doc *doc);
+
+    /**
+     * Finish building the index. If 'success' is false, the index becomes
+     * invalid again.
+     */
+    void endBuild(bool success);
+
+    /**
+     * Drop all the entries (e.g., after the KV store is rolled back), so that
+     * the index is built again before it is used next time.
+     */
+    void invalidate();
+
+    bool isValid();
+
+    /**
+     * Find the first entry that is greater than 'cur' (or equal to 'cur'
+     * if 'inclusive' is true), and whose secondary key is not greater than
+     * 'max_skey' (unless 'max_skey' is NULL).
+     *
+     * @return True if such an entry exists, in which case it is returned
+     *         through 'entry_out'.
+     */
+    bool findNext(const Entry &cur, bool inclusive,
+                  const std::string *max_skey, Entry &entry_out);
+
+    size_t getNumEntries();
+
+    /**
+     * Return the memory used by the secondary indexes of all the open files.
+     */
+    static uint64_t getTotalMemUsage() {
+        return totalMemUsage.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum class State {
+        // Not built yet, or invalidated
+        INVALID,
+        // Being built by a scan, while WAL flushes are applied as well
+        BUILDING,
+        // Maintained by WAL flushes
+        VALID
+    };
+
+    void _update(const std::string &pkey, const std::string *skey);
+    void _clear();
+
+    fdb_secondary_key_fn extractor;
+    void *ctx;
+    State state;
+    std::set<Entry> entries;
+    // Secondary key of each indexed document
+    std::unordered_map<std::string, std::string> skeys;
+    // Documents updated by WAL flushes while the index is being built
+    std::unordered_set<std::string> updatedKeys;
+    // Estimated memory used by the entries
+    uint64_t memUsage;
+    // Protects the fields above from concurrent readers and WAL flushes
+    fdb_rw_lock lock;
+    // Serializes the threads building the index
+    std::mutex buildLock;
+
+    static std::atomic<uint64_t> totalMemUsage;
+};
+
+/**
+ * Secondary indexes of all KV stores in a ForestDB file.
+ *
+ * Indexes are kept in memory only. An index is built by scanning its KV
+ * store when it is registered (or used for the first time after a rollback),
+ * and then maintained by WAL flushes. As the extractor callbacks belong to
+ * the application, indexes need to be registered again whenever the file is
+ * opened. Secondary iterators on snapshot handles use private indexes built
+ * from the documents of the snapshots instead.
+ */
+class KvsSecondaryIndexes {
+public:
+    KvsSecondaryIndexes();
+
+    ~KvsSecondaryIndexes();
+
+    /**
+     * Register the secondary index of the given KV store.
+     *
+     * @return True if the index is newly created. False if the index already
+     *         exists, in which case only its extractor is replaced.
+     */
+    bool registerIndex(fdb_kvs_id_t kv_id, fdb_secondary_key_fn extractor,
+                       void *ctx);
+
+    /**
+     * Return the secondary index of the given KV store, or NULL if it is not
+     * registered. Indexes are never freed while the file is open.
+     */
+    SecondaryIndex *getIndex(fdb_kvs_id_t kv_id);
+
+    /**
+     * Create the same set of (empty) indexes for a new file, which are
+     * populated while the documents are moved into the new file.
+     */
+    KvsSecondaryIndexes *cloneEmpty();
+
+    /**
+     * Invalidate the index of the given KV store (e.g., after the KV store
+     * is rolled back), if it is registered.
+     */
+    void invalidate(fdb_kvs_id_t kv_id);
+
+    /**
+     * Unregister the index of the given KV store (e.g., after the KV store is
+     * removed), and drop its entries. The index itself is freed when the
+     * file is closed.
+     */
+    void removeIndex(fdb_kvs_id_t kv_id);
+
+    /**
+     * Invalidate the indexes of all KV stores (e.g., after the entire file
+     * is rolled back).
+     */
+    void invalidateAll();
+
+private:
+    std::map<fdb_kvs_id_t, SecondaryIndex *> indexes;
+    // Indexes of the removed KV stores
+    std::vector<SecondaryIndex *> removedIndexes;
+    std::mutex lock;
+};
+
+/**
+ * Iterator over the secondary index of a KV store, in the order of
+ * secondary keys.
+ */
+struct FdbSecondaryIterator {
+    fdb_kvs_handle *handle;
+    SecondaryIndex *index;
+    // True if 'index' is a private index built for a snapshot handle
+    bool ownIndex;
+    bool hasMax;
+    std::string maxSkey;
+    // Current entry
+    bool valid;
+    SecondaryIndex::Entry cur;
+};
@@ -0,0 +1,298 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#include "seq_model.h"
+
+#include "memleak.h"
+
+struct seq_model_build_ctx {
+    std::vector<fdb_seqnum_t> *firstSeqs;
+    std::vector<bid_t> *leaves;
+};
+
+SeqLeafModel::SeqLeafModel() :
+    rootBid(BLK_NOT_FOUND)
+{ }
+
+void SeqLeafModel::addLeaf(void *key, bid_t bid, void *ctx)
+{
+    struct seq_model_build_ctx *bctx = (struct seq_model_build_ctx *)ctx;
+    fdb_seqnum_t seqnum;
+
+    memcpy(&seqnum, key, sizeof(seqnum));
+    bctx->firstSeqs->push_back(_endian_decode(seqnum));
+    bctx->leaves->push_back(bid);
+}
+
+bool SeqLeafModel::build(BTree *tree)
+{
+    std::vector<fdb_seqnum_t> first_seqs;
+    struct seq_model_build_ctx ctx;
+
+    segments.clear();
+    leaves.clear();
+    rootBid = BLK_NOT_FOUND;
+    if (tree->getKSize() != sizeof(fdb_seqnum_t)) {
+        return false;
+    }
+
+    ctx.firstSeqs = &first_seqs;
+    ctx.leaves = &leaves;
+    if (tree->scanLeaves(addLeaf, &ctx) != BTREE_RESULT_SUCCESS ||
+        leaves.empty()) {
+        leaves.clear();
+        return false;
+    }
+
+    fitSegments(first_seqs);
+    rootBid = tree->getRootBid();
+    return true;
+}
+
+void SeqLeafModel::fitSegments(const std::vector<fdb_seqnum_t> &first_seqs)
+{
+    const double max_err = SEQ_MODEL_MAX_ERROR;
+    size_t i, j, n = first_seqs.size();
+
+    // Greedily extend each segment as long as there is a slope that keeps
+    // every leaf in the segment within 'max_err' of its predicted position
+    // (i.e., the slope range narrows like a cone from the segment's origin).
+    for (i = 0; i < n; i = j) {
+        Segment seg;
+        double lo = 0, hi = std::numeric_limits<double>::max();
+
+        seg.firstSeq = first_seqs[i];
+        seg.firstLeaf = i;
+        for (j = i + 1; j < n; ++j) {
+            double dx = (double)(first_seqs[j] - seg.firstSeq);
+            double dy = (double)(j - i);
+            double l = (dy - max_err) / dx;
+            double h = (dy + max_err) / dx;
+            if (l > hi || h < lo) {
+                break;
+            }
+            lo = std::max(lo, l);
+            hi = std::min(hi, h);
+        }
+        seg.slope = (j == i + 1) ? 0 : (lo + hi) / 2;
+        segments.push_back(seg);
+    }
+}
+
+uint64_t SeqLeafModel::predict(fdb_seqnum_t seqnum) const
+{
+    auto seg = std::upper_bound(segments.begin(), segments.end(), seqnum,
+                                [](fdb_seqnum_t s, const Segment &e) {
+                                    return s < e.firstSeq;
+                                });
+    if (seg == segments.begin()) {
+        // smaller than any key in the B+tree
+        return 0;
+    }
+    --seg;
+
+    uint64_t last_leaf = (seg + 1 == segments.end()) ?
+                         leaves.size() - 1 : (seg + 1)->firstLeaf - 1;
+    double pos = seg->slope * (double)(seqnum - seg->firstSeq);
+    if (pos >= (double)(last_leaf - seg->firstLeaf)) {
+        return last_leaf;
+    }
+    return seg->firstLeaf + (uint64_t)pos;
+}
+
+seq_model_result SeqLeafModel::find(BTree *tree, fdb_seqnum_t seqnum,
+                                    void *value_buf) const
+{
+    fdb_seqnum_t _seqnum = _endian_encode(seqnum);
+    uint64_t pred = predict(seqnum);
+    uint64_t cur = pred;
+    int position, prev_position = BTREE_LEAF_INVALID;
+
+    // The leaf covering the seqnum should be within the max error of the
+    // prediction; allow one more step for rounding.
+    while (cur + SEQ_MODEL_MAX_ERROR + 1 >= pred &&
+           cur <= pred + SEQ_MODEL_MAX_ERROR + 1) {
+        if (tree->findInLeaf(leaves[cur], &_seqnum, value_buf,
+                             &position) == BTREE_RESULT_SUCCESS) {
+            return SEQ_MODEL_FOUND;
+        }
+        if (position == BTREE_LEAF_INVALID) {
+            break;
+        }
+        if (position == BTREE_LEAF_ABSENT ||
+            (prev_position != BTREE_LEAF_INVALID && prev_position != position)) {
+            // the seqnum is within this leaf's range, or between this leaf
+            // and the previous one
+            return SEQ_MODEL_NOT_FOUND;
+        }
+        if (position == BTREE_LEAF_BEFORE) {
+            if (cur == 0) {
+                return SEQ_MODEL_NOT_FOUND;
+            }
+            --cur;
+        } else {
+            if (cur + 1 == leaves.size()) {
+                return SEQ_MODEL_NOT_FOUND;
+            }
+            ++cur;
+        }
+        prev_position = position;
+    }
+    return SEQ_MODEL_MISS;
+}
+
+KvsSeqModels::KvsSeqModels() :
+    numBuilds(0)
+{
+    init_rw_lock(&lock);
+}
+
+KvsSeqModels::~KvsSeqModels()
+{
+    for (auto &entry : models) {
+        delete entry.second;
+    }
+    destroy_rw_lock(&lock);
+}
+
+void KvsSeqModels::replaceModel(fdb_kvs_id_t kv_id, SeqLeafModel *model)
+{
+    SeqLeafModel *old_model = NULL;
+
+    writer_lock(&lock);
+    staleRoots.erase(kv_id);
+    auto entry = models.find(kv_id);
+    if (entry != models.end()) {
+        old_model = entry->second;
+        if (model) {
+            entry->second = model;
+        } else {
+            models.erase(entry);
+        }
+    } else if (model) {
+        models.insert(std::make_pair(kv_id, model));
+    }
+    writer_unlock(&lock);
+
+    delete old_model;
+}
+
+void KvsSeqModels::rebuild(fdb_kvs_id_t kv_id, BTree *tree)
+{
+    SeqLeafModel *model = NULL;
+
+    // build the new model without blocking readers
+    if (tree) {
+        model = new SeqLeafModel();
+        if (model->build(tree)) {
+            numBuilds++;
+        } else {
+            delete model;
+            model = NULL;
+        }
+    }
+    replaceModel(kv_id, model);
+}
+
+void KvsSeqModels::invalidate(fdb_kvs_id_t kv_id, bid_t root_bid)
+{
+    SeqLeafModel *old_model = NULL;
+
+    writer_lock(&lock);
+    auto entry = models.find(kv_id);
+    if (entry != models.end()) {
+        old_model = entry->second;
+        models.erase(entry);
+    }
+    staleRoots[kv_id] = root_bid;
+    writer_unlock(&lock);
+
+    delete old_model;
+}
+
+seq_model_result KvsSeqModels::find(fdb_kvs_id_t kv_id, BTree *tree,
+                                    fdb_seqnum_t seqnum, void *value_buf)
+{
+    seq_model_result ret = SEQ_MODEL_MISS;
+    bid_t root_bid = tree->getRootBid();
+    bool stale = false;
+
+    reader_lock(&lock);
+    auto entry = models.find(kv_id);
+    if (entry != models.end() &&
+        entry->second->getRootBid() == root_bid) {
+        ret = entry->second->find(tree, seqnum, value_buf);
+    } else {
+        auto stale_entry = staleRoots.find(kv_id);
+        stale = stale_entry != staleRoots.end() &&
+                (stale_entry->second == root_bid ||
+                 stale_entry->second == BLK_NOT_FOUND);
+    }
+    reader_unlock(&lock);
+    if (!stale) {
+        return ret;
+    }
+
+    // Claim the rebuild, so that concurrent lookups don't repeat it; they
+    // search the B+tree from its root in the meantime.
+    writer_lock(&lock);
+    auto stale_entry = staleRoots.find(kv_id);
+    stale = stale_entry != staleRoots.end() &&
+            (stale_entry->second == root_bid ||
+             stale_entry->second == BLK_NOT_FOUND);
+    if (stale) {
+        staleRoots.erase(stale_entry);
+    }
+    writer_unlock(&lock);
+    if (!stale) {
+        return SEQ_MODEL_MISS;
+    }
+
+    // build the new model without blocking readers
+    SeqLeafModel *model = new SeqLeafModel();
+    if (!model->build(tree)) {
+        delete model;
+        return SEQ_MODEL_MISS;
+    }
+    numBuilds++;
+    ret = model->find(tree, seqnum, value_buf);
+
+    writer_lock(&lock);
+    if (staleRoots.find(kv_id) != staleRoots.end()) {
+        // invalidated again while being built
+        writer_unlock(&lock);
+        delete model;
+        return ret;
+    }
+    entry = models.find(kv_id);
+    SeqLeafModel *old_model = NULL;
+    if (entry != models.end()) {
+        old_model = entry->second;
+        entry->second = model;
+    } else {
+        models.insert(std::make_pair(kv_id, model));
+    }
+    writer_unlock(&lock);
+
+    delete old_model;
+    return ret;
+}
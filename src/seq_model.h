@@ -0,0 +1,165 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "internal_types.h"
+#include "btree.h"
+
+typedef enum {
+    // The seqnum exists, and its value has been returned
+    SEQ_MODEL_FOUND,
+    // The seqnum does not exist in the B+tree
+    SEQ_MODEL_NOT_FOUND,
+    // The model cannot answer; the B+tree should be searched from its root
+    SEQ_MODEL_MISS
+} seq_model_result;
+
+/**
+ * Piecewise-linear model over the leaf nodes of a sequence number B+tree.
+ *
+ * Sequence numbers are assigned in increasing order, so the smallest seqnum
+ * of each leaf node grows almost linearly with the position of the leaf. The
+ * model keeps the BIDs of all leaf nodes and a few linear segments that map
+ * a seqnum to the position of its leaf, within SEQ_MODEL_MAX_ERROR leaves.
+ * A lookup reads the predicted leaf and, if the seqnum is out of the leaf's
+ * key range, walks to its neighbors, instead of descending from the root.
+ *
+ * A model is only valid for the B+tree rooted at the BID it was built from.
+ */
+class SeqLeafModel {
+public:
+    SeqLeafModel();
+
+    ~SeqLeafModel() { }
+
+    /**
+     * Build the model from the leaf nodes of the given B+tree, whose keys are
+     * big-endian sequence numbers.
+     *
+     * @return False if the B+tree is empty or cannot be read.
+     */
+    bool build(BTree *tree);
+
+    /**
+     * Look up the given seqnum in 'tree' through the predicted leaf nodes.
+     * 'tree' should be rooted at the same BID as the B+tree that the model
+     * was built from.
+     */
+    seq_model_result find(BTree *tree, fdb_seqnum_t seqnum,
+                          void *value_buf) const;
+
+    bid_t getRootBid() const {
+        return rootBid;
+    }
+
+    size_t getNumLeaves() const {
+        return leaves.size();
+    }
+
+    size_t getNumSegments() const {
+        return segments.size();
+    }
+
+private:
+    struct Segment {
+        // Smallest seqnum of the first leaf in this segment
+        fdb_seqnum_t firstSeq;
+        // Position of the first leaf in this segment
+        uint64_t firstLeaf;
+        // Number of leaves per seqnum
+        double slope;
+    };
+
+    static void addLeaf(void *key, bid_t bid, void *ctx);
+
+    void fitSegments(const std::vector<fdb_seqnum_t> &first_seqs);
+
+    uint64_t predict(fdb_seqnum_t seqnum) const;
+
+    bid_t rootBid;
+    std::vector<Segment> segments;
+    // BIDs of all leaf nodes in key order
+    std::vector<bid_t> leaves;
+};
+
+/**
+ * Sequence number models of all KV stores in a ForestDB file.
+ *
+ * Each WAL flush that touches a KV store discards its model, recording the
+ * new root BID of its seq index if it is known without reading the index, and
+ * the model is rebuilt by the first lookup on that root, so that
+ * a flush doesn't pay for scanning the seq index and consecutive flushes
+ * without lookups in between rebuild the model only once. By-seq lookups on
+ * the latest version of the seq index then read one or two leaf nodes.
+ * Lookups on other versions (e.g., snapshots) do not match the model's root
+ * BID, and fall back to the usual B+tree search. Models are kept in memory
+ * only.
+ */
+class KvsSeqModels {
+public:
+    KvsSeqModels();
+
+    ~KvsSeqModels();
+
+    /**
+     * Replace the model of the given KV store with the one built from 'tree'.
+     * The model is removed if 'tree' is NULL or cannot be modeled.
+     */
+    void rebuild(fdb_kvs_id_t kv_id, BTree *tree);
+
+    /**
+     * Discard the model of the given KV store, as its seq B+tree is now
+     * rooted at 'root_bid'. The model is rebuilt by the next lookup on that
+     * B+tree. If 'root_bid' is BLK_NOT_FOUND (i.e., the new root is not known
+     * yet), the model is rebuilt by the next lookup on any B+tree.
+     */
+    void invalidate(fdb_kvs_id_t kv_id, bid_t root_bid);
+
+    /**
+     * Look up the given seqnum in the seq B+tree of the given KV store,
+     * rebuilding the model first if it has been invalidated for 'tree'.
+     */
+    seq_model_result find(fdb_kvs_id_t kv_id, BTree *tree,
+                          fdb_seqnum_t seqnum, void *value_buf);
+
+    /**
+     * Return the number of models built so far.
+     */
+    uint64_t getNumBuilds() const {
+        return numBuilds.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Replace the model of the given KV store, or remove it if 'model' is
+    // NULL, and cancel its pending rebuild.
+    void replaceModel(fdb_kvs_id_t kv_id, SeqLeafModel *model);
+
+    std::unordered_map<fdb_kvs_id_t, SeqLeafModel *> models;
+    // Root BIDs of the seq B+trees whose models are to be rebuilt, or
+    // BLK_NOT_FOUND if the model is to be rebuilt from any B+tree
+    std::unordered_map<fdb_kvs_id_t, bid_t> staleRoots;
+    // Protects 'models' and 'staleRoots' from concurrent readers
+    fdb_rw_lock lock;
+    std::atomic<uint64_t> numBuilds;
+};
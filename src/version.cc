@@ -21,7 +21,8 @@
 bool ver_is_valid_magic(filemgr_magic_t magic)
 {
     if ( magic == FILEMGR_MAGIC_000 ||
-        (magic >= FILEMGR_MAGIC_001 && magic <= FILEMGR_LATEST_MAGIC)) {
+        (magic >= FILEMGR_MAGIC_001 && magic <= FILEMGR_LATEST_MAGIC) ||
+        ver_blob_support(magic)) {
         return true;
     }
     return false;
@@ -38,7 +39,8 @@ bool ver_is_magic_000(filemgr_magic_t magic)
 bool ver_is_atleast_magic_001(filemgr_magic_t magic)
 {
     // All magic numbers since FILEMGR_MAGIC_001
-    if (magic >= FILEMGR_MAGIC_001 && magic <= FILEMGR_LATEST_MAGIC) {
+    if ((magic >= FILEMGR_MAGIC_001 && magic <= FILEMGR_LATEST_MAGIC) ||
+        ver_blob_support(magic)) {
         return true;
     }
     return false;
@@ -47,7 +49,8 @@ bool ver_is_atleast_magic_001(filemgr_magic_t magic)
 bool ver_staletree_support(filemgr_magic_t magic)
 {
     // All magic numbers since FILEMGR_MAGIC_002
-    if (magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) {
+    if ((magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) ||
+        ver_blob_support(magic)) {
         return true;
     }
     return false;
@@ -56,7 +59,8 @@ bool ver_staletree_support(filemgr_magic_t magic)
 bool ver_non_consecutive_doc(filemgr_magic_t magic)
 {
     // All magic numbers since FILEMGR_MAGIC_002
-    if (magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) {
+    if ((magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) ||
+        ver_blob_support(magic)) {
         return true;
     }
     return false;
@@ -65,7 +69,8 @@ bool ver_non_consecutive_doc(filemgr_magic_t magic)
 bool ver_superblock_support(filemgr_magic_t magic)
 {
     // All magic numbers since FILEMGR_MAGIC_002
-    if (magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) {
+    if ((magic >= FILEMGR_MAGIC_002 && magic <= FILEMGR_LATEST_MAGIC) ||
+        ver_blob_support(magic)) {
         return true;
     }
     return false;
@@ -73,8 +78,32 @@ bool ver_superblock_support(filemgr_magic_t magic)
 
 bool ver_btreev2_format(filemgr_magic_t magic)
 {
-    // All magic numbers since FILEMGR_MAGIC_003
-    if (magic >= FILEMGR_MAGIC_003) {
+    // FILEMGR_MAGIC_004 is a variant of FILEMGR_MAGIC_002
+    if (magic == FILEMGR_MAGIC_003 || magic == FILEMGR_MAGIC_005) {
+        return true;
+    }
+    return false;
+}
+
+bool ver_bnode_prefix_support(filemgr_magic_t magic)
+{
+    if (magic == FILEMGR_MAGIC_005) {
+        return true;
+    }
+    return false;
+}
+
+bool ver_bnode_delta_support(filemgr_magic_t magic)
+{
+    if (magic == FILEMGR_MAGIC_005) {
+        return true;
+    }
+    return false;
+}
+
+bool ver_blob_support(filemgr_magic_t magic)
+{
+    if (magic == FILEMGR_MAGIC_004) {
         return true;
     }
     return false;
@@ -86,6 +115,8 @@ size_t ver_get_new_filename_off(filemgr_magic_t magic) {
         case FILEMGR_MAGIC_001: return 72;
         case FILEMGR_MAGIC_002: return 80;
         case FILEMGR_MAGIC_003: return 80;
+        case FILEMGR_MAGIC_004: return 80;
+        case FILEMGR_MAGIC_005: return 80;
     }
     return (size_t) -1;
 }
@@ -96,6 +127,8 @@ size_t ver_get_last_wal_flush_hdr_off(filemgr_magic_t magic) {
         case FILEMGR_MAGIC_001: return 48;
         case FILEMGR_MAGIC_002: return 56;
         case FILEMGR_MAGIC_003: return 56;
+        case FILEMGR_MAGIC_004: return 56;
+        case FILEMGR_MAGIC_005: return 56;
     }
     return (size_t) -1;
 }
@@ -110,6 +143,10 @@ const char* ver_get_version_string(filemgr_magic_t magic) {
         return "ForestDB v2.x format";
     case FILEMGR_MAGIC_003:
         return "ForestDB v3.x format";
+    case FILEMGR_MAGIC_004:
+        return "ForestDB v2.x format with blob files";
+    case FILEMGR_MAGIC_005:
+        return "ForestDB v3.x format with compressed index nodes";
     }
     return "unknown";
 }
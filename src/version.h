@@ -34,6 +34,21 @@ bool ver_staletree_support(filemgr_magic_t magic);
 bool ver_superblock_support(filemgr_magic_t magic);
 bool ver_non_consecutive_doc(filemgr_magic_t magic);
 bool ver_btreev2_format(filemgr_magic_t magic);
+/**
+ * Check if documents in a file of the given magic value can keep their
+ * bodies in blob files (i.e., DOCIO_BLOB).
+ */
+bool ver_blob_support(filemgr_magic_t magic);
+/**
+ * Check if index nodes in a file of the given magic value can be written
+ * without the common prefix of their keys (i.e., BNODE_FLAG_PREFIX_COMPRESSED).
+ */
+bool ver_bnode_prefix_support(filemgr_magic_t magic);
+/**
+ * Check if index nodes in a file of the given magic value can be written as
+ * delta records against their previous versions (i.e., BNODE_FLAG_DELTA).
+ */
+bool ver_bnode_delta_support(filemgr_magic_t magic);
 size_t ver_get_new_filename_off(filemgr_magic_t magic);
 
 /**
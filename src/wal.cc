@@ -178,6 +178,8 @@ INLINE int _wal_kvs_cmp(struct avl_node *a, struct avl_node *b, void *aux)
     return 0;
 }
 
+std::atomic<uint64_t> Wal::totalMemOverhead(0);
+
 Wal::Wal(FileMgr *_file, size_t nbucket)
     : file(_file)
 {
@@ -227,6 +229,7 @@ Wal::Wal(FileMgr *_file, size_t nbucket)
 Wal::~Wal()
 {
     size_t i = 0;
+    decMemOverhead(mem_overhead.load());
     // Free all WAL shards
     for (; i < num_shards; ++i) {
         hash_free(&key_shards[i]._map);
@@ -574,12 +577,54 @@ inline void Wal::_wal_update_stat(fdb_kvs_id_t kv_id,
     }
 }
 
+// Return the size of the secondary key copy of a WAL item.
+static inline size_t _wal_sindex_key_size(struct wal_item *item)
+{
+    if (!item->sindex_key) {
+        return 0;
+    }
+    uint16_t keylen;
+    memcpy(&keylen, item->sindex_key, sizeof(keylen));
+    return sizeof(keylen) + keylen;
+}
+
+// Return the memory taken by a WAL item.
+static inline size_t _wal_item_mem(struct wal_item *item)
+{
+    return sizeof(struct wal_item) + _wal_sindex_key_size(item);
+}
+
+// Free the secondary key copy that a WAL item holds.
+static inline void _wal_free_item_copies(struct wal_item *item)
+{
+    free(item->sindex_key);
+}
+
+// Replace the secondary key copy of a WAL item. Return the number of bytes
+// added (in two's complement) to the item's memory overhead.
+size_t Wal::_wal_set_sindex_key(struct wal_item *item,
+                                const std::string *sindex_key)
+{
+    size_t old_size = _wal_sindex_key_size(item);
+
+    free(item->sindex_key);
+    item->sindex_key = NULL;
+    if (sindex_key) {
+        uint16_t keylen = sindex_key->size();
+        item->sindex_key = (uint8_t *)malloc(sizeof(keylen) + keylen);
+        memcpy(item->sindex_key, &keylen, sizeof(keylen));
+        memcpy(item->sindex_key + sizeof(keylen), sindex_key->data(), keylen);
+    }
+    return _wal_sindex_key_size(item) - old_size;
+}
+
 inline fdb_status Wal::_insert_Wal(fdb_txn *txn,
                                    struct _fdb_key_cmp_info *cmp_info,
                                    fdb_doc *doc,
                                    uint64_t offset,
                                    wal_insert_by caller,
-                                   bool immediate_remove)
+                                   bool immediate_remove,
+                                   const std::string *sindex_key)
 {
     struct wal_item *item;
     struct wal_item_header query, *header;
@@ -698,6 +743,7 @@ inline fdb_status Wal::_insert_Wal(fdb_txn *txn,
                 item->doc_size = doc->size_ondisk;
                 item->offset = offset;
                 item->shandle = shandle;
+                incMemOverhead(_wal_set_sindex_key(item, sindex_key));
 
                 // move the item to the front of the list (header)
                 list_remove(&header->items, &item->list_elem);
@@ -785,8 +831,8 @@ inline fdb_status Wal::_insert_Wal(fdb_txn *txn,
             // also insert into transaction's list
             list_push_back(txn->items, &item->list_elem_txn);
             size++;
-            mem_overhead.fetch_add(sizeof(struct wal_item),
-                                   std::memory_order_relaxed);
+            incMemOverhead(sizeof(struct wal_item) +
+                           _wal_set_sindex_key(item, sindex_key));
         }
     } else {
         // not exist .. create new one
@@ -805,6 +851,7 @@ inline fdb_status Wal::_insert_Wal(fdb_txn *txn,
                        &header->le_key);
 
         item = (struct wal_item *)malloc(sizeof(struct wal_item));
+        item->sindex_key = NULL;
         // entries inserted by compactor is already committed
         if (caller == WAL_INS_COMPACT_PHASE1) {
             item->flag = WAL_ITEM_COMMITTED;
@@ -878,9 +925,9 @@ inline fdb_status Wal::_insert_Wal(fdb_txn *txn,
         }
 
         size++;
-        mem_overhead.fetch_add(
-            sizeof(struct wal_item) + sizeof(struct wal_item_header) + keylen,
-            std::memory_order_relaxed);
+        incMemOverhead(sizeof(struct wal_item) +
+                       sizeof(struct wal_item_header) + keylen +
+                       _wal_set_sindex_key(item, sindex_key));
     }
 
     if (caller == WAL_INS_WRITER) {
@@ -895,9 +942,10 @@ fdb_status Wal::insert_Wal(fdb_txn *txn,
                            struct _fdb_key_cmp_info *cmp_info,
                            fdb_doc *doc,
                            uint64_t offset,
-                           wal_insert_by caller)
+                           wal_insert_by caller,
+                           const std::string *sindex_key)
 {
-    return _insert_Wal(txn, cmp_info, doc, offset, caller, false);
+    return _insert_Wal(txn, cmp_info, doc, offset, caller, false, sindex_key);
 }
 
 fdb_status Wal::immediateRemove_Wal(fdb_txn *txn,
@@ -906,7 +954,7 @@ fdb_status Wal::immediateRemove_Wal(fdb_txn *txn,
                                     uint64_t offset,
                                     wal_insert_by caller)
 {
-    return _insert_Wal(txn, cmp_info, doc, offset, caller, true);
+    return _insert_Wal(txn, cmp_info, doc, offset, caller, true, NULL);
 }
 
 inline bool Wal::_wal_item_partially_committed(fdb_txn *global_txn,
@@ -1203,6 +1251,7 @@ inline void Wal::_wal_free_item(struct wal_item *item, bool gotlock) {
             spin_unlock(&lock);
         }
     }
+    _wal_free_item_copies(item);
 #ifdef __DEBUG_WAL
     memset(item, 0, sizeof(struct wal_item));
 #endif // __DEBUG_WAL
@@ -1280,14 +1329,15 @@ fdb_status Wal::migrateUncommittedTxns_Wal(void *dbhandle,
                         old_file->getWal()->datasize.fetch_sub(item->doc_size,
                                                           std::memory_order_relaxed);
                     }
+                    mem_overhead += _wal_item_mem(item);
                     // free item
+                    _wal_free_item_copies(item);
                     free(item);
                     // free doc
                     free(doc.key);
                     free(doc.meta);
                     free(doc.body);
                     old_file->getWal()->size--;
-                    mem_overhead += sizeof(struct wal_item);
                 } else {
                     e = list_prev(e);
                 }
@@ -1311,8 +1361,7 @@ fdb_status Wal::migrateUncommittedTxns_Wal(void *dbhandle,
         }
         spin_unlock(&old_file->getWal()->key_shards[i].lock);
     }
-    old_file->getWal()->mem_overhead.fetch_sub(mem_overhead,
-                                          std::memory_order_relaxed);
+    old_file->getWal()->decMemOverhead(mem_overhead);
 
     spin_lock(&old_file->getWal()->lock);
 
@@ -1390,8 +1439,7 @@ fdb_status Wal::commit_Wal(fdb_txn *txn, wal_commit_mark_func *func,
                             "a database file '%s'", item->offset,
                             file->getFileName());
                     spin_unlock(&key_shards[shard_num].lock);
-                    mem_overhead.fetch_sub(_mem_overhead,
-                                           std::memory_order_relaxed);
+                    decMemOverhead(_mem_overhead);
                     return status;
                 }
             }
@@ -1451,7 +1499,7 @@ fdb_status Wal::commit_Wal(fdb_txn *txn, wal_commit_mark_func *func,
                     }
                     // Un-index this item from its snapshot if needed..
                     _item->shandle->snapRemoveItem(_item);
-                    _mem_overhead += sizeof(struct wal_item);
+                    _mem_overhead += _wal_item_mem(_item);
                     _wal_free_item(_item, true);
                 } else {
                     fdb_log(log_callback, status,
@@ -1470,7 +1518,7 @@ fdb_status Wal::commit_Wal(fdb_txn *txn, wal_commit_mark_func *func,
         e1 = list_remove(txn->items, e1);
         spin_unlock(&key_shards[shard_num].lock);
     }
-    mem_overhead.fetch_sub(_mem_overhead, std::memory_order_relaxed);
+    decMemOverhead(_mem_overhead);
 
     LATENCY_STAT_END(file, FDB_LATENCY_WAL_COMMIT);
     return status;
@@ -1550,8 +1598,8 @@ list_elem *Wal::_releaseItems_Wal(size_t shard_num, struct wal_item *item)
     kv_id = item->shandle->id;
     le = list_prev(le);
     if (!_wal_snap_is_immutable(item->shandle)) {
+        _mem_overhead += _wal_item_mem(item);
         releaseItem_Wal(shard_num, kv_id, item);
-        _mem_overhead += sizeof(struct wal_item);
         item = NULL;
     } else {
         item->flag &= ~WAL_ITEM_FLUSH_READY;
@@ -1566,8 +1614,8 @@ list_elem *Wal::_releaseItems_Wal(size_t shard_num, struct wal_item *item)
         le = list_prev(le);
         sitem->flag |= WAL_ITEM_FLUSHED_OUT;
         if (!_wal_snap_is_immutable(sitem->shandle)) {
+            _mem_overhead += _wal_item_mem(sitem);
             releaseItem_Wal(shard_num, kv_id, sitem);
-            _mem_overhead += sizeof(struct wal_item);
         } else {
             item = sitem; // this is the latest and greatest item
             item->flag &= ~WAL_ITEM_FLUSH_READY;
@@ -1584,8 +1632,7 @@ list_elem *Wal::_releaseItems_Wal(size_t shard_num, struct wal_item *item)
         free(header);
         le = NULL;
     }
-    mem_overhead.fetch_sub(_mem_overhead + sizeof(struct wal_item),
-                           std::memory_order_relaxed);
+    decMemOverhead(_mem_overhead + sizeof(struct wal_item));
     return le;
 }
 
@@ -2222,6 +2269,7 @@ inline void Snapshot::snapFreeItems() {
         avl_remove(&key_tree, &item->avl_keysnap);
         free(item->header->key);
         free(item->header);
+        _wal_free_item_copies(item);
         free(item);
     }
 }
@@ -3006,12 +3054,13 @@ fdb_status Wal::discardTxnEntries_Wal(fdb_txn *txn)
         }
 
         // free
+        _mem_overhead += _wal_item_mem(item);
+        _wal_free_item_copies(item);
         free(item);
         size--;
-        _mem_overhead += sizeof(struct wal_item);
         spin_unlock(&key_shards[shard_num].lock);
     }
-    mem_overhead.fetch_sub(_mem_overhead, std::memory_order_relaxed);
+    decMemOverhead(_mem_overhead);
 
     return FDB_RESULT_SUCCESS;
 }
@@ -3143,9 +3192,10 @@ fdb_status Wal::_close_Wal(wal_discard_t type, void *aux,
                         }
                         num_flushable--;
                     }
+                    _mem_overhead += _wal_item_mem(item);
+                    _wal_free_item_copies(item);
                     free(item);
                     size--;
-                    _mem_overhead += sizeof(struct wal_item);
                 } else {
                     e = list_next(e);
                 }
@@ -3166,7 +3216,7 @@ fdb_status Wal::_close_Wal(wal_discard_t type, void *aux,
         }
         spin_unlock(&key_shards[i].lock);
     }
-    mem_overhead.fetch_sub(_mem_overhead, std::memory_order_relaxed);
+    decMemOverhead(_mem_overhead);
 
     return FDB_RESULT_SUCCESS;
 }
@@ -3183,7 +3233,7 @@ fdb_status Wal::shutdown_Wal(ErrLogCallback *log_callback)
     size = 0;
     num_flushable = 0;
     datasize = 0;
-    mem_overhead = 0;
+    decMemOverhead(mem_overhead.load());
     isPopulated = false;
     unFlushedTransactions = false;
     return wr;
@@ -3229,6 +3279,23 @@ size_t Wal::getMemOverhead_Wal(void)
     return mem_overhead.load(std::memory_order_relaxed);
 }
 
+uint64_t Wal::getTotalMemOverhead_Wal(void)
+{
+    return totalMemOverhead.load(std::memory_order_relaxed);
+}
+
+void Wal::incMemOverhead(uint64_t bytes)
+{
+    mem_overhead.fetch_add(bytes, std::memory_order_relaxed);
+    totalMemOverhead.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Wal::decMemOverhead(uint64_t bytes)
+{
+    mem_overhead.fetch_sub(bytes, std::memory_order_relaxed);
+    totalMemOverhead.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
 void Wal::setDirtyStatus_Wal(wal_dirty_t status,
                              bool set_on_non_pending)
 {
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <string>
 #include "internal_types.h"
 #include "hash.h"
 #include "list.h"
@@ -259,6 +260,10 @@ struct wal_item{
     uint64_t offset;
     fdb_seqnum_t seqnum;
     uint64_t old_offset;
+    // Secondary key of the document extracted by the writer, laid out as
+    // [keylen (2 bytes)][key] (keylen is zero if the document is not indexed),
+    // or NULL if it has not been extracted
+    uint8_t *sindex_key;
     union { // for offset-based sorting for WAL flush
         struct list_elem list_elem_txn; // for transaction
         struct avl_node avl_flush;
@@ -324,12 +329,17 @@ public:
 
     /**
      * Index a mutation into the Write Ahead Log
+     *
+     * @param sindex_key Secondary key of the document (if its KV store has
+     *        a secondary index), whose length is zero if the document is not
+     *        indexed, or NULL if it has not been extracted.
      */
     fdb_status insert_Wal(fdb_txn *txn,
                           struct _fdb_key_cmp_info *cmp_info,
                           fdb_doc *doc,
                           uint64_t offset,
-                          wal_insert_by caller);
+                          wal_insert_by caller,
+                          const std::string *sindex_key = NULL);
 
     /**
      * Insert a deleted item with action WAL_ACT_REMOVE
@@ -526,6 +536,10 @@ public:
     size_t getNumDeletes_Wal(void);
     size_t getDataSize_Wal(void);
     size_t getMemOverhead_Wal(void);
+    /**
+     * Return the memory overhead of the WAL entries of all the open files.
+     */
+    static uint64_t getTotalMemOverhead_Wal(void);
     bool tryRestore_Wal() {
         bool inverse = false;
         return isPopulated.compare_exchange_strong(inverse, true);
@@ -537,7 +551,8 @@ private:
                            fdb_doc *doc,
                            uint64_t offset,
                            wal_insert_by caller,
-                           bool immediate_remove);
+                           bool immediate_remove,
+                           const std::string *sindex_key);
     fdb_status _find_Wal(fdb_txn *txn,
                          fdb_kvs_id_t kv_id,
                          struct _fdb_key_cmp_info *cmp_info,
@@ -595,6 +610,8 @@ private:
                                         Snapshot *shandle);
 
     void _wal_free_item(struct wal_item *item, bool gotlock);
+    size_t _wal_set_sindex_key(struct wal_item *item,
+                               const std::string *sindex_key);
     /*
      * Given a key, return the version of the key which was valid at the
      * time of the given snapshot creation
@@ -602,6 +619,10 @@ private:
     static wal_item *getSnapItemHdr_Wal(struct wal_item_header *header,
                                         Snapshot *shandle);
 
+    // Update the memory overhead of this WAL and of all the WALs
+    void incMemOverhead(uint64_t bytes);
+    void decMemOverhead(uint64_t bytes);
+
     bool _wal_are_items_sorted(union wal_flush_items *flush_items);
     fdb_status _wal_do_flush(struct wal_item *item,
                              wal_flush_func *flush_func,
@@ -614,6 +635,8 @@ private:
     std::atomic<uint32_t> num_flushable; // # flushable entries in WAL (uint32_t)
     std::atomic<uint64_t> datasize; // total data size in WAL (uint64_t)
     std::atomic<uint64_t> mem_overhead; // memory overhead of all WAL entries
+    // memory overhead of all WAL entries across all the files
+    static std::atomic<uint64_t> totalMemOverhead;
     struct list txn_list; // list of active transactions
     wal_dirty_t wal_dirty;
     // Are there uncommitted or, committed but not flushed, Transactions..
@@ -3687,6 +3687,295 @@ void compact_upto_last_wal_flush_bid_check()
     TEST_RESULT("compact upto last WAL flush bid check test");
 }
 
+void compact_blob_files_test()
+{
+    TEST_INIT();
+    int i, r;
+    int n = 40;
+    size_t bodylen = 65536;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+    fdb_file_info info;
+    fdb_doc *rdoc;
+    fdb_status s;
+    char keybuf[256];
+    char *bodybuf = (char *)malloc(bodylen);
+
+    memleak_start();
+
+    // remove previous compact_test files
+    r = system(SHELL_DEL " compact_test* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    fconfig.buffercache_size = 0;
+    fconfig.compaction_threshold = 0;
+    fconfig.blob_threshold = 4096;
+    fconfig.blob_gc_threshold = 30;
+    kvs_config = fdb_get_default_kvs_config();
+
+    s = fdb_open(&dbfile, "./compact_test1", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // large bodies should go to the blob file
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%04d", i);
+        memset(bodybuf, 'a' + (i % 26), bodylen);
+        s = fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, bodylen);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    TEST_CHK(does_file_exist("./compact_test1.1.blob"));
+    s = fdb_get_file_info(dbfile, &info);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.file_size < n * bodylen / 4);
+
+    // overwrite half of the docs, so that the blob file of compact_test1
+    // exceeds the blob GC threshold
+    for (i=0;i<n;i+=2){
+        sprintf(keybuf, "key%04d", i);
+        memset(bodybuf, 'A' + (i % 26), bodylen);
+        s = fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, bodylen);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // the stats of the blob file should survive the restart
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_open(&dbfile, "./compact_test1", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // the live bodies are relocated into a new blob file of compact_test2
+    s = fdb_compact(dbfile, "./compact_test2");
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+#if !defined(WIN32) && !defined(_WIN32)
+#ifndef _MSC_VER
+    TEST_CHK(!does_file_exist("./compact_test1.1.blob"));
+#endif
+#endif
+    TEST_CHK(does_file_exist("./compact_test2.2.blob"));
+
+    // the blob file of compact_test2 is fully live, so it should be kept
+    s = fdb_compact(dbfile, "./compact_test3");
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    TEST_CHK(does_file_exist("./compact_test2.2.blob"));
+    TEST_CHK(!does_file_exist("./compact_test3.3.blob"));
+
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // reopen and verify the bodies
+    s = fdb_open(&dbfile, "./compact_test3", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%04d", i);
+        memset(bodybuf, ((i % 2) ? 'a' : 'A') + (i % 26), bodylen);
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        s = fdb_get(db, rdoc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        TEST_CHK(rdoc->bodylen == bodylen);
+        TEST_CMP(rdoc->body, bodybuf, bodylen);
+        fdb_doc_free(rdoc);
+    }
+
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_shutdown();
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    free(bodybuf);
+
+    memleak_end();
+    TEST_RESULT("compact blob files test");
+}
+
+static fdb_compact_decision cb_blob_cancel(fdb_file_handle *fhandle,
+                                           fdb_compaction_status status,
+                                           const char *kv_name,
+                                           fdb_doc *doc, uint64_t old_offset,
+                                           uint64_t new_offset, void *ctx)
+{
+    (void) kv_name;
+    (void) doc;
+    (void) old_offset;
+    (void) new_offset;
+
+    if (status == FDB_CS_FLUSH_WAL && *(bool *)ctx) {
+        // cancel the compaction once some docs have been moved
+        fhandle->getRootHandle()->file->setCancelCompaction(true);
+    }
+    return FDB_CS_KEEP_DOC;
+}
+
+void compact_blob_files_in_place_cancel_test()
+{
+    TEST_INIT();
+    int i, j, r;
+    int n = 500;
+    size_t bodylen = 8192;
+    bool cancel = false;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+    fdb_status s;
+    char keybuf[256];
+    char *bodybuf = (char *)malloc(bodylen);
+    void *value;
+    size_t valuelen;
+
+    memleak_start();
+
+    // remove previous compact_test files
+    r = system(SHELL_DEL " compact_test* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    fconfig.buffercache_size = 0;
+    fconfig.compaction_threshold = 0;
+    fconfig.blob_threshold = 4096;
+    fconfig.blob_gc_threshold = 30;
+    fconfig.compaction_cb = cb_blob_cancel;
+    fconfig.compaction_cb_ctx = &cancel;
+    fconfig.compaction_cb_mask = FDB_CS_FLUSH_WAL;
+    kvs_config = fdb_get_default_kvs_config();
+
+    s = fdb_open(&dbfile, "./compact_test", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // write the docs and overwrite all of them, so that the in-place
+    // compaction relocates the live bodies into a blob file of the file
+    // named 'compact_test.1'
+    for (j=0;j<2;++j){
+        for (i=0;i<n;++i){
+            sprintf(keybuf, "key%04d", i);
+            memset(bodybuf, 'a' + ((i + j) % 26), bodylen);
+            s = fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, bodylen);
+            TEST_CHK(s == FDB_RESULT_SUCCESS);
+        }
+        s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    s = fdb_compact(dbfile, NULL);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // overwrite the docs again, and cancel the next in-place compaction,
+    // which creates another file named 'compact_test.1'
+    s = fdb_open(&dbfile, "./compact_test", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (i=0;i<n;i+=2){
+        sprintf(keybuf, "key%04d", i);
+        memset(bodybuf, 'A' + (i % 26), bodylen);
+        s = fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, bodylen);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    cancel = true;
+    s = fdb_compact(dbfile, NULL);
+    TEST_CHK(s == FDB_RESULT_COMPACTION_CANCELLATION);
+    cancel = false;
+    dbfile->getRootHandle()->file->setCancelCompaction(false);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // all bodies should still be readable after the restart
+    s = fdb_open(&dbfile, "./compact_test", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%04d", i);
+        if (i % 2) {
+            memset(bodybuf, 'a' + ((i + 1) % 26), bodylen);
+        } else {
+            memset(bodybuf, 'A' + (i % 26), bodylen);
+        }
+        s = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        TEST_CHK(valuelen == bodylen);
+        TEST_CMP(value, bodybuf, bodylen);
+        fdb_free_block(value);
+    }
+
+    // the compaction retried after the cancellation should succeed too
+    s = fdb_compact(dbfile, NULL);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%04d", i);
+        s = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        TEST_CHK(valuelen == bodylen);
+        fdb_free_block(value);
+    }
+
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // the blob files of the in-place compacted files are named after
+    // 'compact_test', while the ones of 'compact_test.7' are not
+    fconfig.compaction_cb = NULL;
+    s = fdb_open(&dbfile, "./compact_test.7", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    memset(bodybuf, 'x', bodylen);
+    s = fdb_set_kv(db, "key", 3, bodybuf, bodylen);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    TEST_CHK(does_file_exist("./compact_test.7.1.blob"));
+
+    s = fdb_destroy("./compact_test", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (i=1;i<=8;++i){
+        sprintf(keybuf, "./compact_test.%d.blob", i);
+        TEST_CHK(!does_file_exist(keybuf));
+        sprintf(keybuf, "./compact_test.1.%d.blob", i);
+        TEST_CHK(!does_file_exist(keybuf));
+    }
+
+    // destroying 'compact_test' should leave the bodies of 'compact_test.7'
+    s = fdb_open(&dbfile, "./compact_test.7", &fconfig);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_get_kv(db, "key", 3, &value, &valuelen);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    TEST_CHK(valuelen == bodylen);
+    TEST_CMP(value, bodybuf, bodylen);
+    fdb_free_block(value);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    s = fdb_shutdown();
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    free(bodybuf);
+
+    memleak_end();
+    TEST_RESULT("compact blob files in-place cancel test");
+}
+
 int main(){
     int i;
 
@@ -3695,6 +3984,8 @@ int main(){
     compact_upto_test(false); // single kv instance in file
     compact_upto_test(true); // multiple kv instance in file
     compact_upto_last_wal_flush_bid_check();
+    compact_blob_files_test();
+    compact_blob_files_in_place_cancel_test();
     wal_delete_compact_upto_test();
     compact_upto_with_circular_reuse_test();
     for (i=0;i<4;++i) {
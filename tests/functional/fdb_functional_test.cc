@@ -23,6 +23,7 @@
 #include <time.h>
 #if !defined(WIN32) && !defined(_WIN32)
 #include <unistd.h>
+#include <sys/stat.h>
 #endif
 
 #include <string>
@@ -1496,6 +1497,288 @@ void db_destroy_test()
     TEST_RESULT("Database destroy test");
 }
 
+#if !defined(WIN32) && !defined(_WIN32)
+static bool does_file_exist(const char *filename) {
+    struct stat st;
+    int result = stat(filename, &st);
+    return result == 0;
+}
+#else
+static bool does_file_exist(const char *filename) {
+    return GetFileAttributes(filename) != INVALID_FILE_ATTRIBUTES;
+}
+#endif
+
+void cache_warmup_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 3000;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_doc *rdoc = NULL;
+    fdb_status status;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+    size_t used_before_close, used_after_warmup = 0;
+
+    char keybuf[256], bodybuf[256];
+
+    // remove previous func_test files
+    r = system(SHELL_DEL " func_test* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 16777216;
+    fconfig.wal_threshold = 1024;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.prefetch_duration = 10;
+
+    fdb_open(&dbfile, "./func_test1", &fconfig);
+    fdb_kvs_open(dbfile, &db, NULL, &kvs_config);
+    status = fdb_set_log_callback(db, logCallbackFunc,
+                                  (void *) "cache_warmup_test");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+
+    used_before_close = fdb_get_buffer_cache_used();
+    TEST_CHK(used_before_close > 0);
+
+    // the hot block list should be persisted on close
+    fdb_close(dbfile);
+    TEST_CHK(does_file_exist("./func_test1.warmup"));
+    TEST_CHK(!does_file_exist("./func_test1.warmup.tmp"));
+
+    // reopen the file; the prefetch thread should consume the list and
+    // load the blocks back into the cache
+    fdb_open(&dbfile, "./func_test1", &fconfig);
+    fdb_kvs_open(dbfile, &db, NULL, &kvs_config);
+    status = fdb_set_log_callback(db, logCallbackFunc,
+                                  (void *) "cache_warmup_test");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    for (i=0;i<100;++i) {
+        used_after_warmup = fdb_get_buffer_cache_used();
+        if (used_after_warmup >= used_before_close) {
+            break;
+        }
+        usleep(100000);
+    }
+    TEST_CHK(used_after_warmup >= used_before_close);
+    TEST_CHK(!does_file_exist("./func_test1.warmup"));
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+    }
+    fdb_close(dbfile);
+    TEST_CHK(does_file_exist("./func_test1.warmup"));
+
+    // destroying the file should remove the list as well
+    status = fdb_destroy("./func_test1", &fconfig);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(!does_file_exist("./func_test1.warmup"));
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("cache warmup test");
+}
+
+void cache_resize_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 3000;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_doc *rdoc = NULL;
+    fdb_status status;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+
+    char keybuf[256], bodybuf[256];
+
+    // remove previous func_test files
+    r = system(SHELL_DEL " func_test* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 16777216;
+    fconfig.wal_threshold = 1024;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+
+    // the engine is not initialized yet
+    status = fdb_set_cache_size(1048576);
+    TEST_CHK(status == FDB_RESULT_ENGINE_NOT_INSTANTIATED);
+
+    fdb_open(&dbfile, "./func_test1", &fconfig);
+    fdb_kvs_open(dbfile, &db, NULL, &kvs_config);
+    status = fdb_set_log_callback(db, logCallbackFunc,
+                                  (void *) "cache_resize_test");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(fdb_get_buffer_cache_used() > 65536);
+
+    // shrink the cache while the file is open
+    status = fdb_set_cache_size(65536);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(fdb_get_buffer_cache_used() <= 65536);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+    }
+    TEST_CHK(fdb_get_buffer_cache_used() <= 65536);
+
+    // grow it back
+    status = fdb_set_cache_size(16777216);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    status = fdb_set_cache_size(0);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("cache resize test");
+}
+
+void memory_budget_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 20000;
+    uint64_t budget = 4194304;
+    uint64_t prev_wal = 0;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_status status;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+    fdb_memory_usage usage;
+    bool cache_shrunk = false, wal_reclaimed = false;
+
+    char keybuf[256], bodybuf[256];
+
+    // remove previous func_test files
+    r = system(SHELL_DEL " func_test* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 16777216;
+    fconfig.memory_budget = budget;
+    fconfig.wal_threshold = 65536;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+
+    status = fdb_get_memory_usage(&usage);
+    TEST_CHK(status == FDB_RESULT_ENGINE_NOT_INSTANTIATED);
+
+    fdb_open(&dbfile, "./func_test1", &fconfig);
+    fdb_kvs_open(dbfile, &db, NULL, &kvs_config);
+    status = fdb_set_log_callback(db, logCallbackFunc,
+                                  (void *) "memory_budget_test");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    // the buffer cache is capped by the budget from the beginning
+    status = fdb_get_memory_usage(&usage);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(usage.budget == budget);
+    TEST_CHK(usage.block_cache_capacity <= budget);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        if ((i+1) % 1000 == 0) {
+            fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+            fdb_get_memory_usage(&usage);
+            // the WAL indexes keep growing as wal_threshold is not reached,
+            // so the buffer cache should give up memory for them
+            TEST_CHK(usage.total <= budget);
+            TEST_CHK(usage.total == usage.block_cache_capacity +
+                                    usage.compressed_cache +
+                                    usage.bnode_cache + usage.wal +
+                                    usage.secondary_index);
+            if (usage.wal > 0 && usage.block_cache_capacity < budget) {
+                cache_shrunk = true;
+            }
+            // once the cache can't shrink further, the WAL is flushed
+            if (usage.wal < prev_wal) {
+                wal_reclaimed = true;
+            }
+            prev_wal = usage.wal;
+        }
+    }
+    TEST_CHK(cache_shrunk);
+    TEST_CHK(wal_reclaimed);
+
+    // the cache grows back once the WAL is flushed
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    fdb_get_memory_usage(&usage);
+    TEST_CHK(usage.wal == 0);
+    TEST_CHK(usage.block_cache_capacity == budget);
+
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("memory budget test");
+}
+
 // Test for MB-16348
 void db_destroy_test_full_path()
 {
@@ -5562,6 +5845,9 @@ int main() {
     db_destroy_test_full_path(); // only for non-windows
 #endif
 #endif
+    cache_warmup_test();
+    cache_resize_test();
+    memory_budget_test();
     doc_compression_test();
     read_doc_by_offset_test();
     api_wrapper_test();
@@ -4271,6 +4271,373 @@ void iterator_seek_to_min_key_with_deletes_test() {
 
     TEST_RESULT("iterator seek to max test");
 }
+static size_t _sindex_body_extractor(fdb_doc *doc, void *skey_buf,
+                                     size_t skey_buf_size, void *ctx)
+{
+    (void)ctx;
+    // index documents by their bodies, except for empty ones
+    if (doc->bodylen == 0 || doc->bodylen > skey_buf_size) {
+        return 0;
+    }
+    memcpy(skey_buf, doc->body, doc->bodylen);
+    return doc->bodylen;
+}
+
+static int _sindex_scan(fdb_kvs_handle *db, const char *min_skey,
+                        const char *max_skey, char keys[][16])
+{
+    fdb_secondary_iterator *sit;
+    fdb_doc *rdoc = NULL;
+    fdb_status s;
+    int n = 0;
+
+    s = fdb_secondary_iterator_init(db, &sit,
+                                    min_skey, min_skey ? strlen(min_skey) : 0,
+                                    max_skey, max_skey ? strlen(max_skey) : 0);
+    if (s != FDB_RESULT_SUCCESS) {
+        return -1;
+    }
+    do {
+        s = fdb_secondary_iterator_get(sit, &rdoc);
+        if (s != FDB_RESULT_SUCCESS) {
+            break;
+        }
+        memcpy(keys[n], rdoc->key, rdoc->keylen);
+        keys[n][rdoc->keylen] = 0;
+        n++;
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+    } while (fdb_secondary_iterator_next(sit) == FDB_RESULT_SUCCESS);
+    fdb_secondary_iterator_close(sit);
+    return n;
+}
+
+void secondary_index_test()
+{
+    TEST_INIT();
+    memleak_start();
+
+    int i, n, r;
+    char keybuf[16], bodybuf[16];
+    char keys[16][16];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db, *db2, *snap;
+    fdb_secondary_iterator *sit;
+    fdb_seqnum_t seqnum;
+    fdb_memory_usage usage;
+    fdb_status status;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.wal_flush_before_commit = false;
+
+    r = system(SHELL_DEL" iterator_test* > errorlog.txt");
+    (void)r;
+
+    status = fdb_open(&dbfile, "./iterator_test1", &fconfig);
+    TEST_STATUS(status);
+    status = fdb_kvs_open(dbfile, &db, "kv1", &kvs_config);
+    TEST_STATUS(status);
+
+    // no index has been registered yet
+    status = fdb_secondary_iterator_init(db, &sit, NULL, 0, NULL, 0);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    // key%d -> color: key0 (blue), key1 (green), key2 (red), key3 (blue) ...
+    const char *colors[] = {"blue", "green", "red"};
+    for (i = 0; i < 9; ++i) {
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "%s", colors[i % 3]);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        TEST_STATUS(status);
+    }
+    // not indexed
+    status = fdb_set_kv(db, "key9", 4, NULL, 0);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+
+    // not flushed from the WAL yet
+    status = fdb_set_kv(db, "key5", 4, "green", 5);
+    TEST_STATUS(status);
+
+    // the index is built from the existing documents, which have been
+    // flushed from the WAL
+    status = fdb_register_secondary_index(db, _sindex_body_extractor, NULL);
+    TEST_STATUS(status);
+
+    n = _sindex_scan(db, NULL, NULL, keys);
+    TEST_CHK(n == 9);
+    TEST_CMP(keys[0], "key0", 4);
+    TEST_CMP(keys[2], "key6", 4);
+    TEST_CMP(keys[3], "key1", 4);
+    TEST_CMP(keys[8], "key8", 4);
+
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 3);
+    TEST_CMP(keys[0], "key1", 4);
+    TEST_CMP(keys[1], "key4", 4);
+    TEST_CMP(keys[2], "key7", 4);
+
+    n = _sindex_scan(db, "c", "h", keys);
+    TEST_CHK(n == 3);
+
+    status = fdb_set_kv(db, "key5", 4, "red", 3);
+    TEST_STATUS(status);
+
+    // update and delete, which are reflected once flushed from the WAL
+    status = fdb_set_kv(db, "key1", 4, "red", 3);
+    TEST_STATUS(status);
+    status = fdb_set_kv(db, "key9", 4, "green", 5);
+    TEST_STATUS(status);
+    status = fdb_del_kv(db, "key4", 4);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 2);
+    TEST_CMP(keys[0], "key7", 4);
+    TEST_CMP(keys[1], "key9", 4);
+    n = _sindex_scan(db, "red", NULL, keys);
+    TEST_CHK(n == 4);
+    TEST_CMP(keys[0], "key1", 4);
+
+    // the index is accounted in the memory usage
+    status = fdb_get_memory_usage(&usage);
+    TEST_STATUS(status);
+    TEST_CHK(usage.secondary_index > 0);
+
+    // a snapshot is not affected by the later updates
+    status = fdb_get_kvs_seqnum(db, &seqnum);
+    TEST_STATUS(status);
+    status = fdb_snapshot_open(db, &snap, seqnum);
+    TEST_STATUS(status);
+    status = fdb_set_kv(db, "key3", 4, "green", 5);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 3);
+    TEST_CMP(keys[0], "key3", 4);
+    n = _sindex_scan(snap, "green", "green", keys);
+    TEST_CHK(n == 2);
+    TEST_CMP(keys[0], "key7", 4);
+    TEST_CMP(keys[1], "key9", 4);
+    n = _sindex_scan(snap, "blue", "blue", keys);
+    TEST_CHK(n == 3);
+    TEST_CMP(keys[1], "key3", 4);
+    status = fdb_kvs_close(snap);
+    TEST_STATUS(status);
+    status = fdb_set_kv(db, "key3", 4, "blue", 4);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+
+    // the index is rebuilt after a rollback
+    status = fdb_get_kvs_seqnum(db, &seqnum);
+    TEST_STATUS(status);
+    status = fdb_set_kv(db, "key7", 4, "red", 3);
+    TEST_STATUS(status);
+    status = fdb_del_kv(db, "key9", 4);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 0);
+    status = fdb_rollback(&db, seqnum);
+    TEST_STATUS(status);
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 2);
+    TEST_CMP(keys[0], "key7", 4);
+    TEST_CMP(keys[1], "key9", 4);
+
+    // the index is moved into the new file by compaction
+    status = fdb_compact(dbfile, "./iterator_test2");
+    TEST_STATUS(status);
+    n = _sindex_scan(db, NULL, NULL, keys);
+    TEST_CHK(n == 9);
+    n = _sindex_scan(db, "green", "green", keys);
+    TEST_CHK(n == 2);
+
+    status = fdb_close(dbfile);
+    TEST_STATUS(status);
+
+    // the index should be registered again after reopening the file
+    status = fdb_open(&dbfile, "./iterator_test2", &fconfig);
+    TEST_STATUS(status);
+    status = fdb_kvs_open(dbfile, &db, "kv1", &kvs_config);
+    TEST_STATUS(status);
+    status = fdb_secondary_iterator_init(db, &sit, NULL, 0, NULL, 0);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+    status = fdb_register_secondary_index(db, _sindex_body_extractor, NULL);
+    TEST_STATUS(status);
+    n = _sindex_scan(db, "blue", "blue", keys);
+    TEST_CHK(n == 3);
+    TEST_CMP(keys[0], "key0", 4);
+    TEST_CMP(keys[1], "key3", 4);
+    TEST_CMP(keys[2], "key6", 4);
+
+    // the index is dropped along with its KV store
+    status = fdb_kvs_open(dbfile, &db2, "kv2", &kvs_config);
+    TEST_STATUS(status);
+    status = fdb_register_secondary_index(db2, _sindex_body_extractor, NULL);
+    TEST_STATUS(status);
+    status = fdb_set_kv(db2, "key0", 4, "blue", 4);
+    TEST_STATUS(status);
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+    n = _sindex_scan(db2, NULL, NULL, keys);
+    TEST_CHK(n == 1);
+    status = fdb_kvs_close(db2);
+    TEST_STATUS(status);
+    status = fdb_kvs_remove(dbfile, "kv2");
+    TEST_STATUS(status);
+    status = fdb_kvs_open(dbfile, &db2, "kv2", &kvs_config);
+    TEST_STATUS(status);
+    status = fdb_secondary_iterator_init(db2, &sit, NULL, 0, NULL, 0);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    status = fdb_close(dbfile);
+    TEST_STATUS(status);
+    status = fdb_shutdown();
+    TEST_STATUS(status);
+
+    memleak_end();
+
+    TEST_RESULT("secondary index test");
+}
+
+static int _range_leaf_cmp(void *key1, size_t keylen1,
+                           void *key2, size_t keylen2)
+{
+    // lexicographical order, through the custom compare mode of HB+trie
+    int cmp = memcmp(key1, key2, MIN(keylen1, keylen2));
+    if (cmp == 0) {
+        return (int)keylen1 - (int)keylen2;
+    }
+    return cmp;
+}
+
+// return 0 if the keys in the given range are returned in order, where
+// every 10th key has been deleted
+static int _range_scan(fdb_kvs_handle *db, int min, int max,
+                       fdb_iterator_opt_t opt, bool reverse)
+{
+    int i, step = reverse ? -1 : 1;
+    char minkey[32], maxkey[32], keybuf[32];
+    fdb_iterator *it;
+    fdb_doc *rdoc = NULL;
+    fdb_status s;
+
+    sprintf(minkey, "range_leaf_key%06d", min);
+    sprintf(maxkey, "range_leaf_key%06d", max);
+    s = fdb_iterator_init(db, &it, minkey, strlen(minkey),
+                          maxkey, strlen(maxkey), opt | FDB_ITR_NO_DELETES);
+    if (s != FDB_RESULT_SUCCESS) {
+        return -1;
+    }
+    if (reverse) {
+        fdb_iterator_seek_to_max(it);
+    }
+
+    for (i = reverse ? max : min; i >= min && i <= max; i += step) {
+        if (i % 10 == 0 || (i == min && (opt & FDB_ITR_SKIP_MIN_KEY)) ||
+            (i == max && (opt & FDB_ITR_SKIP_MAX_KEY))) {
+            continue;
+        }
+        s = fdb_iterator_get(it, &rdoc);
+        if (s != FDB_RESULT_SUCCESS) {
+            break;
+        }
+        sprintf(keybuf, "range_leaf_key%06d", i);
+        if (rdoc->keylen != strlen(keybuf) ||
+            memcmp(rdoc->key, keybuf, rdoc->keylen)) {
+            fdb_doc_free(rdoc);
+            break;
+        }
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+        s = reverse ? fdb_iterator_prev(it) : fdb_iterator_next(it);
+        if (s != FDB_RESULT_SUCCESS) {
+            i += step;
+            break;
+        }
+    }
+    fdb_iterator_close(it);
+
+    // the iterator should reach the end right after the last key in range
+    for (; i >= min && i <= max; i += step) {
+        if (i % 10 == 0 || (i == min && (opt & FDB_ITR_SKIP_MIN_KEY)) ||
+            (i == max && (opt & FDB_ITR_SKIP_MAX_KEY))) {
+            continue;
+        }
+        return -1;
+    }
+    return (s == FDB_RESULT_ITERATOR_FAIL) ? 0 : -1;
+}
+
+void iterator_range_leaf_test()
+{
+    TEST_INIT();
+    memleak_start();
+
+    int i, r;
+    int n = 3000;
+    char keybuf[32];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_status status;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.wal_threshold = 1024;
+    fconfig.buffercache_size = 0;
+    kvs_config.custom_cmp = _range_leaf_cmp;
+
+    r = system(SHELL_DEL" iterator_test* > errorlog.txt");
+    (void)r;
+
+    status = fdb_open(&dbfile, "./iterator_test1", &fconfig);
+    TEST_STATUS(status);
+    status = fdb_kvs_open(dbfile, &db, "kv1", &kvs_config);
+    TEST_STATUS(status);
+
+    // keys span many leaf nodes of a leaf B+tree (i.e., custom compare mode)
+    for (i = 0; i < n; ++i) {
+        sprintf(keybuf, "range_leaf_key%06d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf), NULL, 0);
+        TEST_STATUS(status);
+    }
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_STATUS(status);
+    // deletes are partially kept in the WAL
+    for (i = 0; i < n; i += 10) {
+        sprintf(keybuf, "range_leaf_key%06d", i);
+        status = fdb_del_kv(db, keybuf, strlen(keybuf));
+        TEST_STATUS(status);
+    }
+
+    // a range covering the entire leaf nodes in the middle, and ranges
+    // that start or end in the middle of a leaf node
+    TEST_CHK(_range_scan(db, 1, n - 1, FDB_ITR_NONE, false) == 0);
+    TEST_CHK(_range_scan(db, 1, n - 1, FDB_ITR_NONE, true) == 0);
+    TEST_CHK(_range_scan(db, 123, 2345, FDB_ITR_NONE, false) == 0);
+    TEST_CHK(_range_scan(db, 123, 2345, FDB_ITR_NONE, true) == 0);
+    TEST_CHK(_range_scan(db, 777, 1999, FDB_ITR_SKIP_MIN_KEY |
+                                        FDB_ITR_SKIP_MAX_KEY, false) == 0);
+    TEST_CHK(_range_scan(db, 555, 556, FDB_ITR_NONE, false) == 0);
+
+    status = fdb_close(dbfile);
+    TEST_STATUS(status);
+    status = fdb_shutdown();
+    TEST_STATUS(status);
+
+    memleak_end();
+
+    TEST_RESULT("iterator range across leaf nodes test");
+}
+
 int main(){
     iterator_test();
     iterator_with_concurrent_updates_test();
@@ -4306,5 +4673,7 @@ int main(){
     iterator_init_using_substring_test();
     iterator_seek_to_max_key_with_deletes_test();
     iterator_seek_to_min_key_with_deletes_test();
+    secondary_index_test();
+    iterator_range_leaf_test();
     return 0;
 }
@@ -2334,6 +2334,309 @@ void multi_kv_use_existing_mode_test()
     TEST_RESULT("multiple KV instances use existing mode test");
 }
 
+static void _multi_kv_bloom_filter_check(fdb_kvs_handle **db, int n, int ndels)
+{
+    TEST_INIT();
+
+    int i, j;
+    char key[256], value[256];
+    fdb_doc *doc;
+    fdb_status s;
+
+    for (i=0;i<n;++i) {
+        sprintf(key, "key%06d", i);
+        for (j=0;j<2;++j) {
+            fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, NULL, 0);
+            s = fdb_get(db[j], doc);
+            if (i % 2 != j || (j == 0 && i < ndels)) {
+                // keys of the other KV store and deleted keys
+                TEST_CHK(s == FDB_RESULT_KEY_NOT_FOUND);
+            } else {
+                TEST_CHK(s == FDB_RESULT_SUCCESS);
+                sprintf(value, "value%08d(%d)", i, j);
+                TEST_CMP(value, doc->body, doc->bodylen);
+            }
+            fdb_doc_free(doc);
+        }
+    }
+
+    // keys that have never been inserted
+    for (i=n;i<n*2;++i) {
+        sprintf(key, "key%06d", i);
+        for (j=0;j<2;++j) {
+            fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, NULL, 0);
+            s = fdb_get(db[j], doc);
+            TEST_CHK(s == FDB_RESULT_KEY_NOT_FOUND);
+            fdb_doc_free(doc);
+        }
+    }
+}
+
+void multi_kv_bloom_filter_test()
+{
+    TEST_INIT();
+
+    int n = 2000, ndels = 200;
+    int i, j, r;
+    char key[256], value[256];
+    char kvs_name[16];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db[2];
+    fdb_config config;
+    fdb_kvs_config kvs_config;
+    fdb_doc *doc;
+    fdb_status s;
+
+    sprintf(value, SHELL_DEL" multi_kv_test*");
+    r = system(value);
+    (void)r;
+
+    memleak_start();
+
+    config = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    config.wal_threshold = 256;
+    config.buffercache_size = 0;
+    config.bloom_filter_bits_per_key = 10;
+
+    s = fdb_open(&dbfile, "./multi_kv_test1", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (j=0;j<2;++j) {
+        sprintf(kvs_name, "kv%d", j);
+        s = fdb_kvs_open(dbfile, &db[j], kvs_name, &kvs_config);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+
+    // even keys go to 'kv0', and odd keys go to 'kv1'
+    for (i=0;i<n;++i) {
+        j = i % 2;
+        sprintf(key, "key%06d", i);
+        sprintf(value, "value%08d(%d)", i, j);
+        fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, value, strlen(value)+1);
+        s = fdb_set(db[j], doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // delete some keys of 'kv0'
+    for (i=0;i<ndels;i+=2) {
+        sprintf(key, "key%06d", i);
+        fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, NULL, 0);
+        s = fdb_del(db[0], doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    _multi_kv_bloom_filter_check(db, n, ndels);
+
+    // the filters should be read from the file
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_open(&dbfile, "./multi_kv_test1", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (j=0;j<2;++j) {
+        sprintf(kvs_name, "kv%d", j);
+        s = fdb_kvs_open(dbfile, &db[j], kvs_name, &kvs_config);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    _multi_kv_bloom_filter_check(db, n, ndels);
+
+    // the filters should be rebuilt in the new file
+    s = fdb_compact(dbfile, "./multi_kv_test2");
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    _multi_kv_bloom_filter_check(db, n, ndels);
+
+    // insert more keys after the compaction over many commits, so that the
+    // filters are spread over several documents, each of which only holds
+    // the segments changed since the previous one
+    for (i=n;i<n*2;++i) {
+        j = i % 2;
+        sprintf(key, "key%06d", i);
+        sprintf(value, "value%08d(%d)", i, j);
+        fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, value, strlen(value)+1);
+        s = fdb_set(db[j], doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+        if (i % 250 == 0) {
+            s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+            TEST_CHK(s == FDB_RESULT_SUCCESS);
+        }
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    s = fdb_open(&dbfile, "./multi_kv_test2", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (j=0;j<2;++j) {
+        sprintf(kvs_name, "kv%d", j);
+        s = fdb_kvs_open(dbfile, &db[j], kvs_name, &kvs_config);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    _multi_kv_bloom_filter_check(db, n * 2, ndels);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // a file written without filters should still be read correctly
+    config.bloom_filter_bits_per_key = 0;
+    s = fdb_open(&dbfile, "./multi_kv_test2", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    for (j=0;j<2;++j) {
+        sprintf(kvs_name, "kv%d", j);
+        s = fdb_kvs_open(dbfile, &db[j], kvs_name, &kvs_config);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    sprintf(key, "key%06d", n * 2);
+    sprintf(value, "value%08d(%d)", n * 2, 0);
+    fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, value, strlen(value)+1);
+    s = fdb_set(db[0], doc);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    fdb_doc_free(doc);
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    config.bloom_filter_bits_per_key = 10;
+    s = fdb_open(&dbfile, "./multi_kv_test2", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open(dbfile, &db[0], "kv0", &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, NULL, 0);
+    s = fdb_get(db[0], doc);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    TEST_CMP(value, doc->body, doc->bodylen);
+    fdb_doc_free(doc);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // single KV instance files have no KV header to hold the filters
+    config.multi_kv_instances = false;
+    s = fdb_open(&dbfile, "./multi_kv_test3", &config);
+    TEST_CHK(s == FDB_RESULT_INVALID_CONFIG);
+
+    s = fdb_shutdown();
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    memleak_end();
+
+    TEST_RESULT("multiple KV instances Bloom filter test");
+}
+
+static void _multi_kv_leaf_height_check(fdb_kvs_handle *kv, int n)
+{
+    TEST_INIT();
+
+    int i;
+    char key[256], value[256];
+    fdb_doc *doc;
+    fdb_iterator *it;
+    fdb_status s;
+
+    for (i=0;i<n;++i) {
+        sprintf(key, "%08d%056d", i, i);
+        sprintf(value, "value%08d", i);
+        fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, NULL, 0);
+        s = fdb_get(kv, doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, doc->body, doc->bodylen);
+        fdb_doc_free(doc);
+    }
+
+    i = 0;
+    s = fdb_iterator_init(kv, &it, NULL, 0, NULL, 0, FDB_ITR_NONE);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    do {
+        doc = NULL;
+        s = fdb_iterator_get(it, &doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        sprintf(key, "%08d%056d", i, i);
+        TEST_CMP(doc->key, key, doc->keylen);
+        fdb_doc_free(doc);
+        i++;
+    } while (fdb_iterator_next(it) == FDB_RESULT_SUCCESS);
+    TEST_CHK(i == n);
+    fdb_iterator_close(it);
+}
+
+void multi_kv_leaf_height_limit_test()
+{
+    TEST_INIT();
+
+    int n = 5000;
+    int i, r;
+    char key[256], value[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *kv1;
+    fdb_config config;
+    fdb_kvs_config kvs_config;
+    fdb_doc *doc;
+    fdb_status s;
+
+    sprintf(value, SHELL_DEL" multi_kv_test*");
+    r = system(value);
+    (void)r;
+
+    memleak_start();
+
+    config = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    config.wal_threshold = 256;
+    config.buffercache_size = 0;
+    // split the custom cmp B+tree as soon as it has more than one level;
+    // long keys that differ in their first chunk make the split worthwhile
+    config.leaf_height_limit = 1;
+    kvs_config.custom_cmp = _multi_kv_test_keycmp;
+
+    s = fdb_open(&dbfile, "./multi_kv_test1", &config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    s = fdb_kvs_open(dbfile, &kv1, "kv1", &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    for (i=0;i<n;++i) {
+        sprintf(key, "%08d%056d", i, i);
+        sprintf(value, "value%08d", i);
+        fdb_doc_create(&doc, key, strlen(key)+1, NULL, 0, value, strlen(value)+1);
+        s = fdb_set(kv1, doc);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+    }
+    s = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    _multi_kv_leaf_height_check(kv1, n);
+
+    // compaction builds the new trie with the same limit
+    s = fdb_compact(dbfile, "./multi_kv_test2");
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    _multi_kv_leaf_height_check(kv1, n);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    // split B+trees are readable without the limit
+    config.leaf_height_limit = FDB_DEFAULT_LEAF_HEIGHT_LIMIT;
+    {
+        char *kvs_names[] = {(char *)"kv1"};
+        fdb_custom_cmp_variable functions[] = {_multi_kv_test_keycmp};
+        s = fdb_open_custom_cmp(&dbfile, "./multi_kv_test2", &config,
+                                1, kvs_names, functions);
+        TEST_CHK(s == FDB_RESULT_SUCCESS);
+    }
+    s = fdb_kvs_open(dbfile, &kv1, "kv1", &kvs_config);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    _multi_kv_leaf_height_check(kv1, n);
+    s = fdb_close(dbfile);
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+
+    s = fdb_shutdown();
+    TEST_CHK(s == FDB_RESULT_SUCCESS);
+    memleak_end();
+
+    TEST_RESULT("multiple KV instances leaf height limit test");
+}
+
 void *_opening_thread(void *args) {
     int nhandles = 100;
     fdb_file_handle **dbfile = alca(fdb_file_handle *, nhandles);
@@ -2535,6 +2838,8 @@ int main(){
     multi_kv_custom_cmp_test();
     multi_kv_fdb_open_custom_cmp_test();
     multi_kv_use_existing_mode_test();
+    multi_kv_bloom_filter_test();
+    multi_kv_leaf_height_limit_test();
     multi_kv_close_test();
 
     return 0;
@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <vector>
 
 #include "test.h"
 #include "blockcache.h"
@@ -244,9 +246,558 @@ void multi_thread_test(int nblocks, int cachesize,
     TEST_RESULT("multi thread test");
 }
 
+struct optimistic_args {
+    FileMgr *file;
+    size_t nblocks;
+    size_t time_sec;
+    bool writer;
+    std::atomic<uint64_t> *num_hits;
+    std::atomic<uint64_t> *num_torn;
+};
+
+static void fill_block(uint8_t *buf, size_t blocksize, uint64_t word)
+{
+    for (size_t i = 0; i < blocksize; i += sizeof(word)) {
+        memcpy(buf + i, &word, sizeof(word));
+    }
+}
+
+void * optimistic_worker(void *voidargs)
+{
+    struct optimistic_args *args = (struct optimistic_args *)voidargs;
+    size_t blocksize = args->file->getBlockSize();
+    uint8_t *buf = (uint8_t *)malloc(blocksize);
+    struct timeval ts_begin, ts_cur, ts_gap;
+    uint64_t counter = 0, word, first;
+    bid_t bid;
+
+    gettimeofday(&ts_begin, NULL);
+    while (1) {
+        bid = rand() % args->nblocks;
+        if (args->writer) {
+            // Every 8-byte word of a block holds the same (bid, counter) pair,
+            // so that a torn read can be detected by readers.
+            word = (bid << 32) | (++counter & 0xffffffff);
+            fill_block(buf, blocksize, word);
+            BlockCacheManager::getInstance()->write(args->file, bid, buf,
+                                                    BCACHE_REQ_CLEAN, false);
+        } else if (BlockCacheManager::getInstance()->read(args->file, bid, buf)) {
+            (*args->num_hits)++;
+            memcpy(&first, buf, sizeof(first));
+            bool torn = (first >> 32) != bid;
+            for (size_t i = 0; i < blocksize && !torn; i += sizeof(word)) {
+                memcpy(&word, buf + i, sizeof(word));
+                torn = (word != first);
+            }
+            if (torn) {
+                (*args->num_torn)++;
+            }
+        }
+
+        gettimeofday(&ts_cur, NULL);
+        ts_gap = _utime_gap(ts_begin, ts_cur);
+        if ((size_t)ts_gap.tv_sec >= args->time_sec) break;
+    }
+
+    free(buf);
+    thread_exit(0);
+    return NULL;
+}
+
+void optimistic_read_test(int nblocks, int cachesize, int time_sec,
+                          int nwriters, int nreaders)
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, cachesize, 1048576, 0x0, 0,
+                         FILEMGR_CREATE, FDB_SEQTREE_NOT_USE, 0, 8, 0,
+                         FDB_ENCRYPTION_NONE, 0x00, 0, 0);
+    int n = nwriters + nreaders;
+    int i, r;
+    std::string fname("./bcache_testfile");
+    std::atomic<uint64_t> num_hits(0), num_torn(0);
+    thread_t *tid = alca(thread_t, n);
+    struct optimistic_args *args = alca(struct optimistic_args, n);
+    void **ret = alca(void *, n);
+
+    r = system(SHELL_DEL " bcache_testfile");
+    (void)r;
+
+    memleak_start();
+
+    filemgr_open_result result = FileMgr::open(fname, get_filemgr_ops(),
+                                               &config, NULL);
+    file = result.file;
+
+    for (i = 0; i < n; ++i) {
+        args[i].file = file;
+        args[i].nblocks = nblocks;
+        args[i].time_sec = time_sec;
+        args[i].writer = (i < nwriters);
+        args[i].num_hits = &num_hits;
+        args[i].num_torn = &num_torn;
+        thread_create(&tid[i], optimistic_worker, &args[i]);
+    }
+    for (i = 0; i < n; ++i) {
+        thread_join(tid[i], &ret[i]);
+    }
+
+    TEST_CHK(num_hits.load() > 0);
+    TEST_CHK(num_torn.load() == 0);
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("optimistic read test");
+}
+
+void compressed_tier_test()
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 4, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 1, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    uint8_t buf[4096], rbuf[4096];
+    uint64_t i, nblocks = 32;
+    std::string fname("./bcache_testfile");
+    int r;
+
+    r = system(SHELL_DEL " bcache_testfile");
+    (void)r;
+
+    memleak_start();
+
+    config.setCompressedCacheSize(1048576);
+    filemgr_open_result result = FileMgr::open(fname, get_filemgr_ops(),
+                                               &config, NULL);
+    file = result.file;
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+
+    // Write compressible clean blocks; most of them are evicted from
+    // the 4-block cache into the compressed tier.
+    for (i = 0; i < nblocks; ++i) {
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, &i, sizeof(i));
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumCompressedBlocks() > 0);
+
+    // Every block should be served either by the cache or the tier.
+    for (i = 0; i < nblocks; ++i) {
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, &i, sizeof(i));
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+
+    // A block rewritten after its eviction is served with the new content
+    // once it is evicted again, not with the stale compressed copy.
+    memset(buf, 0xab, sizeof(buf));
+    bcache->write(file, 0, buf, BCACHE_REQ_CLEAN, false);
+    for (i = 1; i < nblocks; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+    }
+    r = bcache->read(file, 0, rbuf);
+    TEST_CHK(r == 4096);
+    TEST_CMP(rbuf, buf, sizeof(buf));
+
+    // A block invalidated after a rewrite is not served from the tier.
+    memset(buf, 0xcd, sizeof(buf));
+    bcache->write(file, 0, buf, BCACHE_REQ_CLEAN, false);
+    bcache->invalidateBlock(file, 0);
+    r = bcache->read(file, 0, rbuf);
+    TEST_CHK(r == 0);
+
+    // A block that doesn't compress well is not kept in the tier.
+    uint32_t seed = 0x12345678;
+    for (i = 0; i < sizeof(buf); ++i) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+    bcache->write(file, nblocks, buf, BCACHE_REQ_CLEAN, false);
+    for (i = 1; i < nblocks; ++i) {
+        bcache->read(file, i, rbuf);
+    }
+    r = bcache->read(file, nblocks, rbuf);
+    TEST_CHK(r == 0);
+
+    FileMgr::close(file, true, NULL, NULL);
+    TEST_CHK(bcache->getCompressedTierUsage() == 0);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("compressed tier test");
+}
+
+struct compressed_tier_args {
+    FileMgr *file;
+    bid_t first_bid;
+    size_t nblocks;
+    size_t niters;
+    std::atomic<uint64_t> *num_hits;
+    std::atomic<uint64_t> *num_stale;
+};
+
+void * compressed_tier_worker(void *voidargs)
+{
+    struct compressed_tier_args *args =
+        (struct compressed_tier_args *)voidargs;
+    size_t blocksize = args->file->getBlockSize();
+    uint8_t *buf = (uint8_t *)malloc(blocksize);
+    std::vector<uint64_t> versions(args->nblocks, 0);
+    uint64_t word;
+    size_t i, idx;
+
+    // Each worker owns its own range of blocks, so that any block read back
+    // must hold the version that the worker wrote last.
+    for (i = 0; i < args->niters; ++i) {
+        idx = rand() % args->nblocks;
+        word = ((args->first_bid + idx) << 32) | (++versions[idx]);
+        memset(buf, 0, blocksize);
+        memcpy(buf, &word, sizeof(word));
+        BlockCacheManager::getInstance()->write(args->file,
+                                                args->first_bid + idx, buf,
+                                                BCACHE_REQ_CLEAN, false);
+
+        idx = rand() % args->nblocks;
+        if (BlockCacheManager::getInstance()->read(args->file,
+                                                   args->first_bid + idx,
+                                                   buf)) {
+            (*args->num_hits)++;
+            memcpy(&word, buf, sizeof(word));
+            if (word != (((args->first_bid + idx) << 32) | versions[idx])) {
+                (*args->num_stale)++;
+            }
+        }
+    }
+
+    free(buf);
+    thread_exit(0);
+    return NULL;
+}
+
+void compressed_tier_concurrent_test(int nthreads)
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 8, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    std::string fname("./bcache_testfile");
+    std::atomic<uint64_t> num_hits(0), num_stale(0);
+    thread_t *tid = alca(thread_t, nthreads);
+    struct compressed_tier_args *args =
+        alca(struct compressed_tier_args, nthreads);
+    void **ret = alca(void *, nthreads);
+    int i, r;
+
+    r = system(SHELL_DEL " bcache_testfile");
+    (void)r;
+
+    memleak_start();
+
+    config.setCompressedCacheSize(1048576);
+    filemgr_open_result result = FileMgr::open(fname, get_filemgr_ops(),
+                                               &config, NULL);
+    file = result.file;
+
+    for (i = 0; i < nthreads; ++i) {
+        args[i].file = file;
+        args[i].first_bid = i * 16;
+        args[i].nblocks = 16;
+        args[i].niters = 20000;
+        args[i].num_hits = &num_hits;
+        args[i].num_stale = &num_stale;
+        thread_create(&tid[i], compressed_tier_worker, &args[i]);
+    }
+    for (i = 0; i < nthreads; ++i) {
+        thread_join(tid[i], &ret[i]);
+    }
+
+    // Most of the blocks are only in the tier, as the cache holds 8 blocks.
+    TEST_CHK(num_hits.load() > 0);
+    TEST_CHK(num_stale.load() == 0);
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("compressed tier concurrent test");
+}
+
+void cache_quota_test()
+{
+    TEST_INIT();
+
+    FileMgr *file_limited, *file_high, *file_noisy;
+    FileMgrConfig config(4096, 8, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 1, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    FileMgrConfig config_limited, config_high;
+    uint8_t buf[4096], rbuf[4096];
+    uint64_t i;
+    int r;
+
+    r = system(SHELL_DEL " bcache_testfile*");
+    (void)r;
+
+    memleak_start();
+
+    config_limited = config;
+    config_limited.setCacheMaxLimit(2 * 4096);
+    config_high = config;
+    config_high.setCachePriority(FDB_CACHE_PRIORITY_HIGH);
+
+    file_limited = FileMgr::open(std::string("./bcache_testfile1"),
+                                 get_filemgr_ops(), &config_limited,
+                                 NULL).file;
+    file_high = FileMgr::open(std::string("./bcache_testfile2"),
+                              get_filemgr_ops(), &config_high, NULL).file;
+    file_noisy = FileMgr::open(std::string("./bcache_testfile3"),
+                               get_filemgr_ops(), &config, NULL).file;
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+
+    // A file with a limit evicts its own blocks beyond the limit.
+    memset(buf, 0x11, sizeof(buf));
+    for (i = 0; i < 6; ++i) {
+        bcache->write(file_limited, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file_limited) <= 2);
+
+    // Blocks of a high priority file survive a flood of another file.
+    memset(buf, 0x22, sizeof(buf));
+    for (i = 0; i < 4; ++i) {
+        bcache->write(file_high, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    memset(buf, 0x33, sizeof(buf));
+    for (i = 0; i < 32; ++i) {
+        bcache->write(file_noisy, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    memset(buf, 0x22, sizeof(buf));
+    for (i = 0; i < 4; ++i) {
+        r = bcache->read(file_high, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+
+    FileMgr::close(file_limited, true, NULL, NULL);
+    FileMgr::close(file_high, true, NULL, NULL);
+    FileMgr::close(file_noisy, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("cache quota test");
+}
+
+void scan_read_test()
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 8, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 1, 1, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    uint8_t buf[4096], rbuf[4096];
+    uint64_t i;
+    int r;
+
+    r = system(SHELL_DEL " bcache_testfile*");
+    (void)r;
+
+    memleak_start();
+
+    file = FileMgr::open(std::string("./bcache_testfile"),
+                         get_filemgr_ops(), &config, NULL).file;
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+
+    // working set (a single shard so that eviction order is deterministic)
+    memset(buf, 0x11, sizeof(buf));
+    for (i = 0; i < 4; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+
+    // a one-shot scan much larger than the cache
+    {
+        ScanReadScope scan_scope(file);
+        memset(buf, 0x22, sizeof(buf));
+        for (i = 100; i < 132; ++i) {
+            if (bcache->read(file, i, rbuf) == 0) {
+                bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+            }
+        }
+    }
+
+    // the working set should survive the scan
+    memset(buf, 0x11, sizeof(buf));
+    for (i = 0; i < 4; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+    TEST_CHK(bcache->getNumBlocks(file) <= 8);
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("scan read test");
+}
+
+void resize_test()
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 8, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 1, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    uint8_t buf[4096], rbuf[4096];
+    uint64_t i;
+    int r;
+
+    r = system(SHELL_DEL " bcache_testfile*");
+    (void)r;
+
+    memleak_start();
+
+    file = FileMgr::open(std::string("./bcache_testfile"),
+                         get_filemgr_ops(), &config, NULL).file;
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+    TEST_CHK(bcache->getNumCacheBlocks() == 8);
+
+    memset(buf, 0x11, sizeof(buf));
+    for (i = 0; i < 8; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file) == 8);
+
+    // shrink: cached blocks are evicted
+    TEST_CHK(bcache->resize(3) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumCacheBlocks() == 3);
+    TEST_CHK(bcache->getNumBlocks(file) <= 3);
+    for (i = 8; i < 16; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file) + bcache->getNumFreeBlocks() == 3);
+
+    // grow: retired blocks are reused and a new chunk is allocated
+    TEST_CHK(bcache->resize(16) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumCacheBlocks() == 16);
+    memset(buf, 0x22, sizeof(buf));
+    for (i = 0; i < 16; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file) == 16);
+    for (i = 0; i < 16; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+
+    TEST_CHK(bcache->resize(0) == FDB_RESULT_INVALID_ARGS);
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("resize test");
+}
+
+void huge_page_test()
+{
+    TEST_INIT();
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 16, 1048576, 0x0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 1, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    uint8_t buf[4096], rbuf[4096];
+    uint64_t i;
+    int r;
+
+    r = system(SHELL_DEL " bcache_testfile*");
+    (void)r;
+
+    memleak_start();
+
+    config.setHugePages(true);
+    file = FileMgr::open(std::string("./bcache_testfile"),
+                         get_filemgr_ops(), &config, NULL).file;
+    BlockCacheManager *bcache = BlockCacheManager::getInstance();
+    TEST_CHK(bcache->getNumCacheBlocks() == 16);
+
+    memset(buf, 0x33, sizeof(buf));
+    for (i = 0; i < 16; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    // shrink and grow again: the 64KB chunk doesn't fill a huge page, so
+    // nothing is released in huge pages
+    TEST_CHK(bcache->resize(4) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumReleasedHugePages() == 0);
+    TEST_CHK(bcache->resize(32) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumCacheBlocks() == 32);
+    for (i = 0; i < 32; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file) == 32);
+    for (i = 0; i < 32; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+
+    // Add a chunk of two huge pages (512 blocks each), and use a part of
+    // the cache so that one of the huge pages has no block in use.
+    TEST_CHK(bcache->resize(32 + 1024) == FDB_RESULT_SUCCESS);
+    for (i = 32; i < 256; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    // Shrinking by a huge page worth of blocks empties that huge page
+    // rather than taking free blocks from everywhere.
+    TEST_CHK(bcache->resize(32 + 512) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumReleasedHugePages() == 1);
+    TEST_CHK(bcache->getNumBlocks(file) == 256);
+    for (i = 0; i < 256; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+    // Growing again reuses the released huge page.
+    TEST_CHK(bcache->resize(32 + 1024) == FDB_RESULT_SUCCESS);
+    TEST_CHK(bcache->getNumReleasedHugePages() == 0);
+    for (i = 256; i < 32 + 1024; ++i) {
+        bcache->write(file, i, buf, BCACHE_REQ_CLEAN, false);
+    }
+    TEST_CHK(bcache->getNumBlocks(file) == 32 + 1024);
+    for (i = 0; i < 32 + 1024; ++i) {
+        r = bcache->read(file, i, rbuf);
+        TEST_CHK(r == 4096);
+        TEST_CMP(rbuf, buf, sizeof(buf));
+    }
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("huge page test");
+}
+
 int main()
 {
     basic_test2();
+    compressed_tier_test();
+    compressed_tier_concurrent_test(4);
+    cache_quota_test();
+    scan_read_test();
+    resize_test();
+    huge_page_test();
 #if !defined(THREAD_SANITIZER)
     /**
      * The following tests will be disabled when the code is run with
@@ -261,6 +812,9 @@ int main()
      */
     multi_thread_test(4, 1, 32, 20, 1, 7);
     multi_thread_test(100, 1, 32, 10, 1, 7);
+    // Optimistic readers copy block contents while writers may be
+    // modifying them, and validate the copy afterwards.
+    optimistic_read_test(64, 32, 5, 2, 8);
 #endif
 
     return 0;
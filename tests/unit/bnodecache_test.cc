@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include "bnode.h"
 #include "bnodecache.h"
@@ -169,15 +170,17 @@ void basic_read_write_test() {
     // Check that the bnodecache memory usage is below set threshold
     TEST_CHK(BnodeCacheMgr::get()->getMemoryUsage() < threshold);
 
+    BnodeCacheReader reader;
     for (size_t i = 0; i < offsets.size(); ++i) {
         Bnode* node = nullptr;
         cs_off_t off = offsets.at(i);
+        reader.enter();
         start = get_monotonic_ts();
         int read = BnodeCacheMgr::get()->read(file, &node, off);
         end = get_monotonic_ts();
         TEST_CHK(read == static_cast<int>(node->getNodeSize()));
         collect_stat(sa, READ, (end - start));
-        node->decRefCount();
+        reader.leave();
     }
 
     // Check that the number of bnodecache items is less than the inserted
@@ -209,9 +212,11 @@ void* reader_ops(void* args) {
     size_t bnode_read_count = 0;
     int index = 0;
     ts_nsec start, end;
+    BnodeCacheReader reader;
     while (bnode_read_count < ra->offsets->size()) {
         cs_off_t off= ra->offsets->at(index);
         Bnode* readBnode;
+        reader.enter();
         start = get_monotonic_ts();
         int read = BnodeCacheMgr::get()->read(ra->file,
                                               &readBnode,
@@ -221,7 +226,7 @@ void* reader_ops(void* args) {
         assert(off == static_cast<cs_off_t>(readBnode->getCurOffset()));
         collect_stat(ra->sa, READ, (end - start));
         bnode_read_count++;
-        readBnode->decRefCount();
+        reader.leave();
         index = (index + 1) % ra->offsets->size();
     }
     return nullptr;
@@ -396,8 +401,114 @@ void multi_threaded_read_write_test(int readers,
     TEST_RESULT(title.c_str());
 }
 
+static int reverse_cmp_func(void *key1, size_t keylen1,
+                            void *key2, size_t keylen2) {
+    size_t len = std::min(keylen1, keylen2);
+    int cmp = memcmp(key2, key1, len);
+    if (cmp == 0) {
+        return static_cast<int>(keylen2) - static_cast<int>(keylen1);
+    }
+    return cmp;
+}
+
+void reader_epoch_test() {
+    TEST_INIT();
+
+    int r = system(SHELL_DEL" bnodecache_testfile");
+    (void)r;
+
+    curBid = BLK_NOT_FOUND;
+    curOffset = 0;
+
+    BnodeCacheMgr::init(1048576, 102400);
+
+    FileMgr *file;
+    FileMgrConfig config(4096, 256, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8,
+                         DEFAULT_NUM_BCACHE_PARTITIONS,
+                         FDB_ENCRYPTION_NONE, 0x55, 0, 0);
+    std::string fname("./bnodecache_testfile");
+    filemgr_open_result result = FileMgr::open(fname,
+                                               get_filemgr_ops(),
+                                               &config, nullptr);
+    file = result.file;
+    TEST_CHK(file != nullptr);
+    // set file version to 003
+    file->setVersion(FILEMGR_MAGIC_003);
+
+    char keybuf[128], bodybuf[128];
+    Bnode* bnode = new Bnode();
+    for (int j = 0; j < 10; ++j) {
+        sprintf(keybuf, "key_%d", j);
+        sprintf(bodybuf, "body_%d", j);
+        TEST_CHK(bnode->addKv((void*)keybuf, strlen(keybuf) + 1,
+                              (void*)bodybuf, strlen(bodybuf) + 1,
+                              nullptr, true) == BnodeResult::SUCCESS);
+    }
+    bnode->setMeta((void*)"meta", 5);
+    cs_off_t offset = assignDirtyNodeOffset(file, bnode);
+    bnode->setCurOffset(offset);
+    TEST_CHK(BnodeCacheMgr::get()->write(file, bnode, offset) ==
+             static_cast<int>(bnode->getNodeSize()));
+    TEST_CHK(BnodeCacheMgr::get()->flush(file) == FDB_RESULT_SUCCESS);
+
+    BnodeCacheReader reader, other_reader;
+    Bnode *node = nullptr, *other_node = nullptr;
+
+    // A cache hit returns the cached node itself.
+    reader.enter();
+    TEST_CHK(BnodeCacheMgr::get()->read(file, &node, offset) > 0);
+    TEST_CHK(node == bnode);
+
+    // Remove the node from the cache while the reader is using it.
+    // It is still counted in the memory usage until it is freed.
+    uint64_t mem_usage = BnodeCacheMgr::get()->getMemoryUsage();
+    TEST_CHK(BnodeCacheMgr::get()->invalidateBnode(file, node) ==
+             FDB_RESULT_SUCCESS);
+    TEST_CHK(BnodeCacheMgr::get()->getMemoryUsage() == mem_usage);
+    TEST_CHK(BnodeCacheMgr::get()->invalidateBnode(file, node) ==
+             FDB_RESULT_KEY_NOT_FOUND);
+
+    // Another reader gets a new copy read from the file.
+    other_reader.enter();
+    TEST_CHK(BnodeCacheMgr::get()->read(file, &other_node, offset) > 0);
+    TEST_CHK(other_node != node);
+
+    // The cached node is shared, so reading it with another comparator
+    // returns a new copy instead of changing the cached one.
+    Bnode *cmp_node = nullptr;
+    TEST_CHK(BnodeCacheMgr::get()->read(file, &cmp_node, offset,
+                                        reverse_cmp_func) > 0);
+    TEST_CHK(cmp_node != other_node);
+    TEST_CHK(cmp_node->getCmpFunc() == reverse_cmp_func);
+    TEST_CHK(other_node->getCmpFunc() == nullptr);
+    TEST_CHK(other_node->getNentry() == 10);
+    other_node = nullptr;
+    TEST_CHK(BnodeCacheMgr::get()->read(file, &other_node, offset,
+                                        reverse_cmp_func) > 0);
+    TEST_CHK(other_node == cmp_node);
+    other_reader.leave();
+
+    // The removed node is still intact, as the reader is in its epoch.
+    TEST_CHK(node->getNentry() == 10);
+    TEST_CHK(!strcmp((char*)node->getMeta(), "meta"));
+    void *value = nullptr;
+    size_t valuelen = 0;
+    Bnode *child = nullptr;
+    TEST_CHK(node->findKv((void*)"key_3", 6, value, valuelen, child) ==
+             BnodeResult::SUCCESS);
+    TEST_CHK(!strcmp((char*)value, "body_3"));
+    reader.leave();
+
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    TEST_RESULT("BnodeCache: reader epoch test");
+}
+
 int main() {
     basic_read_write_test();
+    reader_epoch_test();
     multi_threaded_read_write_test(4        /* readers */,
                                    false    /* writer in parallel */);
     multi_threaded_read_write_test(4        /* readers */,
@@ -18,6 +18,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "test.h"
 #include "common.h"
@@ -26,6 +29,7 @@
 #include "bnodecache.h"
 #include "btree_new.h"
 #include "hbtrie.h"
+#include "version.h"
 
 void bnode_basic_test()
 {
@@ -557,6 +561,107 @@ void bnode_split_test()
     TEST_RESULT("bnode split test");
 }
 
+void bnode_prefix_compression_test()
+{
+    TEST_INIT();
+
+    Bnode *bnode = new Bnode();
+    BnodeResult ret;
+    size_t i;
+    size_t n = 100;
+    size_t keylen = 24;
+    char keybuf[64], valuebuf[64];
+    char metabuf[64];
+
+    bnode->setPrefixCompression(true);
+    sprintf(metabuf, "meta_data");
+    bnode->setMeta(metabuf, 9);
+    for (i=0; i<n; ++i) {
+        sprintf(keybuf, "tenant/table_0001/%06d", (int)i);
+        sprintf(valuebuf, "v%07d", (int)i*10);
+        ret = bnode->addKv(keybuf, keylen, valuebuf, 8, nullptr, true);
+        TEST_CHK(ret == BnodeResult::SUCCESS);
+    }
+    // "tenant/table_0001/0000" is shared by all keys.
+    TEST_CHK(bnode->getCommonPrefixLen() == 22);
+    TEST_CHK(bnode->getDiskSize() ==
+             bnode->getNodeSize() + sizeof(uint16_t) + 22 - n * 22);
+
+    // export/import test
+    void *temp_buf = bnode->exportRaw();
+    size_t disk_size = Bnode::readNodeSize(temp_buf);
+    TEST_CHK(disk_size == bnode->getDiskSize());
+
+    Bnode *bnode_copy = new Bnode();
+    void *temp_read_buf = (void*)malloc(disk_size);
+    memcpy(temp_read_buf, temp_buf, disk_size);
+    bnode->releaseExportBuffer();
+    ret = bnode_copy->importRaw(temp_read_buf, disk_size);
+    TEST_CHK(ret == BnodeResult::SUCCESS);
+
+    TEST_CHK(bnode_copy->getNentry() == n);
+    TEST_CHK(bnode_copy->getNodeSize() == bnode->getNodeSize());
+    TEST_CHK(bnode_copy->getDiskSize() == disk_size);
+    TEST_CHK(bnode_copy->getFlags() == bnode->getFlags());
+    TEST_CMP(bnode_copy->getMeta(), metabuf, bnode_copy->getMetaSize());
+
+    size_t valuelen_out;
+    void* value_out;
+    Bnode *bnode_out;
+    for (i=0; i<n; ++i) {
+        sprintf(keybuf, "tenant/table_0001/%06d", (int)i);
+        sprintf(valuebuf, "v%07d", (int)i*10);
+        ret = bnode_copy->findKv(keybuf, keylen, value_out, valuelen_out,
+                                 bnode_out);
+        TEST_CHK(ret == BnodeResult::SUCCESS);
+        TEST_CMP(value_out, valuebuf, valuelen_out);
+    }
+
+    // the imported node is still mutable.
+    sprintf(keybuf, "tenant/table_0002/000000");
+    ret = bnode_copy->addKv(keybuf, keylen, valuebuf, 8, nullptr, true);
+    TEST_CHK(ret == BnodeResult::SUCCESS);
+    TEST_CHK(bnode_copy->getCommonPrefixLen() == 16);
+
+    // the prefix does not grow back until it is re-calculated before write.
+    ret = bnode_copy->removeKv(keybuf, keylen);
+    TEST_CHK(ret == BnodeResult::SUCCESS);
+    TEST_CHK(bnode_copy->getCommonPrefixLen() == 16);
+    bnode_copy->refreshCommonPrefixLen();
+    TEST_CHK(bnode_copy->getCommonPrefixLen() == 22);
+    TEST_CHK(bnode_copy->getDiskSize() == disk_size);
+
+    // split by on-disk size: fewer nodes than without compression.
+    std::list<Bnode *> new_nodes;
+    size_t nentry_total = 0;
+    Bnode *bnode_clone = bnode->cloneNode();
+    bnode->setCurOffset(0);
+    bnode->splitNode(512, new_nodes);
+    size_t num_compressed_nodes = new_nodes.size();
+    for (auto &entry: new_nodes) {
+        nentry_total += entry->getNentry();
+        TEST_CHK(entry->getDiskSize() <= 512);
+        delete entry;
+    }
+    new_nodes.clear();
+    TEST_CHK(nentry_total == n);
+
+    bnode_clone->setPrefixCompression(false);
+    TEST_CHK(bnode_clone->getDiskSize() == bnode_clone->getNodeSize());
+    bnode_clone->setCurOffset(0);
+    bnode_clone->splitNode(512, new_nodes);
+    TEST_CHK(new_nodes.size() > num_compressed_nodes);
+    for (auto &entry: new_nodes) {
+        delete entry;
+    }
+
+    delete bnode_clone;
+    delete bnode;
+    delete bnode_copy;
+
+    TEST_RESULT("bnode prefix compression test");
+}
+
 static int bnode_custom_cmp_func(void *key1, size_t keylen1,
                                  void *key2, size_t keylen2)
 {
@@ -1022,6 +1127,589 @@ void btree_multiple_block_test()
     TEST_RESULT("btree multiple block test");
 }
 
+static void collect_leaves(BnodeMgr *b_mgr, uint64_t offset,
+                           std::vector<cs_off_t> &leaves,
+                           std::vector<std::string> &first_keys,
+                           size_t &num_parents,
+                           size_t &num_internal)
+{
+    Bnode *node = b_mgr->readNode(offset);
+    BnodeIterator bitr(node);
+    if (node->getLevel() == 1) {
+        bitr.begin();
+        leaves.push_back(offset);
+        first_keys.push_back(std::string((char*)bitr.getKv().key,
+                                         bitr.getKv().keylen));
+        return;
+    }
+    ++num_internal;
+    if (node->getLevel() == 2) {
+        ++num_parents;
+    }
+    for (BnodeIteratorResult ret = bitr.begin();
+         ret == BnodeIteratorResult::SUCCESS; ret = bitr.next()) {
+        collect_leaves(b_mgr, BtreeV2::value2offset(bitr.getKv()), leaves,
+                       first_keys, num_parents, num_internal);
+    }
+}
+
+static std::set<cs_off_t> get_cached_offsets(FileMgr *file)
+{
+    std::vector<cs_off_t> offsets;
+    BnodeCacheMgr::get()->getHotBnodes(file, offsets);
+    return std::set<cs_off_t>(offsets.begin(), offsets.end());
+}
+
+void btree_iterator_prefetch_test()
+{
+    TEST_INIT();
+
+    BtreeV2 *btree;
+    BnodeMgr *b_mgr;
+    BtreeIteratorV2 *bti;
+    BtreeKvPair kvp_out;
+    FileMgrConfig config(4096, 39, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    filemgr_open_result fr;
+    std::string fname("./btree_new_testfile");
+
+    int r = system(SHELL_DEL" btree_new_testfile");
+    (void)r;
+
+    fr = FileMgr::open(fname, get_filemgr_ops(), &config, NULL);
+
+    size_t i, j;
+    size_t n = 10000;
+    char keybuf[16];
+    std::vector<BtreeKvPair> kv_list(n);
+
+    for (i=0; i<n; ++i) {
+        kv_list[i].keylen = kv_list[i].valuelen = 8;
+        kv_list[i].key = (void*)malloc( kv_list[i].keylen+1 );
+        kv_list[i].value = (void*)malloc( kv_list[i].valuelen+1 );
+        sprintf((char*)kv_list[i].key, "k%07d", (int)i*2 + 10);
+        sprintf((char*)kv_list[i].value, "v%07d", (int)i*2 + 10);
+    }
+
+    BnodeCacheMgr::init(16000000, 16000000);
+    BnodeCacheMgr::get()->createFileBnodeCache(fr.file);
+    b_mgr = new BnodeMgr();
+    b_mgr->setFile(fr.file);
+    btree = new BtreeV2();
+    btree->setBMgr(b_mgr);
+
+    btree->insertMulti( kv_list );
+    TEST_CHK(btree->getNentry() == n);
+    btree->writeDirtyNodes();
+    b_mgr->moveDirtyNodesToBcache();
+    BnodeCacheMgr::get()->flush(fr.file);
+    TEST_CHK(btree->getHeight() >= 2);
+
+    std::vector<cs_off_t> leaves;
+    std::vector<std::string> first_keys;
+    size_t num_parents = 0, num_internal = 0;
+    BtreeNodeAddr root_addr = btree->getRootAddr();
+    collect_leaves(b_mgr, root_addr.offset, leaves, first_keys,
+                   num_parents, num_internal);
+    b_mgr->releaseCleanNodes();
+    // the first parent has enough leaves for the window to grow to 8
+    TEST_CHK(leaves.size() > 20);
+    Bnode *first_parent = b_mgr->readNode(root_addr.offset);
+    while (first_parent->getLevel() > 2) {
+        BnodeIterator bitr(first_parent);
+        bitr.begin();
+        first_parent = b_mgr->readNode(BtreeV2::value2offset(bitr.getKv()));
+    }
+    TEST_CHK(first_parent->getNentry() >= 15);
+    b_mgr->releaseCleanNodes();
+
+    // start over with a cold cache
+    delete btree;
+    delete b_mgr;
+    BnodeCacheMgr::destroyInstance();
+    BnodeCacheMgr::init(16000000, 16000000);
+    BnodeCacheMgr::get()->createFileBnodeCache(fr.file);
+    b_mgr = new BnodeMgr();
+    b_mgr->setFile(fr.file);
+    btree = new BtreeV2();
+    btree->setBMgr(b_mgr);
+    btree->initFromAddr(root_addr);
+    FileBnodeCache *fcache = fr.file->getBnodeCache();
+
+    // prefetched nodes are cached without being read on demand
+    std::set<cs_off_t> cached = get_cached_offsets(fr.file);
+    for (i = leaves.size() - 4; i < leaves.size(); ++i) {
+        TEST_CHK(cached.find(leaves[i]) == cached.end());
+    }
+    uint64_t num_misses = fcache->getNumMisses();
+    TEST_CHK(b_mgr->prefetchNodes(&leaves[leaves.size() - 4], 4, nullptr) == 4);
+    b_mgr->reapPrefetchedNodes(true);
+    cached = get_cached_offsets(fr.file);
+    for (i = leaves.size() - 4; i < leaves.size(); ++i) {
+        TEST_CHK(cached.find(leaves[i]) != cached.end());
+    }
+    TEST_CHK(fcache->getNumMisses() == num_misses);
+
+    // full forward scan; the prefetch window starts at 2 leaves and doubles
+    // every time the scan reaches it, so that the leaves 7 to 14 are read
+    // ahead once the scan reaches the leaf 3, and are cached by the time the
+    // scan reaches the leaf 7.
+    bti = new BtreeIteratorV2(btree);
+    i = 0;
+    j = 0;
+    do {
+        kvp_out = bti->getKvBT();
+        if (!kvp_out.key) {
+            break;
+        }
+        TEST_CMP(kvp_out.key, kv_list[i].key, kvp_out.keylen);
+        TEST_CMP(kvp_out.value, kv_list[i].value, kvp_out.valuelen);
+        if (j + 1 < leaves.size() &&
+            !memcmp(kvp_out.key, first_keys[j + 1].data(), kvp_out.keylen)) {
+            ++j; // entered the next leaf
+            if (j == 7) {
+                cached = get_cached_offsets(fr.file);
+                for (size_t k = 7; k < 15; ++k) {
+                    TEST_CHK(cached.find(leaves[k]) != cached.end());
+                }
+            }
+        }
+        ++i;
+    } while (bti->nextBT() == BnodeIteratorResult::SUCCESS);
+    TEST_CHK(i == n);
+    TEST_CHK(j == leaves.size() - 1);
+    delete bti;
+    b_mgr->releaseCleanNodes();
+
+    // the scan missed the cache only for the first leaf of each parent and
+    // the intermediate nodes below the root, instead of for every leaf.
+    num_misses = fcache->getNumMisses() - num_misses;
+    TEST_CHK(num_misses <= num_parents + num_internal - 1);
+    TEST_CHK(num_misses * 4 < leaves.size());
+
+    // range scan starting in the middle of the tree
+    sprintf(keybuf, "k%07d", (int)(n/3)*2 + 11);
+    bti = new BtreeIteratorV2(btree, keybuf, 8);
+    i = n/3 + 1;
+    do {
+        kvp_out = bti->getKvBT();
+        if (!kvp_out.key) {
+            break;
+        }
+        TEST_CMP(kvp_out.key, kv_list[i].key, kvp_out.keylen);
+        ++i;
+    } while (bti->nextBT() == BnodeIteratorResult::SUCCESS);
+    TEST_CHK(i == n);
+    delete bti;
+    b_mgr->releaseCleanNodes();
+
+    for (i=0; i<n; ++i) {
+        free(kv_list[i].key);
+        free(kv_list[i].value);
+    }
+
+    delete btree;
+    delete b_mgr;
+
+    FileMgr::close(fr.file, true, NULL, NULL);
+
+    BnodeCacheMgr::destroyInstance();
+
+    FileMgr::shutdown();
+
+    TEST_RESULT("btree iterator prefetch test");
+}
+
+void btree_append_test()
+{
+    TEST_INIT();
+
+    BtreeV2 *btree;
+    BtreeV2Result br;
+    BnodeMgr *b_mgr;
+    BtreeIteratorV2 *bti;
+    BtreeKvPair kvp_out;
+    FileMgrConfig config(4096, 3906, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    filemgr_open_result fr;
+    std::string fname("./btree_new_testfile");
+
+    int r = system(SHELL_DEL" btree_new_testfile");
+    (void)r;
+
+    fr = FileMgr::open(fname, get_filemgr_ops(), &config, NULL);
+
+    size_t i;
+    size_t n = 20000;
+    uint64_t seqnum, offset;
+    char valuebuf[16];
+
+    BnodeCacheMgr::init(16000000, 16000000);
+    BnodeCacheMgr::get()->createFileBnodeCache(fr.file);
+    b_mgr = new BnodeMgr();
+    b_mgr->setFile(fr.file);
+    btree = new BtreeV2();
+    btree->setBMgr(b_mgr);
+
+    BtreeKvPair kv;
+    kv.key = &seqnum;
+    kv.value = &offset;
+    kv.keylen = kv.valuelen = sizeof(uint64_t);
+
+    // append big-endian sequence numbers, with a flush in the middle
+    for (i=0; i<n; ++i) {
+        seqnum = _enc64(i + 1);
+        offset = i * 100;
+        br = btree->insert(kv);
+        TEST_CHK(br == BtreeV2Result::SUCCESS);
+        if (i == n/2) {
+            btree->writeDirtyNodes();
+            b_mgr->moveDirtyNodesToBcache();
+        }
+    }
+    TEST_CHK(btree->getNentry() == n);
+    TEST_CHK(btree->getHeight() > 1);
+
+    // out-of-order insert and overwrite take the regular path
+    seqnum = _enc64(n/4 + 1);
+    offset = 1;
+    btree->insert(kv);
+    seqnum = _enc64(n + 100);
+    offset = n * 100;
+    btree->insert(kv);
+    seqnum = _enc64(n + 100);
+    btree->insert(kv);
+    seqnum = _enc64(n + 101);
+    offset = (n + 1) * 100;
+    btree->insert(kv);
+    TEST_CHK(btree->getNentry() == n + 2);
+
+    btree->writeDirtyNodes();
+    b_mgr->moveDirtyNodesToBcache();
+
+    kv.value = valuebuf;
+    for (i=0; i<n; ++i) {
+        seqnum = _enc64(i + 1);
+        br = btree->find(kv);
+        b_mgr->releaseCleanNodes();
+        TEST_CHK(br == BtreeV2Result::SUCCESS);
+        memcpy(&offset, valuebuf, sizeof(offset));
+        TEST_CHK(offset == ((i == n/4) ? 1 : i * 100));
+    }
+
+    // iteration check
+    bti = new BtreeIteratorV2(btree);
+    i = 0;
+    do {
+        kvp_out = bti->getKvBT();
+        if (!kvp_out.key) {
+            break;
+        }
+        memcpy(&seqnum, kvp_out.key, sizeof(seqnum));
+        if (i < n) {
+            TEST_CHK(_dec64(seqnum) == i + 1);
+        }
+        ++i;
+    } while (bti->nextBT() == BnodeIteratorResult::SUCCESS);
+    TEST_CHK(i == n + 2);
+    delete bti;
+    b_mgr->releaseCleanNodes();
+
+    delete btree;
+    delete b_mgr;
+
+    FileMgr::close(fr.file, true, NULL, NULL);
+
+    BnodeCacheMgr::destroyInstance();
+
+    FileMgr::shutdown();
+
+    TEST_RESULT("btree append test");
+}
+
+void btree_delta_record_test()
+{
+    TEST_INIT();
+
+    BtreeV2 *btree[2];
+    BtreeV2Result br;
+    BnodeMgr *b_mgr[2];
+    FileMgrConfig config(4096, 3906, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    filemgr_open_result fr[2];
+    std::string fname[2] = {"./btree_new_testfile", "./btree_new_testfile_full"};
+
+    int r = system(SHELL_DEL" btree_new_testfile*");
+    (void)r;
+
+    size_t i, j, idx;
+    size_t n = 10000;
+    size_t rounds = 300;
+    uint64_t pos[2];
+    char keybuf[16], valuebuf[16], valuebuf_chk[16];
+    std::vector<int> values(n);
+
+    std::vector<BtreeKvPair> kv_list(n);
+    for (i=0; i<n; ++i) {
+        kv_list[i].keylen = kv_list[i].valuelen = 8;
+        kv_list[i].key = (void*)malloc( kv_list[i].keylen+1 );
+        kv_list[i].value = (void*)malloc( kv_list[i].valuelen+1 );
+        sprintf((char*)kv_list[i].key, "k%07d", (int)i);
+        sprintf((char*)kv_list[i].value, "v%07d", (int)i);
+        values[i] = i;
+    }
+
+    BnodeCacheMgr::init(16000000, 16000000);
+    for (j=0; j<2; ++j) {
+        fr[j] = FileMgr::open(fname[j], get_filemgr_ops(), &config, NULL);
+        BnodeCacheMgr::get()->createFileBnodeCache(fr[j].file);
+        b_mgr[j] = new BnodeMgr();
+        b_mgr[j]->setFile(fr[j].file);
+        btree[j] = new BtreeV2();
+        btree[j]->setBMgr(b_mgr[j]);
+    }
+    // delta records are written into FILEMGR_MAGIC_005 files only.
+    fr[0].file->setVersion(FILEMGR_MAGIC_005);
+
+    for (j=0; j<2; ++j) {
+        btree[j]->insertMulti( kv_list );
+        btree[j]->writeDirtyNodes();
+        b_mgr[j]->moveDirtyNodesToBcache();
+        b_mgr[j]->markEndOfIndexBlocks();
+        pos[j] = fr[j].file->getPos();
+    }
+    TEST_CHK(btree[0]->getHeight() >= 2);
+
+    // random updates, each of which is followed by a flush.
+    BtreeKvPair kv;
+    kv.keylen = kv.valuelen = 8;
+    for (i=0; i<rounds; ++i) {
+        idx = rand() % n;
+        values[idx] = n + i;
+        sprintf(keybuf, "k%07d", (int)idx);
+        sprintf(valuebuf, "v%07d", values[idx]);
+        kv.key = keybuf;
+        kv.value = valuebuf;
+        for (j=0; j<2; ++j) {
+            btree[j]->insert(kv);
+            btree[j]->writeDirtyNodes();
+            b_mgr[j]->moveDirtyNodesToBcache();
+        }
+    }
+    for (j=0; j<2; ++j) {
+        b_mgr[j]->markEndOfIndexBlocks();
+        pos[j] = fr[j].file->getPos() - pos[j];
+    }
+    // index blocks written by the updates shrink by an order of magnitude.
+    TEST_CHK(pos[0] * 8 < pos[1]);
+
+    delete btree[1];
+    delete b_mgr[1];
+    FileMgr::close(fr[1].file, true, NULL, NULL);
+
+    // read the nodes from the file, by applying delta records
+    BtreeNodeAddr root_addr = btree[0]->getRootAddr();
+    BnodeCacheMgr::get()->flush(fr[0].file);
+    delete btree[0];
+    delete b_mgr[0];
+    BnodeCacheMgr::destroyInstance();
+    BnodeCacheMgr::init(16000000, 16000000);
+    BnodeCacheMgr::get()->createFileBnodeCache(fr[0].file);
+
+    b_mgr[0] = new BnodeMgr();
+    b_mgr[0]->setFile(fr[0].file);
+    btree[0] = new BtreeV2();
+    btree[0]->setBMgr(b_mgr[0]);
+    btree[0]->initFromAddr(root_addr);
+
+    kv.value = valuebuf_chk;
+    for (i=0; i<n; ++i) {
+        sprintf(keybuf, "k%07d", (int)i);
+        sprintf(valuebuf, "v%07d", values[i]);
+        kv.key = keybuf;
+        br = btree[0]->find(kv);
+        b_mgr[0]->releaseCleanNodes();
+        TEST_CHK(br == BtreeV2Result::SUCCESS);
+        TEST_CMP(kv.value, valuebuf, kv.valuelen);
+    }
+
+    // nodes rebuilt from delta records are still mutable.
+    for (i=0; i<n; i+=97) {
+        sprintf(keybuf, "k%07d", (int)i);
+        kv.key = keybuf;
+        if (i % 2) {
+            btree[0]->remove(kv);
+            values[i] = -1;
+        } else {
+            values[i] = 2 * n + i;
+            sprintf(valuebuf, "v%07d", values[i]);
+            kv.value = valuebuf;
+            btree[0]->insert(kv);
+        }
+        btree[0]->writeDirtyNodes();
+        b_mgr[0]->moveDirtyNodesToBcache();
+    }
+    kv.value = valuebuf_chk;
+    for (i=0; i<n; ++i) {
+        sprintf(keybuf, "k%07d", (int)i);
+        kv.key = keybuf;
+        br = btree[0]->find(kv);
+        b_mgr[0]->releaseCleanNodes();
+        if (values[i] < 0) {
+            TEST_CHK(br != BtreeV2Result::SUCCESS);
+        } else {
+            sprintf(valuebuf, "v%07d", values[i]);
+            TEST_CHK(br == BtreeV2Result::SUCCESS);
+            TEST_CMP(kv.value, valuebuf, kv.valuelen);
+        }
+    }
+
+    for (i=0; i<n; ++i) {
+        free(kv_list[i].key);
+        free(kv_list[i].value);
+    }
+
+    delete btree[0];
+    delete b_mgr[0];
+    FileMgr::close(fr[0].file, true, NULL, NULL);
+
+    BnodeCacheMgr::destroyInstance();
+
+    FileMgr::shutdown();
+
+    TEST_RESULT("btree delta record test");
+}
+
+void btree_subblock_packing_test()
+{
+    TEST_INIT();
+
+    BtreeV2Result br;
+    BnodeMgr *b_mgr[2];
+    FileMgrConfig config(4096, 3906, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+    filemgr_open_result fr[2];
+    std::string fname[2] = {"./btree_new_testfile", "./btree_new_testfile_full"};
+
+    int r = system(SHELL_DEL" btree_new_testfile*");
+    (void)r;
+
+    size_t i, j, k;
+    size_t n_trees = 200, n_keys = 3;
+    uint64_t pos[2];
+    char keybuf[16], valuebuf[16], valuebuf_chk[16];
+    std::vector<BtreeV2 *> btrees[2];
+    std::vector<BtreeNodeAddr> root_addrs(n_trees);
+    BtreeKvPair kv;
+    kv.keylen = kv.valuelen = 8;
+
+    BnodeCacheMgr::init(16000000, 16000000);
+    for (j=0; j<2; ++j) {
+        fr[j] = FileMgr::open(fname[j], get_filemgr_ops(), &config, NULL);
+        BnodeCacheMgr::get()->createFileBnodeCache(fr[j].file);
+        b_mgr[j] = new BnodeMgr();
+        b_mgr[j]->setFile(fr[j].file);
+        pos[j] = fr[j].file->getPos();
+    }
+
+    // many small trees, each of which is written by a separate WAL flush
+    // before the commit.
+    for (i=0; i<n_trees; ++i) {
+        for (j=0; j<2; ++j) {
+            BtreeV2 *btree = new BtreeV2();
+            btree->setBMgr(b_mgr[j]);
+            for (k=0; k<n_keys; ++k) {
+                sprintf(keybuf, "k%03d%04d", (int)i, (int)k);
+                sprintf(valuebuf, "v%03d%04d", (int)i, (int)k);
+                kv.key = keybuf;
+                kv.value = valuebuf;
+                btree->insert(kv);
+            }
+            btree->writeDirtyNodes();
+            b_mgr[j]->moveDirtyNodesToBcache();
+            BnodeCacheMgr::get()->flush(fr[j].file);
+            if (j == 0) {
+                b_mgr[j]->markEndOfDirtyIndexBlocks();
+            } else {
+                b_mgr[j]->markEndOfIndexBlocks();
+            }
+            btrees[j].push_back(btree);
+        }
+        root_addrs[i] = btrees[0][i]->getRootAddr();
+    }
+    b_mgr[0]->markEndOfIndexBlocks();
+    for (j=0; j<2; ++j) {
+        fr[j].file->setLastCommit(fr[j].file->getPos());
+        pos[j] = fr[j].file->getPos() - pos[j];
+    }
+    // each WAL flush doesn't take up an entire block anymore.
+    TEST_CHK(pos[1] == n_trees * 4096);
+    TEST_CHK(pos[0] * 4 < pos[1]);
+
+    // nodes are never written into the blocks that have been committed.
+    {
+        uint64_t commit_pos = fr[0].file->getPos();
+        BtreeV2 *btree = new BtreeV2();
+        btree->setBMgr(b_mgr[0]);
+        kv.key = keybuf;
+        kv.value = valuebuf;
+        sprintf(keybuf, "kxxx0000");
+        sprintf(valuebuf, "vxxx0000");
+        btree->insert(kv);
+        btree->writeDirtyNodes();
+        b_mgr[0]->moveDirtyNodesToBcache();
+        BnodeCacheMgr::get()->flush(fr[0].file);
+        b_mgr[0]->markEndOfDirtyIndexBlocks();
+        TEST_CHK(btree->getRootAddr().offset >= commit_pos);
+        btrees[0].push_back(btree);
+    }
+
+    for (j=0; j<2; ++j) {
+        for (auto &entry: btrees[j]) {
+            delete entry;
+        }
+        delete b_mgr[j];
+    }
+    FileMgr::close(fr[1].file, true, NULL, NULL);
+
+    // read the nodes from the file, along with the committed ones in the
+    // same blocks.
+    BnodeCacheMgr::destroyInstance();
+    BnodeCacheMgr::init(16000000, 16000000);
+    BnodeCacheMgr::get()->createFileBnodeCache(fr[0].file);
+    b_mgr[0] = new BnodeMgr();
+    b_mgr[0]->setFile(fr[0].file);
+
+    kv.value = valuebuf_chk;
+    for (i=0; i<n_trees; ++i) {
+        BtreeV2 btree;
+        btree.setBMgr(b_mgr[0]);
+        btree.initFromAddr(root_addrs[i]);
+        for (k=0; k<n_keys; ++k) {
+            sprintf(keybuf, "k%03d%04d", (int)i, (int)k);
+            sprintf(valuebuf, "v%03d%04d", (int)i, (int)k);
+            kv.key = keybuf;
+            br = btree.find(kv);
+            b_mgr[0]->releaseCleanNodes();
+            TEST_CHK(br == BtreeV2Result::SUCCESS);
+            TEST_CMP(kv.value, valuebuf, kv.valuelen);
+        }
+    }
+
+    delete b_mgr[0];
+    FileMgr::close(fr[0].file, true, NULL, NULL);
+
+    BnodeCacheMgr::destroyInstance();
+
+    FileMgr::shutdown();
+
+    TEST_RESULT("btree sub-block packing test");
+}
+
 void btree_metadata_test()
 {
     TEST_INIT();
@@ -1728,6 +2416,229 @@ void bsa_base_offset_test()
     TEST_RESULT("Bs Array base offset test");
 }
 
+void bsa_key_prefix_test()
+{
+    TEST_INIT();
+
+    BsArray bsa;
+    BsaItem query, item;
+    size_t i, j;
+    // Keys sharing the first 8 bytes, keys shorter than 8 bytes,
+    // and keys that differ only by trailing zero bytes.
+    const char *keys[] = {"a", "a\0", "a\0\0", "ab", "abcdefgh",
+                          "abcdefgh\0", "abcdefgha", "abcdefghb",
+                          "abcdefghba", "abcdefgi", "b"};
+    size_t keylens[] = {1, 2, 3, 2, 8, 9, 9, 9, 10, 8, 1};
+    size_t n = sizeof(keylens) / sizeof(keylens[0]);
+    char valuebuf[64];
+
+    // insert in reverse order
+    for (i=0; i<n; ++i) {
+        j = n - i - 1;
+        sprintf(valuebuf, "v%07d", (int)j);
+        query = BsaItem((void*)keys[j], keylens[j], valuebuf, 8);
+        bsa.insert( query );
+    }
+    TEST_CHK(bsa.getNumElems() == n);
+
+    for (i=0; i<n; ++i) {
+        sprintf(valuebuf, "v%07d", (int)i);
+        query = BsaItem((void*)keys[i], keylens[i]);
+        item = bsa.find( query );
+        TEST_CHK( !item.isEmpty() );
+        TEST_CHK( item.idx == i );
+        TEST_CMP(item.value, valuebuf, item.valuelen);
+    }
+
+    // non-existing keys between existing ones
+    query = BsaItem((void*)"abcdefgh\0\0", 10);
+    item = bsa.find( query );
+    TEST_CHK( item.isEmpty() );
+    item = bsa.findSmallerOrEqual( query );
+    TEST_CHK( item.idx == 5 );
+    item = bsa.findGreaterOrEqual( query );
+    TEST_CHK( item.idx == 6 );
+
+    query = BsaItem((void*)"abc", 3);
+    item = bsa.findSmallerOrEqual( query );
+    TEST_CHK( item.idx == 3 );
+    item = bsa.findGreaterOrEqual( query );
+    TEST_CHK( item.idx == 4 );
+
+    // remove keys sharing the prefix, and find the rest
+    query = BsaItem((void*)keys[6], keylens[6]);
+    item = bsa.remove( query );
+    TEST_CHK( !item.isEmpty() );
+    query = BsaItem((void*)keys[1], keylens[1]);
+    item = bsa.remove( query );
+    TEST_CHK( !item.isEmpty() );
+    for (i=0; i<n; ++i) {
+        query = BsaItem((void*)keys[i], keylens[i]);
+        item = bsa.find( query );
+        TEST_CHK( item.isEmpty() == (i == 1 || i == 6) );
+    }
+
+    TEST_RESULT("Bs Array key prefix test");
+}
+
+static bool bsa_check_against(BsArray& bsa, std::set<std::string>& keys,
+                              const std::string& q)
+{
+    BsaItem query((void*)q.data(), q.size());
+    BsaItem item;
+    auto ge = keys.lower_bound(q);
+    auto le = keys.upper_bound(q);
+
+    item = bsa.find(query);
+    if (item.isEmpty() != (ge == keys.end() || *ge != q)) {
+        return false;
+    }
+
+    item = bsa.findSmallerOrEqual(query);
+    if (le == keys.begin()) {
+        if (!item.isEmpty()) {
+            return false;
+        }
+    } else {
+        --le;
+        if (item.isEmpty() || *le != std::string((char*)item.key, item.keylen)) {
+            return false;
+        }
+    }
+
+    item = bsa.findGreaterOrEqual(query);
+    if (ge == keys.end()) {
+        return item.isEmpty();
+    }
+    return !item.isEmpty() &&
+           *ge == std::string((char*)item.key, item.keylen);
+}
+
+void bsa_common_prefix_test()
+{
+    TEST_INIT();
+
+    BsArray bsa;
+    BsaItem query;
+    std::set<std::string> keys;
+    std::vector<std::string> queries = {"a", "user", "user:", "user::",
+                                        "user::0", "user::01", "user::0150",
+                                        "user::01500", "user::02", "user:;",
+                                        "usera", "v"};
+    size_t i, n = 200;
+    char keybuf[64];
+
+    // insert keys sharing a prefix in random order, so that the common
+    // prefix of the first and the last keys keeps changing.
+    std::vector<size_t> order(n);
+    for (i=0; i<n; ++i) {
+        order[i] = i;
+    }
+    for (i=n-1; i>0; --i) {
+        std::swap(order[i], order[rand() % (i+1)]);
+    }
+    for (i=0; i<n; ++i) {
+        sprintf(keybuf, "user::%04d", (int)order[i] * 2);
+        query = BsaItem(keybuf, strlen(keybuf), keybuf, 8);
+        bsa.insert(query);
+        keys.insert(keybuf);
+    }
+    TEST_CHK(bsa.getNumElems() == n);
+
+    for (i=0; i<n*2; ++i) {
+        sprintf(keybuf, "user::%04d", (int)i);
+        queries.push_back(keybuf);
+    }
+    for (auto &entry: queries) {
+        TEST_CHK(bsa_check_against(bsa, keys, entry));
+    }
+
+    // remove the smallest keys, so that the common prefix becomes longer.
+    for (i=0; i<n/2+10; ++i) {
+        std::string key = *keys.begin();
+        query = BsaItem((void*)key.data(), key.size());
+        TEST_CHK(!bsa.remove(query).isEmpty());
+        keys.erase(key);
+    }
+    for (auto &entry: queries) {
+        TEST_CHK(bsa_check_against(bsa, keys, entry));
+    }
+
+    // keys that don't share the prefix at all.
+    for (std::string key: {"user::", "b", "user::01"}) {
+        query = BsaItem((void*)key.data(), key.size(), (void*)key.data(), 1);
+        bsa.insert(query);
+        keys.insert(key);
+        for (auto &entry: queries) {
+            TEST_CHK(bsa_check_against(bsa, keys, entry));
+        }
+    }
+
+    // the index of a node read from its raw image.
+    Bnode *bnode = new Bnode();
+    for (auto &entry: keys) {
+        bnode->addKv((void*)entry.data(), entry.size(), (void*)"value", 5,
+                     nullptr, true);
+    }
+    void *raw = bnode->exportRaw();
+    size_t nodesize = bnode->getNodeSize();
+    void *buf = malloc(nodesize);
+    memcpy(buf, raw, nodesize);
+    delete bnode;
+    bnode = new Bnode();
+    bnode->importRaw(buf, nodesize);
+    for (auto &entry: queries) {
+        TEST_CHK(bsa_check_against(bnode->getKvArr(), keys, entry));
+    }
+    delete bnode;
+
+    TEST_RESULT("Bs Array common prefix test");
+}
+
+void bsa_fixed_key_test()
+{
+    TEST_INIT();
+
+    BsArray bsa;
+    BsaItem query, item;
+    size_t i;
+    size_t n = 200;
+    uint64_t seqnum, seqnum_enc;
+    char valuebuf[64];
+
+    // 8-byte big-endian sequence numbers (odd numbers only),
+    // inserted in a shuffled order.
+    for (i=0; i<n; ++i) {
+        seqnum = ((i * 37) % n) * 2 + 1;
+        seqnum_enc = _enc64(seqnum);
+        sprintf(valuebuf, "v%07d", (int)seqnum);
+        query = BsaItem(&seqnum_enc, sizeof(seqnum_enc), valuebuf, 8);
+        bsa.insert( query );
+    }
+    TEST_CHK(bsa.getNumElems() == n);
+
+    for (i=0; i<n; ++i) {
+        // existing key
+        seqnum = i * 2 + 1;
+        seqnum_enc = _enc64(seqnum);
+        sprintf(valuebuf, "v%07d", (int)seqnum);
+        query = BsaItem(&seqnum_enc, sizeof(seqnum_enc));
+        item = bsa.find( query );
+        TEST_CHK( item.idx == i );
+        TEST_CMP(item.value, valuebuf, item.valuelen);
+
+        // non-existing key right after it
+        seqnum_enc = _enc64(seqnum + 1);
+        query = BsaItem(&seqnum_enc, sizeof(seqnum_enc));
+        item = bsa.find( query );
+        TEST_CHK( item.isEmpty() );
+        item = bsa.findSmallerOrEqual( query );
+        TEST_CHK( item.idx == i );
+    }
+
+    TEST_RESULT("Bs Array fixed-size key test");
+}
+
 void bnodemgr_basic_test()
 {
     TEST_INIT();
@@ -2611,6 +3522,7 @@ int main()
     bnode_basic_test();
     bnode_iterator_test();
     bnode_split_test();
+    bnode_prefix_compression_test();
     bnode_custom_cmp_test();
     bnode_clone_test();
 
@@ -2619,6 +3531,9 @@ int main()
     bsa_insert_ptr_test();
     bsa_iteration_test();
     bsa_base_offset_test();
+    bsa_key_prefix_test();
+    bsa_common_prefix_test();
+    bsa_fixed_key_test();
 
     bnodemgr_basic_test();
 
@@ -2626,6 +3541,10 @@ int main()
     btree_remove_test();
     btree_iterator_test();
     btree_multiple_block_test();
+    btree_iterator_prefetch_test();
+    btree_append_test();
+    btree_delta_record_test();
+    btree_subblock_packing_test();
     btree_metadata_test();
     btree_smaller_greater_test();
     btree_smaller_greater_edge_case_test();
@@ -24,6 +24,7 @@
 #include "btreeblock.h"
 #include "btree.h"
 #include "btree_kv.h"
+#include "seq_model.h"
 #include "test.h"
 
 #include "memleak.h"
@@ -774,6 +775,147 @@ void btree_reverse_iterator_test()
     TEST_RESULT("btree reverse iterator test");
 }
 
+static int blk_test_cmp64_endian(void *key1, void *key2, void *aux)
+{
+    (void) aux;
+    uint64_t a, b;
+    a = _endian_decode(deref64(key1));
+    b = _endian_decode(deref64(key2));
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+// Check that the model returns the same result as the B+tree search for
+// every seqnum in [0, max_seq].
+static bool seq_model_check(KvsSeqModels *models, BTree *btree,
+                            uint64_t max_seq)
+{
+    uint64_t seq, _seq, v, v_model;
+    btree_result br;
+    seq_model_result smr;
+
+    for (seq = 0; seq <= max_seq; ++seq) {
+        _seq = _endian_encode(seq);
+        br = btree->find((void*)&_seq, (void*)&v);
+        smr = models->find(0, btree, seq, (void*)&v_model);
+        if (br == BTREE_RESULT_SUCCESS) {
+            if (smr != SEQ_MODEL_FOUND || v_model != v) {
+                return false;
+            }
+        } else if (smr != SEQ_MODEL_NOT_FOUND) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void seq_model_test()
+{
+    TEST_INIT();
+    memleak_start();
+
+    int r;
+    int blocksize = 4096;
+    uint64_t i, n = 50000, k, v;
+    std::string fname("./btreeblock_testfile");
+    FileMgr *file;
+    BTreeBlkHandle *bhandle;
+    BTree *btree;
+    FileMgrConfig config(blocksize, 0, 1048576, 0, 0, FILEMGR_CREATE,
+                         FDB_SEQTREE_NOT_USE, 0, 8, 0, FDB_ENCRYPTION_NONE,
+                         0x00, 0, 0);
+
+    r = system(SHELL_DEL" btreeblock_testfile");
+    (void)r;
+
+    filemgr_open_result result = FileMgr::open(fname, get_filemgr_ops(),
+                                               &config, NULL);
+    file = result.file;
+    bhandle = new BTreeBlkHandle(file, blocksize);
+    BTreeKVOps *kv_ops = new FixedKVOps(sizeof(uint64_t), sizeof(uint64_t),
+                                        blk_test_cmp64_endian);
+    btree = new BTree(bhandle, kv_ops, blocksize, sizeof(uint64_t),
+                      sizeof(uint64_t), 0x0, NULL);
+
+    // seqnums are dense, except for a gap in the middle
+    for (i = 1; i <= n; ++i) {
+        if (i > n / 2 && i <= n / 2 + 5000) {
+            continue;
+        }
+        k = _endian_encode(i);
+        v = i * 10;
+        btree->insert((void*)&k, (void*)&v);
+        bhandle->flushBuffer();
+    }
+    file->commit_FileMgr(true, NULL);
+
+    KvsSeqModels *models = new KvsSeqModels();
+    models->rebuild(0, btree);
+    TEST_CHK(seq_model_check(models, btree, n + 10));
+
+    SeqLeafModel model;
+    TEST_CHK(model.build(btree));
+    TEST_CHK(model.getNumLeaves() > 100);
+    TEST_CHK(model.getNumSegments() * 10 < model.getNumLeaves());
+
+    // remove seqnums of updated documents, and append new ones
+    for (i = 1; i <= n; i += 3) {
+        k = _endian_encode(i);
+        btree->remove((void*)&k);
+        bhandle->flushBuffer();
+    }
+    for (i = n + 1; i <= n + 1000; ++i) {
+        k = _endian_encode(i);
+        v = i * 10;
+        btree->insert((void*)&k, (void*)&v);
+        bhandle->flushBuffer();
+    }
+    file->commit_FileMgr(true, NULL);
+
+    // the model of the old root is not used for the new root
+    TEST_CHK(models->find(0, btree, n + 1, (void*)&v) == SEQ_MODEL_MISS);
+
+    models->rebuild(0, btree);
+    TEST_CHK(seq_model_check(models, btree, n + 1010));
+
+    // an invalidated model is rebuilt once, by the first lookup on the new
+    // root, no matter how many times it has been invalidated before
+    uint64_t num_builds = models->getNumBuilds();
+    for (i = n + 1001; i <= n + 1100; ++i) {
+        k = _endian_encode(i);
+        v = i * 10;
+        btree->insert((void*)&k, (void*)&v);
+        bhandle->flushBuffer();
+        file->commit_FileMgr(true, NULL);
+        models->invalidate(0, btree->getRootBid());
+    }
+    TEST_CHK(models->getNumBuilds() == num_builds);
+    TEST_CHK(seq_model_check(models, btree, n + 1110));
+    TEST_CHK(models->getNumBuilds() == num_builds + 1);
+
+    // lookups on other roots neither use nor rebuild the model
+    models->invalidate(0, btree->getRootBid() + 1);
+    TEST_CHK(models->find(0, btree, n + 1, (void*)&v) == SEQ_MODEL_MISS);
+    TEST_CHK(models->getNumBuilds() == num_builds + 1);
+
+    // a model invalidated without its new root is rebuilt by the next lookup
+    models->invalidate(0, BLK_NOT_FOUND);
+    TEST_CHK(seq_model_check(models, btree, n + 1110));
+    TEST_CHK(models->getNumBuilds() == num_builds + 2);
+
+    models->rebuild(0, NULL);
+    TEST_CHK(models->find(0, btree, n + 1, (void*)&v) == SEQ_MODEL_MISS);
+
+    delete models;
+    delete btree;
+    delete kv_ops;
+    delete bhandle;
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+    TEST_RESULT("seq model test");
+}
+
 int main()
 {
 #ifdef _MEMPOOL
@@ -786,6 +928,7 @@ int main()
     range_test();
     subblock_test();
     btree_reverse_iterator_test();
+    seq_model_test();
 
     return 0;
 }
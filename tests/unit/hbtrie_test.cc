@@ -392,6 +392,233 @@ void skew_basic_test()
     TEST_RESULT("skew basic test");
 }
 
+void _leaf_extension_check(HBTrie *trie, BTreeBlkHandle *bhandle,
+                           char **key, int n, bool reverse)
+{
+    TEST_INIT();
+
+    HBTrieIterator *it;
+    hbtrie_result hr;
+    char key_buf[256], prev_key[256];
+    size_t keylen;
+    uint64_t offset;
+    int i, count;
+
+    // find all keys
+    for (i=0;i<n;++i){
+        hr = trie->find((void *)key[i], strlen(key[i]), (void *)&offset);
+        bhandle->flushBuffer();
+        TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+        offset = _endian_decode(offset);
+        TEST_CHK(offset == (uint64_t)i);
+    }
+
+    // range scan should return all keys in order
+    count = 0;
+    it = new HBTrieIterator();
+    hr = it->init(trie, (void*)NULL, (size_t)0);
+    while (hr == HBTRIE_RESULT_SUCCESS) {
+        hr = it->next((void *)key_buf, keylen, (void *)&offset);
+        bhandle->flushBuffer();
+        if (hr != HBTRIE_RESULT_SUCCESS) break;
+        key_buf[keylen]=0;
+        if (count) {
+            TEST_CHK(reverse ? (strcmp(prev_key, key_buf) > 0)
+                             : (strcmp(prev_key, key_buf) < 0));
+        }
+        strcpy(prev_key, key_buf);
+        count++;
+    }
+    delete it;
+    TEST_CHK(count == n);
+}
+
+hbtrie_cmp_func *_leaf_cmp_map(void *chunk, void *aux)
+{
+    (void)chunk;
+    (void)aux;
+    // use leaf b-trees with the default (lexicographical) comparison
+    return (hbtrie_cmp_func *)_leaf_cmp_map;
+}
+
+int _leaf_reverse_cmp(void *key1, void *key2, void *aux)
+{
+    btree_cmp_args *args = (btree_cmp_args *)aux;
+    BTreeKVOps *kv_ops = args->kv_ops;
+    uint8_t keystr1[HBTRIE_MAX_KEYLEN], keystr2[HBTRIE_MAX_KEYLEN];
+    size_t keylen1, keylen2;
+    int is_key1_inf = kv_ops->isInfVarKey(key1);
+    int is_key2_inf = kv_ops->isInfVarKey(key2);
+    int cmp;
+
+    if (is_key1_inf || is_key2_inf) {
+        return is_key1_inf - is_key2_inf;
+    }
+    kv_ops->getVarKey(key1, (void *)keystr1, keylen1);
+    kv_ops->getVarKey(key2, (void *)keystr2, keylen2);
+    if (keylen1 == 0 || keylen2 == 0) {
+        // empty key is the smallest one, as in _fdb_custom_cmp_wrap()
+        return (int)(keylen2 == 0) - (int)(keylen1 == 0);
+    }
+
+    // non-empty keys in descending order
+    cmp = memcmp(keystr2, keystr1, MIN(keylen1, keylen2));
+    if (cmp == 0) {
+        cmp = (int)keylen2 - (int)keylen1;
+    }
+    return cmp;
+}
+
+void hbtrie_leaf_extension_test()
+{
+    TEST_INIT();
+
+    int blocksize = 256;
+    BTreeBlkHandle *bhandle;
+    FileMgr *file;
+    HBTrie *trie;
+    FileMgrConfig config(blocksize, 0, 1048576, 0x0, sizeof(uint64_t),
+                         FILEMGR_CREATE, FDB_SEQTREE_NOT_USE, 0, 8, 0,
+                         FDB_ENCRYPTION_NONE, 0x00, 0, 0);
+    uint8_t value_buf[8];
+    uint64_t offset, _offset;
+    int i, j, n=200, rr;
+    char **key = alca(char *, n);
+    struct hbtrie_leaf_stats stats;
+
+    memleak_start();
+
+    for (i=0;i<n;++i){
+        key[i] = alca(char, 32);
+    }
+    _skew_key_ptr = key;
+
+    rr = system(SHELL_DEL " hbtrie_testfile");
+    (void)rr;
+
+    std::string fname("./hbtrie_testfile");
+    filemgr_open_result result = FileMgr::open(fname,
+                                               get_filemgr_ops(), &config, NULL);
+    file = result.file;
+    DocioHandle dhandle(file, false, NULL);
+    bhandle = new BTreeBlkHandle(file, blocksize);
+
+    // 1. key suffixes with high entropy: leaf b-trees should be extended
+    trie = new HBTrie(8, 8, blocksize, BLK_NOT_FOUND,
+                      bhandle, (void *)&dhandle, _readkey_wrap_memory);
+    trie->setMapFunction(_leaf_cmp_map);
+    trie->allocLastMapChunk();
+    trie->setLeafHeightLimit(1);
+
+    for (i=0;i<n;++i){
+        sprintf(key[i], "prefix__");
+        _set_random_key(key[i] + 8, 8);
+        offset = i;
+        _offset = _endian_encode(offset);
+        trie->insert((void *)key[i], strlen(key[i]),
+                      (void *)&_offset, (void *)value_buf);
+        bhandle->flushBuffer();
+    }
+    TEST_CHK(trie->getNumLeafExtensions() > 0);
+    TEST_CHK(trie->getLeafStats("prefix__", 8, &stats));
+    TEST_CHK(stats.extended);
+    TEST_CHK(stats.height > 1);
+    TEST_CHK(stats.height_after < stats.height);
+    _leaf_extension_check(trie, bhandle, key, n, false);
+    delete trie;
+
+    // 2. all keys share one of only two chunks right after the common
+    //    prefix: extension does not shorten the lookup path, so leaf b-trees
+    //    should be kept as they are
+    trie = new HBTrie(8, 8, blocksize, BLK_NOT_FOUND,
+                      bhandle, (void *)&dhandle, _readkey_wrap_memory);
+    trie->setMapFunction(_leaf_cmp_map);
+    trie->allocLastMapChunk();
+    trie->setLeafHeightLimit(1);
+
+    for (i=0;i<n;++i){
+        sprintf(key[i], "prefix__");
+        for (j=0;j<8;++j) {
+            key[i][8+j] = (i % 2)?('b'):('a');
+        }
+        _set_random_key(key[i] + 16, 8);
+        offset = i;
+        _offset = _endian_encode(offset);
+        trie->insert((void *)key[i], strlen(key[i]),
+                      (void *)&_offset, (void *)value_buf);
+        bhandle->flushBuffer();
+    }
+    TEST_CHK(trie->getNumLeafExtensions() == 0);
+    TEST_CHK(trie->getLeafStats("prefix__", 8, &stats));
+    TEST_CHK(!stats.extended);
+    TEST_CHK(stats.ndistinct == 2);
+    TEST_CHK(stats.max_group == (stats.nkeys + 1) / 2);
+    TEST_CHK(stats.height_after >= stats.height);
+    _leaf_extension_check(trie, bhandle, key, n, false);
+    delete trie;
+
+    // 3. leaf b-trees already taller than the limit when it is lowered
+    //    should be extended on the next insert
+    trie = new HBTrie(8, 8, blocksize, BLK_NOT_FOUND,
+                      bhandle, (void *)&dhandle, _readkey_wrap_memory);
+    trie->setMapFunction(_leaf_cmp_map);
+    trie->allocLastMapChunk();
+    trie->setLeafHeightLimit(0xff);
+
+    for (i=0;i<n;++i){
+        sprintf(key[i], "prefix__");
+        _set_random_key(key[i] + 8, 8);
+        offset = i;
+        _offset = _endian_encode(offset);
+        trie->insert((void *)key[i], strlen(key[i]),
+                      (void *)&_offset, (void *)value_buf);
+        bhandle->flushBuffer();
+        if (i == n-2) {
+            TEST_CHK(trie->getNumLeafStats() == 0);
+            trie->setLeafHeightLimit(1);
+        }
+    }
+    TEST_CHK(trie->getNumLeafExtensions() == 1);
+    TEST_CHK(trie->getLeafStats("prefix__", 8, &stats));
+    TEST_CHK(stats.extended);
+    _leaf_extension_check(trie, bhandle, key, n, false);
+    delete trie;
+
+    // 4. leaf b-trees whose comparison function does not order the keys
+    //    byte-wise should not be extended, as it would reorder the keys
+    trie = new HBTrie(8, 8, blocksize, BLK_NOT_FOUND,
+                      bhandle, (void *)&dhandle, _readkey_wrap_memory);
+    trie->setMapFunction(_leaf_cmp_map);
+    trie->setLeafCmp(_leaf_reverse_cmp);
+    trie->allocLastMapChunk();
+    trie->setLeafHeightLimit(1);
+
+    for (i=0;i<n;++i){
+        sprintf(key[i], "prefix__");
+        _set_random_key(key[i] + 8, 8);
+        offset = i;
+        _offset = _endian_encode(offset);
+        trie->insert((void *)key[i], strlen(key[i]),
+                      (void *)&_offset, (void *)value_buf);
+        bhandle->flushBuffer();
+    }
+    TEST_CHK(trie->getNumLeafExtensions() == 0);
+    TEST_CHK(trie->getLeafStats("prefix__", 8, &stats));
+    TEST_CHK(!stats.extended);
+    TEST_CHK(stats.height_after < stats.height);
+    _leaf_extension_check(trie, bhandle, key, n, true);
+    delete trie;
+
+    file->commit_FileMgr(true, NULL);
+    delete bhandle;
+    FileMgr::close(file, true, NULL, NULL);
+    FileMgr::shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("HB+trie adaptive leaf extension test");
+}
+
 #define HB_KEYSTR "key%06d"
 size_t _readkey_wrap_memory_itr( void *handle,
                                  uint64_t offset,
@@ -735,6 +962,7 @@ int main(){
 
     basic_test();
     skew_basic_test();
+    hbtrie_leaf_extension_test();
     hbtrie_reverse_iterator_test();
     hbtrie_partial_update_test();
 